@@ -40,12 +40,23 @@ void BackfillDiskCallback::callback(GetValue &gv) {
     }
 }
 
-bool BackfillDiskLoad::callback(Dispatcher &, TaskId) {
+bool BackfillDiskLoad::callback(Dispatcher &d, TaskId t) {
     bool valid = false;
 
     if (connMap.checkConnectivity(name) && !engine->getEpStore()->isFlushAllScheduled()) {
+        ssize_t backfilled = connMap.backfilledBytes(name);
+        if (backfilled > 0 && d.getState() == dispatcher_running &&
+            (static_cast<size_t>(backfilled) > engine->getTapConfig().getBackfillReadAhead() ||
+             isMemoryUsageTooHigh(engine->getEpStats()))) {
+            // Let the connection catch up before reading any further.
+            d.snooze(t, BACKFILL_DISK_SLEEP_TIME);
+            return true;
+        }
+
         shared_ptr<Callback<GetValue> > backfill_cb(new BackfillDiskCallback(name, connMap, engine));
-        store->dump(vbucket, backfill_cb);
+        if (!store->dumpFrom(vbucket, position, BACKFILL_DISK_BATCH_SIZE, backfill_cb)) {
+            return true;
+        }
         valid = true;
     }
 
@@ -70,6 +81,78 @@ std::string BackfillDiskLoad::description() {
     return rv.str();
 }
 
+bool BackfillSnapshotLoad::callback(Dispatcher &d, TaskId t) {
+    bool valid = false;
+
+    if (connMap.checkConnectivity(name) && !engine->getEpStore()->isFlushAllScheduled()) {
+        ssize_t backfilled = connMap.backfilledBytes(name);
+        if (backfilled > 0 && d.getState() == dispatcher_running &&
+            (static_cast<size_t>(backfilled) > engine->getTapConfig().getBackfillReadAhead() ||
+             isMemoryUsageTooHigh(engine->getEpStats()))) {
+            d.snooze(t, BACKFILL_DISK_SLEEP_TIME);
+            return true;
+        }
+
+        std::vector<SnapshotValue> values;
+        bool more = vbucket->ht.scanSnapshot(snapshot, BACKFILL_SNAPSHOT_BUCKETS, values);
+        send(values);
+        if (more) {
+            return true;
+        }
+        valid = snapshot->isValid();
+    }
+
+    getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                     "VBucket %d backfill from the snapshot at checkpoint %llu "
+                     "is completed, %llu versions were preserved.\n",
+                     vbucket->getId(),
+                     static_cast<unsigned long long>(snapshot->getCheckpointId()),
+                     static_cast<unsigned long long>(snapshot->getTotalVersions()));
+    vbucket->ht.endSnapshot(snapshot);
+
+    CompleteDiskBackfillTapOperation op;
+    connMap.performTapOp(name, op, static_cast<void*>(NULL));
+
+    if (valid && connMap.checkBackfillCompletion(name)) {
+        engine->notifyNotificationThread();
+    }
+
+    return false;
+}
+
+void BackfillSnapshotLoad::send(std::vector<SnapshotValue> &values) {
+    std::list<queued_item> queue;
+    time_t now = ep_real_time();
+    uint16_t vbid = vbucket->getId();
+    std::vector<SnapshotValue>::iterator it;
+    for (it = values.begin(); it != values.end(); ++it) {
+        if (it->exptime != 0 && it->exptime < now) {
+            continue;
+        }
+        if (it->resident) {
+            Item *itm = new Item(it->key, it->flags, it->exptime, it->value,
+                                 it->cas, it->id, vbid, it->seqno);
+            CompletedBGFetchTapOperation tapop(true);
+            if (!connMap.performTapOp(name, tapop, itm)) {
+                delete itm;
+                return;
+            }
+        } else {
+            queue.push_back(queued_item(new QueuedItem(it->key, vbid, queue_op_set,
+                                                       -1, it->id)));
+        }
+    }
+    if (!queue.empty()) {
+        connMap.setEvents(name, &queue);
+    }
+}
+
+std::string BackfillSnapshotLoad::description() {
+    std::stringstream rv;
+    rv << "Loading TAP backfill from a snapshot of vb " << vbucket->getId();
+    return rv.str();
+}
+
 bool BackFillVisitor::visitBucket(RCPtr<VBucket> &vb) {
     apply();
 
@@ -83,6 +166,11 @@ bool BackFillVisitor::visitBucket(RCPtr<VBucket> &vb) {
             return true;
         }
 
+        if (engine->getTapConfig().isBackfillSnapshot() && scheduleSnapshotBackfill(vb)) {
+            // The snapshot task sends the items instead of this visitor.
+            return false;
+        }
+
         double resident_threshold = engine->getTapConfig().getBackfillResidentThreshold();
         residentRatioBelowThreshold =
             ((num_items - num_non_resident) / num_items) < resident_threshold ? true : false;
@@ -108,6 +196,35 @@ bool BackFillVisitor::visitBucket(RCPtr<VBucket> &vb) {
     return false;
 }
 
+bool BackFillVisitor::scheduleSnapshotBackfill(RCPtr<VBucket> &vb) {
+    // Everything written after the snapshot is taken goes into the open
+    // checkpoint, so the cursor has to be there before the snapshot is.
+    engine->tapConnMap->SetCursorToOpenCheckpoint(name, vb->getId());
+    RCPtr<HashTableSnapshot> snapshot =
+        vb->ht.beginSnapshot(vb->checkpointManager.getOpenCheckpointId());
+    if (!snapshot) {
+        // Another connection is already backfilling from a snapshot.
+        return false;
+    }
+
+    getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                     "Schedule a backfill from the snapshot of vbucket %d "
+                     "at checkpoint %llu.\n", vb->getId(),
+                     static_cast<unsigned long long>(snapshot->getCheckpointId()));
+    // Counted like a disk backfill so the backfill isn't reported as
+    // done before the snapshot is sent.
+    ScheduleDiskBackfillTapOperation tapop;
+    engine->tapConnMap->performTapOp(name, tapop, static_cast<void*>(NULL));
+    engine->tapConnMap->incrBackfillRemaining(name, vb->ht.getNumItems());
+
+    shared_ptr<DispatcherCallback> cb(new BackfillSnapshotLoad(name, engine,
+                                                               *engine->tapConnMap,
+                                                               vb, snapshot));
+    engine->epstore->getNonIODispatcher()->schedule(cb, NULL,
+                                                    Priority::BackfillTaskPriority);
+    return true;
+}
+
 void BackFillVisitor::visit(StoredValue *v) {
     // If efficient VBdump is supported and an item is not resident,
     // skip the item as it will be fetched by the disk backfill.
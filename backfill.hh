@@ -11,11 +11,19 @@
 #include "ep_engine.h"
 
 #define BACKFILL_MEM_THRESHOLD 0.9
+#define BACKFILL_DISK_BATCH_SIZE 1000
+#define BACKFILL_DISK_SLEEP_TIME 0.1
+#define BACKFILL_SNAPSHOT_BUCKETS 64
 
 /**
  * Dispatcher callback responsible for bulk backfilling tap queues
  * from a KVStore.
  *
+ * Each run reads one batch of the vbucket, and the task pauses while
+ * the tap connection has more than tap_backfill_readahead bytes of
+ * backfilled items left to send, so a slow connection doesn't pile up
+ * the whole vbucket in memory.
+ *
  * Note that this is only used if the KVStore reports that it has
  * efficient vbucket ops.
  */
@@ -39,6 +47,41 @@ private:
     KVStore                    *store;
     uint16_t                    vbucket;
     const void                 *validityToken;
+    DumpPosition                position;
+};
+
+/**
+ * Dispatcher callback that streams a copy-on-write snapshot of a
+ * vbucket's hash table into a tap queue.
+ *
+ * Each run copies a few hash table buckets, so no bucket lock is held
+ * for longer than it takes to copy one bucket, and writes that land
+ * while the scan runs don't change what gets sent.  Items whose values
+ * were ejected are queued by key and read from disk when they're sent,
+ * so those may reflect a later write.  Mutations after the snapshot
+ * reach the connection through its checkpoint cursor.
+ */
+class BackfillSnapshotLoad : public DispatcherCallback {
+public:
+
+    BackfillSnapshotLoad(const std::string &n, EventuallyPersistentEngine* e,
+                         TapConnMap &tcm, RCPtr<VBucket> &vb,
+                         const RCPtr<HashTableSnapshot> &snap)
+        : name(n), engine(e), connMap(tcm), vbucket(vb), snapshot(snap) { }
+
+    bool callback(Dispatcher &, TaskId);
+
+    std::string description();
+
+private:
+
+    void send(std::vector<SnapshotValue> &values);
+
+    const std::string           name;
+    EventuallyPersistentEngine *engine;
+    TapConnMap                 &connMap;
+    RCPtr<VBucket>              vbucket;
+    RCPtr<HashTableSnapshot>    snapshot;
 };
 
 /**
@@ -80,6 +123,8 @@ private:
 
     void setEvents();
 
+    bool scheduleSnapshotBackfill(RCPtr<VBucket> &vb);
+
     bool pauseVisitor();
 
     bool checkValidity();
@@ -0,0 +1,120 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "config.h"
+
+#include <sstream>
+
+#include "binary_stats.hh"
+#include "crc32.h"
+#include "statwriter.hh"
+
+// visitCounters() and visitHistograms() are generated from stats.json
+#include "generated_binary_stats.cc"
+
+const uint32_t BinaryStats::MAGIC(0x45504253); // "EPBS"
+const size_t BinaryStats::HEADER_SLOTS(3);
+
+/**
+ * Assign a slot to every counter and histogram bin.
+ */
+class SchemaBuilder {
+public:
+    SchemaBuilder(std::vector<std::pair<std::string, std::string> > &s) :
+        schema(s), slot(0) { }
+
+    void operator() (const char *name, uint64_t) {
+        std::stringstream ss;
+        ss << slot++;
+        schema.push_back(std::make_pair(std::string(name), ss.str()));
+    }
+
+    template <typename T>
+    void operator() (const char *name, const Histogram<T> &histo) {
+        std::stringstream bins;
+        size_t nbins(0);
+        typename Histogram<T>::iterator it = histo.begin();
+        for (; it != histo.end(); ++it, ++nbins) {
+            bins << " " << (*it)->start() << "," << (*it)->end();
+        }
+
+        std::stringstream ss;
+        ss << slot << " " << nbins << bins.str();
+        slot += nbins;
+        schema.push_back(std::make_pair(std::string(name), ss.str()));
+    }
+
+    size_t getNumSlots() const {
+        return slot;
+    }
+
+private:
+    std::vector<std::pair<std::string, std::string> > &schema;
+    size_t slot;
+};
+
+/**
+ * Copy the current values into the slots.
+ */
+class SlotWriter {
+public:
+    SlotWriter(uint64_t *o) : out(o) { }
+
+    void operator() (const char *, uint64_t val) {
+        *out++ = htonll(val);
+    }
+
+    template <typename T>
+    void operator() (const char *, const Histogram<T> &histo) {
+        typename Histogram<T>::iterator it = histo.begin();
+        for (; it != histo.end(); ++it) {
+            *out++ = htonll(static_cast<uint64_t>((*it)->count()));
+        }
+    }
+
+private:
+    uint64_t *out;
+};
+
+BinaryStats::BinaryStats(EPStats &st, Configuration &conf) :
+    stats(st), config(conf)
+{
+    SchemaBuilder builder(schema);
+    visitCounters(stats, config, builder);
+    visitHistograms(stats, builder);
+    numSlots = builder.getNumSlots();
+
+    std::stringstream ss;
+    std::vector<std::pair<std::string, std::string> >::iterator it;
+    for (it = schema.begin(); it != schema.end(); ++it) {
+        ss << it->first << "=" << it->second << ";";
+    }
+    std::string s(ss.str());
+    schemaId = crc32buf(reinterpret_cast<uint8_t*>(const_cast<char*>(s.data())),
+                        s.length());
+
+    buffer.resize(HEADER_SLOTS + numSlots);
+    buffer[0] = htonll((static_cast<uint64_t>(MAGIC) << 32) | schemaId);
+    buffer[2] = htonll(static_cast<uint64_t>(numSlots));
+}
+
+void BinaryStats::addStats(ADD_STAT add_stat, const void *cookie) {
+    LockHolder lh(mutex);
+    buffer[1] = htonll(static_cast<uint64_t>(ep_real_time()));
+    SlotWriter writer(&buffer[HEADER_SLOTS]);
+    visitCounters(stats, config, writer);
+    visitHistograms(stats, writer);
+
+    const char *key = "binary";
+    add_stat(key, static_cast<uint16_t>(strlen(key)),
+             reinterpret_cast<const char*>(&buffer[0]),
+             static_cast<uint32_t>(buffer.size() * sizeof(uint64_t)), cookie);
+}
+
+void BinaryStats::addSchema(ADD_STAT add_stat, const void *cookie) {
+    add_casted_stat("schema_id", schemaId, add_stat, cookie);
+    add_casted_stat("slots", numSlots, add_stat, cookie);
+    std::vector<std::pair<std::string, std::string> >::iterator it;
+    for (it = schema.begin(); it != schema.end(); ++it) {
+        add_casted_stat(it->first.c_str(), it->second.c_str(), add_stat, cookie);
+    }
+}
@@ -0,0 +1,67 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef BINARY_STATS_HH
+#define BINARY_STATS_HH 1
+
+#include "common.hh"
+
+#include <string>
+#include <vector>
+
+#include "configuration.hh"
+#include "locks.hh"
+#include "stats.hh"
+
+/**
+ * Export all of the numeric stats in one binary buffer for scrapers
+ * polling at a high rate.
+ *
+ * The layout is generated from stats.json and configuration.json by
+ * gen_config. A buffer starts with three header slots (magic and
+ * schema id, timestamp, number of value slots) followed by one slot
+ * per counter and one slot per histogram bin. All slots are 64 bit
+ * in network byte order. The schema maps each stat name to its slot
+ * (counted from the first value slot) and describes the bins of every
+ * histogram.
+ */
+class BinaryStats {
+public:
+
+    BinaryStats(EPStats &st, Configuration &conf);
+
+    /**
+     * Send the current values as a single "binary" stat.
+     */
+    void addStats(ADD_STAT add_stat, const void *cookie);
+
+    /**
+     * Send the schema describing the layout of the buffer.
+     */
+    void addSchema(ADD_STAT add_stat, const void *cookie);
+
+    uint32_t getSchemaId() const {
+        return schemaId;
+    }
+
+    size_t getNumSlots() const {
+        return numSlots;
+    }
+
+    static const uint32_t MAGIC;
+    static const size_t HEADER_SLOTS;
+
+private:
+    EPStats       &stats;
+    Configuration &config;
+
+    std::vector<std::pair<std::string, std::string> > schema;
+    uint32_t schemaId;
+    size_t   numSlots;
+
+    // Preallocated buffer used for every request
+    Mutex                 mutex;
+    std::vector<uint64_t> buffer;
+
+    DISALLOW_COPY_AND_ASSIGN(BinaryStats);
+};
+
+#endif /* BINARY_STATS_HH */
@@ -0,0 +1,48 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "cas_generator.hh"
+#include "atomic.hh"
+#include "locks.hh"
+
+extern "C" {
+    static void releaseCasClock(void *arg);
+}
+
+static Mutex clockMutex;
+static CasClock clocks[CasGenerator::MAX_CLOCKS];
+static ThreadLocal<CasClock*> threadClock(releaseCasClock);
+
+static void releaseCasClock(void *arg) {
+    LockHolder lh(clockMutex);
+    static_cast<CasClock*>(arg)->inUse = false;
+}
+
+CasClock *CasGenerator::getClock() {
+    CasClock *c = threadClock.get();
+    if (c != NULL) {
+        return c;
+    }
+
+    LockHolder lh(clockMutex);
+    for (uint64_t i = 0; i < MAX_CLOCKS; ++i) {
+        if (!clocks[i].inUse) {
+            c = &clocks[i];
+            break;
+        }
+    }
+    if (c == NULL) {
+        fprintf(stderr, "More than %d threads generate CAS values\n",
+                (int)MAX_CLOCKS);
+        abort();
+    }
+    c->id = c - clocks;
+    c->inUse = true;
+    lh.unlock();
+
+    threadClock.set(c);
+    return c;
+}
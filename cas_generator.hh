@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef CAS_GENERATOR_HH
+#define CAS_GENERATOR_HH 1
+
+#include <sys/time.h>
+
+#include "common.hh"
+
+/**
+ * The clock of a single thread.  Only the owning thread touches it.
+ */
+struct CasClock {
+    //! The clock reading of the last CAS handed out.
+    uint64_t last;
+    //! Identifies the thread in the low bits of its CAS values.
+    uint64_t id;
+    //! Whether a live thread owns the clock.
+    bool     inUse;
+    char     pad[64 - 2 * sizeof(uint64_t) - sizeof(bool)];
+};
+
+/**
+ * Hands out CAS values from a hybrid logical clock kept per thread.
+ *
+ * A CAS is the clock reading in its high bits and the id of the thread
+ * that generated it in the low THREAD_BITS bits, so two threads never
+ * hand out the same value and nothing is shared between them on the
+ * mutation path.  The clock follows the wall clock in microseconds but
+ * never goes back: every value a thread generates is larger than the
+ * previous one, and larger than the CAS the caller says it observed.
+ *
+ * A thread takes a clock when it generates its first CAS and gives it
+ * back when it exits.  The clock keeps its last reading, so a thread
+ * that later gets the same id continues where the old one stopped.
+ *
+ * Callers replacing a version of a key pass the CAS of that version,
+ * so the CAS of a key always grows, whichever thread mutated it last
+ * and even if it was last set by setWithMeta with a CAS generated on
+ * another node.  Different keys of a vbucket are ordered by time
+ * within the resolution of the clock.
+ *
+ * An observed CAS comes off the wire, so it only moves the clock if it
+ * is at most MAX_OBSERVED_AHEAD ahead of the wall clock.  One that's
+ * further ahead is ignored rather than dragging the thread's clock
+ * (and every CAS it hands out afterwards) along with it.
+ */
+class CasGenerator {
+public:
+
+    //! The number of low bits holding the thread id.
+    static const int THREAD_BITS = 10;
+    //! The number of threads that may generate CAS values at once.
+    static const uint64_t MAX_CLOCKS = 1 << THREAD_BITS;
+    //! How far (in microseconds) an observed CAS may be ahead of us.
+    static const uint64_t MAX_OBSERVED_AHEAD = 600ULL * 1000000;
+    //! The largest clock reading; shifting it can't overflow.
+    static const uint64_t MAX_TIME = (~0ULL >> THREAD_BITS) - 1;
+
+    /**
+     * Get a new CAS.
+     *
+     * @param observed a CAS the new one must be larger than (0 if none)
+     */
+    static uint64_t next(uint64_t observed = 0) {
+        CasClock *c = getClock();
+        uint64_t now = wallClock();
+        uint64_t t = c->last + 1;
+        if (now > t) {
+            t = now;
+        }
+        uint64_t seen = getTime(observed);
+        if (seen >= t && seen <= now + MAX_OBSERVED_AHEAD) {
+            t = seen + 1;
+        }
+        if (t > MAX_TIME) {
+            t = MAX_TIME;
+        }
+        c->last = t;
+        return (t << THREAD_BITS) | c->id;
+    }
+
+    /**
+     * The clock reading a CAS was generated at.
+     */
+    static uint64_t getTime(uint64_t cas) {
+        return cas >> THREAD_BITS;
+    }
+
+    /**
+     * The id of the thread that generated a CAS.
+     */
+    static uint64_t getThreadId(uint64_t cas) {
+        return cas & (MAX_CLOCKS - 1);
+    }
+
+private:
+
+    static uint64_t wallClock() {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+
+    static CasClock *getClock();
+};
+
+#endif /* CAS_GENERATOR_HH */
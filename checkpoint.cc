@@ -69,6 +69,8 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
     if (it != keyIndex.end()) {
         std::list<queued_item>::iterator currPos = it->second.position;
         uint64_t currMutationId = it->second.mutation_id;
+        // Whether the flusher may already have the existing item.
+        bool pulled = false;
 
         if (*(checkpointManager->persistenceCursor.currentCheckpoint) == this) {
             // If the existing item is in the left-hand side of the item pointed by the
@@ -79,12 +81,17 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
                 uint64_t mutationId = ita->second.mutation_id;
                 if (currMutationId <= mutationId) {
                     checkpointManager->decrPersistenceCursorOffset(1);
+                    pulled = true;
                 }
+            } else if (checkpointManager->persistenceCursor.currentPos != toWrite.begin()) {
+                // The cursor is on a meta item; assume the worst.
+                pulled = true;
             }
             // If the persistence cursor points to the existing item for the same key,
             // shift the cursor left by 1.
             if (checkpointManager->persistenceCursor.currentPos == currPos) {
                 checkpointManager->decrPersistenceCursorPos_UNLOCKED();
+                pulled = true;
             }
         }
 
@@ -107,6 +114,12 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
                 }
             }
         }
+        // Nobody will persist the existing item now, so don't keep its
+        // value alive.  Once the flusher has it, only the flusher may
+        // drop the snapshot.
+        if (!pulled) {
+            (*currPos)->clearSnapshot();
+        }
         // Copy the queued time of the existing item to the new one.
         qi->setQueuedTime((*currPos)->getQueuedTime());
         // Remove the existing item for the same key from the list.
@@ -128,6 +141,7 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
         // Set the index of the key to the new item that is pushed back into the list.
         keyIndex[qi->getKey()] = entry;
         if (rv == NEW_ITEM) {
+            checkpointManager->addKeyToFilter_UNLOCKED(qi->getKey());
             size_t newEntrySize = qi->getKey().size() + sizeof(index_entry) + sizeof(queued_item);
             memOverhead += newEntrySize;
             stats.memOverhead.incr(newEntrySize);
@@ -137,7 +151,8 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
     return rv;
 }
 
-size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
+size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                                       CheckpointKeyFilter *filter) {
     size_t numNewItems = 0;
     size_t newEntryMemOverhead = 0;
     std::list<queued_item>::reverse_iterator rit = pPrevCheckpoint->rbegin();
@@ -163,6 +178,7 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
             toWrite.insert(pos, *rit);
             index_entry entry = {--pos, pPrevCheckpoint->getMutationIdForKey(key)};
             keyIndex[key] = entry;
+            filter->add(key);
             newEntryMemOverhead += key.size() + sizeof(index_entry);
             ++numItems;
             ++numNewItems;
@@ -183,6 +199,9 @@ uint64_t Checkpoint::getMutationIdForKey(const std::string &key) {
     return mid;
 }
 
+const size_t CheckpointManager::MIN_KEY_FILTER_SIZE(1024);
+const size_t CheckpointManager::MAX_KEY_FILTER_SIZE(1 << 22);
+
 CheckpointManager::~CheckpointManager() {
     LockHolder lh(queueLock);
     std::list<Checkpoint*>::iterator it = checkpointList.begin();
@@ -190,6 +209,49 @@ CheckpointManager::~CheckpointManager() {
         delete *it;
         ++it;
     }
+    stats.memOverhead.decr(keyFilter->memorySize());
+    assert(stats.memOverhead.get() < GIGANTOR);
+}
+
+void CheckpointManager::addKeyToFilter_UNLOCKED(const std::string &key) {
+    keyFilter->add(key);
+    // Keep at least eight counters per key to hold false positives
+    // around 5%.
+    size_t size = keyFilter->size();
+    if (keyFilter->getNumKeys() * 8 > size && size < MAX_KEY_FILTER_SIZE) {
+        resetKeyFilter_UNLOCKED(size * 2);
+    }
+}
+
+void CheckpointManager::removeCheckpointFromFilter_UNLOCKED(Checkpoint *checkpoint) {
+    std::list<queued_item>::iterator it = checkpoint->begin();
+    for (; it != checkpoint->end(); ++it) {
+        const std::string &key = (*it)->getKey();
+        if (key.size() > 0) {
+            keyFilter->remove(key);
+        }
+    }
+}
+
+void CheckpointManager::resetKeyFilter_UNLOCKED(size_t size) {
+    CheckpointKeyFilter *filter = new CheckpointKeyFilter(size);
+    std::list<Checkpoint*>::iterator cit = checkpointList.begin();
+    for (; cit != checkpointList.end(); ++cit) {
+        std::list<queued_item>::iterator it = (*cit)->begin();
+        for (; it != (*cit)->end(); ++it) {
+            const std::string &key = (*it)->getKey();
+            if (key.size() > 0) {
+                filter->add(key);
+            }
+        }
+    }
+
+    if (keyFilter) {
+        stats.memOverhead.decr(keyFilter->memorySize());
+    }
+    stats.memOverhead.incr(filter->memorySize());
+    assert(stats.memOverhead.get() < GIGANTOR);
+    keyFilter.reset(filter);
 }
 
 uint64_t CheckpointManager::getOpenCheckpointId_UNLOCKED() {
@@ -653,6 +715,15 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbu
           checkpointConfig.isInconsistentSlaveCheckpoint()))) {
         collapseClosedCheckpoints(unrefCheckpointList);
     }
+    std::list<Checkpoint*>::iterator unref_it = unrefCheckpointList.begin();
+    for (; unref_it != unrefCheckpointList.end(); ++unref_it) {
+        removeCheckpointFromFilter_UNLOCKED(*unref_it);
+    }
+    size_t filterSize = keyFilter->size();
+    if (keyFilter->getNumKeys() * 64 < filterSize && filterSize > MIN_KEY_FILTER_SIZE) {
+        // Give back the memory of a filter grown by a burst of mutations.
+        resetKeyFilter_UNLOCKED(std::max(MIN_KEY_FILTER_SIZE, filterSize / 4));
+    }
     lh.unlock();
 
     std::list<Checkpoint*>::iterator chkpoint_it = unrefCheckpointList.begin();
@@ -705,7 +776,8 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
         ++rit; ++rit;// Move to the second lastest closed checkpoint.
         size_t numDuplicatedItems = 0, numMetaItems = 0;
         for (; rit != checkpointList.rend(); ++rit) {
-            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit);
+            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit,
+                                                                         keyFilter.get());
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += 2; // checkpoint start and end meta items
             slowCursors.insert((*rit)->getCursorNameList().begin(),
@@ -760,6 +832,21 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
 
 bool CheckpointManager::queueDirty(const queued_item &qi, const RCPtr<VBucket> &vbucket) {
     LockHolder lh(queueLock);
+    return queueDirty_UNLOCKED(qi, vbucket);
+}
+
+void CheckpointManager::queueDirty(const std::vector<queued_item> &items,
+                                   const RCPtr<VBucket> &vbucket,
+                                   std::vector<bool> &queued) {
+    queued.resize(items.size());
+    LockHolder lh(queueLock);
+    for (size_t i = 0; i < items.size(); ++i) {
+        queued[i] = queueDirty_UNLOCKED(items[i], vbucket);
+    }
+}
+
+bool CheckpointManager::queueDirty_UNLOCKED(const queued_item &qi,
+                                            const RCPtr<VBucket> &vbucket) {
     if (vbucket->getState() != vbucket_state_active &&
         checkpointList.back()->getState() == closed) {
         // Replica vbucket might receive items from the master even if the current open checkpoint
@@ -974,6 +1061,7 @@ void CheckpointManager::clear(vbucket_state_t vbState) {
     checkpointList.clear();
     numItems = 0;
     mutationCounter = 0;
+    resetKeyFilter_UNLOCKED(MIN_KEY_FILTER_SIZE);
 
     uint64_t checkpointId = vbState == vbucket_state_active ? 1 : 0;
     // Add a new open checkpoint.
@@ -1045,6 +1133,12 @@ uint64_t CheckpointManager::checkOpenCheckpoint_UNLOCKED(bool forceCreation, boo
 }
 
 bool CheckpointManager::isKeyResidentInCheckpoints(const std::string &key) {
+    RCPtr<CheckpointKeyFilter> filter(keyFilter);
+    if (!filter->mayContain(key)) {
+        ++stats.chkKeyFilterSkips;
+        return false;
+    }
+
     LockHolder lh(queueLock);
 
     std::list<Checkpoint*>::iterator it = checkpointList.begin();
@@ -1164,9 +1258,11 @@ bool CheckpointManager::checkAndAddNewCheckpoint(uint64_t id, bool &pCursorRepos
         size_t numDuplicatedItems = 0, numMetaItems = 0;
         // Collapse all checkpoints.
         for (; rit != checkpointList.rend(); ++rit) {
-            size_t numAddedItems = checkpointList.back()->mergePrevCheckpoint(*rit);
+            size_t numAddedItems = checkpointList.back()->mergePrevCheckpoint(*rit,
+                                                                              keyFilter.get());
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += 2; // checkpoint start and end meta items
+            removeCheckpointFromFilter_UNLOCKED(*rit);
             delete *rit;
         }
         numItems -= (numDuplicatedItems + numMetaItems);
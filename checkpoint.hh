@@ -6,6 +6,7 @@
 #include <list>
 #include <map>
 #include <set>
+#include <vector>
 
 #include "common.hh"
 #include "atomic.hh"
@@ -50,6 +51,102 @@ class CheckpointManager;
 class CheckpointConfig;
 class VBucket;
 
+/**
+ * Counting filter over the keys held by the checkpoints of a vbucket.
+ *
+ * Every key is counted once for each checkpoint it is in.  A key whose
+ * counters are not all set is in none of the checkpoints; a key whose
+ * counters are all set may or may not be.  Counters are only changed
+ * with the checkpoint manager's queue lock held, but can be read
+ * without it.
+ */
+class CheckpointKeyFilter : public RCValue {
+public:
+
+    /**
+     * Create a filter with the given number of counters (a power of 2).
+     */
+    CheckpointKeyFilter(size_t n) : counters(n, 0), mask(n - 1), numKeys(0) {
+        assert(n > 0 && (n & mask) == 0);
+    }
+
+    void add(const std::string &key) {
+        uint32_t h = hash(key);
+        incr(h & mask);
+        incr(probe(h) & mask);
+        ++numKeys;
+    }
+
+    void remove(const std::string &key) {
+        uint32_t h = hash(key);
+        decr(h & mask);
+        decr(probe(h) & mask);
+        --numKeys;
+    }
+
+    /**
+     * @return false if the key is in none of the checkpoints
+     */
+    bool mayContain(const std::string &key) const {
+        uint32_t h = hash(key);
+        return counters[h & mask] != 0 && counters[probe(h) & mask] != 0;
+    }
+
+    /**
+     * The number of (checkpoint, key) pairs counted.
+     */
+    size_t getNumKeys() const {
+        return numKeys;
+    }
+
+    /**
+     * The number of counters.
+     */
+    size_t size() const {
+        return counters.size();
+    }
+
+    size_t memorySize() const {
+        return sizeof(CheckpointKeyFilter) + counters.size();
+    }
+
+private:
+
+    static const uint8_t SATURATED = 0xff;
+
+    static uint32_t hash(const std::string &key) {
+        uint32_t h = 2166136261U;
+        for (size_t i = 0; i < key.size(); ++i) {
+            h = (h ^ static_cast<unsigned char>(key[i])) * 16777619U;
+        }
+        return h;
+    }
+
+    static uint32_t probe(uint32_t h) {
+        return (h >> 16) | (h << 16);
+    }
+
+    // A saturated counter has lost count, so it stays set for good.
+    void incr(size_t i) {
+        if (counters[i] != SATURATED) {
+            ++counters[i];
+        }
+    }
+
+    void decr(size_t i) {
+        if (counters[i] != SATURATED) {
+            assert(counters[i] > 0);
+            --counters[i];
+        }
+    }
+
+    std::vector<uint8_t> counters;
+    size_t               mask;
+    size_t               numKeys;
+
+    DISALLOW_COPY_AND_ASSIGN(CheckpointKeyFilter);
+};
+
 /**
  * A checkpoint cursor
  */
@@ -221,9 +318,11 @@ public:
      * Merge the previous checkpoint into the this checkpoint by adding the items from
      * the previous checkpoint, which don't exist in this checkpoint.
      * @param pPrevCheckpoint pointer to the previous checkpoint.
+     * @param filter the key filter to count the added keys in.
      * @return the number of items added from the previous checkpoint.
      */
-    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint);
+    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                               CheckpointKeyFilter *filter);
 
     /**
      * Get the mutation id for a given key in this checkpoint
@@ -263,6 +362,7 @@ public:
         onlineUpdateCursor("online_update"), isCollapsedCheckpoint(false),
         checkpointExtension(false), doOnlineUpdate(false), doHotReload(false)
     {
+        resetKeyFilter_UNLOCKED(MIN_KEY_FILTER_SIZE);
         addNewCheckpoint(checkpointId);
         registerPersistenceCursor();
     }
@@ -364,6 +464,17 @@ public:
      */
     bool queueDirty(const queued_item &qi, const RCPtr<VBucket> &vbucket);
 
+    /**
+     * Queue a batch of items of the vbucket under a single acquisition
+     * of the queue lock.
+     * @param items the items to be persisted, in the order to queue them.
+     * @param vbucket the vbucket that the items are pushed into.
+     * @param queued set to whether each item increased the size of the
+     *        persistence queue by 1.
+     */
+    void queueDirty(const std::vector<queued_item> &items,
+                    const RCPtr<VBucket> &vbucket, std::vector<bool> &queued);
+
     /**
      * Return the next item to be sent to a given TAP connection
      * @param name the name of a given TAP connection
@@ -510,6 +621,8 @@ private:
      */
     uint64_t checkOpenCheckpoint_UNLOCKED(bool forceCreation, bool timeBound);
 
+    bool queueDirty_UNLOCKED(const queued_item &qi, const RCPtr<VBucket> &vbucket);
+
     uint64_t checkOpenCheckpoint(bool forceCreation, bool timeBound) {
         LockHolder lh(queueLock);
         return checkOpenCheckpoint_UNLOCKED(forceCreation, timeBound);
@@ -556,6 +669,22 @@ private:
 
     void collapseClosedCheckpoints(std::list<Checkpoint*> &collapsedChks);
 
+    /**
+     * Count a key that was added to one of the checkpoints.
+     */
+    void addKeyToFilter_UNLOCKED(const std::string &key);
+
+    /**
+     * Uncount the keys of a checkpoint that is about to be removed.
+     */
+    void removeCheckpointFromFilter_UNLOCKED(Checkpoint *checkpoint);
+
+    /**
+     * Replace the key filter with one of the given size counting the
+     * keys of all current checkpoints.
+     */
+    void resetKeyFilter_UNLOCKED(size_t size);
+
     void resetCursors();
 
     static queued_item createCheckpointItem(uint64_t id, uint16_t vbid,
@@ -578,6 +707,10 @@ private:
 
     Atomic<bool>              doOnlineUpdate;
     Atomic<bool>              doHotReload;
+    RCPtr<CheckpointKeyFilter> keyFilter;
+
+    static const size_t MIN_KEY_FILTER_SIZE;
+    static const size_t MAX_KEY_FILTER_SIZE;
 };
 
 /**
@@ -62,6 +62,7 @@ bool ClosedUnrefCheckpointRemover::callback(Dispatcher &d, TaskId t) {
         shared_ptr<CheckpointVisitor> pv(new CheckpointVisitor(store, stats, &available));
         store->visit(pv, "Checkpoint Remover", &d, Priority::CheckpointRemoverPriority);
     }
+    store->reclaimVBuckets();
     d.snooze(t, sleepTime);
     return true;
 }
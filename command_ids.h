@@ -190,6 +190,26 @@
  */
 #define CMD_EXTEND_CHECKPOINT 0xab
 
+/**
+ * CMD_GET_MULTI fetches a batch of keys in one request.  The body is
+ * a sequence of entries, each being a 16 bit vbucket id and a 16 bit
+ * key length followed by the key.  The response body carries one
+ * entry per key in request order: a 16 bit status, 32 bit flags,
+ * 64 bit cas and 32 bit value length followed by the value.  All
+ * integers are in network byte order.
+ */
+#define CMD_GET_MULTI 0xac
+
+/**
+ * CMD_SET_MULTI stores a batch of items in one request.  The body is
+ * a sequence of entries, each being a 16 bit vbucket id, a 16 bit key
+ * length, 32 bit flags, 32 bit expiration, 64 bit cas and 32 bit
+ * value length followed by the key and the value.  The response body
+ * carries a 16 bit status and the 64 bit cas for each item in request
+ * order.  All integers are in network byte order.
+ */
+#define CMD_SET_MULTI 0xad
+
 /*
  * Parameter types of CMD_SET_PARAM command.
  */
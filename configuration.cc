@@ -129,6 +129,9 @@ void Configuration::setParameter(const std::string &key, bool value) {
     }
     attributes[key].datatype = DT_BOOL;
     attributes[key].val.v_bool = value;
+    if (attributes[key].cached.v_bool != NULL) {
+        attributes[key].cached.v_bool->set(value);
+    }
     std::vector<ValueChangedListener*> copy(attributes[key].changeListener);
     lh.unlock();
     std::vector<ValueChangedListener*>::iterator iter;
@@ -148,10 +151,11 @@ void Configuration::setParameter(const std::string &key, size_t value) {
         }
     }
     attributes[key].datatype = DT_SIZE;
-    if (key.compare("cache_size") == 0) {
-        attributes["max_size"].val.v_size = value;
-    } else {
-        attributes[key].val.v_size = value;
+    value_t &v = key.compare("cache_size") == 0 ? attributes["max_size"]
+                                                 : attributes[key];
+    v.val.v_size = value;
+    if (v.cached.v_size != NULL) {
+        v.cached.v_size->set(value);
     }
 
     std::vector<ValueChangedListener*> copy(attributes[key].changeListener);
@@ -176,6 +180,9 @@ void Configuration::setParameter(const std::string &key, float value) {
 
     attributes[key].datatype = DT_FLOAT;
     attributes[key].val.v_float = value;
+    if (attributes[key].cached.v_float != NULL) {
+        attributes[key].cached.v_float->set(value);
+    }
     std::vector<ValueChangedListener*> copy(attributes[key].changeListener);
     lh.unlock();
     std::vector<ValueChangedListener*>::iterator iter;
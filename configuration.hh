@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <iostream>
 
+#include "atomic.hh"
 #include "locks.hh"
 #include "memcached/engine.h"
 
@@ -229,7 +230,8 @@ public:
     Configuration();
     ~Configuration();
 
-    // Include the generated prototypes for the member functions
+    // Include the generated prototypes for the member functions, and
+    // the members holding the values the getters return
 #include "generated_configuration.hh"
 
     /**
@@ -326,7 +328,10 @@ private:
     size_t getInteger(const std::string &key) const;
 
     struct value_t {
-        value_t() : validator(NULL) { val.v_string = 0; }
+        value_t() : validator(NULL) {
+            val.v_string = 0;
+            cached.v_size = NULL;
+        }
         std::vector<ValueChangedListener *> changeListener;
         ValueChangedValidator *validator;
         config_datatype datatype;
@@ -336,6 +341,12 @@ private:
             bool v_bool;
             const char *v_string;
         } val;
+        //! The member the generated getter reads, if the type has one
+        union {
+            Atomic<size_t> *v_size;
+            Atomic<float> *v_float;
+            Atomic<bool> *v_bool;
+        } cached;
     };
 
     // Access to the configuration variables is protected by the mutex
@@ -47,21 +47,192 @@ void Dispatcher::start() {
     }
 }
 
+static hrtime_t usecsSince(const struct timeval &then,
+                           const struct timeval &now) {
+    if (less_tv(now, then)) {
+        return 0;
+    }
+    return static_cast<hrtime_t>(now.tv_sec - then.tv_sec) * 1000000
+        + now.tv_usec - then.tv_usec;
+}
+
 TaskId Dispatcher::nextTask() {
     assert (!empty());
+    pickedOverdue = false;
+    if (numFairReady > 0) {
+        return nextFairTask();
+    }
     return readyQueue.empty() ? futureQueue.top() : readyQueue.top();
 }
 
 void Dispatcher::popNext() {
     assert (!empty());
+    if (numFairReady > 0) {
+        ReadyClass &rc = readyClasses[pickedClass];
+        assert(!rc.tasks.empty());
+        rc.tasks.pop_front();
+        --numFairReady;
+        if (rc.tasks.empty()) {
+            // Don't let an idle class save up time.
+            rc.deficit = std::min(rc.deficit, static_cast<int64_t>(0));
+        }
+        if (pickedOverdue) {
+            ++numOverdue;
+        }
+        return;
+    }
     readyQueue.empty() ? futureQueue.pop() : readyQueue.pop();
 }
 
+TaskId Dispatcher::nextFairTask() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    // Anything that waited longer than it's expected to run goes first.
+    std::map<int, ReadyClass>::iterator it;
+    hrtime_t worst(0);
+    for (it = readyClasses.begin(); it != readyClasses.end(); ++it) {
+        if (it->second.tasks.empty()) {
+            continue;
+        }
+        TaskId &task = it->second.tasks.front();
+        hrtime_t waited = usecsSince(task->waketime, now);
+        hrtime_t limit = task->maxExpectedDuration();
+        if (waited > limit && waited - limit > worst) {
+            worst = waited - limit;
+            pickedClass = it->first;
+            pickedOverdue = true;
+        }
+    }
+    if (pickedOverdue) {
+        return readyClasses[pickedClass].tasks.front();
+    }
+
+    // Keep serving the current class while it has time left.
+    it = readyClasses.find(currentClass);
+    if (it != readyClasses.end() && !it->second.tasks.empty()
+        && it->second.deficit > 0) {
+        pickedClass = currentClass;
+        return it->second.tasks.front();
+    }
+
+    // Otherwise hand a time slice to the next class with ready tasks.
+    // Every pass adds a slice to a class with tasks, so this ends.
+    for (;;) {
+        if (it == readyClasses.end()) {
+            it = readyClasses.begin();
+        } else if (++it == readyClasses.end()) {
+            it = readyClasses.begin();
+        }
+        ReadyClass &rc = it->second;
+        if (rc.tasks.empty()) {
+            continue;
+        }
+        rc.deficit += quantumFor(it->first);
+        if (rc.deficit > 0) {
+            currentClass = pickedClass = it->first;
+            return rc.tasks.front();
+        }
+    }
+}
+
+void Dispatcher::pushReady(TaskId task) {
+    if (fairShare) {
+        readyClasses[task->priority].tasks.push_back(task);
+        ++numFairReady;
+    } else {
+        readyQueue.push(task);
+    }
+}
+
+void Dispatcher::chargeTask(TaskId task, hrtime_t runtime) {
+    LockHolder lh(mutex);
+    if (!fairShare) {
+        return;
+    }
+    ReadyClass &rc = readyClasses[task->priority];
+    rc.deficit -= static_cast<int64_t>(runtime);
+    int64_t maxDebt = quantumFor(task->priority) * DISPATCHER_MAX_DEBT;
+    if (rc.deficit < -maxDebt) {
+        rc.deficit = -maxDebt;
+    }
+}
+
+void Dispatcher::recordWait(TaskId task, const struct timeval &now) {
+    if (task->prio == NULL) {
+        return;
+    }
+    Histogram<hrtime_t> *&histo = waitHistos[task->prio];
+    if (histo == NULL) {
+        histo = new Histogram<hrtime_t>();
+    }
+    histo->add(usecsSince(task->waketime, now));
+}
+
+void Dispatcher::setFairShare(bool to) {
+    LockHolder lh(mutex);
+    if (to == fairShare) {
+        return;
+    }
+    fairShare = to;
+    if (fairShare) {
+        while (!readyQueue.empty()) {
+            pushReady(readyQueue.top());
+            readyQueue.pop();
+        }
+    } else {
+        std::map<int, ReadyClass>::iterator it;
+        for (it = readyClasses.begin(); it != readyClasses.end(); ++it) {
+            std::deque<TaskId>::iterator tit;
+            for (tit = it->second.tasks.begin(); tit != it->second.tasks.end(); ++tit) {
+                readyQueue.push(*tit);
+            }
+        }
+        readyClasses.clear();
+        numFairReady = 0;
+        currentClass = -1;
+    }
+    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: %s ready tasks by %s\n",
+                     getName().c_str(), fairShare ? "Sharing time between" : "Ordering",
+                     fairShare ? "priority class" : "priority");
+}
+
+bool Dispatcher::shouldYield() {
+    if (!fairShare || !running_task) {
+        return false;
+    }
+    hrtime_t ran = (gethrtime() - taskStart) / 1000;
+    if (static_cast<int64_t>(ran) < quantumFor(runningPriority)) {
+        return false;
+    }
+
+    LockHolder lh(mutex);
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (numFairReady > 0 ||
+        (!futureQueue.empty() && less_tv(futureQueue.top()->waketime, now))) {
+        ++numYields;
+        return true;
+    }
+    return false;
+}
+
+std::vector<std::pair<std::string, const Histogram<hrtime_t>*> > Dispatcher::getWaitHistos() {
+    LockHolder lh(mutex);
+    std::vector<std::pair<std::string, const Histogram<hrtime_t>*> > rv;
+    std::map<const Priority*, Histogram<hrtime_t>*>::iterator it;
+    for (it = waitHistos.begin(); it != waitHistos.end(); ++it) {
+        rv.push_back(std::make_pair(it->first->toString(),
+                                    static_cast<const Histogram<hrtime_t>*>(it->second)));
+    }
+    return rv;
+}
+
 void Dispatcher::moveReadyTasks(const struct timeval &tv) {
     while (!futureQueue.empty()) {
         TaskId tid = futureQueue.top();
         if (less_tv(tid->waketime, tv)) {
-            readyQueue.push(tid);
+            pushReady(tid);
             futureQueue.pop();
         } else {
             // We found all the ready stuff.
@@ -112,10 +283,12 @@ void Dispatcher::run() {
                 // Otherwise, do the normal thing.
                 popNext();
                 taskDesc = task->getName();
+                recordWait(task, tv);
             }
             tlh.unlock();
 
             taskStart = gethrtime();
+            runningPriority = task->priority;
             lh.unlock();
             rel_time_t startReltime = ep_current_time();
             try {
@@ -135,6 +308,9 @@ void Dispatcher::run() {
             running_task = false;
 
             hrtime_t runtime((gethrtime() - taskStart) / 1000);
+            if (task != idleTask) {
+                chargeTask(task, runtime);
+            }
             JobLogEntry jle(taskDesc, runtime, startReltime);
             joblog.add(jle);
             if (runtime > task->maxExpectedDuration()) {
@@ -171,7 +347,7 @@ void Dispatcher::schedule(shared_ptr<DispatcherCallback> callback,
                           bool mustComplete) {
     LockHolder lh(mutex);
     TaskId task(new Task(callback, priority.getPriorityValue(), sleeptime,
-                         isDaemon, mustComplete));
+                         isDaemon, mustComplete, &priority));
     if (outtid) {
         *outtid = TaskId(task);
     }
@@ -3,16 +3,26 @@
 #define DISPATCHER_HH
 
 #include <stdexcept>
+#include <map>
 #include <queue>
 
 #include "common.hh"
 #include "atomic.hh"
+#include "histo.hh"
 #include "locks.hh"
 #include "priority.hh"
 #include "ringbuffer.hh"
 
 #define JOB_LOG_SIZE 20
 
+//! Time slice (in microseconds) of the lowest priority class when
+//! the dispatcher shares its time between the priority classes.
+#define DISPATCHER_QUANTUM 5000
+//! Priority values below this get a proportionally larger time slice.
+#define DISPATCHER_WEIGHTED_PRIORITIES 10
+//! The most time slices a priority class can fall behind by.
+#define DISPATCHER_MAX_DEBT 20
+
 class Dispatcher;
 
 /**
@@ -113,8 +123,9 @@ public:
 
 protected:
     Task(shared_ptr<DispatcherCallback> cb,  int p, double sleeptime = 0,
-         bool isDaemon = true, bool completeBeforeShutdown = false) :
-        callback(cb), priority(p),
+         bool isDaemon = true, bool completeBeforeShutdown = false,
+         const Priority *pr = NULL) :
+        callback(cb), priority(p), prio(pr),
         state(task_running), isDaemonTask(isDaemon),
         blockShutdown(completeBeforeShutdown)
     {
@@ -123,6 +134,7 @@ protected:
 
     Task(const Task &task) {
         priority = task.priority;
+        prio = task.prio;
         state = task_running;
         callback = task.callback;
         isDaemonTask = task.isDaemonTask;
@@ -156,6 +168,7 @@ protected:
     struct timeval waketime;
     shared_ptr<DispatcherCallback> callback;
     int priority;
+    const Priority *prio;
     enum task_state state;
     Mutex mutex;
     bool isDaemonTask;
@@ -226,6 +239,20 @@ public:
     }
 };
 
+/**
+ * Ready tasks of one priority value.  When the dispatcher shares its
+ * time, the classes are served round robin and each one may run its
+ * tasks for a time slice per round (deficit round robin).
+ */
+class ReadyClass {
+public:
+    ReadyClass() : deficit(0) {}
+
+    std::deque<TaskId> tasks;
+    //! Microseconds this class may still run in the current round.
+    int64_t deficit;
+};
+
 /**
  * Snapshot of the state of a dispatcher.
  */
@@ -294,13 +321,20 @@ public:
     Dispatcher(EventuallyPersistentEngine &e, const char *desc = NULL) :
         notifications(0), joblog(JOB_LOG_SIZE), slowjobs(JOB_LOG_SIZE),
         idleTask(new IdleTask), state(dispatcher_running),
-        forceTermination(false), engine(e), name(desc ? desc : "Dispatcher")
+        running_task(false), forceTermination(false), fairShare(false),
+        numFairReady(0), currentClass(-1), pickedClass(-1),
+        pickedOverdue(false), runningPriority(0), engine(e),
+        name(desc ? desc : "Dispatcher")
     {
         noTask();
     }
 
     ~Dispatcher() {
         stop();
+        std::map<const Priority*, Histogram<hrtime_t>*>::iterator it;
+        for (it = waitHistos.begin(); it != waitHistos.end(); ++it) {
+            delete it->second;
+        }
     }
 
     /**
@@ -375,6 +409,41 @@ public:
 
     const std::string &getName() { return name; }
 
+    /**
+     * Choose how ready tasks are ordered.
+     *
+     * By default the ready task with the best priority always runs
+     * first.  When sharing time, each priority value gets a time
+     * slice per round, weighted towards the better priorities, and a
+     * task that has waited longer than its maxExpectedDuration runs
+     * before anything else.
+     *
+     * @param to true to share time between the priority classes
+     */
+    void setFairShare(bool to);
+
+    bool isFairShare() { return fairShare; }
+
+    /**
+     * True if the running task has used up its time slice while other
+     * tasks are ready to run.  Long running tasks should check this
+     * where they can stop, and return true to be rescheduled.  Only
+     * call this from within a task run by this dispatcher.
+     */
+    bool shouldYield();
+
+    /**
+     * Get the histograms of how long (in microseconds) the tasks of
+     * each priority waited between being due and being run.
+     */
+    std::vector<std::pair<std::string, const Histogram<hrtime_t>*> > getWaitHistos();
+
+    //! Number of tasks run ahead of their turn because they were overdue.
+    size_t getNumOverdue() { return numOverdue.get(); }
+
+    //! Number of times a running task was asked to yield.
+    size_t getNumYields() { return numYields.get(); }
+
 private:
 
     friend class IdleTask;
@@ -402,7 +471,30 @@ private:
     void moveReadyTasks(const struct timeval &tv);
 
     //! True if there are no tasks scheduled.
-    bool empty() { return readyQueue.empty() && futureQueue.empty(); }
+    bool empty() {
+        return readyQueue.empty() && numFairReady == 0 && futureQueue.empty();
+    }
+
+    //! Add a task that's due to the ready tasks.
+    void pushReady(TaskId task);
+
+    //! Pick the next ready task when sharing time.
+    TaskId nextFairTask();
+
+    //! Charge a task's run time against its priority class.
+    void chargeTask(TaskId task, hrtime_t runtime);
+
+    //! Record how long a task waited after it was due.
+    void recordWait(TaskId task, const struct timeval &now);
+
+    //! The time slice (in microseconds) of the given priority value.
+    static int64_t quantumFor(int priority) {
+        int weight(1);
+        if (priority >= 0 && priority < DISPATCHER_WEIGHTED_PRIORITIES) {
+            weight = DISPATCHER_WEIGHTED_PRIORITIES - priority;
+        }
+        return static_cast<int64_t>(weight) * DISPATCHER_QUANTUM;
+    }
 
     //! Get the next task.
     TaskId nextTask();
@@ -426,6 +518,17 @@ private:
     bool running_task;
     bool forceTermination;
 
+    bool fairShare;
+    std::map<int, ReadyClass> readyClasses;
+    size_t numFairReady;
+    int currentClass;
+    int pickedClass;
+    bool pickedOverdue;
+    int runningPriority;
+    std::map<const Priority*, Histogram<hrtime_t>*> waitHistos;
+    Atomic<size_t> numOverdue;
+    Atomic<size_t> numYields;
+
     EventuallyPersistentEngine &engine;
     std::string name;
 };
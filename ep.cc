@@ -34,6 +34,7 @@
 #include "htresizer.hh"
 #include "checkpoint_remover.hh"
 #include "invalid_vbtable_remover.hh"
+#include "value_cache_compactor.hh"
 
 extern "C" {
     static rel_time_t uninitialized_current_time(void) {
@@ -75,6 +76,8 @@ public:
             stats.tapThrottleThreshold.set(static_cast<double>(value) / 100.0);
         } else if (key.compare("tap_throttle_queue_cap") == 0) {
             stats.tapThrottleWriteQueueCap.set(value);
+        } else if (key.compare("expiry_index_max_keys") == 0) {
+            stats.expiryIndexMaxEntries.set(value);
         }
     }
 
@@ -144,6 +147,12 @@ public:
         }
     }
 
+    virtual void booleanValueChanged(const std::string &key, bool value) {
+        if (key.compare("dispatcher_fair_share") == 0) {
+            store.setDispatcherFairShare(value);
+        }
+    }
+
 private:
     EventuallyPersistentStore &store;
 };
@@ -186,6 +195,103 @@ private:
     hrtime_t init;
 };
 
+/**
+ * The reads a background fetch handed to the reader pool.  The
+ * requestor is notified once the last of them completed.
+ */
+class BGFetchBatch {
+public:
+    BGFetchBatch(EventuallyPersistentEngine &e, Atomic<size_t> &queue,
+                 const void *c, size_t n) :
+        engine(e), counter(queue), cookie(c), remaining(n),
+        status(ENGINE_SUCCESS) {
+        assert(cookie);
+        assert(remaining > 0);
+    }
+
+    void complete(ENGINE_ERROR_CODE r) {
+        LockHolder lh(mutex);
+        if (status == ENGINE_SUCCESS) {
+            status = r;
+        }
+        assert(remaining > 0);
+        if (--remaining == 0) {
+            lh.unlock();
+            engine.notifyIOComplete(cookie, status);
+        }
+    }
+
+private:
+    EventuallyPersistentEngine &engine;
+    BGFetchCounter              counter;
+    const void                 *cookie;
+    Mutex                       mutex;
+    size_t                      remaining;
+    ENGINE_ERROR_CODE           status;
+};
+
+/**
+ * Completes a read of a background fetch on the reader thread that
+ * performed it.
+ */
+class BGFetchReadCallback : public Callback<GetValue> {
+public:
+    BGFetchReadCallback(EventuallyPersistentStore *e, const std::string &k,
+                        uint16_t vbid, hrtime_t i,
+                        shared_ptr<BGFetchBatch> b) :
+        ep(e), key(k), vbucket(vbid), init(i), start(gethrtime()),
+        batch(b) {
+        assert(ep);
+    }
+
+    void callback(GetValue &gv) {
+        batch->complete(ep->restoreBGValue(key, vbucket, gv, init, start));
+    }
+
+private:
+    EventuallyPersistentStore *ep;
+    std::string                key;
+    uint16_t                   vbucket;
+    hrtime_t                   init;
+    hrtime_t                   start;
+    shared_ptr<BGFetchBatch>   batch;
+};
+
+/**
+ * Dispatcher job performing a single disk fetch for all of the misses
+ * of a batched get.
+ */
+class MultiBGFetchCallback : public DispatcherCallback {
+public:
+    MultiBGFetchCallback(EventuallyPersistentStore *e,
+                         const std::vector<BGFetchRequest> &r,
+                         const void *c) :
+        ep(e), reqs(r), cookie(c), counter(ep->bgFetchQueue),
+        init(gethrtime()) {
+        assert(ep);
+        assert(cookie);
+    }
+
+    bool callback(Dispatcher &, TaskId) {
+        ep->completeBGFetchMulti(reqs, cookie, init);
+        return false;
+    }
+
+    std::string description() {
+        std::stringstream ss;
+        ss << "Fetching " << reqs.size() << " items from disk";
+        return ss.str();
+    }
+
+private:
+    EventuallyPersistentStore   *ep;
+    std::vector<BGFetchRequest>  reqs;
+    const void                  *cookie;
+    BGFetchCounter               counter;
+
+    hrtime_t init;
+};
+
 /**
  * Dispatcher job for performing disk fetches for "stats vkey".
  */
@@ -309,6 +415,7 @@ public:
         execution_time = 0;
         start_wall_time = gethrtime();
         vbucket = vb->getId();
+        vbdv.reserve(vb->ht.getNumItems());
         vb->ht.visit(vbdv);
         vbdv.createRangeList(range_list);
         current_range = range_list.begin();
@@ -455,8 +562,11 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
                                                      bool startVb0,
                                                      bool concurrentDB) :
     engine(theEngine), stats(engine.getEpStats()), rwUnderlying(t),
-    storageProperties(t->getStorageProperties()),
+    storageProperties(t->getStorageProperties()), readerPool(NULL),
+    valueCache(NULL),
     vbuckets(theEngine.getConfiguration()),
+    hotKeys(theEngine.getConfiguration().getHotKeySampleRate(),
+            theEngine.getConfiguration().getHotKeyThreshold()),
     mutationLog(theEngine.getConfiguration().getKlogPath(),
                 theEngine.getConfiguration().getKlogBlockSize()),
     diskFlushAll(false),
@@ -513,6 +623,10 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     config.addValueChangedListener("tap_throttle_queue_cap",
                                    new StatsValueChangeListener(stats));
 
+    stats.expiryIndexMaxEntries.set(config.getExpiryIndexMaxKeys());
+    config.addValueChangedListener("expiry_index_max_keys",
+                                   new StatsValueChangeListener(stats));
+
     setBGFetchDelay(config.getBgFetchDelay());
     config.addValueChangedListener("bg_fetch_delay",
                                    new EPStoreValueChangeListener(*this));
@@ -529,6 +643,32 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     config.addValueChangedListener("couch_vbucket_batch_count",
                                    new EPStoreValueChangeListener(*this));
 
+    setDispatcherFairShare(config.isDispatcherFairShare());
+    config.addValueChangedListener("dispatcher_fair_share",
+                                   new EPStoreValueChangeListener(*this));
+
+    // The reader pool needs a store per thread, so it's only used if
+    // the storage layer allows concurrent readers.
+    if (config.getAsyncReaders() > 0 && hasSeparateRODispatcher()) {
+        std::vector<KVStore*> readers;
+        for (size_t i = 0; i < config.getAsyncReaders(); ++i) {
+            readers.push_back(engine.newKVStore());
+        }
+        readerPool = new ReaderPool(engine, stats, readers);
+        readerPool->start();
+    }
+
+    if (config.getValueCachePath() != "") {
+        valueCache = new ValueCache(config.getValueCachePath(),
+                                    config.getValueCacheSize(), stats);
+        if (!valueCache->open()) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Can't open the value cache (disabling)\n");
+            delete valueCache;
+            valueCache = NULL;
+        }
+    }
+
     if (startVb0) {
         RCPtr<VBucket> vb(new VBucket(0, vbucket_state_active, stats,
                                       engine.getCheckpointConfig()));
@@ -708,11 +848,24 @@ void EventuallyPersistentStore::initialize() {
     dispatcher->schedule(sscb, NULL, Priority::StatSnapPriority,
                          STATSNAP_FREQ);
 
+    shared_ptr<DispatcherCallback> sgcb(new StatGroupSnapper(&engine));
+    nonIODispatcher->schedule(sgcb, NULL, Priority::StatGroupSnapperPriority, 0);
+
     if (mutationLog.isEnabled()) {
         shared_ptr<MutationLogCompactor>
             compactor(new MutationLogCompactor(this, mutationLog, mlogCompactorConfig, stats));
-        dispatcher->schedule(compactor, NULL, Priority::MutationLogCompactorPriority,
-                             mlogCompactorConfig.getSleepTime());
+        nonIODispatcher->schedule(compactor, NULL,
+                                  Priority::MutationLogCompactorPriority,
+                                  mlogCompactorConfig.getSleepTime());
+    }
+
+    if (valueCache) {
+        size_t stime(engine.getConfiguration().getValueCacheCompactorStime());
+        shared_ptr<DispatcherCallback>
+            vccb(new ValueCacheCompactor(this, *valueCache, stime));
+        nonIODispatcher->schedule(vccb, NULL,
+                                  Priority::ValueCacheCompactorPriority,
+                                  static_cast<double>(stime));
     }
 
     if (config.getBackend().compare("sqlite") == 0 &&
@@ -730,9 +883,13 @@ EventuallyPersistentStore::~EventuallyPersistentStore() {
     dispatcher->stop(forceShutdown);
     if (hasSeparateRODispatcher()) {
         roDispatcher->stop(forceShutdown);
+        // The readers restore values into the vbuckets, so they have
+        // to stop before the store goes away.
+        delete readerPool;
         delete roUnderlying;
     }
     nonIODispatcher->stop(forceShutdown);
+    delete valueCache;
 
     delete flusher;
     delete dispatcher;
@@ -807,7 +964,8 @@ void EventuallyPersistentStore::firePendingVBucketOps() {
  */
 class Deleter {
 public:
-    Deleter(EventuallyPersistentStore *ep) : e(ep), startTime(ep_real_time()) {}
+    Deleter(EventuallyPersistentStore *ep) : e(ep), startTime(ep_real_time()),
+                                             deleted(0) {}
     void operator() (std::pair<uint16_t, std::string> vk) {
         RCPtr<VBucket> vb = e->getVBucket(vk.first);
         if (vb) {
@@ -818,23 +976,26 @@ public:
                 vb->ht.unlocked_softDelete(v, 0);
                 e->queueDirty(vk.second, vb->getId(), queue_op_del,
                               v->getSeqno(), v->getId(), false);
+                ++deleted;
             }
         }
     }
+    size_t numDeleted() const { return deleted; }
 private:
     EventuallyPersistentStore *e;
     time_t                     startTime;
+    size_t                     deleted;
 };
 /// @endcond
 
-void
+size_t
 EventuallyPersistentStore::deleteExpiredItems(std::list<std::pair<uint16_t, std::string> > &keys) {
     // This can be made a lot more efficient, but I'd rather see it
     // show up in a profiling report first.
-    std::for_each(keys.begin(), keys.end(), Deleter(this));
+    return std::for_each(keys.begin(), keys.end(), Deleter(this)).numDeleted();
 }
 
-StoredValue *EventuallyPersistentStore::fetchValidValue(RCPtr<VBucket> vb,
+StoredValue *EventuallyPersistentStore::fetchValidValue(VBucket *vb,
                                                         const std::string &key,
                                                         int bucket_num,
                                                         bool wantDeleted) {
@@ -889,13 +1050,10 @@ protocol_binary_response_status EventuallyPersistentStore::evictKey(const std::s
     return rv;
 }
 
-ENGINE_ERROR_CODE EventuallyPersistentStore::set(const Item &itm,
-                                                 const void *cookie,
-                                                 bool force) {
-
-    RCPtr<VBucket> vb = getVBucket(itm.getVBucketId());
+ENGINE_ERROR_CODE EventuallyPersistentStore::checkWritableVBucket(VBucket *vb,
+                                                                  const void *cookie,
+                                                                  bool force) {
     if (!vb || vb->getState() == vbucket_state_dead) {
-        ++stats.numNotMyVBuckets;
         return ENGINE_NOT_MY_VBUCKET;
     } else if (vb->getState() == vbucket_state_active) {
         if (vb->checkpointManager.isHotReload()) {
@@ -904,18 +1062,19 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::set(const Item &itm,
             }
         }
     } else if (vb->getState() == vbucket_state_replica && !force) {
-        ++stats.numNotMyVBuckets;
         return ENGINE_NOT_MY_VBUCKET;
     } else if (vb->getState() == vbucket_state_pending && !force) {
         if (vb->addPendingOp(cookie)) {
             return ENGINE_EWOULDBLOCK;
         }
     }
+    return ENGINE_SUCCESS;
+}
 
+ENGINE_ERROR_CODE EventuallyPersistentStore::completeSet(const Item &itm,
+                                                         mutation_type_t mtype,
+                                                         int64_t row_id) {
     bool cas_op = (itm.getCas() != 0);
-
-    int64_t row_id = -1;
-    mutation_type_t mtype = vb->ht.set(itm, row_id);
     ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
 
     switch (mtype) {
@@ -936,7 +1095,7 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::set(const Item &itm,
         // Even if the item was dirty, push it into the vbucket's open checkpoint.
     case WAS_CLEAN:
         queueDirty(itm.getKey(), itm.getVBucketId(), queue_op_set,
-                   itm.getSeqno(), row_id);
+                   itm.getSeqno(), row_id, false, &itm);
         break;
     case INVALID_VBUCKET:
         ret = ENGINE_NOT_MY_VBUCKET;
@@ -946,10 +1105,247 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::set(const Item &itm,
     return ret;
 }
 
+ENGINE_ERROR_CODE EventuallyPersistentStore::set(const Item &itm,
+                                                 const void *cookie,
+                                                 bool force) {
+
+    EpochGuard eg(vbuckets.getEpochManager());
+    VBucket *vb = vbuckets.peekBucket(itm.getVBucketId());
+    ENGINE_ERROR_CODE ret = checkWritableVBucket(vb, cookie, force);
+    if (ret != ENGINE_SUCCESS) {
+        if (ret == ENGINE_NOT_MY_VBUCKET) {
+            ++stats.numNotMyVBuckets;
+        }
+        return ret;
+    }
+
+    int64_t row_id = -1;
+    mutation_type_t mtype = vb->ht.set(itm, row_id);
+    return completeSet(itm, mtype, row_id);
+}
+
+/**
+ * Order the entries of a batched operation by vbucket and then by
+ * hash table lock.
+ */
+template <typename T>
+static bool multiOpLess(const T *a, const T *b) {
+    return a->vbucket < b->vbucket ||
+        (a->vbucket == b->vbucket && a->lock < b->lock);
+}
+
+/**
+ * Find the end of the run of entries sharing the vbucket of the
+ * entry at start.
+ */
+template <typename T>
+static size_t multiOpVBucketEnd(const std::vector<T*> &order, size_t start) {
+    size_t end = start + 1;
+    while (end < order.size() && order[end]->vbucket == order[start]->vbucket) {
+        ++end;
+    }
+    return end;
+}
+
+/**
+ * Hash the keys of one vbucket's entries and sort them by the hash
+ * table lock guarding them.
+ */
+template <typename T>
+static void multiOpSortByLock(HashTable &ht, std::vector<T*> &order,
+                              size_t start, size_t end,
+                              const std::string &(*keyOf)(const T*)) {
+    for (size_t i = start; i < end; ++i) {
+        order[i]->hash = ht.hash(keyOf(order[i]));
+        order[i]->lock = ht.getLockNumForHash(order[i]->hash);
+    }
+    std::stable_sort(order.begin() + start, order.begin() + end,
+                     multiOpLess<T>);
+}
+
+static const std::string &multiSetKey(const MultiSetItem *msi) {
+    return msi->item->getKey();
+}
+
+static const std::string &multiGetKey(const MultiGetItem *mgi) {
+    return mgi->key;
+}
+
+ENGINE_ERROR_CODE EventuallyPersistentStore::setMulti(std::vector<MultiSetItem> &items,
+                                                      const void *cookie) {
+    std::vector<MultiSetItem*> order;
+    order.reserve(items.size());
+    std::vector<MultiSetItem>::iterator it;
+    for (it = items.begin(); it != items.end(); ++it) {
+        it->lock = 0;
+        order.push_back(&*it);
+    }
+    std::stable_sort(order.begin(), order.end(), multiOpLess<MultiSetItem>);
+
+    // Check all of the vbuckets first so that a batch is either blocked
+    // as a whole or not at all.
+    std::vector<RCPtr<VBucket> > vbs;
+    std::vector<ENGINE_ERROR_CODE> vbstatus;
+    for (size_t start = 0; start < order.size();
+         start = multiOpVBucketEnd(order, start)) {
+        RCPtr<VBucket> vb = getVBucket(order[start]->vbucket);
+        ENGINE_ERROR_CODE st = checkWritableVBucket(vb, cookie, false);
+        if (st == ENGINE_EWOULDBLOCK) {
+            return st;
+        }
+        vbs.push_back(vb);
+        vbstatus.push_back(st);
+    }
+
+    size_t nvb = 0;
+    for (size_t start = 0, end = 0; start < order.size(); start = end, ++nvb) {
+        end = multiOpVBucketEnd(order, start);
+        RCPtr<VBucket> &vb = vbs[nvb];
+        if (vbstatus[nvb] != ENGINE_SUCCESS) {
+            for (size_t i = start; i < end; ++i) {
+                order[i]->status = vbstatus[nvb];
+                ++stats.numNotMyVBuckets;
+            }
+            continue;
+        }
+
+        setMultiInVBucket(vb, order, start, end);
+        for (size_t i = start; i < end; ++i) {
+            order[i]->status = completeSet(*order[i]->item, order[i]->mtype,
+                                           order[i]->rowid);
+        }
+    }
+
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Store the given entries of one vbucket, taking each hash table lock
+ * once for all of the entries it guards.
+ */
+void EventuallyPersistentStore::setMultiInVBucket(RCPtr<VBucket> &vb,
+                                                  std::vector<MultiSetItem*> &order,
+                                                  size_t start, size_t end) {
+    multiOpSortByLock(vb->ht, order, start, end, multiSetKey);
+    std::vector<MultiSetItem*> retry;
+    for (size_t i = start; i < end; ) {
+        int lock_num = order[i]->lock;
+        LockHolder lh = vb->ht.getLock(lock_num);
+        for (; i < end && order[i]->lock == lock_num; ++i) {
+            MultiSetItem *msi = order[i];
+            int bucket_num = vb->ht.getBucketUnderLock(msi->hash, lock_num);
+            if (bucket_num < 0) {
+                // The table was resized since the keys were grouped.
+                retry.push_back(msi);
+                continue;
+            }
+            if (msi->meta) {
+                msi->mtype = vb->ht.unlocked_set(*msi->item, 0, msi->rowid,
+                                                 true, true, bucket_num);
+            } else {
+                msi->mtype = vb->ht.unlocked_set(*msi->item,
+                                                 msi->item->getCas(),
+                                                 msi->rowid, true, false,
+                                                 bucket_num);
+            }
+        }
+    }
+
+    std::vector<MultiSetItem*>::iterator rit;
+    for (rit = retry.begin(); rit != retry.end(); ++rit) {
+        MultiSetItem *msi = *rit;
+        if (msi->meta) {
+            msi->mtype = vb->ht.set(*msi->item, 0, msi->rowid, true);
+        } else {
+            msi->mtype = vb->ht.set(*msi->item, msi->rowid);
+        }
+    }
+}
+
+void EventuallyPersistentStore::setTapMutations(uint16_t vbucket,
+                                                std::vector<MultiSetItem> &items,
+                                                bool backfill) {
+    RCPtr<VBucket> vb = getVBucket(vbucket);
+    if (!vb || vb->getState() == vbucket_state_dead ||
+        (backfill && vb->getState() == vbucket_state_active &&
+         !engine.getCheckpointConfig().isInconsistentSlaveCheckpoint())) {
+        std::vector<MultiSetItem>::iterator it;
+        for (it = items.begin(); it != items.end(); ++it) {
+            it->status = ENGINE_NOT_MY_VBUCKET;
+            ++stats.numNotMyVBuckets;
+        }
+        return;
+    }
+
+    std::vector<MultiSetItem*> order;
+    order.reserve(items.size());
+    std::vector<MultiSetItem>::iterator it;
+    for (it = items.begin(); it != items.end(); ++it) {
+        order.push_back(&*it);
+    }
+    setMultiInVBucket(vb, order, 0, order.size());
+
+    // Queue in the order the items were received.
+    std::vector<queued_item> dirty;
+    dirty.reserve(items.size());
+    uint16_t vbver(vbuckets.getBucketVersion(vbucket));
+    for (it = items.begin(); it != items.end(); ++it) {
+        bool queue = false;
+        switch (it->mtype) {
+        case NOMEM:
+            it->status = ENGINE_ENOMEM;
+            break;
+        case INVALID_CAS:
+        case IS_LOCKED:
+            it->status = ENGINE_KEY_EEXISTS;
+            break;
+        case INVALID_VBUCKET:
+            it->status = ENGINE_NOT_MY_VBUCKET;
+            break;
+        case WAS_DIRTY:
+            // A dirty backfill item is already queued.
+            queue = !backfill;
+            break;
+        case NOT_FOUND:
+        case WAS_CLEAN:
+            queue = true;
+            break;
+        }
+        if (queue && doPersistence) {
+            const Item &itm = *it->item;
+            QueuedItem *qi = new QueuedItem(itm.getKey(), vbucket,
+                                            queue_op_set, vbver, it->rowid,
+                                            itm.getSeqno());
+            if (!backfill && !it->meta) {
+                qi->setSnapshot(itm);
+            }
+            dirty.push_back(queued_item(qi));
+        }
+    }
+
+    if (dirty.empty()) {
+        return;
+    }
+    std::vector<bool> queued(dirty.size(), true);
+    if (backfill) {
+        vb->queueBackfillItems(dirty);
+    } else {
+        vb->checkpointManager.queueDirty(dirty, vb, queued);
+    }
+    for (size_t i = 0; i < dirty.size(); ++i) {
+        if (queued[i]) {
+            ++stats.queue_size;
+            ++stats.totalEnqueued;
+            vb->doStatsForQueueing(*dirty[i], dirty[i]->size());
+        }
+    }
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentStore::add(const Item &itm,
                                                  const void *cookie)
 {
-    RCPtr<VBucket> vb = getVBucket(itm.getVBucketId());
+    EpochGuard eg(vbuckets.getEpochManager());
+    VBucket *vb = vbuckets.peekBucket(itm.getVBucketId());
     if (!vb || vb->getState() == vbucket_state_dead || vb->getState() == vbucket_state_replica) {
         ++stats.numNotMyVBuckets;
         return ENGINE_NOT_MY_VBUCKET;
@@ -978,7 +1374,7 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::add(const Item &itm,
     case ADD_SUCCESS:
     case ADD_UNDEL:
         queueDirty(itm.getKey(), itm.getVBucketId(), queue_op_set,
-                   itm.getSeqno(), -1);
+                   itm.getSeqno(), -1, false, &itm);
     }
     return ENGINE_SUCCESS;
 }
@@ -1238,18 +1634,16 @@ bool EventuallyPersistentStore::resetVBucket(uint16_t vbid) {
     return rv;
 }
 
-void EventuallyPersistentStore::completeBGFetch(const std::string &key,
-                                                uint16_t vbucket,
-                                                uint16_t vbver,
-                                                uint64_t rowid,
-                                                const void *cookie,
-                                                hrtime_t init) {
+ENGINE_ERROR_CODE EventuallyPersistentStore::fetchBGItem(const std::string &key,
+                                                         uint16_t vbucket,
+                                                         uint16_t vbver,
+                                                         uint64_t rowid,
+                                                         hrtime_t init) {
+    if (restoreCachedValue(key, vbucket)) {
+        return ENGINE_SUCCESS;
+    }
+
     hrtime_t start(gethrtime());
-    ++stats.bg_fetched;
-    std::stringstream ss;
-    ss << "Completed a background fetch, now at " << bgFetchQueue.get()
-       << std::endl;
-    getLogger()->log(EXTENSION_LOG_DEBUG, NULL, ss.str().c_str());
 
     // Go find the data
     RememberingCallback<GetValue> gcb;
@@ -1258,18 +1652,49 @@ void EventuallyPersistentStore::completeBGFetch(const std::string &key,
     gcb.waitForValue();
     assert(gcb.fired);
 
+    return restoreBGValue(key, vbucket, gcb.val, init, start);
+}
+
+void EventuallyPersistentStore::fetchBGItemAsync(const std::string &key,
+                                                 uint16_t vbucket,
+                                                 uint16_t vbver,
+                                                 uint64_t rowid,
+                                                 hrtime_t init,
+                                                 shared_ptr<BGFetchBatch> batch) {
+    if (restoreCachedValue(key, vbucket)) {
+        batch->complete(ENGINE_SUCCESS);
+        return;
+    }
+
+    shared_ptr<Callback<GetValue> > cb(new BGFetchReadCallback(this, key,
+                                                               vbucket, init,
+                                                               batch));
+    readerPool->getAsync(key, rowid, vbucket, vbver, cb);
+}
+
+ENGINE_ERROR_CODE EventuallyPersistentStore::restoreBGValue(const std::string &key,
+                                                            uint16_t vbucket,
+                                                            GetValue &gv,
+                                                            hrtime_t init,
+                                                            hrtime_t start) {
+    ++stats.bg_fetched;
+    std::stringstream ss;
+    ss << "Completed a background fetch, now at " << bgFetchQueue.get()
+       << std::endl;
+    getLogger()->log(EXTENSION_LOG_DEBUG, NULL, ss.str().c_str());
+
     // Lock to prevent a race condition between a fetch for restore and delete
     LockHolder lh(vbsetMutex);
 
     RCPtr<VBucket> vb = getVBucket(vbucket);
-    if (vb && vb->getState() == vbucket_state_active && gcb.val.getStatus() == ENGINE_SUCCESS) {
+    if (vb && vb->getState() == vbucket_state_active && gv.getStatus() == ENGINE_SUCCESS) {
         int bucket_num(0);
         LockHolder hlh = vb->ht.getLockedBucket(key, &bucket_num);
         StoredValue *v = fetchValidValue(vb, key, bucket_num);
 
         if (v && !v->isResident()) {
-            assert(gcb.val.getStatus() == ENGINE_SUCCESS);
-            v->restoreValue(gcb.val.getValue()->getValue(), stats, vb->ht);
+            assert(gv.getStatus() == ENGINE_SUCCESS);
+            v->restoreValue(gv.getValue()->getValue(), stats, vb->ht);
             assert(v->isResident());
         }
     }
@@ -1296,8 +1721,91 @@ void EventuallyPersistentStore::completeBGFetch(const std::string &key,
         stats.bgMaxLoad.setIfBigger(l);
     }
 
-    engine.notifyIOComplete(cookie, gcb.val.getStatus());
-    delete gcb.val.getValue();
+    delete gv.getValue();
+    return gv.getStatus();
+}
+
+bool EventuallyPersistentStore::restoreCachedValue(const std::string &key,
+                                                   uint16_t vbucket) {
+    if (!valueCache) {
+        return false;
+    }
+
+    RCPtr<VBucket> vb = getVBucket(vbucket);
+    if (!vb || vb->getState() != vbucket_state_active) {
+        return false;
+    }
+    uint64_t cas;
+    {
+        int bucket_num(0);
+        LockHolder hlh = vb->ht.getLockedBucket(key, &bucket_num);
+        StoredValue *v = fetchValidValue(vb, key, bucket_num);
+        if (!v || v->isResident()) {
+            return false;
+        }
+        cas = v->getCas();
+    }
+
+    // Read it without holding the bucket lock.
+    value_t value(valueCache->get(vbucket, key, cas));
+    if (!value) {
+        return false;
+    }
+
+    // Lock to prevent a race condition between a fetch for restore and delete
+    LockHolder lh(vbsetMutex);
+    vb = getVBucket(vbucket);
+    if (vb && vb->getState() == vbucket_state_active) {
+        int bucket_num(0);
+        LockHolder hlh = vb->ht.getLockedBucket(key, &bucket_num);
+        StoredValue *v = fetchValidValue(vb, key, bucket_num);
+        if (v && !v->isResident() && v->getCas() == cas) {
+            v->restoreValue(value, stats, vb->ht);
+            assert(v->isResident());
+        }
+    }
+    return true;
+}
+
+void EventuallyPersistentStore::completeBGFetch(const std::string &key,
+                                                uint16_t vbucket,
+                                                uint16_t vbver,
+                                                uint64_t rowid,
+                                                const void *cookie,
+                                                hrtime_t init) {
+    if (readerPool) {
+        shared_ptr<BGFetchBatch> batch(new BGFetchBatch(engine, bgFetchQueue,
+                                                        cookie, 1));
+        fetchBGItemAsync(key, vbucket, vbver, rowid, init, batch);
+        return;
+    }
+    engine.notifyIOComplete(cookie,
+                            fetchBGItem(key, vbucket, vbver, rowid, init));
+}
+
+void EventuallyPersistentStore::completeBGFetchMulti(const std::vector<BGFetchRequest> &reqs,
+                                                     const void *cookie,
+                                                     hrtime_t init) {
+    std::vector<BGFetchRequest>::const_iterator it;
+    if (readerPool) {
+        shared_ptr<BGFetchBatch> batch(new BGFetchBatch(engine, bgFetchQueue,
+                                                        cookie, reqs.size()));
+        for (it = reqs.begin(); it != reqs.end(); ++it) {
+            fetchBGItemAsync(it->key, it->vbucket, it->vbver, it->rowid,
+                             init, batch);
+        }
+        return;
+    }
+
+    ENGINE_ERROR_CODE rv = ENGINE_SUCCESS;
+    for (it = reqs.begin(); it != reqs.end(); ++it) {
+        ENGINE_ERROR_CODE r = fetchBGItem(it->key, it->vbucket, it->vbver,
+                                          it->rowid, init);
+        if (rv == ENGINE_SUCCESS) {
+            rv = r;
+        }
+    }
+    engine.notifyIOComplete(cookie, rv);
 }
 
 void EventuallyPersistentStore::bgFetch(const std::string &key,
@@ -1316,33 +1824,74 @@ void EventuallyPersistentStore::bgFetch(const std::string &key,
     roDispatcher->schedule(dcb, NULL, Priority::BgFetcherPriority, bgFetchDelay);
 }
 
-GetValue EventuallyPersistentStore::getInternal(const std::string &key,
-                                        uint16_t vbucket,
-                                        const void *cookie,
-                                        bool queueBG,
-                                        bool honorStates,
-                                        vbucket_state_t allowedState) {
+void EventuallyPersistentStore::bgFetchMulti(const std::vector<BGFetchRequest> &reqs,
+                                             const void *cookie) {
+    shared_ptr<MultiBGFetchCallback> dcb(new MultiBGFetchCallback(this, reqs,
+                                                                  cookie));
+    assert(bgFetchQueue > 0);
+    std::stringstream ss;
+    ss << "Queued a background fetch of " << reqs.size()
+       << " items, now at " << bgFetchQueue.get() << std::endl;
+    getLogger()->log(EXTENSION_LOG_DEBUG, NULL, ss.str().c_str());
+    roDispatcher->schedule(dcb, NULL, Priority::BgFetcherPriority, bgFetchDelay);
+}
+
+ENGINE_ERROR_CODE EventuallyPersistentStore::checkReadableVBucket(VBucket *vb,
+                                                                  const void *cookie,
+                                                                  bool honorStates,
+                                                                  vbucket_state_t allowedState) {
     vbucket_state_t disallowedState = (allowedState == vbucket_state_active) ?
         vbucket_state_replica : vbucket_state_active;
-    RCPtr<VBucket> vb = getVBucket(vbucket);
     if (!vb) {
-        ++stats.numNotMyVBuckets;
-        return GetValue(NULL, ENGINE_NOT_MY_VBUCKET);
+        return ENGINE_NOT_MY_VBUCKET;
     } else if (honorStates && vb->getState() == vbucket_state_dead) {
-        ++stats.numNotMyVBuckets;
-        return GetValue(NULL, ENGINE_NOT_MY_VBUCKET);
+        return ENGINE_NOT_MY_VBUCKET;
     } else if (vb->getState() == allowedState) {
         if (vb->checkpointManager.isHotReload()) {
             if (vb->addPendingOp(cookie)) {
-                return GetValue(NULL, ENGINE_EWOULDBLOCK);
+                return ENGINE_EWOULDBLOCK;
             }
         }
     } else if (honorStates && vb->getState() == disallowedState) {
-        ++stats.numNotMyVBuckets;
-        return GetValue(NULL, ENGINE_NOT_MY_VBUCKET);
+        return ENGINE_NOT_MY_VBUCKET;
     } else if (honorStates && vb->getState() == vbucket_state_pending) {
         if (vb->addPendingOp(cookie)) {
-            return GetValue(NULL, ENGINE_EWOULDBLOCK);
+            return ENGINE_EWOULDBLOCK;
+        }
+    }
+    return ENGINE_SUCCESS;
+}
+
+GetValue EventuallyPersistentStore::getInternal(const std::string &key,
+                                        uint16_t vbucket,
+                                        const void *cookie,
+                                        bool queueBG,
+                                        bool honorStates,
+                                        vbucket_state_t allowedState) {
+    EpochGuard eg(vbuckets.getEpochManager());
+    VBucket *vb = vbuckets.peekBucket(vbucket);
+    ENGINE_ERROR_CODE status = checkReadableVBucket(vb, cookie, honorStates,
+                                                    allowedState);
+    if (status != ENGINE_SUCCESS) {
+        if (status == ENGINE_NOT_MY_VBUCKET) {
+            ++stats.numNotMyVBuckets;
+        }
+        return GetValue(NULL, status);
+    }
+
+    // Front end reads of hot keys skip the bucket lock.  Callers asking
+    // for the stored value (e.g. TAP) always take the locked path.
+    bool frontEnd(honorStates && allowedState == vbucket_state_active);
+    bool sampled(frontEnd && hotKeys.shouldSample());
+    if (frontEnd) {
+        Item *hot = vb->ht.getHotItem(key, vbucket);
+        if (hot) {
+            if (sampled) {
+                ++stats.hotKeySamples;
+                ++stats.hotKeyLockFreeSamples;
+                hotKeys.sample(vbucket, key);
+            }
+            return GetValue(hot, ENGINE_SUCCESS, hot->getId());
         }
     }
 
@@ -1360,10 +1909,21 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
             return GetValue(NULL, ENGINE_EWOULDBLOCK, v->getId(), -1, v);
         }
 
+        if (sampled) {
+            ++stats.hotKeySamples;
+            if (hotKeys.sample(vbucket, key)) {
+                vb->ht.unlocked_publishHot(v);
+            }
+        }
+
         GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket),
                     ENGINE_SUCCESS, v->getId(), -1, v);
         return rv;
     } else {
+        // Only values are ever ejected, so once warmup is done a key
+        // that isn't in the hash table isn't on disk either, and the
+        // miss never has to reach the underlying store.  Until then
+        // the key may just not be loaded yet.
         GetValue rv;
         if (engine.isDegradedMode()) {
             rv.setStatus(ENGINE_TMPFAIL);
@@ -1372,6 +1932,98 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
     }
 }
 
+void EventuallyPersistentStore::getMultiItem(RCPtr<VBucket> &vb,
+                                             MultiGetItem &mgi,
+                                             int bucket_num,
+                                             std::vector<BGFetchRequest> &misses) {
+    StoredValue *v = fetchValidValue(vb, mgi.key, bucket_num);
+
+    if (!v) {
+        mgi.status = engine.isDegradedMode() ? ENGINE_TMPFAIL : ENGINE_KEY_ENOENT;
+    } else if (!v->isResident()) {
+        mgi.status = ENGINE_EWOULDBLOCK;
+        misses.push_back(BGFetchRequest(mgi.key, mgi.vbucket,
+                                        vbuckets.getBucketVersion(mgi.vbucket),
+                                        v->getId()));
+    } else {
+        mgi.value = v->toItem(v->isLocked(ep_current_time()), mgi.vbucket);
+        mgi.status = ENGINE_SUCCESS;
+    }
+}
+
+ENGINE_ERROR_CODE EventuallyPersistentStore::getMulti(std::vector<MultiGetItem> &items,
+                                                      const void *cookie,
+                                                      bool queueBG) {
+    std::vector<MultiGetItem*> order;
+    order.reserve(items.size());
+    std::vector<MultiGetItem>::iterator it;
+    for (it = items.begin(); it != items.end(); ++it) {
+        it->lock = 0;
+        order.push_back(&*it);
+    }
+    std::stable_sort(order.begin(), order.end(), multiOpLess<MultiGetItem>);
+
+    // Check all of the vbuckets first so that a batch is either blocked
+    // as a whole or not at all.
+    std::vector<RCPtr<VBucket> > vbs;
+    std::vector<ENGINE_ERROR_CODE> vbstatus;
+    for (size_t start = 0; start < order.size();
+         start = multiOpVBucketEnd(order, start)) {
+        RCPtr<VBucket> vb = getVBucket(order[start]->vbucket);
+        ENGINE_ERROR_CODE st = checkReadableVBucket(vb, cookie, true,
+                                                    vbucket_state_active);
+        if (st == ENGINE_EWOULDBLOCK) {
+            return st;
+        }
+        vbs.push_back(vb);
+        vbstatus.push_back(st);
+    }
+
+    std::vector<BGFetchRequest> misses;
+    size_t nvb = 0;
+    for (size_t start = 0, end = 0; start < order.size(); start = end, ++nvb) {
+        end = multiOpVBucketEnd(order, start);
+        RCPtr<VBucket> &vb = vbs[nvb];
+        if (vbstatus[nvb] != ENGINE_SUCCESS) {
+            for (size_t i = start; i < end; ++i) {
+                order[i]->status = vbstatus[nvb];
+                ++stats.numNotMyVBuckets;
+            }
+            continue;
+        }
+
+        multiOpSortByLock(vb->ht, order, start, end, multiGetKey);
+        std::vector<MultiGetItem*> retry;
+        for (size_t i = start; i < end; ) {
+            int lock_num = order[i]->lock;
+            LockHolder lh = vb->ht.getLock(lock_num);
+            for (; i < end && order[i]->lock == lock_num; ++i) {
+                int bucket_num = vb->ht.getBucketUnderLock(order[i]->hash,
+                                                           lock_num);
+                if (bucket_num < 0) {
+                    // The table was resized since the keys were grouped.
+                    retry.push_back(order[i]);
+                } else {
+                    getMultiItem(vb, *order[i], bucket_num, misses);
+                }
+            }
+        }
+
+        std::vector<MultiGetItem*>::iterator rit;
+        for (rit = retry.begin(); rit != retry.end(); ++rit) {
+            int bucket_num(0);
+            LockHolder lh = vb->ht.getLockedBucket((*rit)->hash, &bucket_num);
+            getMultiItem(vb, **rit, bucket_num, misses);
+        }
+    }
+
+    if (!misses.empty() && queueBG) {
+        bgFetchMulti(misses, cookie);
+        return ENGINE_EWOULDBLOCK;
+    }
+    return ENGINE_SUCCESS;
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
                                                          uint16_t vbucket,
                                                          const void *cookie,
@@ -1497,7 +2149,10 @@ GetValue EventuallyPersistentStore::getAndUpdateTtl(const std::string &key,
     StoredValue *v = fetchValidValue(vb, key, bucket_num);
 
     if (v) {
+        vb->ht.unlocked_preserve(key, bucket_num, v);
+        time_t oldExptime = v->getExptime();
         v->setExptime(exptime);
+        vb->ht.indexExpiry(key, oldExptime, v->getExptime());
         // If the value is not resident, wait for it...
         if (!v->isResident()) {
             if (queueBG) {
@@ -1610,7 +2265,8 @@ bool EventuallyPersistentStore::getLocked(const std::string &key,
         v->lock(currentTime + lockTimeout);
 
         Item *it = v->toItem(false, vbucket);
-        it->setCas();
+        it->setCasAfter(v->getCas());
+        vb->ht.unlocked_preserve(key, bucket_num, v);
         v->setCas(it->getCas());
 
         GetValue rv(it);
@@ -1718,7 +2374,8 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::deleteItem(const std::string &key,
                                                         const void *cookie,
                                                         bool force,
                                                         bool use_meta) {
-    RCPtr<VBucket> vb = getVBucket(vbucket);
+    EpochGuard eg(vbuckets.getEpochManager());
+    VBucket *vb = vbuckets.peekBucket(vbucket);
     if (!vb || vb->getState() == vbucket_state_dead) {
         ++stats.numNotMyVBuckets;
         return ENGINE_NOT_MY_VBUCKET;
@@ -1744,6 +2401,7 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::deleteItem(const std::string &key,
         if (engine.isDegradedMode()) {
             LockHolder rlh(restore.mutex);
             restore.itemsDeleted.insert(key);
+            restore.numDeleted = restore.itemsDeleted.size();
         } else {
             return ENGINE_KEY_ENOENT;
         }
@@ -1849,10 +2507,12 @@ std::queue<queued_item>* EventuallyPersistentStore::beginFlush() {
         }
 
         std::vector<queued_item> item_list;
-        std::set<queued_item, CompareQueuedItemsByKey> item_set;
+        std::vector<queued_item> vb_items;
         size_t dedup = 0;
         size_t num_items = 0;
         size_t numOfVBuckets = vbuckets.getSize();
+        bool keyOrdered = rwUnderlying->isKeyOrderedWrites();
+        hrtime_t collectTime(0), dedupTime(0), shardTime(0);
 
         item_list.reserve(getTxnSize());
         assert(numOfVBuckets <= std::numeric_limits<uint16_t>::max());
@@ -1865,6 +2525,7 @@ std::queue<queued_item>* EventuallyPersistentStore::beginFlush() {
                 continue;
             }
 
+            hrtime_t start = gethrtime();
             vbucket_state_t st = vb->getState();
             if (isVbCachedStateStale(vbid, st)) {
                 rwUnderlying->vbStateChanged(vbid, st);
@@ -1875,6 +2536,7 @@ std::queue<queued_item>* EventuallyPersistentStore::beginFlush() {
             std::map<uint16_t, std::vector<queued_item> >::iterator rit = restore.items.find(vbid);
             if (rit != restore.items.end()) {
                 item_list.insert(item_list.end(), rit->second.begin(), rit->second.end());
+                restore.numItems.decr(rit->second.size());
                 rit->second.clear();
             }
             rlh.unlock();
@@ -1885,39 +2547,59 @@ std::queue<queued_item>* EventuallyPersistentStore::beginFlush() {
             // Get all dirty items from the checkpoint.
             uint64_t checkpointId = vb->checkpointManager.getAllItemsForPersistence(item_list);
             persistenceCheckpointIds[vbid] = checkpointId;
+            hrtime_t collected = gethrtime();
 
+            flushDedup.reset(item_list.size());
             std::vector<queued_item>::reverse_iterator reverse_it = item_list.rbegin();
             // Perform further deduplication here by removing duplicate mutations for each key.
             for (; reverse_it != item_list.rend(); ++reverse_it) {
-                queued_item qi = *reverse_it;
+                queued_item &qi = *reverse_it;
                 switch (qi->getOperation()) {
                 case queue_op_set:
                 case queue_op_del:
-                    if (!(item_set.insert(qi).second)) {
+                    if (!flushDedup.insert(qi)) {
                         ++dedup;
                         vb->doStatsForFlushing(*qi, qi->size());
+                        qi->clearSnapshot();
                     }
+                    break;
                 default:
                     // Ignore
                     ;
                 }
             }
+            flushDedup.drain(vb_items);
+            item_list.clear();
 
-            uint16_t shard_id = 0;
-            std::set<queued_item, CompareQueuedItemsByKey>::iterator sit = item_set.begin();
-            for (; sit != item_set.end(); ++sit) {
-                const queued_item &qitem = *sit;
-                shard_id = rwUnderlying->getShardId(*qitem);
-                dbShardQueues[shard_id].push_back(*sit);
+            // Stores writing by row id sort each shard queue in
+            // optimizeWrites() anyway.
+            if (keyOrdered) {
+                std::sort(vb_items.begin(), vb_items.end(),
+                          CompareQueuedItemsByKey());
             }
-            num_items += item_set.size();
-            item_list.clear();
-            item_set.clear();
+            hrtime_t deduped = gethrtime();
+
+            std::vector<queued_item>::iterator vit = vb_items.begin();
+            for (; vit != vb_items.end(); ++vit) {
+                dbShardQueues[rwUnderlying->getShardId(**vit)].push_back(*vit);
+            }
+            num_items += vb_items.size();
+            vb_items.clear();
+
+            hrtime_t stop = gethrtime();
+            collectTime += collected - start;
+            dedupTime += deduped - collected;
+            shardTime += stop - deduped;
         }
 
         if (num_items > 0) {
+            hrtime_t start = gethrtime();
             pushToOutgoingQueue();
+            shardTime += gethrtime() - start;
         }
+        stats.flushCollectHisto.add(collectTime / 1000);
+        stats.flushDedupHisto.add(dedupTime / 1000);
+        stats.flushShardHisto.add(shardTime / 1000);
         size_t queue_size = getWriteQueueSize();
         stats.flusherDedup += dedup;
         stats.flusher_todo.set(writing.size());
@@ -2012,16 +2694,20 @@ int EventuallyPersistentStore::flushSome(std::queue<queued_item> *q,
     int tsz = tctx.remaining();
     int oldest = stats.min_data_age;
     int completed(0);
-    for (completed = 0;
-         completed < tsz && !q->empty() && !shouldPreemptFlush(completed);
-         ++completed) {
-
+    bool preempted(false);
+    hrtime_t start = gethrtime();
+    for (completed = 0; completed < tsz && !q->empty(); ++completed) {
+        if (shouldPreemptFlush(completed)) {
+            preempted = true;
+            break;
+        }
         int n = flushOne(q, rejectQueue);
         if (n != 0 && n < oldest) {
             oldest = n;
         }
     }
-    if (shouldPreemptFlush(completed)) {
+    stats.flushWriteHisto.add((gethrtime() - start) / 1000);
+    if (preempted) {
         ++stats.flusherPreempts;
     } else {
         tctx.commit();
@@ -2257,6 +2943,8 @@ public:
                     if (store->getEPEngine().isDegradedMode()) {
                         LockHolder rlh(store->restore.mutex);
                         store->restore.itemsDeleted.insert(queuedItem->getKey());
+                        store->restore.numDeleted =
+                            store->restore.itemsDeleted.size();
                     }
                     bool deleted = vb->ht.unlocked_del(queuedItem->getKey(),
                                                        bucket_num);
@@ -2330,6 +3018,7 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
     }
 
     int bucket_num(0);
+    hrtime_t lockStart = gethrtime();
     LockHolder lh = vb->ht.getLockedBucket(qi->getKey(), &bucket_num);
     StoredValue *v = fetchValidValue(vb, qi->getKey(), bucket_num, true);
 
@@ -2342,14 +3031,29 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
     bool isDirty = found && v->isDirty();
     rel_time_t queued(qi->getQueuedTime()), dirtied(0);
 
-    Item itm(qi->getKey(),
-             found ? v->getFlags() : 0,
-             found ? v->getExptime() : 0,
-             found ? v->getValue() : value_t(NULL),
-             found ? v->getCas() : 0,
-             rowid,
-             qi->getVBucketId(),
-             found ? v->getSeqno() : 0);
+    // The mutation may have been captured when it was queued.  If the
+    // stored value is still that mutation, the item to persist is built
+    // from the capture after the lock is released instead of being
+    // copied out of the hash table here.
+    const QueuedItemSnapshot *snap = qi->getSnapshot();
+    bool current = snap != NULL && found && !deleted
+        && v->getSeqno() == qi->getSeqno()
+        && v->getCas() == snap->cas
+        && v->getValue().get() == snap->value.get()
+        && v->getFlags() == snap->flags
+        && v->getExptime() == snap->exptime;
+
+    uint32_t flags(0), seqno(0);
+    time_t exptime(0);
+    uint64_t cas(0);
+    value_t value;
+    if (found && !current) {
+        flags = v->getFlags();
+        exptime = v->getExptime();
+        value = v->getValue();
+        cas = v->getCas();
+        seqno = v->getSeqno();
+    }
 
     int ret = 0;
 
@@ -2400,15 +3104,13 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
         }
     }
 
+    bool doSet = false;
     if (isDirty && !deleted) {
-        if (qi->getVBucketVersion() != vbuckets.getBucketVersion(qi->getVBucketId())) {
-            lh.unlock();
-        } else {
+        if (qi->getVBucketVersion() == vbuckets.getBucketVersion(qi->getVBucketId())) {
             // If a vbucket snapshot task with the high priority is currently scheduled,
             // requeue the persistence task and wait until the snapshot task is completed.
             if (vbuckets.isHighPriorityVbSnapshotScheduled()) {
                 v->clearPendingId();
-                lh.unlock();
                 rejectQueue->push(qi);
                 ++vb->opsReject;
             } else {
@@ -2420,25 +3122,46 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
                 // TODO: An item should be marked as clean in TransactionContext::commit()
                 // to support a consistent read from disk after the item is ejected.
                 v->markClean(NULL);
-                lh.unlock();
-                BlockTimer timer(rowid == -1 ?
-                                 &stats.diskInsertHisto : &stats.diskUpdateHisto,
-                                 rowid == -1 ? "disk_insert" : "disk_update",
-                                 stats.timingLog);
-                PersistenceCallback *cb;
-                cb = new PersistenceCallback(qi, rejectQueue, this, &mutationLog,
-                                             queued, dirtied, &stats);
-                tctx.addCallback(cb);
-                rwUnderlying->set(itm, qi->getVBucketVersion(), *cb);
-                if (rowid == -1)  {
-                    ++vb->opsCreate;
-                } else {
-                    ++vb->opsUpdate;
-                }
+                doSet = true;
             }
         }
-    } else if (deleted) {
-        lh.unlock();
+    }
+
+    lh.unlock();
+    stats.flushLockHoldHisto.add(gethrtime() - lockStart);
+
+    if (!doSet && !deleted) {
+        qi->clearSnapshot();
+        return ret;
+    }
+
+    if (current) {
+        flags = snap->flags;
+        exptime = snap->exptime;
+        value = snap->value;
+        cas = snap->cas;
+        seqno = qi->getSeqno();
+    }
+    Item itm(qi->getKey(), flags, exptime, value, cas, rowid,
+             qi->getVBucketId(), seqno);
+    qi->clearSnapshot();
+
+    if (doSet) {
+        BlockTimer timer(rowid == -1 ?
+                         &stats.diskInsertHisto : &stats.diskUpdateHisto,
+                         rowid == -1 ? "disk_insert" : "disk_update",
+                         stats.timingLog);
+        PersistenceCallback *cb;
+        cb = new PersistenceCallback(qi, rejectQueue, this, &mutationLog,
+                                     queued, dirtied, &stats);
+        tctx.addCallback(cb);
+        rwUnderlying->set(itm, qi->getVBucketVersion(), *cb);
+        if (rowid == -1)  {
+            ++vb->opsCreate;
+        } else {
+            ++vb->opsUpdate;
+        }
+    } else {
         BlockTimer timer(&stats.diskDelHisto, "disk_delete", stats.timingLog);
 
         PersistenceCallback *cb;
@@ -2509,13 +3232,17 @@ void EventuallyPersistentStore::queueDirty(const std::string &key,
                                            enum queue_operation op,
                                            uint32_t seqno,
                                            int64_t rowid,
-                                           bool tapBackfill) {
+                                           bool tapBackfill,
+                                           const Item *snapshot) {
     if (doPersistence) {
         RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
         if (vb) {
             QueuedItem *qi = new QueuedItem(key, vbid, op,
                                             vbuckets.getBucketVersion(vbid),
                                             rowid, seqno);
+            if (snapshot) {
+                qi->setSnapshot(*snapshot);
+            }
 
             queued_item itm(qi);
             bool rv = tapBackfill ?
@@ -2529,7 +3256,8 @@ void EventuallyPersistentStore::queueDirty(const std::string &key,
     }
 }
 
-int EventuallyPersistentStore::restoreItem(const Item &itm, enum queue_operation op)
+int EventuallyPersistentStore::restoreItem(const Item &itm, enum queue_operation op,
+                                           std::vector<queued_item> *batch)
 {
     const std::string &key = itm.getKey();
     uint16_t vbid = itm.getVBucketId();
@@ -2540,24 +3268,44 @@ int EventuallyPersistentStore::restoreItem(const Item &itm, enum queue_operation
 
     int bucket_num(0);
     LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
-    LockHolder rlh(restore.mutex);
-    if (restore.itemsDeleted.find(key) == restore.itemsDeleted.end() &&
-        vb->ht.unlocked_restoreItem(itm, op, bucket_num)) {
-
-        lh.unlock();
-        queued_item qi(new QueuedItem(key, vbid, op, vbuckets.getBucketVersion(vbid)));
-        std::map<uint16_t, std::vector<queued_item> >::iterator it = restore.items.find(vbid);
-        if (it != restore.items.end()) {
-            it->second.push_back(qi);
-        } else {
-            std::vector<queued_item> vb_items;
-            vb_items.push_back(qi);
-            restore.items[vbid] = vb_items;
+    // Deleted keys are only recorded in degraded mode, under the
+    // bucket lock held here.
+    if (restore.numDeleted > 0) {
+        LockHolder rlh(restore.mutex);
+        if (restore.itemsDeleted.find(key) != restore.itemsDeleted.end()) {
+            return 1;
         }
-        return 0;
     }
+    if (!vb->ht.unlocked_restoreItem(itm, op, bucket_num)) {
+        return 1;
+    }
+    lh.unlock();
+
+    queued_item qi(new QueuedItem(key, vbid, op, vbuckets.getBucketVersion(vbid)));
+    if (batch != NULL) {
+        batch->push_back(qi);
+    } else {
+        LockHolder rlh(restore.mutex);
+        restore.items[vbid].push_back(qi);
+        ++restore.numItems;
+    }
+    return 0;
+}
 
-    return 1;
+void EventuallyPersistentStore::queueRestoredItems(std::vector<queued_item> &batch)
+{
+    if (batch.empty()) {
+        return;
+    }
+
+    LockHolder rlh(restore.mutex);
+    std::vector<queued_item>::iterator it = batch.begin();
+    for (; it != batch.end(); ++it) {
+        restore.items[(*it)->getVBucketId()].push_back(*it);
+    }
+    restore.numItems.incr(batch.size());
+    rlh.unlock();
+    batch.clear();
 }
 
 std::map<std::pair<uint16_t, uint16_t>, vbucket_state> EventuallyPersistentStore::loadVBucketState() {
@@ -2567,6 +3315,7 @@ std::map<std::pair<uint16_t, uint16_t>, vbucket_state> EventuallyPersistentStore
 void EventuallyPersistentStore::completeDegradedMode() {
     LockHolder lh(restore.mutex);
     restore.itemsDeleted.clear();
+    restore.numDeleted = 0;
 }
 
 void EventuallyPersistentStore::warmupCompleted() {
@@ -2740,8 +3489,10 @@ void EventuallyPersistentStore::setExpiryPagerSleeptime(size_t val) {
 
     expiryPager.sleeptime = val;
     if (val != 0) {
+        bool useIndex = engine.getConfiguration().isExpPagerUseIndex();
         shared_ptr<DispatcherCallback> exp_cb(new ExpiredItemPager(this, stats,
-                                                                   expiryPager.sleeptime));
+                                                                   expiryPager.sleeptime,
+                                                                   useIndex));
 
         getNonIODispatcher()->schedule(exp_cb, &expiryPager.task,
                                        Priority::ItemPagerPriority,
@@ -2930,6 +3681,7 @@ void TransactionContext::commit() {
     stats.commit_time.set(complete_time - cstart);
     stats.cumulativeCommitTime.incr(complete_time - cstart);
     intxn = false;
+    observeRegistry.itemsPersisted(uncommittedItems);
     uncommittedItems.clear();
     numUncommittedItems = 0;
 }
@@ -50,6 +50,10 @@ extern EXTENSION_LOGGER_DESCRIPTOR *getLogger(void);
 #include "item_pager.hh"
 #include "mutation_log.hh"
 #include "mutation_log_compactor.hh"
+#include "flush_dedup.hh"
+#include "reader_pool.hh"
+#include "hot_keys.hh"
+#include "value_cache.hh"
 
 #define MAX_BG_FETCH_DELAY 900
 
@@ -233,28 +237,49 @@ private:
 
 /**
  * Hash table visitor that builds ranges of row IDs for deleting vbuckets.
+ *
+ * The row ids are collected into a flat array that is sorted once all
+ * of them are in, which takes a fraction of the memory and time of
+ * keeping them in a tree as they arrive.
  */
 class VBucketDeletionVisitor : public HashTableVisitor {
 public:
     /**
      * Construct a VBucketDeletionVisitor that will attempt to get all the
      * row_ids for a given vbucket from memory.
+     *
+     * @param deletion_size the number of row ids in each chunk
+     * @param expected the number of row ids expected (to size the array)
      */
-    VBucketDeletionVisitor(size_t deletion_size)
-        : row_ids(new std::set<int64_t>), chunk_size(deletion_size) {}
-
-    ~VBucketDeletionVisitor() {
-        if (row_ids) {
-            delete row_ids;
-        }
+    VBucketDeletionVisitor(size_t deletion_size, size_t expected = 0)
+        : chunk_size(deletion_size) {
+        row_ids.reserve(expected);
     }
 
     void visit(StoredValue *v) {
         if(v->hasId()) {
-            row_ids->insert(v->getId());
+            addRowId(v->getId());
         }
     }
 
+    void addRowId(int64_t row_id) {
+        row_ids.push_back(row_id);
+    }
+
+    /**
+     * Reserve room for the given number of row ids.
+     */
+    void reserve(size_t n) {
+        row_ids.reserve(n);
+    }
+
+    /**
+     * The number of bytes currently held for the row ids.
+     */
+    size_t memorySize() const {
+        return row_ids.capacity() * sizeof(int64_t);
+    }
+
     /**
      * Construct the list of chunks from the row id list for a given vbucket.
      * Note that each chunk might have a different range size as each chunk is
@@ -262,34 +287,28 @@ public:
      *
      */
     void createRangeList(VBDeletionChunkRangeList& range_list) {
-        size_t counter = 0;
-        int64_t start_row_id = -1, end_row_id = -1;
-
-        std::set<int64_t>::iterator iter;
-        for (iter = row_ids->begin(); iter != row_ids->end(); ++iter) {
-            ++counter;
-            if (counter == 1) {
-                start_row_id = *iter;
-            }
-            if (counter == chunk_size || iter == --(row_ids->end())) {
-                end_row_id = *iter;
-                chunk_range_t r(start_row_id, end_row_id);
-                range_list.add(r);
-                counter = 0;
-            }
+        std::sort(row_ids.begin(), row_ids.end());
+        row_ids.erase(std::unique(row_ids.begin(), row_ids.end()),
+                      row_ids.end());
+
+        size_t num_ids = row_ids.size();
+        size_t step = chunk_size > 0 ? chunk_size : num_ids;
+        for (size_t i = 0; i < num_ids; i += step) {
+            size_t last = std::min(i + step, num_ids) - 1;
+            range_list.add(row_ids[i], row_ids[last]);
         }
 
-        delete row_ids;
-        row_ids = NULL;
+        std::vector<int64_t>().swap(row_ids);
     }
 
-    std::set<int64_t>                       *row_ids;
+    std::vector<int64_t>                     row_ids;
     size_t                                   chunk_size;
 };
 
 // Forward declaration
 class Flusher;
 class TapBGFetchCallback;
+class BGFetchBatch;
 class EventuallyPersistentStore;
 
 class PersistenceCallback;
@@ -416,6 +435,67 @@ private:
 
 class EventuallyPersistentEngine;
 
+/**
+ * A key requested through EventuallyPersistentStore::getMulti and the
+ * result of looking it up.
+ */
+class MultiGetItem {
+public:
+    MultiGetItem(const std::string &k, uint16_t vb) :
+        key(k), vbucket(vb), status(ENGINE_KEY_ENOENT), value(NULL),
+        hash(0), lock(0) { }
+
+    std::string       key;
+    uint16_t          vbucket;
+    //! The result of the lookup
+    ENGINE_ERROR_CODE status;
+    //! The item found (only set on ENGINE_SUCCESS, owned by the caller)
+    Item             *value;
+
+    // Used by the store to group the keys by hash table lock.
+    int               hash;
+    int               lock;
+};
+
+/**
+ * An item stored through EventuallyPersistentStore::setMulti and the
+ * result of storing it.
+ */
+class MultiSetItem {
+public:
+    MultiSetItem(Item *i, bool m = false) :
+        item(i), vbucket(i->getVBucketId()), meta(m), status(ENGINE_SUCCESS),
+        mtype(NOT_FOUND), rowid(-1), hash(0), lock(0) { }
+
+    Item             *item;
+    uint16_t          vbucket;
+    //! Keep the CAS and seqno of the item, as setWithMeta does
+    bool              meta;
+    //! The result of the store
+    ENGINE_ERROR_CODE status;
+
+    // Used by the store to group the items by hash table lock.
+    mutation_type_t   mtype;
+    int64_t           rowid;
+    int               hash;
+    int               lock;
+};
+
+/**
+ * A single key of a coalesced background fetch.
+ */
+class BGFetchRequest {
+public:
+    BGFetchRequest(const std::string &k, uint16_t vb, uint16_t vbv,
+                   uint64_t r) :
+        key(k), vbucket(vb), vbver(vbv), rowid(r) { }
+
+    std::string key;
+    uint16_t    vbucket;
+    uint16_t    vbver;
+    uint64_t    rowid;
+};
+
 /**
  * Manager of all interaction with the persistence.
  */
@@ -442,6 +522,41 @@ public:
                           const void *cookie,
                           bool force = false);
 
+    /**
+     * Set a batch of items in the store.
+     *
+     * The items are grouped by vbucket and hash table lock so that each
+     * vbucket is looked up once and each lock is taken once for all of
+     * the items it guards.  If any of the vbuckets can't accept
+     * mutations right now the cookie is queued for notification and
+     * none of the items are stored.
+     *
+     * @param items the items to set, the status of each is updated
+     * @param cookie the cookie representing the client
+     * @return ENGINE_EWOULDBLOCK if the whole batch has to be retried,
+     *         ENGINE_SUCCESS otherwise (see the status of each item)
+     */
+    ENGINE_ERROR_CODE setMulti(std::vector<MultiSetItem> &items,
+                               const void *cookie);
+
+    /**
+     * Apply a batch of mutations received by a TAP consumer to a
+     * single vbucket.
+     *
+     * The vbucket is looked up once, each hash table lock is taken once
+     * for all of the items it guards, and the stored items are queued
+     * under a single acquisition of the checkpoint lock.  Each item is
+     * stored as set() with force (or setWithMeta() with force if it
+     * carries metadata) would, or as addTAPBackfillItem() would if the
+     * items come from a backfill.
+     *
+     * @param vbucket the vbucket all of the items belong to
+     * @param items the items to store, the status of each is updated
+     * @param backfill true if the items come from a backfill
+     */
+    void setTapMutations(uint16_t vbucket, std::vector<MultiSetItem> &items,
+                         bool backfill);
+
     ENGINE_ERROR_CODE add(const Item &item, const void *cookie);
 
     /**
@@ -470,6 +585,23 @@ public:
                            vbucket_state_active);
     }
 
+    /**
+     * Retrieve a batch of values from active vbuckets.
+     *
+     * Works like get() for every key, but the keys are grouped by
+     * vbucket and hash table lock so that each lock is taken once, and
+     * all of the non-resident keys are loaded by a single background
+     * fetch which notifies the cookie once it's done.
+     *
+     * @param items the keys to fetch, the result of each is updated
+     * @param cookie the connection cookie
+     * @param queueBG if true, queue a background fetch for the misses
+     * @return ENGINE_EWOULDBLOCK if the cookie will be notified and the
+     *         request should be retried, ENGINE_SUCCESS otherwise
+     */
+    ENGINE_ERROR_CODE getMulti(std::vector<MultiGetItem> &items,
+                               const void *cookie, bool queueBG=true);
+
     /**
      * Retrieve a value from a vbucket in replica state.
      *
@@ -630,6 +762,28 @@ public:
         return dispatcher != roDispatcher;
     }
 
+    /**
+     * The number of threads serving background fetches from disk
+     * without holding up the read-only dispatcher (0 if none).
+     */
+    size_t getNumAsyncReaders() {
+        return readerPool ? readerPool->getNumReaders() : 0;
+    }
+
+    /**
+     * The local tier holding ejected values (NULL if there's none).
+     */
+    ValueCache *getValueCache() {
+        return valueCache;
+    }
+
+    /**
+     * The sampler finding the keys most reads go to.
+     */
+    HotKeyTracker &getHotKeyTracker() {
+        return hotKeys;
+    }
+
     /**
      * Get the current non-io dispatcher.
      *
@@ -640,6 +794,16 @@ public:
         return nonIODispatcher;
     }
 
+    /**
+     * Switch all of the dispatchers between running ready tasks by
+     * priority and sharing their time between the priority classes.
+     */
+    void setDispatcherFairShare(bool to) {
+        dispatcher->setFairShare(to);
+        roDispatcher->setFairShare(to);
+        nonIODispatcher->setFairShare(to);
+    }
+
     void stopFlusher(void);
 
     void startFlusher(void);
@@ -679,8 +843,41 @@ public:
                          const void *cookie,
                          hrtime_t init);
 
+    /**
+     * Enqueue a single background fetch for a set of keys.
+     *
+     * @param reqs the keys to be bg fetched
+     * @param cookie the cookie of the requestor
+     */
+    void bgFetchMulti(const std::vector<BGFetchRequest> &reqs,
+                      const void *cookie);
+
+    /**
+     * Complete a coalesced background fetch, notifying the requestor
+     * once all of the keys are loaded.
+     *
+     * @param reqs the keys that were fetched
+     * @param cookie the cookie of the requestor
+     * @param init the timestamp of when the request came in
+     */
+    void completeBGFetchMulti(const std::vector<BGFetchRequest> &reqs,
+                              const void *cookie,
+                              hrtime_t init);
+
     RCPtr<VBucket> getVBucket(uint16_t vbid);
 
+    /**
+     * Release the removed vbuckets front-end operations are done with.
+     */
+    void reclaimVBuckets() {
+        size_t released = vbuckets.reclaim();
+        if (released > 0) {
+            getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                             "Released %d removed vbuckets\n",
+                             static_cast<int>(released));
+        }
+    }
+
     uint16_t getVBucketVersion(uint16_t vbv) {
         return vbuckets.getBucketVersion(vbv);
     }
@@ -782,7 +979,12 @@ public:
         return invalidItemDbPager;
     }
 
-    void deleteExpiredItems(std::list<std::pair<uint16_t, std::string> > &);
+    /**
+     * Delete the given keys if they're still expired.
+     *
+     * @return the number of items that were deleted
+     */
+    size_t deleteExpiredItems(std::list<std::pair<uint16_t, std::string> > &);
 
     /**
      * Get the memoized storage properties from the DB.kv
@@ -811,9 +1013,26 @@ public:
      * and works our way back until epoch.. We should therefore only
      * add values to the backup if they're not there;
      *
+     * If a batch is given the queued item for the restored value is
+     * appended to it instead of being handed to the flusher right
+     * away, and the caller must pass the batch to queueRestoredItems.
+     *
      * @return 0 success, 1 skipped, -1 invalid vbucket
      */
-    int restoreItem(const Item &itm, enum queue_operation op);
+    int restoreItem(const Item &itm, enum queue_operation op,
+                    std::vector<queued_item> *batch = NULL);
+
+    /**
+     * Hand a batch of restored items over to the flusher and clear it.
+     */
+    void queueRestoredItems(std::vector<queued_item> &batch);
+
+    /**
+     * Get the number of restored items waiting to be persisted.
+     */
+    size_t getNumPendingRestoreItems() {
+        return restore.numItems.get();
+    }
 
     bool isFlushAllScheduled() {
         return diskFlushAll.get();
@@ -875,7 +1094,8 @@ private:
                     enum queue_operation op,
                     uint32_t seqno,
                     int64_t rowid,
-                    bool tapBackfill = false);
+                    bool tapBackfill = false,
+                    const Item *snapshot = NULL);
 
     /**
      * Retrieve a StoredValue and invoke a method on it.
@@ -924,13 +1144,19 @@ private:
     int flushOneDeleteAll(void);
     int flushOneDelOrSet(const queued_item &qi, std::queue<queued_item> *rejectQueue);
 
-    StoredValue *fetchValidValue(RCPtr<VBucket> vb, const std::string &key,
+    StoredValue *fetchValidValue(VBucket *vb, const std::string &key,
                                  int bucket_num, bool wantsDeleted=false);
 
+    StoredValue *fetchValidValue(const RCPtr<VBucket> &vb,
+                                 const std::string &key,
+                                 int bucket_num, bool wantsDeleted=false) {
+        return fetchValidValue(vb.get(), key, bucket_num, wantsDeleted);
+    }
+
     bool shouldPreemptFlush(size_t completed) {
         return (completed > 100
-                && bgFetchQueue > 0
-                && !hasSeparateRODispatcher());
+                && ((bgFetchQueue > 0 && !hasSeparateRODispatcher())
+                    || dispatcher->shouldYield()));
     }
 
     size_t getWriteQueueSize(void);
@@ -944,8 +1170,46 @@ private:
                          bool honorStates,
                          vbucket_state_t allowedState);
 
+    ENGINE_ERROR_CODE checkReadableVBucket(VBucket *vb,
+                                           const void *cookie,
+                                           bool honorStates,
+                                           vbucket_state_t allowedState);
+    ENGINE_ERROR_CODE checkReadableVBucket(RCPtr<VBucket> &vb,
+                                           const void *cookie,
+                                           bool honorStates,
+                                           vbucket_state_t allowedState) {
+        return checkReadableVBucket(vb.get(), cookie, honorStates,
+                                    allowedState);
+    }
+    ENGINE_ERROR_CODE checkWritableVBucket(VBucket *vb,
+                                           const void *cookie,
+                                           bool force);
+    ENGINE_ERROR_CODE checkWritableVBucket(RCPtr<VBucket> &vb,
+                                           const void *cookie,
+                                           bool force) {
+        return checkWritableVBucket(vb.get(), cookie, force);
+    }
+    ENGINE_ERROR_CODE completeSet(const Item &itm, mutation_type_t mtype,
+                                  int64_t row_id);
+    void setMultiInVBucket(RCPtr<VBucket> &vb, std::vector<MultiSetItem*> &order,
+                           size_t start, size_t end);
+    void getMultiItem(RCPtr<VBucket> &vb, MultiGetItem &mi, int bucket_num,
+                      std::vector<BGFetchRequest> &misses);
+    ENGINE_ERROR_CODE fetchBGItem(const std::string &key, uint16_t vbucket,
+                                  uint16_t vbver, uint64_t rowid,
+                                  hrtime_t init);
+    void fetchBGItemAsync(const std::string &key, uint16_t vbucket,
+                          uint16_t vbver, uint64_t rowid, hrtime_t init,
+                          shared_ptr<BGFetchBatch> batch);
+    ENGINE_ERROR_CODE restoreBGValue(const std::string &key, uint16_t vbucket,
+                                     GetValue &gv, hrtime_t init,
+                                     hrtime_t start);
+    bool restoreCachedValue(const std::string &key, uint16_t vbucket);
+
     friend class Flusher;
     friend class BGFetchCallback;
+    friend class MultiBGFetchCallback;
+    friend class BGFetchReadCallback;
     friend class VKeyStatBGFetchCallback;
     friend class TapBGFetchCallback;
     friend class TapConnection;
@@ -961,10 +1225,13 @@ private:
     StorageProperties          storageProperties;
     Dispatcher                *dispatcher;
     Dispatcher                *roDispatcher;
+    ReaderPool                *readerPool;
+    ValueCache                *valueCache;
     Dispatcher                *nonIODispatcher;
     Flusher                   *flusher;
     InvalidItemDbPager        *invalidItemDbPager;
     VBucketMap                 vbuckets;
+    HotKeyTracker              hotKeys;
     SyncObject                 mutex;
 
     MutationLog                mutationLog;
@@ -976,6 +1243,9 @@ private:
     // locking...
     std::queue<queued_item>    writing;
     std::vector<queued_item>  *dbShardQueues;
+    // Used by the flusher thread to drop all but the latest mutation
+    // of each key from a vbucket's dirty items.
+    FlushDedupArena            flushDedup;
     std::map<uint16_t, vbucket_state_t> flusherCachedVbStates;
     pthread_t                  thread;
     Atomic<size_t>             bgFetchQueue;
@@ -994,6 +1264,11 @@ private:
         // master via TAP or from the normal clients during online restore.
         // As an alternative to std::set, we can consider boost::unordered_set later.
         std::set<std::string> itemsDeleted;
+        // The number of entries in itemsDeleted (readable without the
+        // mutex).  Keys are only added under their hash bucket lock.
+        Atomic<size_t> numDeleted;
+        // The number of entries in items (readable without the mutex).
+        Atomic<size_t> numItems;
     } restore;
     struct ExpiryPagerDelta {
         ExpiryPagerDelta() : sleeptime(0) {}
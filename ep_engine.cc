@@ -203,6 +203,8 @@ extern "C" {
                 e->getConfiguration().setTapThrottleThreshold(v);
             } else if (strcmp(keyz, "tap_throttle_queue_cap") == 0) {
                 e->getConfiguration().setTapThrottleQueueCap(v);
+            } else if (strcmp(keyz, "tap_consumer_batch") == 0) {
+                e->getConfiguration().setTapConsumerBatch(v);
             } else {
                 *msg = "Unknown config param";
                 rv = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
@@ -340,6 +342,12 @@ extern "C" {
                 validate(vsize, static_cast<uint64_t>(0),
                          std::numeric_limits<uint64_t>::max());
                 e->getConfiguration().setExpPagerStime((size_t)vsize);
+            } else if (strcmp(keyz, "expiry_index_max_keys") == 0) {
+                char *ptr = NULL;
+                uint64_t vsize = strtoull(valz, &ptr, 10);
+                validate(vsize, static_cast<uint64_t>(0),
+                         std::numeric_limits<uint64_t>::max());
+                e->getConfiguration().setExpiryIndexMaxKeys((size_t)vsize);
             } else if (strcmp(keyz, "couchdb_response_timeout") == 0) {
                 e->getConfiguration().setCouchResponseTimeout(v);
             } else if (strcmp(keyz, "klog_max_log_size") == 0) {
@@ -851,6 +859,16 @@ extern "C" {
             return h->getMeta(cookie,
                               reinterpret_cast<protocol_binary_request_get_meta*>(request),
                               response);
+        case CMD_GET_MULTI:
+            {
+                BlockTimer timer(&stats.getMultiCmdHisto);
+                return h->getMulti(cookie, request, response);
+            }
+        case CMD_SET_MULTI:
+            {
+                BlockTimer timer(&stats.setMultiCmdHisto);
+                return h->setMulti(cookie, request, response);
+            }
         case CMD_SET_WITH_META:
         case CMD_SETQ_WITH_META:
         case CMD_ADD_WITH_META:
@@ -1071,7 +1089,8 @@ EventuallyPersistentEngine::EventuallyPersistentEngine(GET_SERVER_API get_server
     tapConnMap(NULL), tapConfig(NULL), checkpointConfig(NULL),
     memLowWat(std::numeric_limits<size_t>::max()),
     memHighWat(std::numeric_limits<size_t>::max()),
-    mutation_count(0), observeRegistry(&epstore, &stats), warmingUp(true)
+    mutation_count(0), observeRegistry(&epstore, &stats),
+    binaryStats(stats, configuration), warmingUp(true)
 {
     interface.interface = 1;
     ENGINE_HANDLE_V1::get_info = EvpGetInfo;
@@ -1103,6 +1122,7 @@ EventuallyPersistentEngine::EventuallyPersistentEngine(GET_SERVER_API get_server
     info.info.features[info.info.num_features++].feature = ENGINE_FEATURE_PERSISTENT_STORAGE;
     info.info.features[info.info.num_features++].feature = ENGINE_FEATURE_LRU;
     restore.manager = NULL;
+    statGroups.version = 0;
 }
 
 /**
@@ -1755,6 +1775,16 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::tapNotify(const void *cookie,
     std::string k(static_cast<const char*>(key), nkey);
     ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
 
+    TapConsumer *consumer = dynamic_cast<TapConsumer*>(connection);
+    if (consumer && tap_event != TAP_MUTATION) {
+        // Mutations held back go before anything else from the producer.
+        ret = consumer->applyBatch();
+        if (ret != ENGINE_SUCCESS) {
+            connection->processedEvent(tap_event, ret);
+            return ret;
+        }
+    }
+
     switch (tap_event) {
     case TAP_ACK:
         ret = processTapAck(cookie, tap_seqno, tap_flags, k);
@@ -1837,7 +1867,7 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::tapNotify(const void *cookie,
             }
 
             BlockTimer timer(&stats.tapMutationHisto);
-            TapConsumer *tc = dynamic_cast<TapConsumer*>(connection);
+            TapConsumer *tc = consumer;
             RCPtr<Blob> vblob(Blob::New(static_cast<const char*>(data), ndata));
             Item *itm = new Item(k, flags, exptime, vblob);
             itm->setVBucketId(vbucket);
@@ -1853,13 +1883,28 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::tapNotify(const void *cookie,
                     meta = true;
                 }
 
-                if (tc->isBackfillPhase(vbucket)) {
-                    ret = epstore->addTAPBackfillItem(*itm, meta);
+                bool backfill = tc->isBackfillPhase(vbucket);
+                if (tc->canBatchMutation(*itm, (tap_flags & TAP_FLAG_ACK) != 0)) {
+                    if (!tc->isBatchFor(vbucket, backfill)) {
+                        ret = tc->applyBatch();
+                    }
+                    if (ret == ENGINE_SUCCESS) {
+                        // The batch owns the item and reports it when applied.
+                        if (tc->addToBatch(itm, meta, backfill)) {
+                            ret = tc->applyBatch();
+                        }
+                        itm = NULL;
+                    }
                 } else {
-                    if (meta) {
-                        ret = epstore->setWithMeta(*itm, 0, cookie, true, true);
-                    } else {
-                        ret = epstore->set(*itm, cookie, true);
+                    ret = tc->applyBatch();
+                    if (ret == ENGINE_SUCCESS) {
+                        if (backfill) {
+                            ret = epstore->addTAPBackfillItem(*itm, meta);
+                        } else if (meta) {
+                            ret = epstore->setWithMeta(*itm, 0, cookie, true, true);
+                        } else {
+                            ret = epstore->set(*itm, cookie, true);
+                        }
                     }
                 }
             } else {
@@ -1869,7 +1914,7 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::tapNotify(const void *cookie,
                 ret = ENGINE_DISCONNECT;
             }
 
-            if (ret == ENGINE_SUCCESS) {
+            if (ret == ENGINE_SUCCESS && itm != NULL) {
                 addMutationEvent(itm);
             } else if (ret == ENGINE_ENOMEM) {
                 if (connection->supportsAck()) {
@@ -1883,9 +1928,11 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::tapNotify(const void *cookie,
                 }
             }
 
-            delete itm;
-            if (tc && !tc->supportsCheckpointSync()) {
-                tc->checkVBOpenCheckpoint(vbucket);
+            if (itm != NULL) {
+                delete itm;
+                if (tc && !tc->supportsCheckpointSync()) {
+                    tc->checkVBOpenCheckpoint(vbucket);
+                }
             }
 
             if (ret == ENGINE_DISCONNECT) {
@@ -2047,6 +2094,10 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::tapNotify(const void *cookie,
                         connection->logHeader());
     }
 
+    if (consumer && (tap_flags & TAP_FLAG_ACK)) {
+        consumer->ackRequested();
+    }
+
     connection->processedEvent(tap_event, ret);
     return ret;
 }
@@ -2372,10 +2423,16 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     cookie);
     add_casted_stat("ep_num_expiry_pager_runs", epstats.expiryPagerRuns, add_stat,
                     cookie);
+    add_casted_stat("ep_exp_pager_expired", epstats.expiryPagerExpired,
+                    add_stat, cookie);
+    add_casted_stat("ep_exp_pager_expired_rate", epstats.expiryPagerRate,
+                    add_stat, cookie);
     add_casted_stat("ep_num_checkpoint_remover_runs", epstats.checkpointRemoverRuns,
                     add_stat, cookie);
     add_casted_stat("ep_items_rm_from_checkpoints", epstats.itemsRemovedFromCheckpoints,
                     add_stat, cookie);
+    add_casted_stat("ep_chk_key_filter_skips", epstats.chkKeyFilterSkips,
+                    add_stat, cookie);
     add_casted_stat("ep_num_value_ejects", epstats.numValueEjects, add_stat,
                     cookie);
     add_casted_stat("ep_num_eject_replicas", epstats.numReplicaEjects, add_stat,
@@ -2472,6 +2529,53 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                         add_stat, cookie);
     }
 
+    if (epstore->getNumAsyncReaders() > 0) {
+        add_casted_stat("ep_async_readers", epstore->getNumAsyncReaders(),
+                        add_stat, cookie);
+        add_casted_stat("ep_bg_reads_in_flight", epstats.bgReadsInFlight,
+                        add_stat, cookie);
+        add_casted_stat("ep_bg_max_reads_in_flight",
+                        epstats.bgMaxReadsInFlight,
+                        add_stat, cookie);
+    }
+
+    ValueCache *valueCache(epstore->getValueCache());
+    if (valueCache) {
+        size_t hits(epstats.valueCacheHits), misses(epstats.valueCacheMisses);
+        add_casted_stat("ep_value_cache_hits", hits, add_stat, cookie);
+        add_casted_stat("ep_value_cache_misses", misses, add_stat, cookie);
+        add_casted_stat("ep_value_cache_hit_ratio",
+                        hits + misses > 0 ?
+                        static_cast<double>(hits) / static_cast<double>(hits + misses) : 0.0,
+                        add_stat, cookie);
+        add_casted_stat("ep_value_cache_writes", epstats.valueCacheWrites,
+                        add_stat, cookie);
+        add_casted_stat("ep_value_cache_write_failures",
+                        epstats.valueCacheWriteFailures, add_stat, cookie);
+        add_casted_stat("ep_value_cache_items", valueCache->getNumItems(),
+                        add_stat, cookie);
+        size_t fileSize(valueCache->getFileSize());
+        size_t rawSize(valueCache->getRawSize());
+        add_casted_stat("ep_value_cache_file_size", fileSize, add_stat, cookie);
+        add_casted_stat("ep_value_cache_live_size", valueCache->getLiveSize(),
+                        add_stat, cookie);
+        add_casted_stat("ep_value_cache_raw_size", rawSize, add_stat, cookie);
+        add_casted_stat("ep_value_cache_space_amp",
+                        rawSize > 0 ?
+                        static_cast<double>(fileSize) / static_cast<double>(rawSize) : 0.0,
+                        add_stat, cookie);
+        add_casted_stat("ep_value_cache_compactor_runs",
+                        epstats.valueCacheCompactorRuns, add_stat, cookie);
+    }
+
+    add_casted_stat("ep_hot_key_samples", epstats.hotKeySamples,
+                    add_stat, cookie);
+    add_casted_stat("ep_hot_key_lock_free_samples",
+                    epstats.hotKeyLockFreeSamples, add_stat, cookie);
+    add_casted_stat("ep_hot_keys",
+                    epstore->getHotKeyTracker().getNumHotKeys(),
+                    add_stat, cookie);
+
     StorageProperties sprop(epstore->getStorageProperties());
     add_casted_stat("ep_store_max_concurrency", sprop.maxConcurrency(),
                     add_stat, cookie);
@@ -2594,6 +2698,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
             add_casted_stat(buf, vb->ht.getSize(), add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:locks", vbid);
             add_casted_stat(buf, vb->ht.getNumLocks(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:lock_waits", vbid);
+            add_casted_stat(buf, vb->ht.getNumLockWaits(), add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:min_depth", vbid);
             add_casted_stat(buf, depthVisitor.min == -1 ? 0 : depthVisitor.min,
                             add_stat, cookie);
@@ -2611,6 +2717,11 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
             add_casted_stat(buf, vb->ht.memSize, add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:mem_size_counted", vbid);
             add_casted_stat(buf, depthVisitor.memUsed, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:meta_size", vbid);
+            add_casted_stat(buf, vb->ht.memorySize() + depthVisitor.metaUsed,
+                            add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:hot_items", vbid);
+            add_casted_stat(buf, vb->ht.getNumHotItems(), add_stat, cookie);
 
             return false;
         }
@@ -2671,6 +2782,17 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doCheckpointStats(const void *cook
             add_casted_stat(buf,
                             vb->checkpointManager.isCheckpointExtension() ? "true" : "false",
                             add_stat, cookie);
+            RCPtr<HashTableSnapshot> snapshot = vb->ht.getSnapshot();
+            if (snapshot) {
+                snprintf(buf, sizeof(buf), "vb_%d:snapshot_checkpoint_id", vbid);
+                add_casted_stat(buf, snapshot->getCheckpointId(), add_stat, cookie);
+                snprintf(buf, sizeof(buf), "vb_%d:snapshot_versions", vbid);
+                add_casted_stat(buf, snapshot->getNumVersions(), add_stat, cookie);
+                snprintf(buf, sizeof(buf), "vb_%d:snapshot_total_versions", vbid);
+                add_casted_stat(buf, snapshot->getTotalVersions(), add_stat, cookie);
+                snprintf(buf, sizeof(buf), "vb_%d:snapshot_bytes", vbid);
+                add_casted_stat(buf, snapshot->getMemory(), add_stat, cookie);
+            }
             std::list<std::string> tapcursor_names = vb->checkpointManager.getTAPCursorNames();
             std::list<std::string>::iterator tap_it = tapcursor_names.begin();
             for (;tap_it != tapcursor_names.end(); ++tap_it) {
@@ -2702,6 +2824,42 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doCheckpointStats(const void *cook
     return ENGINE_SUCCESS;
 }
 
+ENGINE_ERROR_CODE EventuallyPersistentEngine::doStatGroupSnapshotStats(const void *cookie,
+                                                                       ADD_STAT add_stat,
+                                                                       bool checkpoint) {
+    LockHolder lh(statGroups.mutex);
+    RCPtr<StatGroupSnapshot> snapshot(statGroups.snapshot);
+    lh.unlock();
+
+    if (!snapshot) {
+        // The first snapshot is taken right after warmup; until then
+        // the stats are computed on the spot.
+        add_casted_stat("snapshot_version", 0, add_stat, cookie);
+        if (checkpoint) {
+            return doCheckpointStats(cookie, add_stat, "checkpoint", 10);
+        }
+        return doHashStats(cookie, add_stat);
+    }
+
+    snapshot->addStats(checkpoint ? snapshot->checkpoint : snapshot->hash,
+                       add_stat, cookie);
+    return ENGINE_SUCCESS;
+}
+
+void EventuallyPersistentEngine::updateStatGroupSnapshot() {
+    LockHolder lh(statGroups.mutex);
+    uint64_t version = ++statGroups.version;
+    lh.unlock();
+
+    RCPtr<StatGroupSnapshot> snapshot(new StatGroupSnapshot(version));
+    ADD_STAT collector = StatGroupSnapshot::getCollector();
+    doHashStats(&snapshot->hash, collector);
+    doCheckpointStats(&snapshot->checkpoint, collector, "checkpoint", 10);
+
+    lh.lock();
+    statGroups.snapshot = snapshot;
+}
+
 /// @cond DETAILS
 
 /**
@@ -3048,6 +3206,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
 
     // Regular commands
     add_casted_stat("get_cmd", stats.getCmdHisto, add_stat, cookie);
+    add_casted_stat("get_multi_cmd", stats.getMultiCmdHisto, add_stat, cookie);
+    add_casted_stat("set_multi_cmd", stats.setMultiCmdHisto, add_stat, cookie);
     add_casted_stat("arith_cmd", stats.arithCmdHisto, add_stat, cookie);
     // Admin commands
     add_casted_stat("get_vb_cmd", stats.getVbucketCmdHisto, add_stat, cookie);
@@ -3071,6 +3231,18 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     add_casted_stat("disk_commit", stats.diskCommitHisto, add_stat, cookie);
     add_casted_stat("disk_invalid_item_del", stats.diskInvaidItemDelHisto,
                     add_stat, cookie);
+    add_casted_stat("disk_read", stats.diskReadHisto, add_stat, cookie);
+    add_casted_stat("disk_read_wait", stats.diskReadWaitHisto, add_stat, cookie);
+    add_casted_stat("value_cache_read", stats.valueCacheReadHisto, add_stat, cookie);
+
+    // Flusher stages (the commit stage is disk_commit above)
+    add_casted_stat("flush_collect", stats.flushCollectHisto, add_stat, cookie);
+    add_casted_stat("flush_dedup", stats.flushDedupHisto, add_stat, cookie);
+    add_casted_stat("flush_shard", stats.flushShardHisto, add_stat, cookie);
+    add_casted_stat("flush_write", stats.flushWriteHisto, add_stat, cookie);
+    add_casted_stat("flush_lock_hold", stats.flushLockHoldHisto,
+                    add_stat, cookie);
+    add_casted_stat("exp_pager_run", stats.expiryPagerHisto, add_stat, cookie);
 
     add_casted_stat("online_update_revert", stats.checkpointRevertHisto,
                     add_stat, cookie);
@@ -3114,8 +3286,9 @@ static void showJobLog(const char *prefix, const char *logname,
     }
 }
 
-static void doDispatcherStat(const char *prefix, const DispatcherState &ds,
+static void doDispatcherStat(const char *prefix, Dispatcher *d,
                              const void *cookie, ADD_STAT add_stat) {
+    DispatcherState ds(d->getDispatcherState());
     char statname[80] = {0};
     snprintf(statname, sizeof(statname), "%s:state", prefix);
     add_casted_stat(statname, ds.getStateName(), add_stat, cookie);
@@ -3136,20 +3309,32 @@ static void doDispatcherStat(const char *prefix, const DispatcherState &ds,
 
     showJobLog(prefix, "log", ds.getLog(), cookie, add_stat);
     showJobLog(prefix, "slow", ds.getSlowLog(), cookie, add_stat);
+
+    snprintf(statname, sizeof(statname), "%s:scheduler", prefix);
+    add_casted_stat(statname, d->isFairShare() ? "fair_share" : "priority",
+                    add_stat, cookie);
+    snprintf(statname, sizeof(statname), "%s:overdue", prefix);
+    add_casted_stat(statname, d->getNumOverdue(), add_stat, cookie);
+    snprintf(statname, sizeof(statname), "%s:yields", prefix);
+    add_casted_stat(statname, d->getNumYields(), add_stat, cookie);
+
+    std::vector<std::pair<std::string, const Histogram<hrtime_t>*> > histos(d->getWaitHistos());
+    std::vector<std::pair<std::string, const Histogram<hrtime_t>*> >::iterator it;
+    for (it = histos.begin(); it != histos.end(); ++it) {
+        snprintf(statname, sizeof(statname), "%s:wait:%s", prefix, it->first.c_str());
+        add_casted_stat(statname, *it->second, add_stat, cookie);
+    }
 }
 
 ENGINE_ERROR_CODE EventuallyPersistentEngine::doDispatcherStats(const void *cookie,
                                                                 ADD_STAT add_stat) {
-    DispatcherState ds(epstore->getDispatcher()->getDispatcherState());
-    doDispatcherStat("dispatcher", ds, cookie, add_stat);
+    doDispatcherStat("dispatcher", epstore->getDispatcher(), cookie, add_stat);
 
     if (epstore->hasSeparateRODispatcher()) {
-        DispatcherState rods(epstore->getRODispatcher()->getDispatcherState());
-        doDispatcherStat("ro_dispatcher", rods, cookie, add_stat);
+        doDispatcherStat("ro_dispatcher", epstore->getRODispatcher(), cookie, add_stat);
     }
 
-    DispatcherState nds(epstore->getNonIODispatcher()->getDispatcherState());
-    doDispatcherStat("nio_dispatcher", nds, cookie, add_stat);
+    doDispatcherStat("nio_dispatcher", epstore->getNonIODispatcher(), cookie, add_stat);
 
     return ENGINE_SUCCESS;
 }
@@ -3184,6 +3369,44 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doKlogStats(const void* cookie,
     return ENGINE_SUCCESS;
 }
 
+ENGINE_ERROR_CODE EventuallyPersistentEngine::doHotKeyStats(const void* cookie,
+                                                            ADD_STAT add_stat) {
+
+    class HotItemsVisitor : public VBucketVisitor {
+    public:
+        HotItemsVisitor(const void *c, ADD_STAT a) : cookie(c), add_stat(a) {}
+
+        bool visitBucket(RCPtr<VBucket> &vb) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "vb_%d:hot_items", vb->getId());
+            add_casted_stat(buf, vb->ht.getNumHotItems(), add_stat, cookie);
+            return false;
+        }
+
+        const void *cookie;
+        ADD_STAT add_stat;
+    };
+
+    // Unlike the hash stats, these are the current counts.
+    HotItemsVisitor hiv(cookie, add_stat);
+    epstore->visit(hiv);
+
+    HotKeyTracker &tracker(epstore->getHotKeyTracker());
+    std::vector<HotKey> keys;
+    tracker.getKeys(keys);
+    std::vector<HotKey>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        std::stringstream prefix;
+        prefix << "vb_" << it->vbucket << ":" << it->key << ":";
+        add_casted_stat((prefix.str() + "samples").c_str(), it->samples,
+                        add_stat, cookie);
+        add_casted_stat((prefix.str() + "hot").c_str(),
+                        it->samples >= tracker.getThreshold(),
+                        add_stat, cookie);
+    }
+    return ENGINE_SUCCESS;
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentEngine::getStats(const void* cookie,
                                                        const char* stat_key,
                                                        int nkey,
@@ -3204,21 +3427,31 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::getStats(const void* cookie,
     } else if (nkey == 3 && strncmp(stat_key, "tap", 3) == 0) {
         rv = doTapStats(cookie, add_stat);
     } else if (nkey == 4 && strncmp(stat_key, "hash", 3) == 0) {
-        rv = doHashStats(cookie, add_stat);
+        rv = doStatGroupSnapshotStats(cookie, add_stat, false);
     } else if (nkey == 7 && strncmp(stat_key, "vbucket", 7) == 0) {
         rv = doVBucketStats(cookie, add_stat, false, false);
     } else if (nkey == 15 && strncmp(stat_key, "vbucket-details", 15) == 0) {
         rv = doVBucketStats(cookie, add_stat, false, true);
     } else if (nkey == 12 && strncmp(stat_key, "prev-vbucket", 12) == 0) {
         rv = doVBucketStats(cookie, add_stat, true, false);
-    } else if (nkey >= 10 && strncmp(stat_key, "checkpoint", 10) == 0) {
+    } else if (nkey == 10 && strncmp(stat_key, "checkpoint", 10) == 0) {
+        rv = doStatGroupSnapshotStats(cookie, add_stat, true);
+    } else if (nkey > 10 && strncmp(stat_key, "checkpoint", 10) == 0) {
         rv = doCheckpointStats(cookie, add_stat, stat_key, nkey);
     } else if (nkey == 4 && strncmp(stat_key, "klog", 10) == 0) {
         rv = doKlogStats(cookie, add_stat);
+    } else if (nkey == 7 && strncmp(stat_key, "hotkeys", 7) == 0) {
+        rv = doHotKeyStats(cookie, add_stat);
     } else if (nkey == 7 && strncmp(stat_key, "timings", 7) == 0) {
         rv = doTimingStats(cookie, add_stat);
     } else if (nkey == 10 && strncmp(stat_key, "dispatcher", 10) == 0) {
         rv = doDispatcherStats(cookie, add_stat);
+    } else if (nkey == 6 && strncmp(stat_key, "binary", 6) == 0) {
+        binaryStats.addStats(add_stat, cookie);
+        rv = ENGINE_SUCCESS;
+    } else if (nkey == 13 && strncmp(stat_key, "binary-schema", 13) == 0) {
+        binaryStats.addSchema(add_stat, cookie);
+        rv = ENGINE_SUCCESS;
     } else if (nkey == 6 && strncmp(stat_key, "memory", 6) == 0) {
         rv = doMemoryStats(cookie, add_stat);
     } else if (nkey == 7 && strncmp(stat_key, "restore", 7) == 0) {
@@ -3747,6 +3980,192 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::getMeta(const void* cookie,
     return rv;
 }
 
+/**
+ * Cursor over the body of a batched request.
+ */
+class MultiRequestReader {
+public:
+    MultiRequestReader(protocol_binary_request_header *request) :
+        ptr(reinterpret_cast<const char*>(request->bytes
+                                          + sizeof(request->bytes))),
+        left(ntohl(request->request.bodylen)) { }
+
+    bool empty() const { return left == 0; }
+
+    bool read(void *dest, size_t n) {
+        if (left < n) {
+            return false;
+        }
+        memcpy(dest, ptr, n);
+        ptr += n;
+        left -= n;
+        return true;
+    }
+
+    bool skip(const char **dest, size_t n) {
+        if (left < n) {
+            return false;
+        }
+        *dest = ptr;
+        ptr += n;
+        left -= n;
+        return true;
+    }
+
+private:
+    const char *ptr;
+    size_t      left;
+};
+
+template <typename T>
+static void appendMultiResponse(std::string &out, T val) {
+    out.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+ENGINE_ERROR_CODE EventuallyPersistentEngine::getMulti(const void* cookie,
+                                                       protocol_binary_request_header *request,
+                                                       ADD_RESPONSE response)
+{
+    if (request->request.extlen != 0 || request->request.keylen != 0) {
+        return sendResponse(response, NULL, 0, NULL, 0, NULL, 0,
+                            PROTOCOL_BINARY_RAW_BYTES,
+                            PROTOCOL_BINARY_RESPONSE_EINVAL, 0, cookie);
+    }
+
+    std::vector<MultiGetItem> items;
+    MultiRequestReader reader(request);
+    while (!reader.empty()) {
+        uint16_t vbucket, nkey;
+        const char *key;
+        if (!reader.read(&vbucket, sizeof(vbucket)) ||
+            !reader.read(&nkey, sizeof(nkey)) ||
+            !reader.skip(&key, ntohs(nkey))) {
+            return sendResponse(response, NULL, 0, NULL, 0, NULL, 0,
+                                PROTOCOL_BINARY_RAW_BYTES,
+                                PROTOCOL_BINARY_RESPONSE_EINVAL, 0, cookie);
+        }
+        items.push_back(MultiGetItem(std::string(key, ntohs(nkey)),
+                                     ntohs(vbucket)));
+    }
+
+    ENGINE_ERROR_CODE rv = epstore->getMulti(items, cookie);
+
+    std::string body;
+    std::vector<MultiGetItem>::iterator it;
+    for (it = items.begin(); it != items.end(); ++it) {
+        if (rv == ENGINE_SUCCESS) {
+            ENGINE_ERROR_CODE status = it->status;
+            if (status == ENGINE_EWOULDBLOCK) {
+                // We didn't ask for a background fetch..
+                status = ENGINE_TMPFAIL;
+            }
+            appendMultiResponse(body,
+                                htons(engine_error_2_protocol_error(status)));
+            if (it->value) {
+                appendMultiResponse(body, it->value->getFlags());
+                appendMultiResponse(body, htonll(it->value->getCas()));
+                appendMultiResponse(body, htonl(it->value->getNBytes()));
+                body.append(it->value->getData(), it->value->getNBytes());
+            } else {
+                appendMultiResponse(body, static_cast<uint32_t>(0));
+                appendMultiResponse(body, static_cast<uint64_t>(0));
+                appendMultiResponse(body, static_cast<uint32_t>(0));
+            }
+        }
+        delete it->value;
+    }
+
+    if (rv != ENGINE_SUCCESS) {
+        // Every key is looked up again once we're notified.
+        return rv;
+    }
+
+    return sendResponse(response, NULL, 0, NULL, 0,
+                        body.data(), body.length(),
+                        PROTOCOL_BINARY_RAW_BYTES,
+                        PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, cookie);
+}
+
+ENGINE_ERROR_CODE EventuallyPersistentEngine::setMulti(const void* cookie,
+                                                       protocol_binary_request_header *request,
+                                                       ADD_RESPONSE response)
+{
+    if (request->request.extlen != 0 || request->request.keylen != 0) {
+        return sendResponse(response, NULL, 0, NULL, 0, NULL, 0,
+                            PROTOCOL_BINARY_RAW_BYTES,
+                            PROTOCOL_BINARY_RESPONSE_EINVAL, 0, cookie);
+    }
+
+    if (isDegradedMode() && !restore.enabled.get()) {
+        return sendResponse(response, NULL, 0, NULL, 0, NULL, 0,
+                            PROTOCOL_BINARY_RAW_BYTES,
+                            PROTOCOL_BINARY_RESPONSE_ETMPFAIL, 0, cookie);
+    }
+
+    std::vector<MultiSetItem> items;
+    MultiRequestReader reader(request);
+    protocol_binary_response_status res = PROTOCOL_BINARY_RESPONSE_SUCCESS;
+    while (!reader.empty()) {
+        uint16_t vbucket, nkey;
+        uint32_t flags, exptime, nbytes;
+        uint64_t cas;
+        const char *key, *data;
+        if (!reader.read(&vbucket, sizeof(vbucket)) ||
+            !reader.read(&nkey, sizeof(nkey)) ||
+            !reader.read(&flags, sizeof(flags)) ||
+            !reader.read(&exptime, sizeof(exptime)) ||
+            !reader.read(&cas, sizeof(cas)) ||
+            !reader.read(&nbytes, sizeof(nbytes)) ||
+            !reader.skip(&key, ntohs(nkey)) ||
+            !reader.skip(&data, ntohl(nbytes))) {
+            res = PROTOCOL_BINARY_RESPONSE_EINVAL;
+            break;
+        }
+        if (ntohl(nbytes) > maxItemSize) {
+            res = PROTOCOL_BINARY_RESPONSE_E2BIG;
+            break;
+        }
+
+        exptime = ntohl(exptime);
+        time_t expiretime = (exptime == 0) ? 0 : ep_abs_time(ep_reltime(exptime));
+        Item *itm = new Item(key, ntohs(nkey), flags, expiretime,
+                             data, ntohl(nbytes), ntohll(cas), -1,
+                             ntohs(vbucket));
+        itm->fixupJSON();
+        items.push_back(MultiSetItem(itm));
+    }
+
+    ENGINE_ERROR_CODE rv = ENGINE_SUCCESS;
+    std::string body;
+    if (res == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        rv = epstore->setMulti(items, cookie);
+    }
+
+    std::vector<MultiSetItem>::iterator it;
+    for (it = items.begin(); it != items.end(); ++it) {
+        if (res == PROTOCOL_BINARY_RESPONSE_SUCCESS && rv == ENGINE_SUCCESS) {
+            uint64_t cas = 0;
+            if (it->status == ENGINE_SUCCESS) {
+                cas = it->item->getCas();
+                addMutationEvent(it->item);
+            }
+            appendMultiResponse(body,
+                                htons(engine_error_2_protocol_error(it->status)));
+            appendMultiResponse(body, htonll(cas));
+        }
+        delete it->item;
+    }
+
+    if (rv != ENGINE_SUCCESS) {
+        // Nothing was stored, the whole batch is retried once we're notified.
+        return rv;
+    }
+
+    return sendResponse(response, NULL, 0, NULL, 0,
+                        body.data(), body.length(),
+                        PROTOCOL_BINARY_RAW_BYTES, res, 0, cookie);
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentEngine::setWithMeta(const void* cookie,
                                                     protocol_binary_request_set_with_meta *request,
                                                     ADD_RESPONSE response)
@@ -25,6 +25,8 @@
 #include "tapconnection.hh"
 #include "restore.hh"
 #include "configuration.hh"
+#include "statsnap.hh"
+#include "binary_stats.hh"
 
 #define DEFAULT_BACKFILL_RESIDENT_THRESHOLD 0.9
 #define MINIMUM_BACKFILL_RESIDENT_THRESHOLD 0.7
@@ -249,6 +251,12 @@ public:
 
     void resetStats() { stats.reset(); }
 
+    /**
+     * Recompute the "hash" and "checkpoint" stat groups and publish
+     * them for the following stat requests.
+     */
+    void updateStatGroupSnapshot();
+
     ENGINE_ERROR_CODE store(const void *cookie,
                             item* itm,
                             uint64_t *cas,
@@ -381,6 +389,12 @@ public:
     ENGINE_ERROR_CODE getMeta(const void* cookie,
                               protocol_binary_request_get_meta *request,
                               ADD_RESPONSE response);
+    ENGINE_ERROR_CODE getMulti(const void* cookie,
+                               protocol_binary_request_header *request,
+                               ADD_RESPONSE response);
+    ENGINE_ERROR_CODE setMulti(const void* cookie,
+                               protocol_binary_request_header *request,
+                               ADD_RESPONSE response);
     ENGINE_ERROR_CODE setWithMeta(const void* cookie,
                                   protocol_binary_request_set_with_meta *request,
                                   ADD_RESPONSE response);
@@ -636,6 +650,7 @@ private:
     friend class TapBGFetchCallback;
     friend class TapConnMap;
     friend class EventuallyPersistentStore;
+    friend class TapConsumer;
 
     void warmupCompleted() {
         warmingUp.set(false);
@@ -688,6 +703,7 @@ private:
                                      const char* stat_key, int nkey);
     ENGINE_ERROR_CODE doEngineStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doKlogStats(const void *cookie, ADD_STAT add_stat);
+    ENGINE_ERROR_CODE doHotKeyStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doMemoryStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doVBucketStats(const void *cookie, ADD_STAT add_stat,
                                      bool prevStateRequested,
@@ -695,6 +711,8 @@ private:
     ENGINE_ERROR_CODE doHashStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doCheckpointStats(const void *cookie, ADD_STAT add_stat,
                                         const char* stat_key, int nkey);
+    ENGINE_ERROR_CODE doStatGroupSnapshotStats(const void *cookie, ADD_STAT add_stat,
+                                               bool checkpoint);
     ENGINE_ERROR_CODE doTapStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doTapAggStats(const void *cookie, ADD_STAT add_stat,
                                     const char *sep, size_t nsep);
@@ -772,12 +790,20 @@ private:
     EPStats stats;
     ObserveRegistry observeRegistry;
     Configuration configuration;
+    BinaryStats binaryStats;
     Atomic<bool> warmingUp;
     struct {
         Mutex mutex;
         RestoreManager *manager;
         Atomic<bool> enabled;
     } restore;
+    // The mutex only protects the pointer; the snapshot itself is
+    // immutable once published.
+    struct {
+        Mutex mutex;
+        RCPtr<StatGroupSnapshot> snapshot;
+        uint64_t version;
+    } statGroups;
 };
 
 #endif
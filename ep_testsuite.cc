@@ -2734,6 +2734,56 @@ static enum test_result test_tap_rcvr_mutate_replica(ENGINE_HANDLE *h, ENGINE_HA
     return SUCCESS;
 }
 
+static enum test_result test_tap_rcvr_mutate_batched(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    check(set_vbucket_state(h, h1, 1, vbucket_state_replica), "Failed to set vbucket state.");
+    const void *cookie = testHarness.create_cookie();
+    // Mutations are only held back once the producer asked for an ack.
+    check(h1->tap_notify(h, cookie, NULL, 0, 1, TAP_FLAG_ACK, TAP_MUTATION, 1,
+                         "key", 3, 0, 0, 0, "first", 5, 1) == ENGINE_SUCCESS,
+          "Failed tap notify.");
+    for (int i = 0; i < 1000; ++i) {
+        std::stringstream ss;
+        ss << "key" << i;
+        std::string key(ss.str());
+        check(h1->tap_notify(h, cookie, NULL, 0, 1, 0, TAP_MUTATION, i + 2,
+                             key.c_str(), key.length(), 0, 0, 0,
+                             key.c_str(), key.length(), 1) == ENGINE_SUCCESS,
+              "Failed tap notify.");
+        if (i == 500) {
+            // Applies everything before it first.
+            check(h1->tap_notify(h, cookie, NULL, 0, 1, 0, TAP_DELETION, i + 2,
+                                 "key100", 6, 0, 0, 0, NULL, 0, 1) == ENGINE_SUCCESS,
+                  "Failed tap notify.");
+        }
+    }
+    // Overwrites a key held back in the same batch.
+    check(h1->tap_notify(h, cookie, NULL, 0, 1, 0, TAP_MUTATION, 1003,
+                         "key999", 6, 0, 0, 0, "last", 4, 1) == ENGINE_SUCCESS,
+          "Failed tap notify.");
+    // The ack covers everything held back.
+    check(h1->tap_notify(h, cookie, NULL, 0, 1, TAP_FLAG_ACK, TAP_MUTATION, 1004,
+                         "key", 3, 0, 0, 0, "again", 5, 1) == ENGINE_SUCCESS,
+          "Failed tap notify.");
+    testHarness.destroy_cookie(cookie);
+
+    check(set_vbucket_state(h, h1, 1, vbucket_state_active), "Failed to set vbucket state.");
+    check(check_key_value(h, h1, "key", "again", 5, 1) == SUCCESS, "Bad value.");
+    check(verify_vb_key(h, h1, "key100", 1) == ENGINE_KEY_ENOENT,
+          "Deleted key is back.");
+    check(check_key_value(h, h1, "key999", "last", 4, 1) == SUCCESS, "Bad value.");
+    for (int i = 0; i < 999; ++i) {
+        if (i == 100) {
+            continue;
+        }
+        std::stringstream ss;
+        ss << "key" << i;
+        std::string key(ss.str());
+        check(check_key_value(h, h1, key.c_str(), key.c_str(), key.length(), 1)
+              == SUCCESS, "Bad value.");
+    }
+    return SUCCESS;
+}
+
 static enum test_result test_tap_rcvr_delete(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     check(h1->tap_notify(h, NULL, NULL, 0,
                          1, 0, TAP_DELETION, 0, "key", 3, 0, 0, 0,
@@ -2824,9 +2874,9 @@ static enum test_result test_tap_agg_stats(ENGINE_HANDLE *h,
     return SUCCESS;
 }
 
-static enum test_result test_tap_stream(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
-    const int num_keys = 30;
-    bool keys[num_keys];
+static enum test_result verify_tap_stream(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                                          const int num_keys) {
+    std::vector<bool> keys(num_keys);
     int initialPersisted = get_int_stat(h, h1, "ep_total_persisted");
 
     for (int ii = 0; ii < num_keys; ++ii) {
@@ -2917,6 +2967,21 @@ static enum test_result test_tap_stream(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1)
     return SUCCESS;
 }
 
+static enum test_result test_tap_stream(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    return verify_tap_stream(h, h1, 30);
+}
+
+static enum test_result test_tap_stream_readahead(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    // Far more items than fit in the read-ahead, so the disk backfill
+    // has to pause and resume to get them all out.
+    return verify_tap_stream(h, h1, 2500);
+}
+
+static enum test_result test_tap_stream_snapshot(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    // The items come from a hash table snapshot, paced by the read-ahead.
+    return verify_tap_stream(h, h1, 2500);
+}
+
 static enum test_result test_tap_takeover(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     const int num_keys = 30;
     bool keys[num_keys];
@@ -3550,6 +3615,71 @@ static enum test_result test_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     return SUCCESS;
 }
 
+static enum test_result test_stat_group_snapshot(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    int version = get_int_stat(h, h1, "snapshot_version", "hash");
+    // Before the first snapshot the stats are computed on the spot.
+    check(vals.find("vb_0:size") != vals.end(), "Expected vb_0 in the hash stats");
+    while (version == 0) {
+        usleep(10000);
+        version = get_int_stat(h, h1, "snapshot_version", "hash");
+    }
+    check(vals.find("vb_0:size") != vals.end(), "Expected vb_0 in the hash stats");
+    check(vals.find("snapshot_age") != vals.end(), "Expected the snapshot age");
+
+    check(get_int_stat(h, h1, "snapshot_version", "checkpoint") >= version,
+          "The checkpoint stats should come from the same or a newer snapshot");
+    check(vals.find("vb_0:open_checkpoint_id") != vals.end(),
+          "Expected vb_0 in the checkpoint stats");
+
+    // Wait for the snapshot to be refreshed
+    while (get_int_stat(h, h1, "snapshot_version", "hash") == version) {
+        usleep(100000);
+    }
+    return SUCCESS;
+}
+
+static enum test_result test_binary_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    item *i = NULL;
+    check(store(h, h1, NULL, OPERATION_SET, "key", "somevalue", &i) == ENGINE_SUCCESS,
+          "Failed to store an item.");
+    h1->release(h, NULL, i);
+    wait_for_flusher_to_settle(h, h1);
+
+    vals.clear();
+    check(h1->get_stats(h, NULL, "binary-schema", 13, add_stats) == ENGINE_SUCCESS,
+          "Failed to get the binary stats schema.");
+    std::map<std::string, std::string> schema(vals);
+    size_t nslots = atoi(schema["slots"].c_str());
+    check(nslots > 0, "Expected some slots");
+    check(schema.find("ep_total_persisted") != schema.end(),
+          "Expected ep_total_persisted in the schema");
+    check(schema.find("get_cmd") != schema.end(),
+          "Expected the get_cmd histogram in the schema");
+
+    vals.clear();
+    check(h1->get_stats(h, NULL, "binary", 6, add_stats) == ENGINE_SUCCESS,
+          "Failed to get the binary stats.");
+    std::string buf = vals["binary"];
+    check(buf.size() == (nslots + 3) * sizeof(uint64_t),
+          "Unexpected size of the binary stats");
+    std::vector<uint64_t> slots(nslots + 3);
+    memcpy(&slots[0], buf.data(), buf.size());
+
+    uint64_t header = ntohll(slots[0]);
+    check((header >> 32) == 0x45504253, "Incorrect magic");
+    check((header & 0xffffffff) == strtoul(schema["schema_id"].c_str(), NULL, 10),
+          "The buffer should use the schema we got");
+    check(ntohll(slots[2]) == nslots, "Incorrect number of slots");
+
+    size_t persisted = atoi(schema["ep_total_persisted"].c_str());
+    check(ntohll(slots[3 + persisted]) == 1, "Expected one persisted item");
+    size_t sets = atoi(schema["ep_total_enqueued"].c_str());
+    check(ntohll(slots[3 + sets]) ==
+          static_cast<uint64_t>(get_int_stat(h, h1, "ep_total_enqueued")),
+          "The binary stats should match the text stats");
+    return SUCCESS;
+}
+
 static enum test_result test_mem_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     char value[2048];
     memset(value, 'b', sizeof(value));
@@ -3652,6 +3782,45 @@ static enum test_result test_bg_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     return SUCCESS;
 }
 
+static enum test_result test_async_bg_fetch(ENGINE_HANDLE *h,
+                                            ENGINE_HANDLE_V1 *h1) {
+    check(get_int_stat(h, h1, "ep_async_readers") == 4,
+          "Expected four async readers.");
+
+    std::vector<std::string> keys;
+    for (int j = 0; j < 100; ++j) {
+        std::stringstream ss;
+        ss << "key" << j;
+        keys.push_back(ss.str());
+    }
+
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        item *i;
+        check(store(h, h1, NULL, OPERATION_SET, it->c_str(), it->c_str(), &i)
+              == ENGINE_SUCCESS, "Failed to store a value");
+        h1->release(h, NULL, i);
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    h1->reset_stats(h, NULL);
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        evict_key(h, h1, it->c_str(), 0, "Ejected.");
+    }
+    int fetched = get_int_stat(h, h1, "ep_bg_fetched");
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        check_key_value(h, h1, it->c_str(), it->data(), it->size(), 0);
+    }
+
+    check(get_int_stat(h, h1, "ep_bg_fetched") == fetched + 100,
+          "Expected every key to be fetched from disk.");
+    check(get_int_stat(h, h1, "ep_bg_reads_in_flight") == 0,
+          "Expected no reads in flight.");
+    check(get_int_stat(h, h1, "ep_bg_max_reads_in_flight") >= 1,
+          "Expected the reads to go through the async readers.");
+    return SUCCESS;
+}
+
 static enum test_result test_key_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     item *i = NULL;
 
@@ -5077,6 +5246,53 @@ static enum test_result test_compact_mutation_log(ENGINE_HANDLE *h, ENGINE_HANDL
     return SUCCESS;
 }
 
+static enum test_result test_hot_key_reads(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    item *i = NULL;
+    check(store(h, h1, NULL, OPERATION_SET, "hot", "v1", &i) == ENGINE_SUCCESS,
+          "Failed to store a value");
+    h1->release(h, NULL, i);
+    check(store(h, h1, NULL, OPERATION_SET, "cold", "v", &i) == ENGINE_SUCCESS,
+          "Failed to store a value");
+    h1->release(h, NULL, i);
+
+    for (int j = 0; j < 100; ++j) {
+        check_key_value(h, h1, "hot", "v1", 2);
+    }
+    check_key_value(h, h1, "cold", "v", 1);
+    check(get_int_stat(h, h1, "ep_hot_keys") == 1, "Expected one hot key");
+    check(get_int_stat(h, h1, "vb_0:hot_items", "hotkeys") == 1,
+          "Expected the hot key to be published");
+    check(get_int_stat(h, h1, "ep_hot_key_lock_free_samples") > 0,
+          "Expected reads without the bucket lock");
+    check(get_int_stat(h, h1, "vb_0:hot:samples", "hotkeys") >= 10,
+          "Expected the hot key in the hotkeys stats");
+
+    // A new version is seen at once.
+    check(store(h, h1, NULL, OPERATION_SET, "hot", "v2", &i) == ENGINE_SUCCESS,
+          "Failed to store a value");
+    h1->release(h, NULL, i);
+    check_key_value(h, h1, "hot", "v2", 2);
+
+    // So is a lock.
+    for (int j = 0; j < 10; ++j) {
+        check_key_value(h, h1, "hot", "v2", 2);
+    }
+    protocol_binary_request_header *pkt = create_packet(CMD_GET_LOCKED, "hot", "");
+    check(h1->unknown_command(h, NULL, pkt, add_response) == ENGINE_SUCCESS,
+          "Getl Failed");
+    free(pkt);
+    check(last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS, "Expected getl to succeed");
+    item_info info;
+    check(get_value(h, h1, "hot", &info), "Failed to get the locked key");
+    check(info.cas == static_cast<uint64_t>(-1), "Expected the key to read as locked");
+
+    // And a deletion.
+    check(h1->remove(h, NULL, "cold", 4, 0, 0) == ENGINE_SUCCESS,
+          "Failed to remove a key");
+    check(verify_key(h, h1, "cold") == ENGINE_KEY_ENOENT, "Expected a miss");
+    return SUCCESS;
+}
+
 static enum test_result prepare(engine_test_t *test) {
     if (test->cfg == NULL || // No config
         strstr(test->cfg, "backend") == NULL || // No backend specified
@@ -5328,9 +5544,16 @@ engine_test_t* get_tests(void) {
                  cleanup, BACKEND_ALL),
         TestCase("bg stats", test_bg_stats, NULL, teardown, NULL, prepare,
                  cleanup, BACKEND_ALL),
+        TestCase("async bg fetch", test_async_bg_fetch, NULL, teardown,
+                 "async_readers=4", prepare, cleanup, BACKEND_ALL),
         TestCase("mem stats", test_mem_stats, NULL, teardown,
                  "chk_remover_stime=1;chk_period=60", prepare, cleanup,
                  BACKEND_ALL),
+        TestCase("stats hash and checkpoint snapshot", test_stat_group_snapshot,
+                 NULL, teardown, "stat_snapshot_stime=1", prepare, cleanup,
+                 BACKEND_ALL),
+        TestCase("binary stats", test_binary_stats, NULL, teardown, NULL,
+                 prepare, cleanup, BACKEND_ALL),
         TestCase("stats key", test_key_stats, NULL, teardown, NULL, prepare,
                  cleanup, BACKEND_ALL),
         TestCase("stats vkey", test_vkey_stats, NULL, teardown, NULL,
@@ -5366,6 +5589,10 @@ engine_test_t* get_tests(void) {
         TestCase("tap receiver mutation (replica)",
                  test_tap_rcvr_mutate_replica,
                  NULL, teardown, NULL, prepare, cleanup, BACKEND_ALL),
+        TestCase("tap receiver mutation (batched)",
+                 test_tap_rcvr_mutate_batched,
+                 NULL, teardown, "tap_consumer_batch=64", prepare, cleanup,
+                 BACKEND_ALL),
         TestCase("tap receiver delete", test_tap_rcvr_delete, NULL, teardown,
                  NULL, prepare, cleanup, BACKEND_ALL),
         TestCase("tap receiver delete (dead)", test_tap_rcvr_delete_dead,
@@ -5376,6 +5603,12 @@ engine_test_t* get_tests(void) {
                  NULL, teardown, NULL, prepare, cleanup, BACKEND_ALL),
         TestCase("tap stream", test_tap_stream, NULL, teardown, NULL,
                  prepare, cleanup, BACKEND_ALL),
+        TestCase("tap stream (small backfill readahead)", test_tap_stream_readahead,
+                 NULL, teardown, "tap_backfill_readahead=1024",
+                 prepare, cleanup, BACKEND_ALL),
+        TestCase("tap stream (snapshot backfill)", test_tap_stream_snapshot,
+                 NULL, teardown, "tap_backfill_snapshot=true;tap_backfill_readahead=1024",
+                 prepare, cleanup, BACKEND_ALL),
         TestCase("tap agg stats", test_tap_agg_stats, NULL, teardown, NULL,
                  prepare, cleanup, BACKEND_ALL),
         TestCase("tap takeover (with concurrent mutations)", test_tap_takeover, NULL, teardown, NULL,
@@ -5610,6 +5843,10 @@ engine_test_t* get_tests(void) {
                  "klog_max_entry_ratio=2;klog_compactor_stime=5",
                  prepare, cleanup, BACKEND_ALL),
 
+        TestCase("hot key reads", test_hot_key_reads, NULL, teardown,
+                 "hot_key_sample_rate=1;hot_key_threshold=10",
+                 prepare, cleanup, BACKEND_ALL),
+
         TestCase(NULL, NULL, NULL, NULL, NULL, prepare, cleanup, BACKEND_ALL)
     };
 
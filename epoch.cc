@@ -0,0 +1,75 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <limits>
+
+#include "epoch.hh"
+#include "locks.hh"
+
+EpochManager::EpochManager() : globalEpoch(1), slots(NULL) {
+}
+
+EpochManager::~EpochManager() {
+    std::list<std::pair<uint64_t, Retired*> >::iterator it;
+    for (it = retired.begin(); it != retired.end(); ++it) {
+        delete it->second;
+    }
+    while (slots != NULL) {
+        EpochSlot *next = slots->next;
+        delete slots;
+        slots = next;
+    }
+}
+
+EpochSlot *EpochManager::registerThread() {
+    EpochSlot *s = new EpochSlot;
+    LockHolder lh(mutex);
+    s->next = slots;
+    slots = s;
+    slot.set(s);
+    return s;
+}
+
+uint64_t EpochManager::oldestReader() {
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    for (EpochSlot *s = slots; s != NULL; s = s->next) {
+        uint64_t e = s->epoch.get();
+        if (e != 0 && e < oldest) {
+            oldest = e;
+        }
+    }
+    return oldest;
+}
+
+void EpochManager::retire(Retired *r) {
+    LockHolder lh(mutex);
+    // Readers that entered before this point may have seen the object,
+    // and they all entered in this epoch or an older one.
+    retired.push_back(std::make_pair(globalEpoch.get(), r));
+}
+
+size_t EpochManager::reclaim() {
+    std::list<Retired*> dead;
+    LockHolder lh(mutex);
+    // Readers entering from now on can't see anything retired so far.
+    ++globalEpoch;
+    uint64_t oldest = oldestReader();
+    std::list<std::pair<uint64_t, Retired*> >::iterator it = retired.begin();
+    while (it != retired.end() && it->first < oldest) {
+        dead.push_back(it->second);
+        it = retired.erase(it);
+    }
+    lh.unlock();
+
+    // Objects may drop the last reference to something big.
+    std::list<Retired*>::iterator dit;
+    for (dit = dead.begin(); dit != dead.end(); ++dit) {
+        delete *dit;
+    }
+    return dead.size();
+}
+
+size_t EpochManager::getNumRetired() {
+    LockHolder lh(mutex);
+    return retired.size();
+}
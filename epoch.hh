@@ -0,0 +1,145 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef EPOCH_HH
+#define EPOCH_HH 1
+
+#include <list>
+#include <utility>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "mutex.hh"
+
+/**
+ * Something that was unlinked from a shared structure and waits for
+ * the readers that may still see it to move on.
+ */
+class Retired {
+public:
+    virtual ~Retired() {}
+};
+
+/**
+ * Keeps a reference to an object alive until it's reclaimed.
+ */
+template <typename T>
+class RetiredRCPtr : public Retired {
+public:
+    RetiredRCPtr(const RCPtr<T> &p) : ptr(p) {}
+
+private:
+    RCPtr<T> ptr;
+};
+
+/**
+ * The epoch a thread is reading in, padded so readers don't write to
+ * a cache line another reader writes to.
+ */
+struct EpochSlot {
+    EpochSlot() : epoch(0), depth(0), next(NULL) {}
+
+    //! The epoch the thread entered, 0 while it isn't reading.
+    Atomic<uint64_t> epoch;
+    char             pad[64 - sizeof(Atomic<uint64_t>)];
+    //! How many guards the thread holds; only touched by the thread.
+    int              depth;
+    EpochSlot       *next;
+};
+
+/**
+ * Epoch based reclamation for objects readers reach through plain
+ * pointers.
+ *
+ * A reader announces the epoch it's reading in for the duration of an
+ * operation (see EpochGuard) and may use whatever it loads until it
+ * leaves.  A writer that unlinks an object retires it instead of
+ * dropping it; the object is destroyed by a later reclaim() once every
+ * thread still reading entered after it was retired.
+ */
+class EpochManager {
+public:
+
+    EpochManager();
+
+    /**
+     * Destroys everything retired; nobody may be reading any more.
+     */
+    ~EpochManager();
+
+    /**
+     * Start reading in the current epoch.  Guards may be nested.
+     */
+    void enter() {
+        EpochSlot *s = slot.get();
+        if (s == NULL) {
+            s = registerThread();
+        }
+        if (s->depth++ == 0) {
+            // set() is followed by a full barrier, so the epoch is
+            // visible before the reader loads any pointer.
+            s->epoch.set(globalEpoch.get());
+        }
+    }
+
+    /**
+     * Stop reading.
+     */
+    void leave() {
+        EpochSlot *s = slot.get();
+        assert(s && s->depth > 0);
+        if (--s->depth == 0) {
+            s->epoch.set(0);
+        }
+    }
+
+    /**
+     * Destroy the given object once no reader can still see it.  The
+     * object must already be unreachable for new readers.
+     */
+    void retire(Retired *r);
+
+    /**
+     * Destroy the retired objects no reader can see any more.
+     *
+     * @return the number of objects destroyed
+     */
+    size_t reclaim();
+
+    /**
+     * The number of retired objects waiting to be destroyed.
+     */
+    size_t getNumRetired();
+
+private:
+
+    EpochSlot *registerThread();
+    uint64_t oldestReader();
+
+    Atomic<uint64_t>                         globalEpoch;
+    ThreadLocal<EpochSlot*>                  slot;
+    Mutex                                    mutex;
+    EpochSlot                               *slots;
+    std::list<std::pair<uint64_t, Retired*> > retired;
+
+    DISALLOW_COPY_AND_ASSIGN(EpochManager);
+};
+
+/**
+ * Reads in the current epoch for as long as it exists.
+ */
+class EpochGuard {
+public:
+    EpochGuard(EpochManager &m) : manager(m) {
+        manager.enter();
+    }
+
+    ~EpochGuard() {
+        manager.leave();
+    }
+
+private:
+    EpochManager &manager;
+
+    DISALLOW_COPY_AND_ASSIGN(EpochGuard);
+};
+
+#endif /* EPOCH_HH */
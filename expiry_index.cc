@@ -0,0 +1,208 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "expiry_index.hh"
+
+const size_t ExpiryIndex::DEFAULT_SLOTS(256);
+
+ExpiryIndex::ExpiryIndex(time_t start, Atomic<size_t> &entries,
+                         const Atomic<size_t> &maxE, size_t slots)
+    : wheel(slots), numSlots(slots), numEntries(entries), maxEntries(maxE),
+      cursor(start), inWheel(0), inOverflow(0), numDropped(0) {
+    assert(numSlots > 0);
+}
+
+ExpiryIndex::~ExpiryIndex() {
+    numEntries.decr(inWheel + inOverflow);
+}
+
+int ExpiryIndex::update(const std::string &key, time_t oldExptime,
+                        time_t exptime) {
+    if (oldExptime == exptime) {
+        return 0;
+    }
+    LockHolder lh(mutex);
+    return unlocked_update(key, oldExptime, exptime);
+}
+
+ssize_t ExpiryIndex::apply(const std::vector<ExpiryChange> &changes) {
+    ssize_t rv(0);
+    LockHolder lh(mutex);
+    std::vector<ExpiryChange>::const_iterator it;
+    for (it = changes.begin(); it != changes.end(); ++it) {
+        if (it->oldExptime != it->exptime) {
+            int change = unlocked_update(it->key, it->oldExptime, it->exptime);
+            rv += change * static_cast<ssize_t>(entrySize(it->key));
+        }
+    }
+    return rv;
+}
+
+int ExpiryIndex::unlocked_update(const std::string &key, time_t oldExptime,
+                                 time_t exptime) {
+    int rv(0);
+    if (oldExptime != 0 && erase(key, oldExptime)) {
+        --rv;
+        numEntries.decr(1);
+    }
+    if (exptime != 0) {
+        if (numEntries.get() >= maxEntries.get()) {
+            ++numDropped;
+        } else if (place(key, exptime)) {
+            ++rv;
+            ++numEntries;
+        }
+    }
+    return rv;
+}
+
+bool ExpiryIndex::place(const std::string &key, time_t exptime) {
+    if (exptime < cursor) {
+        // The wheel is already past it.
+        if (!due.insert(std::make_pair(key, exptime)).second) {
+            return false;
+        }
+        ++inWheel;
+    } else if (exptime < cursor + static_cast<time_t>(numSlots)) {
+        slot_t &slot(wheel[exptime % numSlots]);
+        if (!slot.insert(std::make_pair(key, exptime)).second) {
+            return false;
+        }
+        ++inWheel;
+    } else {
+        slot_t &slot(overflow[spanOf(exptime)]);
+        if (!slot.insert(std::make_pair(key, exptime)).second) {
+            return false;
+        }
+        ++inOverflow;
+    }
+    return true;
+}
+
+bool ExpiryIndex::erase(const std::string &key, time_t exptime) {
+    // Wherever the entry was placed, the wheel can't have moved it
+    // anywhere but the slot of its time or the due slot.
+    slot_t::iterator it;
+    if (exptime < cursor) {
+        it = due.find(key);
+        if (it != due.end() && it->second == exptime) {
+            due.erase(it);
+            --inWheel;
+            return true;
+        }
+        return false;
+    }
+
+    slot_t &slot(wheel[exptime % numSlots]);
+    it = slot.find(key);
+    if (it != slot.end() && it->second == exptime) {
+        slot.erase(it);
+        --inWheel;
+        return true;
+    }
+
+    std::map<time_t, slot_t>::iterator oit = overflow.find(spanOf(exptime));
+    if (oit != overflow.end()) {
+        it = oit->second.find(key);
+        if (it != oit->second.end() && it->second == exptime) {
+            oit->second.erase(it);
+            --inOverflow;
+            if (oit->second.empty()) {
+                overflow.erase(oit);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void ExpiryIndex::cascade() {
+    while (!overflow.empty() && overflow.begin()->first <= cursor) {
+        slot_t &entries = overflow.begin()->second;
+        inOverflow -= entries.size();
+        slot_t::iterator it;
+        for (it = entries.begin(); it != entries.end(); ++it) {
+            place(it->first, it->second);
+        }
+        overflow.erase(overflow.begin());
+    }
+}
+
+bool ExpiryIndex::popExpired(time_t now, std::vector<std::string> &out,
+                             size_t limit, size_t &memory) {
+    LockHolder lh(mutex);
+    size_t popped(0);
+    popSlot(due, out, popped, memory);
+    while (cursor < now) {
+        if (popped >= limit) {
+            return false;
+        }
+        if (inWheel == 0) {
+            // Nothing to pop until the next overflow span comes due.
+            time_t next = now;
+            if (!overflow.empty()) {
+                next = std::min(now, overflow.begin()->first);
+            }
+            if (next > cursor) {
+                cursor = next;
+                cascade();
+                continue;
+            }
+        }
+
+        popSlot(wheel[cursor % numSlots], out, popped, memory);
+        ++cursor;
+        cascade();
+    }
+    return true;
+}
+
+void ExpiryIndex::popSlot(slot_t &slot, std::vector<std::string> &out,
+                          size_t &popped, size_t &memory) {
+    slot_t::iterator it;
+    for (it = slot.begin(); it != slot.end(); ++it) {
+        memory += entrySize(it->first);
+        out.push_back(it->first);
+    }
+    popped += slot.size();
+    inWheel -= slot.size();
+    numEntries.decr(slot.size());
+    slot.clear();
+}
+
+size_t ExpiryIndex::clear() {
+    LockHolder lh(mutex);
+    size_t memory(0);
+    std::vector<std::string> ignored;
+    size_t popped(0);
+    popSlot(due, ignored, popped, memory);
+    std::vector<slot_t>::iterator wit;
+    for (wit = wheel.begin(); wit != wheel.end(); ++wit) {
+        slot_t::iterator it;
+        for (it = wit->begin(); it != wit->end(); ++it) {
+            memory += entrySize(it->first);
+        }
+        wit->clear();
+    }
+    std::map<time_t, slot_t>::iterator oit;
+    for (oit = overflow.begin(); oit != overflow.end(); ++oit) {
+        slot_t::iterator it;
+        for (it = oit->second.begin(); it != oit->second.end(); ++it) {
+            memory += entrySize(it->first);
+        }
+    }
+    overflow.clear();
+    numEntries.decr(inWheel + inOverflow);
+    inWheel = 0;
+    inOverflow = 0;
+    numDropped = 0;
+    return memory;
+}
+
+size_t ExpiryIndex::size() {
+    LockHolder lh(mutex);
+    return inWheel + inOverflow;
+}
@@ -0,0 +1,194 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef EXPIRY_INDEX_HH
+#define EXPIRY_INDEX_HH 1
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "mutex.hh"
+#include "locks.hh"
+
+/**
+ * A change to the expiry time of a key, waiting to be applied to an
+ * expiry index.
+ */
+struct ExpiryChange {
+    ExpiryChange(const std::string &k, time_t o, time_t e)
+        : key(k), oldExptime(o), exptime(e) {}
+
+    /**
+     * The number of bytes accounted for a change to the given key.
+     */
+    static size_t size(const std::string &k) {
+        return sizeof(ExpiryChange) + k.size();
+    }
+
+    std::string key;
+    time_t      oldExptime;
+    time_t      exptime;
+};
+
+/**
+ * Index of the keys of a hash table by the time they expire.
+ *
+ * Keys that expire within the next "slots" seconds live in a wheel of
+ * one second slots.  Keys further out are kept in coarse buckets of
+ * "slots" seconds each and are spread into the wheel when the wheel
+ * reaches them.  Popping the expired keys only touches the slots that
+ * came due since the last pop.  Keys added with a time the wheel has
+ * already passed are kept aside and handed out by the next pop.
+ *
+ * A key has at most one entry: the caller passes the expiry time a key
+ * had before so its entry can be found and replaced, and removes it
+ * when the key goes away.  Entries are still hints, as the key may
+ * have changed between the pop and the caller locking it, so whoever
+ * pops a key must check the stored value before expiring it.
+ *
+ * The indexes of a bucket share a budget of entries.  Keys that don't
+ * fit are counted as dropped, and the caller has to find them some
+ * other way.
+ */
+class ExpiryIndex {
+public:
+
+    /**
+     * Create an expiry index.
+     *
+     * @param start the time the wheel starts at
+     * @param numEntries the entries of every index sharing the budget
+     * @param maxEntries the most entries those indexes may hold
+     * @param slots the number of one second slots in the wheel
+     */
+    ExpiryIndex(time_t start, Atomic<size_t> &numEntries,
+                const Atomic<size_t> &maxEntries,
+                size_t slots = DEFAULT_SLOTS);
+
+    ~ExpiryIndex();
+
+    /**
+     * Remember that the given key expires at the given time.
+     *
+     * @return true if a new entry was added
+     */
+    bool add(const std::string &key, time_t exptime) {
+        return update(key, 0, exptime) > 0;
+    }
+
+    /**
+     * Forget the entry of a key.
+     *
+     * @param key the key
+     * @param exptime the expiry time the key was indexed with
+     * @return true if an entry was removed
+     */
+    bool remove(const std::string &key, time_t exptime) {
+        return update(key, exptime, 0) < 0;
+    }
+
+    /**
+     * Move a key to a new expiry time.
+     *
+     * @param key the key
+     * @param oldExptime the expiry time the key was indexed with (0 if
+     *        it had none)
+     * @param exptime the new expiry time (0 if it has none)
+     * @return the change in the number of entries (-1, 0 or 1)
+     */
+    int update(const std::string &key, time_t oldExptime, time_t exptime);
+
+    /**
+     * Apply a batch of changes in order.
+     *
+     * @param changes the changes to apply
+     * @return the change in the number of bytes used by the entries
+     */
+    ssize_t apply(const std::vector<ExpiryChange> &changes);
+
+    /**
+     * Remove the keys that expire before the given time.
+     *
+     * Whole slots are popped until at least limit keys were found, so
+     * more than limit keys may be returned.
+     *
+     * @param now keys with an expiry time before this are popped
+     * @param out where to append the keys
+     * @param limit stop once this many keys were popped
+     * @param memory incremented by the number of bytes released
+     * @return true if every expired key was popped
+     */
+    bool popExpired(time_t now, std::vector<std::string> &out,
+                    size_t limit, size_t &memory);
+
+    /**
+     * Drop all entries.
+     *
+     * @return the number of bytes released
+     */
+    size_t clear();
+
+    /**
+     * The number of entries in the index.
+     */
+    size_t size();
+
+    /**
+     * The number of keys that weren't indexed because the index was
+     * full, since it was created or last cleared.
+     */
+    size_t getNumDropped() {
+        LockHolder lh(mutex);
+        return numDropped;
+    }
+
+    /**
+     * The number of bytes used by the wheel itself.
+     */
+    size_t memorySize() const {
+        return sizeof(ExpiryIndex) + numSlots * sizeof(slot_t);
+    }
+
+    /**
+     * The number of bytes accounted for an entry with the given key.
+     */
+    static size_t entrySize(const std::string &key) {
+        return sizeof(slot_t::value_type) + key.size();
+    }
+
+    static const size_t DEFAULT_SLOTS;
+
+private:
+
+    //! The keys of a slot and the time each of them expires.
+    typedef std::map<std::string, time_t> slot_t;
+
+    int unlocked_update(const std::string &key, time_t oldExptime,
+                        time_t exptime);
+    bool place(const std::string &key, time_t exptime);
+    bool erase(const std::string &key, time_t exptime);
+    void cascade();
+    void popSlot(slot_t &slot, std::vector<std::string> &out,
+                 size_t &popped, size_t &memory);
+
+    time_t spanOf(time_t t) const {
+        return t - (t % numSlots);
+    }
+
+    Mutex                    mutex;
+    std::vector<slot_t>      wheel;
+    slot_t                   due;
+    std::map<time_t, slot_t> overflow;
+    size_t                   numSlots;
+    Atomic<size_t>          &numEntries;
+    const Atomic<size_t>    &maxEntries;
+    time_t                   cursor;
+    size_t                   inWheel;
+    size_t                   inOverflow;
+    size_t                   numDropped;
+
+    DISALLOW_COPY_AND_ASSIGN(ExpiryIndex);
+};
+
+#endif /* EXPIRY_INDEX_HH */
@@ -0,0 +1,115 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef FLUSH_DEDUP_HH
+#define FLUSH_DEDUP_HH 1
+
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "common.hh"
+#include "queueditem.hh"
+
+/**
+ * Open addressed hash set of queued items keyed by their keys.
+ *
+ * The flusher uses this to keep only the first mutation it sees for
+ * each key of a vbucket.  The slots are kept from one use to the next
+ * and only the ones that were filled get cleared, so deduplicating a
+ * vbucket doesn't allocate anything once the arena has grown to the
+ * size of the largest batch.
+ */
+class FlushDedupArena {
+public:
+
+    FlushDedupArena() : mask(0) { }
+
+    /**
+     * Get ready to deduplicate up to the given number of items.
+     */
+    void reset(size_t n) {
+        assert(filled.empty());
+        size_t want = 16;
+        while (want < n * 2) {
+            want <<= 1;
+        }
+        if (slots.size() < want) {
+            slots.clear();
+            slots.resize(want);
+            mask = want - 1;
+        }
+        filled.reserve(n);
+    }
+
+    /**
+     * Add an item unless an item with the same key was already added.
+     *
+     * @return true if the item was added
+     */
+    bool insert(const queued_item &qi) {
+        const std::string &key = qi->getKey();
+        size_t h = hash(key);
+        size_t idx = h & mask;
+        while (slots[idx].item.get() != NULL) {
+            if (slots[idx].hash == h && slots[idx].item->getKey() == key) {
+                return false;
+            }
+            idx = (idx + 1) & mask;
+        }
+        slots[idx].hash = h;
+        slots[idx].item = qi;
+        filled.push_back(idx);
+        return true;
+    }
+
+    /**
+     * Move all of the added items (in the order they were added) to
+     * the given vector and empty the arena.
+     */
+    void drain(std::vector<queued_item> &out) {
+        out.reserve(out.size() + filled.size());
+        std::vector<size_t>::iterator it;
+        for (it = filled.begin(); it != filled.end(); ++it) {
+            out.push_back(slots[*it].item);
+            slots[*it].item.reset();
+        }
+        filled.clear();
+    }
+
+    /**
+     * The number of items currently added.
+     */
+    size_t size() const {
+        return filled.size();
+    }
+
+    /**
+     * The number of slots currently allocated.
+     */
+    size_t capacity() const {
+        return slots.size();
+    }
+
+private:
+
+    static size_t hash(const std::string &key) {
+        size_t h = 5381;
+        for (size_t i = 0; i < key.length(); ++i) {
+            h = ((h << 5) + h) ^ static_cast<unsigned char>(key[i]);
+        }
+        return h;
+    }
+
+    struct Slot {
+        Slot() : hash(0) { }
+        size_t      hash;
+        queued_item item;
+    };
+
+    std::vector<Slot>   slots;
+    std::vector<size_t> filled;
+    size_t              mask;
+
+    DISALLOW_COPY_AND_ASSIGN(FlushDedupArena);
+};
+
+#endif /* FLUSH_DEDUP_HH */
@@ -0,0 +1,170 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <algorithm>
+
+#include "hot_keys.hh"
+#include "locks.hh"
+
+extern "C" {
+    static void releaseReadCount(void *arg);
+}
+
+static ThreadLocal<size_t*> readCount(releaseReadCount);
+
+static void releaseReadCount(void *arg) {
+    delete static_cast<size_t*>(arg);
+}
+
+EpochManager &HotItems::getEpochManager() {
+    static EpochManager epochs;
+    return epochs;
+}
+
+Item *HotItems::get(const std::string &key, uint16_t vbucket) {
+    if (numItems == 0) {
+        return NULL;
+    }
+
+    EpochGuard eg(getEpochManager());
+    for (size_t i = 0; i < NUM_SLOTS; ++i) {
+        HotItem *item = slots[i].get();
+        if (item && item->key == key) {
+            if (item->isExpired(ep_real_time())) {
+                // The locked path deletes it.
+                return NULL;
+            }
+            return item->toItem(vbucket);
+        }
+    }
+    return NULL;
+}
+
+void HotItems::replace_UNLOCKED(size_t slot, HotItem *item) {
+    // swap() is a full barrier, so the item is complete before
+    // readers can find it.
+    HotItem *old = slots[slot].swap(item);
+    if (old) {
+        --numItems;
+        getEpochManager().retire(old);
+    }
+    if (item) {
+        ++numItems;
+    }
+}
+
+void HotItems::publish(HotItem *item) {
+    LockHolder lh(mutex);
+    size_t slot = NUM_SLOTS;
+    for (size_t i = 0; i < NUM_SLOTS; ++i) {
+        HotItem *current = slots[i].get();
+        if (current && current->key == item->key) {
+            slot = i;
+            break;
+        } else if (!current && slot == NUM_SLOTS) {
+            slot = i;
+        }
+    }
+    if (slot == NUM_SLOTS) {
+        slot = next;
+        next = (next + 1) % NUM_SLOTS;
+    }
+    replace_UNLOCKED(slot, item);
+    lh.unlock();
+    getEpochManager().reclaim();
+}
+
+void HotItems::unpublishKey(const std::string &key) {
+    LockHolder lh(mutex);
+    bool found(false);
+    for (size_t i = 0; i < NUM_SLOTS; ++i) {
+        HotItem *current = slots[i].get();
+        if (current && current->key == key) {
+            replace_UNLOCKED(i, NULL);
+            found = true;
+        }
+    }
+    lh.unlock();
+    if (found) {
+        getEpochManager().reclaim();
+    }
+}
+
+void HotItems::clear() {
+    LockHolder lh(mutex);
+    for (size_t i = 0; i < NUM_SLOTS; ++i) {
+        replace_UNLOCKED(i, NULL);
+    }
+    lh.unlock();
+    getEpochManager().reclaim();
+}
+
+bool HotKeyTracker::shouldSample() const {
+    if (sampleRate == 0) {
+        return false;
+    }
+    size_t *count = readCount.get();
+    if (count == NULL) {
+        count = new size_t(0);
+        readCount.set(count);
+    }
+    return ++*count % sampleRate == 0;
+}
+
+bool HotKeyTracker::sample(uint16_t vbucket, const std::string &key) {
+    LockHolder lh(mutex);
+    if (++samplesInWindow >= WINDOW) {
+        samplesInWindow = 0;
+        candidates_t::iterator it = candidates.begin();
+        while (it != candidates.end()) {
+            it->second /= 2;
+            if (it->second == 0) {
+                candidates.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    std::pair<uint16_t, std::string> k(vbucket, key);
+    candidates_t::iterator it = candidates.find(k);
+    if (it != candidates.end()) {
+        return ++it->second >= threshold;
+    }
+
+    size_t samples = 1;
+    if (candidates.size() >= MAX_CANDIDATES) {
+        candidates_t::iterator least = candidates.begin();
+        for (it = candidates.begin(); it != candidates.end(); ++it) {
+            if (it->second < least->second) {
+                least = it;
+            }
+        }
+        samples += least->second;
+        candidates.erase(least);
+    }
+    candidates[k] = samples;
+    return samples >= threshold;
+}
+
+void HotKeyTracker::getKeys(std::vector<HotKey> &keys) {
+    LockHolder lh(mutex);
+    candidates_t::iterator it;
+    for (it = candidates.begin(); it != candidates.end(); ++it) {
+        keys.push_back(HotKey(it->first.first, it->first.second, it->second));
+    }
+    lh.unlock();
+    std::sort(keys.begin(), keys.end());
+}
+
+size_t HotKeyTracker::getNumHotKeys() {
+    LockHolder lh(mutex);
+    size_t rv(0);
+    candidates_t::iterator it;
+    for (it = candidates.begin(); it != candidates.end(); ++it) {
+        if (it->second >= threshold) {
+            ++rv;
+        }
+    }
+    return rv;
+}
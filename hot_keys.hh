@@ -0,0 +1,208 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef HOT_KEYS_HH
+#define HOT_KEYS_HH 1
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "epoch.hh"
+#include "item.hh"
+#include "mutex.hh"
+
+/**
+ * A resident item as it was when it was published for lock free
+ * reads.  It's never changed afterwards; a newer version is a new
+ * HotItem.
+ */
+class HotItem : public Retired {
+public:
+    HotItem(const std::string &k, uint32_t fl, time_t exp, uint64_t c,
+            int64_t i, uint32_t sno, const value_t &v) :
+        key(k), flags(fl), exptime(exp), cas(c), id(i), seqno(sno), value(v) {}
+
+    /**
+     * Get a copy of the item to hand out.  The value is shared.
+     */
+    Item *toItem(uint16_t vbucket) const {
+        return new Item(key, flags, exptime, value, cas, id, vbucket, seqno);
+    }
+
+    bool isExpired(time_t asOf) const {
+        return exptime != 0 && exptime < asOf;
+    }
+
+    const std::string key;
+    const uint32_t    flags;
+    const time_t      exptime;
+    const uint64_t    cas;
+    const int64_t     id;
+    const uint32_t    seqno;
+    const value_t     value;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(HotItem);
+};
+
+/**
+ * The hot items of a hash table, readable without any lock.
+ *
+ * Readers look the items up in a handful of slots while in an epoch
+ * (see EpochManager), so they never take the bucket lock nor write
+ * to the stored value.  Writers replace a slot's item and retire the
+ * old one, which is destroyed once nobody can be reading it.
+ *
+ * The hash table publishes an item while holding its bucket lock and
+ * unpublishes it (under the same lock) before the stored value
+ * changes, so a published item is always the current version.
+ */
+class HotItems {
+public:
+
+    //! The most items published in a table at once.
+    static const size_t NUM_SLOTS = 4;
+
+    HotItems() : numItems(0), next(0) {}
+
+    ~HotItems() {
+        clear();
+    }
+
+    /**
+     * Get a copy of a published item.
+     *
+     * @param key the key to look for
+     * @param vbucket the vbucket the copy is for
+     * @return the item, or NULL if it isn't published (or expired)
+     */
+    Item *get(const std::string &key, uint16_t vbucket);
+
+    /**
+     * Publish an item, replacing the one with the same key or else
+     * the one published the longest ago.
+     */
+    void publish(HotItem *item);
+
+    /**
+     * Stop handing out a key.
+     */
+    void unpublish(const std::string &key) {
+        if (numItems > 0) {
+            unpublishKey(key);
+        }
+    }
+
+    /**
+     * Stop handing out anything.
+     */
+    void clear();
+
+    size_t getNumItems() const {
+        return numItems;
+    }
+
+    /**
+     * The epochs the readers of every table read in.
+     */
+    static EpochManager &getEpochManager();
+
+private:
+
+    void unpublishKey(const std::string &key);
+    void replace_UNLOCKED(size_t slot, HotItem *item);
+
+    AtomicPtr<HotItem> slots[NUM_SLOTS];
+    Atomic<size_t>     numItems;
+    //! The slot to replace when they're all taken.
+    size_t             next;
+    //! Serializes the writers.
+    Mutex              mutex;
+
+    DISALLOW_COPY_AND_ASSIGN(HotItems);
+};
+
+/**
+ * A key the tracker counts samples of.
+ */
+struct HotKey {
+    HotKey(uint16_t vb, const std::string &k, size_t s) :
+        vbucket(vb), key(k), samples(s) {}
+
+    bool operator <(const HotKey &other) const {
+        return samples > other.samples;
+    }
+
+    uint16_t    vbucket;
+    std::string key;
+    size_t      samples;
+};
+
+/**
+ * Finds the keys most reads go to from a sample of the reads.
+ *
+ * Every thread samples one out of sampleRate of its reads without
+ * touching anything shared.  The sampled keys are counted with the
+ * space saving algorithm: at most MAX_CANDIDATES keys are counted,
+ * and a key not counted yet takes the place of the least sampled one
+ * with its count plus one.  The counts are halved every WINDOW
+ * samples, so keys that cool down drop out.  A key is hot while it
+ * has at least threshold samples.
+ */
+class HotKeyTracker {
+public:
+
+    //! The most keys counted at once.
+    static const size_t MAX_CANDIDATES = 64;
+    //! The number of samples after which the counts are halved.
+    static const size_t WINDOW = 1024;
+
+    /**
+     * @param rate sample one out of this many reads (0 samples none)
+     * @param thresh the samples that make a key hot
+     */
+    HotKeyTracker(size_t rate, size_t thresh) :
+        sampleRate(rate), threshold(thresh), samplesInWindow(0) {}
+
+    /**
+     * Whether the calling thread samples the read it's doing.
+     */
+    bool shouldSample() const;
+
+    /**
+     * Count a sampled read.
+     *
+     * @return true if the key is hot
+     */
+    bool sample(uint16_t vbucket, const std::string &key);
+
+    /**
+     * Get the keys being counted, the most sampled first.
+     */
+    void getKeys(std::vector<HotKey> &keys);
+
+    /**
+     * The number of keys that are hot.
+     */
+    size_t getNumHotKeys();
+
+    size_t getSampleRate() const { return sampleRate; }
+
+    size_t getThreshold() const { return threshold; }
+
+private:
+
+    typedef std::map<std::pair<uint16_t, std::string>, size_t> candidates_t;
+
+    const size_t sampleRate;
+    const size_t threshold;
+    Mutex        mutex;
+    candidates_t candidates;
+    size_t       samplesInWindow;
+
+    DISALLOW_COPY_AND_ASSIGN(HotKeyTracker);
+};
+
+#endif /* HOT_KEYS_HH */
@@ -0,0 +1,201 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef HT_SNAPSHOT_HH
+#define HT_SNAPSHOT_HH 1
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "item.hh"
+#include "locks.hh"
+#include "mutex.hh"
+
+/**
+ * The state of a key in a hash table snapshot.
+ */
+class SnapshotValue {
+public:
+
+    SnapshotValue(const std::string &k)
+        : key(k), flags(0), exptime(0), cas(0), id(-1), seqno(0),
+          resident(false), present(false) { }
+
+    /**
+     * The number of bytes accounted for keeping this version around.
+     */
+    size_t size() const {
+        return sizeof(SnapshotValue) + key.size()
+            + (value.get() ? value->length() : 0);
+    }
+
+    std::string key;
+    value_t     value;
+    uint32_t    flags;
+    time_t      exptime;
+    uint64_t    cas;
+    int64_t     id;
+    uint32_t    seqno;
+    //! false if the value was ejected and has to be read from disk
+    bool        resident;
+    //! false if the key didn't exist when the snapshot was taken
+    bool        present;
+};
+
+/**
+ * A point in time image of a hash table that's copied out bucket by
+ * bucket while the table keeps taking writes.
+ *
+ * The scan walks the buckets in order.  Until the scan gets to a
+ * bucket, the first write to each key in it saves the state the key
+ * had when the snapshot was taken (copy on write), and the scan uses
+ * the saved state instead of the live one.  Buckets the scan already
+ * copied are never saved again, so the number of versions retained is
+ * bounded by the number of keys written ahead of the scan.
+ *
+ * The hash table drives all of this under its bucket locks; see
+ * HashTable::beginSnapshot.
+ */
+class HashTableSnapshot : public RCValue {
+public:
+
+    HashTableSnapshot(uint64_t chkId)
+        : checkpointId(chkId), nextBucket(0), numVersions(0),
+          totalVersions(0), memory(0), valid(true) { }
+
+    /**
+     * The id of the open checkpoint when the snapshot was taken.
+     */
+    uint64_t getCheckpointId() const {
+        return checkpointId;
+    }
+
+    /**
+     * The first bucket the scan hasn't copied yet.
+     */
+    int getNextBucket() const {
+        return nextBucket.get();
+    }
+
+    /**
+     * True if the scan already copied the given bucket.  The caller
+     * must hold the lock for the bucket.
+     */
+    bool isScanned(int bucket_num) const {
+        return bucket_num < nextBucket.get();
+    }
+
+    /**
+     * Save the state of a key before its first change since the
+     * snapshot was taken.  The caller must hold the lock for the
+     * bucket.
+     *
+     * @return the number of bytes retained
+     */
+    size_t preserve(int bucket_num, const SnapshotValue &sv) {
+        LockHolder lh(mutex);
+        std::vector<SnapshotValue> &versions = preserved[bucket_num];
+        std::vector<SnapshotValue>::iterator it;
+        for (it = versions.begin(); it != versions.end(); ++it) {
+            if (it->key == sv.key) {
+                // Only the first change of a key matters.
+                return 0;
+            }
+        }
+        versions.push_back(sv);
+        ++numVersions;
+        ++totalVersions;
+        memory += sv.size();
+        return sv.size();
+    }
+
+    /**
+     * Hand out the saved states of the given bucket and mark it as
+     * copied.  The caller must hold the lock for the bucket.
+     *
+     * @return the number of bytes released
+     */
+    size_t takeBucket(int bucket_num, std::vector<SnapshotValue> &out) {
+        LockHolder lh(mutex);
+        nextBucket.set(bucket_num + 1);
+        std::map<int, std::vector<SnapshotValue> >::iterator it;
+        it = preserved.find(bucket_num);
+        if (it == preserved.end()) {
+            return 0;
+        }
+        size_t released(0);
+        std::vector<SnapshotValue>::iterator vit;
+        for (vit = it->second.begin(); vit != it->second.end(); ++vit) {
+            released += vit->size();
+        }
+        out.swap(it->second);
+        preserved.erase(it);
+        numVersions -= out.size();
+        memory -= released;
+        return released;
+    }
+
+    /**
+     * Drop every saved state and mark the snapshot as unusable.
+     *
+     * @return the number of bytes released
+     */
+    size_t invalidate() {
+        LockHolder lh(mutex);
+        size_t released(memory);
+        preserved.clear();
+        numVersions = 0;
+        memory = 0;
+        valid = false;
+        return released;
+    }
+
+    /**
+     * False if the hash table was cleared under the snapshot.
+     */
+    bool isValid() {
+        LockHolder lh(mutex);
+        return valid;
+    }
+
+    /**
+     * The number of saved versions currently retained.
+     */
+    size_t getNumVersions() {
+        LockHolder lh(mutex);
+        return numVersions;
+    }
+
+    /**
+     * The number of versions saved since the snapshot was taken.
+     */
+    size_t getTotalVersions() {
+        LockHolder lh(mutex);
+        return totalVersions;
+    }
+
+    /**
+     * The number of bytes currently retained by saved versions.
+     */
+    size_t getMemory() {
+        LockHolder lh(mutex);
+        return memory;
+    }
+
+private:
+
+    const uint64_t checkpointId;
+    Atomic<int>    nextBucket;
+
+    Mutex                                       mutex;
+    std::map<int, std::vector<SnapshotValue> > preserved;
+    size_t                                      numVersions;
+    size_t                                      totalVersions;
+    size_t                                      memory;
+    bool                                        valid;
+
+    DISALLOW_COPY_AND_ASSIGN(HashTableSnapshot);
+};
+
+#endif /* HT_SNAPSHOT_HH */
@@ -10,6 +10,9 @@ static const double FREQUENCY(60.0);
 
 /**
  * Look at all the hash tables and make sure they're sized appropriately.
+ *
+ * Tables of dead or empty vbuckets are compacted, and the others get
+ * as many locks as their threads need.
  */
 class ResizingVisitor : public VBucketVisitor {
 public:
@@ -17,7 +20,12 @@ public:
     ResizingVisitor() { }
 
     bool visitBucket(RCPtr<VBucket> &vb) {
-        vb->ht.resize();
+        if (vb->getState() == vbucket_state_dead || vb->ht.getNumItems() == 0) {
+            vb->ht.compact();
+        } else {
+            vb->ht.resize();
+            vb->ht.adjustLocks();
+        }
         return false;
     }
 
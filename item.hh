@@ -11,6 +11,7 @@
 #include "mutex.hh"
 #include "locks.hh"
 #include "atomic.hh"
+#include "cas_generator.hh"
 #include "objectregistry.hh"
 #include "stats.hh"
 
@@ -226,6 +227,15 @@ public:
         cas = nextCas();
     }
 
+    /**
+     * Give the item a new CAS larger than the given one.
+     *
+     * @param observed the CAS of the version this item replaces
+     */
+    void setCasAfter(uint64_t observed) {
+        cas = nextCas(observed);
+    }
+
     void setCas(uint64_t ncas) {
         cas = ncas;
     }
@@ -386,20 +396,10 @@ private:
     uint32_t seqno;
     uint16_t vbucketId;
 
-    static uint64_t nextCas(void) {
-        uint64_t ret = gethrtime();
-        if ((ret & 1000) == 0) {
-            // we don't have a good enough resolution on the clock
-            ret |= casCounter++;
-            if (casCounter > 1000) {
-                casCounter = 1;
-            }
-        }
-
-        return ret;
+    static uint64_t nextCas(uint64_t observed = 0) {
+        return CasGenerator::next(observed);
     }
 
-    static Atomic<uint64_t> casCounter;
     static const uint32_t metaDataSize;
     DISALLOW_COPY_AND_ASSIGN(Item);
 };
@@ -12,6 +12,20 @@
 
 static const double EJECTION_RATIO_THRESHOLD(0.1);
 static const size_t MAX_PERSISTENCE_QUEUE_SIZE = 1000000;
+static const size_t EXPIRY_INDEX_BATCH_SIZE = 10000;
+
+/**
+ * A value ejected by the pager, on its way to the value cache.
+ */
+struct EjectedValue {
+    EjectedValue(uint16_t vb, const std::string &k, uint64_t c,
+                 const value_t &v) : vbucket(vb), key(k), cas(c), value(v) {}
+
+    uint16_t    vbucket;
+    std::string key;
+    uint64_t    cas;
+    value_t     value;
+};
 
 /**
  * As part of the ItemPager, visit all of the objects in memory and
@@ -34,7 +48,9 @@ public:
                   bool *sfin, bool pause = false)
         : store(s), stats(st), percent(pcnt), ejected(0),
           totalEjected(0), totalEjectionAttempts(0),
-          startTime(ep_real_time()), stateFinalizer(sfin), canPause(pause) {}
+          startTime(ep_real_time()), started(gethrtime()),
+          stateFinalizer(sfin), canPause(pause),
+          valueCache(s->getValueCache()) {}
 
     void visit(StoredValue *v) {
         // Remember expired objects -- we're going to delete them.
@@ -53,11 +69,24 @@ public:
             // Check if the key exists in the open or closed referenced checkpoints.
             bool foundInCheckpoints =
                 currentBucket->checkpointManager.isKeyResidentInCheckpoints(v->getKey());
-            if (!foundInCheckpoints && v->ejectValue(stats, currentBucket->ht)) {
+            if (foundInCheckpoints) {
+                return;
+            }
+            value_t value(v->getValue());
+            if (v->ejectValue(stats, currentBucket->ht)) {
                 if (currentBucket->getState() == vbucket_state_replica) {
                     ++stats.numReplicaEjects;
                 }
                 ++ejected;
+                // Written to the value cache once the bucket lock is
+                // released, as the value is compressed on the way.
+                // Only active vbuckets are served from it.
+                if (valueCache &&
+                    currentBucket->getState() == vbucket_state_active) {
+                    ejectedValues.push_back(EjectedValue(currentBucket->getId(),
+                                                         v->getKey(),
+                                                         v->getCas(), value));
+                }
             }
         }
     }
@@ -68,8 +97,17 @@ public:
     }
 
     void update() {
-        stats.expired.incr(expired.size());
-        store->deleteExpiredItems(expired);
+        std::list<EjectedValue>::iterator it;
+        for (it = ejectedValues.begin(); it != ejectedValues.end(); ++it) {
+            valueCache->put(it->vbucket, it->key, it->cas, it->value);
+        }
+        ejectedValues.clear();
+
+        size_t num_deleted = store->deleteExpiredItems(expired);
+        stats.expired.incr(num_deleted);
+        if (percent < 0) {
+            stats.expiryPagerExpired.incr(num_deleted);
+        }
 
         if (numEjected() > 0) {
             getLogger()->log(EXTENSION_LOG_INFO, NULL,
@@ -94,6 +132,10 @@ public:
 
     void complete() {
         update();
+        if (percent < 0) {
+            // Only purging expired items, so time it as an expiry pager run.
+            stats.expiryPagerHisto.add((gethrtime() - started) / 1000);
+        }
         if (stateFinalizer) {
             *stateFinalizer = true;
         }
@@ -117,6 +159,7 @@ public:
 
 private:
     std::list<std::pair<uint16_t, std::string> > expired;
+    std::list<EjectedValue> ejectedValues;
 
     EventuallyPersistentStore *store;
     EPStats                   &stats;
@@ -125,8 +168,10 @@ private:
     size_t                     totalEjected;
     size_t                     totalEjectionAttempts;
     time_t                     startTime;
+    hrtime_t                   started;
     bool                      *stateFinalizer;
     bool                       canPause;
+    ValueCache                *valueCache;
 };
 
 bool ItemPager::callback(Dispatcher &d, TaskId t) {
@@ -177,6 +222,24 @@ bool ItemPager::callback(Dispatcher &d, TaskId t) {
 }
 
 bool ExpiredItemPager::callback(Dispatcher &d, TaskId t) {
+    updateRate();
+    if (useIndex) {
+        size_t queueSize = stats.queue_size.get() + stats.flusher_todo.get();
+        if (queueSize >= MAX_PERSISTENCE_QUEUE_SIZE) {
+            // Let the flusher catch up before queueing more deletions.
+            d.snooze(t, 10);
+            return true;
+        } else if (!purgeFromIndex()) {
+            d.snooze(t, 0);
+            return true;
+        } else if (!indexDropped) {
+            d.snooze(t, sleepTime);
+            return true;
+        }
+        // Some keys didn't fit in the index, so they have to be
+        // found the old way too.
+    }
+
     if (available) {
         ++stats.expiryPagerRuns;
 
@@ -190,6 +253,72 @@ bool ExpiredItemPager::callback(Dispatcher &d, TaskId t) {
     return true;
 }
 
+bool ExpiredItemPager::purgeFromIndex() {
+    ++stats.expiryPagerRuns;
+    hrtime_t start = gethrtime();
+    time_t now = ep_real_time();
+    bool complete = true;
+    size_t num_deleted = 0;
+    indexDropped = false;
+
+    const VBucketMap &vbuckets = store->getVBuckets();
+    size_t num_vbuckets = vbuckets.getSize();
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < num_vbuckets; ++i) {
+        assert(i <= std::numeric_limits<uint16_t>::max());
+        uint16_t vbid = static_cast<uint16_t>(i);
+        RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
+        if (!vb) {
+            continue;
+        }
+
+        if (vb->ht.getExpiryIndexDropped() > 0) {
+            indexDropped = true;
+        }
+        keys.clear();
+        if (!vb->ht.popExpired(now, keys, EXPIRY_INDEX_BATCH_SIZE)) {
+            complete = false;
+        }
+        if (keys.empty()) {
+            continue;
+        }
+
+        std::list<std::pair<uint16_t, std::string> > expired;
+        std::vector<std::string>::iterator it;
+        for (it = keys.begin(); it != keys.end(); ++it) {
+            expired.push_back(std::make_pair(vbid, *it));
+        }
+        num_deleted += store->deleteExpiredItems(expired);
+    }
+
+    stats.expired.incr(num_deleted);
+    stats.expiryPagerExpired.incr(num_deleted);
+    stats.expiryPagerHisto.add((gethrtime() - start) / 1000);
+
+    if (num_deleted > 0) {
+        getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                         "Purged %d expired items\n", num_deleted);
+    }
+    return complete;
+}
+
+void ExpiredItemPager::updateRate() {
+    hrtime_t now = gethrtime();
+    hrtime_t elapsed = (now - lastRun) / 1000000;
+    if (elapsed < 1000) {
+        // Don't bother with the continuation runs of a busy pager.
+        return;
+    }
+    size_t expired = stats.expiryPagerExpired.get();
+    if (expired < lastExpired) {
+        // The stats were reset.
+        lastExpired = 0;
+    }
+    stats.expiryPagerRate.set((expired - lastExpired) * 1000 / elapsed);
+    lastRun = now;
+    lastExpired = expired;
+}
+
 void InvalidItemDbPager::addInvalidItem(Item *itm, uint16_t vbucket_version) {
     uint16_t vbucket_id = itm->getVBucketId();
     std::map<uint16_t, uint16_t>::iterator version_it = vb_versions.find(vbucket_id);
@@ -54,21 +54,33 @@ public:
      * @param s the store (where we'll visit)
      * @param st the stats
      * @param stime number of seconds to wait between runs
+     * @param index true to use the expiry index of each vbucket
+     *        instead of visiting every item
      */
     ExpiredItemPager(EventuallyPersistentStore *s, EPStats &st,
-                     size_t stime) :
+                     size_t stime, bool index = true) :
         store(s), stats(st), sleepTime(static_cast<double>(stime)),
-        available(true) {}
+        available(true), useIndex(index), indexDropped(false),
+        lastRun(gethrtime()),
+        lastExpired(st.expiryPagerExpired.get()) {}
 
     bool callback(Dispatcher &d, TaskId t);
 
     std::string description() { return std::string("Paging expired items."); }
 
 private:
+    bool purgeFromIndex();
+    void updateRate();
+
     EventuallyPersistentStore *store;
     EPStats                   &stats;
     double                     sleepTime;
     bool                       available;
+    bool                       useIndex;
+    //! Whether any expiry index was too full to hold every key.
+    bool                       indexDropped;
+    hrtime_t                   lastRun;
+    size_t                     lastExpired;
 };
 
 /**
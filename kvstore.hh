@@ -42,6 +42,26 @@ struct vbucket_state {
  */
 typedef std::map<std::pair<uint16_t, uint16_t>, vbucket_state> vbucket_map_t;
 
+/**
+ * Where a paused dump of a vbucket picks up again.
+ *
+ * Stores fill in whichever of the fields fit the order they keep the
+ * items of a vbucket in.
+ */
+class DumpPosition {
+public:
+    DumpPosition() : part(0), rowid(-1), done(false) { }
+
+    //! The table (or other part of the vbucket) being read.
+    size_t      part;
+    //! The row id of the last item read from that part.
+    int64_t     rowid;
+    //! The last key read, for stores that keep items ordered by key.
+    std::string key;
+    //! True once every item of the vbucket was read.
+    bool        done;
+};
+
 /**
  * Properites of the storage layer.
  *
@@ -212,6 +232,30 @@ public:
      */
     virtual void dump(uint16_t vbid, shared_ptr<Callback<GetValue> > cb) = 0;
 
+    /**
+     * Pass up to limit items of the given vbucket, starting where the
+     * last call with the same position left off, through the given
+     * callback.
+     *
+     * Stores that can't stop in the middle of a vbucket pass all of
+     * the items through on the first call.
+     *
+     * @param vbid the vbucket to dump
+     * @param pos where to start; updated to where to start next time
+     * @param limit the maximum number of items to pass through
+     * @param cb the callback to fire for each item
+     * @return true once every item of the vbucket was passed through
+     */
+    virtual bool dumpFrom(uint16_t vbid, DumpPosition &pos, size_t limit,
+                          shared_ptr<Callback<GetValue> > cb) {
+        (void)limit;
+        if (!pos.done) {
+            dump(vbid, cb);
+            pos.done = true;
+        }
+        return true;
+    }
+
     /**
      * Check if the kv-store supports a dumping all of the keys
      * @return true you may call dumpKeys() to do a prefetch
@@ -221,6 +265,15 @@ public:
         return false;
     }
 
+    /**
+     * Check if the kv-store wants the items of each vbucket handed to
+     * it sorted by key.  Other stores get them in no particular order
+     * and sort them in optimizeWrites().
+     */
+    virtual bool isKeyOrderedWrites() {
+        return false;
+    }
+
     /**
      * Dump the keys from a given set of vbuckets
      * @param vbids the vbuckets to dump
@@ -180,6 +180,45 @@ void LevelDBKVStore::dump(uint16_t, shared_ptr<Callback<GetValue> >) {
     abort();
 }
 
+bool LevelDBKVStore::dumpFrom(uint16_t vb, DumpPosition &pos, size_t limit,
+                              shared_ptr<Callback<GetValue> > cb) {
+    if (pos.done) {
+        return true;
+    }
+
+    const char *prefix(reinterpret_cast<const char*>(&vb));
+    std::string start(prefix, sizeof(vb));
+    start.append(pos.key);
+    leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
+    it->Seek(start);
+    if (!pos.key.empty() && it->Valid() && it->key() == leveldb::Slice(start)) {
+        // Already passed through by the last call.
+        it->Next();
+    }
+
+    size_t n(0);
+    for (; n < limit && it->Valid() && matches_prefix(it->key(), sizeof(vb), prefix);
+         it->Next(), ++n) {
+        uint16_t vbid;
+        uint32_t flags, exp;
+        size_t sz;
+        const char *p;
+        grokKeySlice(it->key(), &vbid, &pos.key);
+        grokValSlice(it->value(), &flags, &exp, &sz, &p);
+
+        GetValue rv(new Item(pos.key, flags, exp, p, sz,
+                             0, // CAS
+                             -1, // rowid
+                             vbid),
+                    ENGINE_SUCCESS, -1, 0);
+        cb->callback(rv);
+    }
+    pos.done = n < limit;
+    assert(it->status().ok());
+    delete it;
+    return pos.done;
+}
+
 StorageProperties LevelDBKVStore::getStorageProperties() {
     size_t concurrency(1);
     StorageProperties rv(concurrency, concurrency - 1, 1, true, true);
@@ -125,6 +125,12 @@ public:
 
     void dump(uint16_t vb, shared_ptr<Callback<GetValue> > cb);
 
+    /**
+     * Overrides dumpFrom
+     */
+    bool dumpFrom(uint16_t vb, DumpPosition &pos, size_t limit,
+                  shared_ptr<Callback<GetValue> > cb);
+
     void destroyInvalidVBuckets(bool);
 
     size_t getNumShards() {
@@ -138,6 +144,10 @@ public:
     void optimizeWrites(std::vector<queued_item> &) {
     }
 
+    bool isKeyOrderedWrites() {
+        return true;
+    }
+
 private:
 
     EPStats &stats;
@@ -26,6 +26,39 @@ public:
         lock();
     }
 
+    /**
+     * Acquire the lock in the given mutex, or only try to.
+     *
+     * @param m the mutex to lock
+     * @param tryOnly if true, give up if somebody holds the lock
+     *                already (see isLocked())
+     */
+    LockHolder(Mutex &m, bool tryOnly) : mutex(m), locked(false) {
+        if (tryOnly) {
+            locked = mutex.tryAcquire();
+        } else {
+            lock();
+        }
+    }
+
+    /**
+     * Acquire the lock in the given mutex, measuring how long it took
+     * if somebody else was holding it.
+     *
+     * @param m the mutex to lock
+     * @param waited set to the time spent waiting (0 if the lock was free)
+     */
+    LockHolder(Mutex &m, hrtime_t &waited) : mutex(m), locked(false) {
+        if (mutex.tryAcquire()) {
+            waited = 0;
+            locked = true;
+        } else {
+            hrtime_t start(gethrtime());
+            lock();
+            waited = gethrtime() - start;
+        }
+    }
+
     /**
      * Copy constructor hands this lock to the new copy and then
      * consider it released locally (i.e. renders unlock() a noop).
@@ -59,6 +92,13 @@ public:
         }
     }
 
+    /**
+     * True if this holder holds its lock.
+     */
+    bool isLocked() const {
+        return locked;
+    }
+
 private:
     Mutex &mutex;
     bool locked;
@@ -85,6 +125,25 @@ public:
         lock();
     }
 
+    /**
+     * Acquire a series of locks, or only try to.
+     *
+     * @param m beginning of an array of locks
+     * @param n the number of locks to lock
+     * @param tryOnly if true, take none of the locks if any of them is
+     *                held already (see isLocked())
+     */
+    MultiLockHolder(Mutex *m, size_t n, bool tryOnly) : mutexes(m),
+                                                        locked(new bool[n]),
+                                                        n_locks(n) {
+        std::fill_n(locked, n_locks, false);
+        if (tryOnly) {
+            tryLock();
+        } else {
+            lock();
+        }
+    }
+
     ~MultiLockHolder() {
         unlock();
         delete[] locked;
@@ -101,6 +160,30 @@ public:
         }
     }
 
+    /**
+     * Lock the whole series if none of it is held by anybody.
+     *
+     * @return true if every lock was acquired
+     */
+    bool tryLock() {
+        for (size_t i = 0; i < n_locks; i++) {
+            assert(!locked[i]);
+            if (!mutexes[i].tryAcquire()) {
+                unlock();
+                return false;
+            }
+            locked[i] = true;
+        }
+        return true;
+    }
+
+    /**
+     * True if this holder holds all of its locks.
+     */
+    bool isLocked() const {
+        return n_locks == 0 || locked[n_locks - 1];
+    }
+
     /**
      * Manually unlock the series.
      */
@@ -2,10 +2,21 @@
 
 #include "config.h"
 
+#include <pthread.h>
+#include <signal.h>
+
 #include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
 #include <utility>
-#include <cstdlib>
+#include <vector>
 
 #ifdef HAVE_SYSEXITS_H
 #include <sysexits.h>
@@ -18,6 +29,10 @@
 #include <kvstore.hh>
 #include <item.hh>
 #include <callbacks.hh>
+#include <queueditem.hh>
+#include "atomic.hh"
+#include "locks.hh"
+#include "syncobject.hh"
 #include "sqlite-kvstore/sqlite-strategies.hh"
 #include "sqlite-kvstore/sqlite-kvstore.hh"
 
@@ -38,6 +53,8 @@
 
 using namespace std;
 
+static const size_t nVBuckets(1024);
+
 static KVStore *getStore(EPStats &st,
                          const char *path,
                          const char *strategyName,
@@ -50,7 +67,6 @@ static KVStore *getStore(EPStats &st,
         exit(EX_USAGE);
     }
 
-    size_t nVBuckets(1024);
     size_t dbShards(4);
     SqliteStrategy *sqliteInstance = NULL;
 
@@ -98,58 +114,267 @@ public:
     }
 };
 
-class Mover : public Callback<GetValue> {
+static volatile sig_atomic_t interrupted(0);
+
+extern "C" {
+    static void stopConversion(int sig) {
+        (void)sig;
+        interrupted = 1;
+    }
+
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+}
+
+/**
+ * Tracks which vbuckets are completely in the destination, and keeps
+ * the checkpoint file listing them up to date.
+ *
+ * A vbucket is complete once its reader passed all of its items on
+ * and every writer committed the ones it was handed.
+ */
+class Progress {
 public:
 
-    Mover(KVStore *d, size_t re, bool kc, size_t ts) : dest(d),
-                                                       transferred(0),
-                                                       txnSize(ts),
-                                                       reportEvery(re),
-                                                       killCrlf(kc),
-                                                       inTxn(false) {
-        assert(dest);
-        assert(txnSize != 0);
-        assert(reportEvery != 0);
+    Progress(const char *cp) : checkpointFile(cp), pending(nVBuckets, 0),
+                               read(nVBuckets, false),
+                               done(nVBuckets, false),
+                               numDone(0), doneAtStart(0), transferred(0) {
+    }
 
-        if (!enterTransaction()) {
-           cout << "Failed to start a transaction" << endl;
-           abort();
+    /**
+     * Read the vbuckets completed by an earlier run.
+     *
+     * @return true if there was a checkpoint to resume from
+     */
+    bool load() {
+        if (checkpointFile == NULL) {
+            return false;
+        }
+        ifstream in(checkpointFile);
+        if (!in.good()) {
+            return false;
         }
+        string line;
+        while (getline(in, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            size_t vb = static_cast<size_t>(atoi(line.c_str()));
+            if (vb < nVBuckets && !done[vb]) {
+                done[vb] = true;
+                ++numDone;
+            }
+        }
+        doneAtStart = numDone;
+        return true;
+    }
 
-        startTime = gethrtime();
+    bool isDone(uint16_t vb) {
+        LockHolder lh(mutex);
+        return done[vb];
     }
 
-    ~Mover() {
-        nextTransaction(false);
-        cout << "Elapsed time=" << (gethrtime() - startTime)/1000000000 << " seconds."<< std::endl;
+    //! Items of the vbucket were handed to the writers.
+    void queued(uint16_t vb, size_t n) {
+        LockHolder lh(mutex);
+        pending[vb] += n;
     }
 
-    void callback(GetValue &gv) {
-        Item *i = gv.getValue();
-        adjust(&i);
-        dest->set(*i, 0, mv);
-        delete i;
+    //! The reader passed on every item of the vbucket.
+    void readAll(uint16_t vb) {
+        LockHolder lh(mutex);
+        read[vb] = true;
+        if (pending[vb] == 0) {
+            complete_UNLOCKED(vb);
+            save_UNLOCKED();
+        }
+    }
 
-        if ((++transferred % txnSize) == 0) {
-            nextTransaction(true);
+    //! A writer committed the given number of items per vbucket.
+    void committed(const map<uint16_t, size_t> &items) {
+        LockHolder lh(mutex);
+        bool changed(false);
+        map<uint16_t, size_t>::const_iterator it;
+        for (it = items.begin(); it != items.end(); ++it) {
+            assert(pending[it->first] >= it->second);
+            pending[it->first] -= it->second;
+            transferred += it->second;
+            if (pending[it->first] == 0 && read[it->first]) {
+                complete_UNLOCKED(it->first);
+                changed = true;
+            }
         }
-        if ((transferred % reportEvery) == 0) {
-            cout << "." << flush;
+        if (changed) {
+            save_UNLOCKED();
         }
     }
 
     size_t getTransferred() {
+        LockHolder lh(mutex);
         return transferred;
     }
 
-    bool enterTransaction()  {
-        if (!inTxn) {
-           inTxn = dest->begin();
+    size_t getNumDone() {
+        LockHolder lh(mutex);
+        return numDone;
+    }
+
+    size_t getDoneAtStart() {
+        return doneAtStart;
+    }
+
+private:
+
+    void complete_UNLOCKED(uint16_t vb) {
+        if (!done[vb]) {
+            done[vb] = true;
+            ++numDone;
+        }
+    }
+
+    /**
+     * Replace the checkpoint file, so an interruption leaves either
+     * the old or the new list behind.
+     */
+    void save_UNLOCKED() {
+        if (checkpointFile == NULL) {
+            return;
+        }
+        string tmp(string(checkpointFile) + ".tmp");
+        {
+            ofstream out(tmp.c_str());
+            out << "# vbuckets completely converted" << endl;
+            for (size_t vb = 0; vb < nVBuckets; ++vb) {
+                if (done[vb]) {
+                    out << vb << endl;
+                }
+            }
+            if (!out.good()) {
+                cerr << "Failed to write " << tmp << endl;
+                abort();
+            }
+        }
+        if (rename(tmp.c_str(), checkpointFile) != 0) {
+            cerr << "Failed to rename " << tmp << " to " << checkpointFile
+                 << ": " << strerror(errno) << endl;
+            abort();
+        }
+    }
+
+    Mutex           mutex;
+    const char     *checkpointFile;
+    vector<size_t>  pending;
+    vector<bool>    read;
+    vector<bool>    done;
+    size_t          numDone;
+    size_t          doneAtStart;
+    size_t          transferred;
+};
+
+typedef vector<Item*> Batch;
+
+/**
+ * Hands batches of items from the readers to one writer, making the
+ * readers wait while the writer is behind.
+ */
+class BatchQueue {
+public:
+
+    BatchQueue(size_t cap) : capacity(cap), closed(false) {
+        assert(capacity > 0);
+    }
+
+    void push(Batch *b) {
+        LockHolder lh(sync);
+        while (batches.size() >= capacity) {
+            sync.wait();
+        }
+        batches.push_back(b);
+        sync.notify();
+    }
+
+    /**
+     * Get the next batch, waiting for one if needed.
+     *
+     * @return NULL once the queue was closed and drained
+     */
+    Batch *pop() {
+        LockHolder lh(sync);
+        while (batches.empty() && !closed) {
+            sync.wait();
+        }
+        if (batches.empty()) {
+            return NULL;
+        }
+        Batch *rv = batches.front();
+        batches.pop_front();
+        sync.notify();
+        return rv;
+    }
+
+    //! No more batches are coming.
+    void close() {
+        LockHolder lh(sync);
+        closed = true;
+        sync.notify();
+    }
+
+private:
+    SyncObject     sync;
+    deque<Batch*>  batches;
+    size_t         capacity;
+    bool           closed;
+};
+
+/**
+ * Writes the batches of one queue into the destination, committing
+ * every txnSize items.
+ */
+class Writer {
+public:
+
+    Writer(KVStore *d, BatchQueue *q, Progress &p, size_t ts)
+        : dest(d), queue(q), progress(p), txnSize(ts), inTxn(false),
+          inTxnItems(0) {
+        assert(dest);
+        assert(txnSize != 0);
+    }
+
+    void run() {
+        Batch *batch;
+        while ((batch = queue->pop()) != NULL) {
+            if (!inTxn) {
+                enterTransaction();
+            }
+            Batch::iterator it;
+            for (it = batch->begin(); it != batch->end(); ++it) {
+                dest->set(**it, 0, mv);
+                ++uncommitted[(*it)->getVBucketId()];
+                delete *it;
+                if (++inTxnItems >= txnSize) {
+                    commit();
+                    enterTransaction();
+                }
+            }
+            delete batch;
         }
-        return inTxn;
+        commit();
     }
 
-    bool nextTransaction(bool next)  {
+private:
+
+    void enterTransaction() {
+        while (!(inTxn = dest->begin())) {
+            cout << "Failed to start a transaction. Sleep a while." << endl;
+            sleep(1);
+        }
+    }
+
+    void commit() {
         if (inTxn) {
             while (!dest->commit()) {
                 cout << "Failed to commit a transaction. Sleep a while." << endl;
@@ -157,11 +382,84 @@ public:
             }
             inTxn = false;
         }
-        return next ? enterTransaction() : true;
+        progress.committed(uncommitted);
+        uncommitted.clear();
+        inTxnItems = 0;
+    }
+
+    MutationVerifier       mv;
+    KVStore               *dest;
+    BatchQueue            *queue;
+    Progress              &progress;
+    map<uint16_t, size_t>  uncommitted;
+    size_t                 txnSize;
+    bool                   inTxn;
+    size_t                 inTxnItems;
+};
+
+/**
+ * Sorts the items read from the source into one batch per writer.
+ *
+ * Each writer owns the destination shards whose number modulo the
+ * number of writers is its own, so writers never share a database
+ * file.
+ */
+class Distributor : public Callback<GetValue> {
+public:
+
+    Distributor(KVStore *d, vector<BatchQueue*> &q, Progress &p,
+                bool kc, size_t bs)
+        : dest(d), queues(q), progress(p), batches(q.size()),
+          killCrlf(kc), batchSize(bs) {
+        assert(batchSize != 0);
+    }
+
+    ~Distributor() {
+        flush();
+    }
+
+    void callback(GetValue &gv) {
+        Item *i = gv.getValue();
+        adjust(&i);
+        QueuedItem qi(i->getKey(), i->getVBucketId(), queue_op_set);
+        size_t w(dest->getShardId(qi) % queues.size());
+        if (batches[w] == NULL) {
+            batches[w] = new Batch();
+            batches[w]->reserve(batchSize);
+        }
+        batches[w]->push_back(i);
+        if (batches[w]->size() >= batchSize) {
+            push(w);
+        }
+    }
+
+    //! Pass the items collected so far on to the writers.
+    void flush() {
+        for (size_t w = 0; w < batches.size(); ++w) {
+            if (batches[w] != NULL) {
+                push(w);
+            }
+        }
     }
 
 private:
 
+    void push(size_t w) {
+        Batch *b = batches[w];
+        batches[w] = NULL;
+        // Count the items before a writer can commit them.
+        map<uint16_t, size_t> perVBucket;
+        Batch::iterator it;
+        for (it = b->begin(); it != b->end(); ++it) {
+            ++perVBucket[(*it)->getVBucketId()];
+        }
+        map<uint16_t, size_t>::iterator mit;
+        for (mit = perVBucket.begin(); mit != perVBucket.end(); ++mit) {
+            progress.queued(mit->first, mit->second);
+        }
+        queues[w]->push(b);
+    }
+
     void adjust(Item **i) {
         Item *input(*i);
         if (killCrlf) {
@@ -178,16 +476,115 @@ private:
         }
     }
 
-    MutationVerifier  mv;
-    KVStore          *dest;
-    size_t            transferred;
-    size_t            txnSize;
-    size_t            reportEvery;
-    bool              killCrlf;
-    bool              inTxn;
-    hrtime_t          startTime;
+    KVStore              *dest;
+    vector<BatchQueue*>  &queues;
+    Progress             &progress;
+    vector<Batch*>        batches;
+    bool                  killCrlf;
+    size_t                batchSize;
+};
+
+/**
+ * Reads vbuckets from the source, taking the next one not yet done
+ * from a list shared with the other readers.
+ *
+ * A reader with no vbucket list dumps the whole source at once.
+ */
+class Reader {
+public:
+
+    Reader(KVStore *s, shared_ptr<Distributor> d, Progress &p,
+           vector<uint16_t> *v, Atomic<size_t> *n, size_t bs,
+           Atomic<size_t> *f)
+        : src(s), distributor(d), progress(p), vbuckets(v), next(n),
+          batchSize(bs), finished(f) {
+    }
+
+    void run() {
+        read();
+        ++(*finished);
+    }
+
+private:
+
+    void read() {
+        if (vbuckets == NULL) {
+            if (progress.getNumDone() == nVBuckets) {
+                return;
+            }
+            src->dump(distributor);
+            distributor->flush();
+            for (size_t vb = 0; vb < nVBuckets; ++vb) {
+                progress.readAll(static_cast<uint16_t>(vb));
+            }
+            return;
+        }
+
+        size_t i;
+        while (!interrupted && (i = next->incr(1)) < vbuckets->size()) {
+            uint16_t vb((*vbuckets)[i]);
+            DumpPosition pos;
+            bool done(false);
+            while (!done && !interrupted) {
+                done = src->dumpFrom(vb, pos, batchSize, distributor);
+                distributor->flush();
+            }
+            if (done) {
+                progress.readAll(vb);
+            }
+        }
+    }
+
+    KVStore                  *src;
+    shared_ptr<Distributor>   distributor;
+    Progress                 &progress;
+    vector<uint16_t>         *vbuckets;
+    Atomic<size_t>           *next;
+    size_t                    batchSize;
+    Atomic<size_t>           *finished;
 };
 
+extern "C" {
+    static void *launchReader(void *arg) {
+        static_cast<Reader*>(arg)->run();
+        return NULL;
+    }
+
+    static void *launchWriter(void *arg) {
+        static_cast<Writer*>(arg)->run();
+        return NULL;
+    }
+}
+
+static string formatDuration(hrtime_t secs) {
+    stringstream ss;
+    ss << secs / 3600 << "h" << (secs / 60) % 60 << "m" << secs % 60 << "s";
+    return ss.str();
+}
+
+/**
+ * Print how many items were moved, at what rate, and how long the
+ * vbuckets still to go are going to take at the rate seen so far.
+ */
+static void report(Progress &progress, hrtime_t startTime,
+                   size_t &lastItems, hrtime_t &lastTime) {
+    hrtime_t now(gethrtime());
+    size_t items(progress.getTransferred());
+    size_t vbs(progress.getNumDone());
+    hrtime_t elapsed((now - lastTime) / 1000000);
+    cout << "Moved " << items << " items ("
+         << ((items - lastItems) * 1000) / (elapsed ? elapsed : 1)
+         << " items/s), " << vbs << "/" << nVBuckets << " vbuckets done";
+    size_t doneNow(vbs - progress.getDoneAtStart());
+    if (doneNow > 0 && vbs < nVBuckets) {
+        hrtime_t ran((now - startTime) / 1000000000);
+        cout << ", ETA " << formatDuration(ran * (nVBuckets - vbs) / doneNow);
+    }
+    cout << endl;
+    lastItems = items;
+    lastTime = now;
+}
+
 static void usage(const char *cmd) {
     cerr << "Usage:  " << cmd << " [args] srcPath destPath" << endl
          << endl
@@ -199,10 +596,43 @@ static void usage(const char *cmd) {
          << "  --remove-crlf" << endl
          << "  --txn-size=someNumber (default=10000)" << endl
          << "  --report-every=someNumber (default=10000)" << endl
-         << "  --init-file=filepath (default=NULL)" << endl;
+         << "  --init-file=filepath (default=NULL)" << endl
+         << "  --readers=someNumber (default=4)" << endl
+         << "  --writers=someNumber (default=4)" << endl
+         << "  --batch-size=someNumber (default=1000)" << endl
+         << "  --queue-size=someNumber (default=16)" << endl
+         << "  --checkpoint=filepath (default=NULL)" << endl;
     exit(EX_USAGE);
 }
 
+/**
+ * Remove whatever an interrupted run left of the vbuckets not yet
+ * completely converted.
+ */
+static void clearIncomplete(KVStore *dest, Progress &progress) {
+    bool efficient(dest->getStorageProperties().hasEfficientVBDeletion());
+    for (size_t vb = 0; vb < nVBuckets; ++vb) {
+        if (progress.isDone(static_cast<uint16_t>(vb))) {
+            continue;
+        }
+        bool rv;
+        if (efficient) {
+            rv = dest->delVBucket(static_cast<uint16_t>(vb), 0);
+        } else {
+            rv = dest->begin() &&
+                dest->delVBucket(static_cast<uint16_t>(vb), 0,
+                                 make_pair(static_cast<int64_t>(0),
+                                           numeric_limits<int64_t>::max())) &&
+                dest->commit();
+        }
+        if (!rv) {
+            cerr << "Failed to clear vbucket " << vb
+                 << " of the destination" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
 int main(int argc, char **argv) {
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
     const char *cmd(argv[0]);
@@ -210,8 +640,9 @@ int main(int argc, char **argv) {
     const char *destPath(NULL), *destStrategy("multiMTVBDB");
     const char *srcShardPattern("%d/%b-%i.sqlite");
     const char *destShardPattern("%d/%b-%i.mb");
-    const char *initFile(NULL);
+    const char *initFile(NULL), *checkpointFile(NULL);
     size_t txnSize(10000), reportEvery(10000);
+    size_t numReaders(4), numWriters(4), batchSize(1000), queueSize(16);
     int killCrlf(0);
 
     /* options descriptor */
@@ -224,6 +655,11 @@ int main(int argc, char **argv) {
         { OPTNAME("txn-size"),      required_argument, NULL,      't' },
         { OPTNAME("report-every"),  required_argument, NULL,      'r' },
         { OPTNAME("init-file"),     required_argument, NULL,      'i' },
+        { OPTNAME("readers"),       required_argument, NULL,      'R' },
+        { OPTNAME("writers"),       required_argument, NULL,      'W' },
+        { OPTNAME("batch-size"),    required_argument, NULL,      'b' },
+        { OPTNAME("queue-size"),    required_argument, NULL,      'q' },
+        { OPTNAME("checkpoint"),    required_argument, NULL,      'c' },
         { NULL,            0,                 NULL,      0 }
     };
 
@@ -251,6 +687,21 @@ int main(int argc, char **argv) {
         case 'r':
             reportEvery = static_cast<size_t>(atoi(optarg));
             break;
+        case 'R':
+            numReaders = static_cast<size_t>(atoi(optarg));
+            break;
+        case 'W':
+            numWriters = static_cast<size_t>(atoi(optarg));
+            break;
+        case 'b':
+            batchSize = static_cast<size_t>(atoi(optarg));
+            break;
+        case 'q':
+            queueSize = static_cast<size_t>(atoi(optarg));
+            break;
+        case 'c':
+            checkpointFile = optarg;
+            break;
         case 0: // Path for automatically handled cases (e.g. remove-crlf)
             break;
         default:
@@ -260,7 +711,8 @@ int main(int argc, char **argv) {
     argc -= optind;
     argv += optind;
 
-    if (argc != 2) {
+    if (argc != 2 || txnSize == 0 || reportEvery == 0 || numReaders == 0 ||
+        numWriters == 0 || batchSize == 0 || queueSize == 0) {
         usage(cmd);
     }
     srcPath = argv[0];
@@ -271,16 +723,121 @@ int main(int argc, char **argv) {
     EPStats srcStats, destStats;
 
     SqliteStrategy::disableSchemaCheck();
+    // Writers own different shards, but would wait for each other if
+    // each transaction locked them all.
+    SqliteStrategy::deferTransactionLocks();
+
+    // Every thread gets its own connection.  They're all opened up
+    // front so the schema is only ever created by one of them at a time.
+    vector<KVStore*> srcs;
+    srcs.push_back(getStore(srcStats, srcPath, srcStrategy, srcShardPattern));
+    bool byVBucket(srcs[0]->getStorageProperties().hasEfficientVBDump());
+    if (!byVBucket) {
+        numReaders = 1;
+    }
+    while (srcs.size() < numReaders) {
+        srcs.push_back(getStore(srcStats, srcPath,
+                                srcStrategy, srcShardPattern));
+    }
+
+    vector<KVStore*> dests;
+    dests.push_back(getStore(destStats, destPath, destStrategy,
+                             destShardPattern, initFile));
+    numWriters = std::min(numWriters, dests[0]->getNumShards());
+    while (dests.size() < numWriters) {
+        dests.push_back(getStore(destStats, destPath, destStrategy,
+                                 destShardPattern, initFile));
+    }
+
+    Progress progress(checkpointFile);
+    if (progress.load()) {
+        cout << "Resuming from " << checkpointFile << " with "
+             << progress.getNumDone() << " vbuckets done." << endl;
+        clearIncomplete(dests[0], progress);
+    }
 
-    KVStore *src(getStore(srcStats, srcPath,
-                          srcStrategy, srcShardPattern));
-    KVStore *dest(getStore(destStats, destPath,
-                           destStrategy, destShardPattern, initFile));
+    vector<uint16_t> vbuckets;
+    Atomic<size_t> nextVBucket(0);
+    if (byVBucket) {
+        for (size_t vb = 0; vb < nVBuckets; ++vb) {
+            if (!progress.isDone(static_cast<uint16_t>(vb))) {
+                vbuckets.push_back(static_cast<uint16_t>(vb));
+            }
+        }
+        // Stop between batches, leaving a checkpoint to resume from.
+        signal(SIGINT, stopConversion);
+        signal(SIGTERM, stopConversion);
+    } else if (checkpointFile != NULL) {
+        cout << "The source can only be read as a whole; an interrupted "
+             << "conversion starts over." << endl;
+    }
 
-    shared_ptr<Mover> mover(new Mover(dest, txnSize, static_cast<bool>(killCrlf), reportEvery));
-    cout << "Each . represents " << reportEvery << " items moved." << endl;
-    src->dump(mover);
-    cout << endl << "Moved " << mover->getTransferred() << " items." << endl;
+    cout << "Moving with " << numReaders << " readers and " << numWriters
+         << " writers." << endl;
+    hrtime_t startTime(gethrtime());
+
+    vector<BatchQueue*> queues;
+    vector<Writer*> writers;
+    vector<pthread_t> writerThreads(numWriters);
+    for (size_t w = 0; w < numWriters; ++w) {
+        queues.push_back(new BatchQueue(queueSize));
+        writers.push_back(new Writer(dests[w], queues[w], progress, txnSize));
+        if (pthread_create(&writerThreads[w], NULL, launchWriter,
+                           writers[w]) != 0) {
+            cerr << "Failed to start a writer thread" << endl;
+            abort();
+        }
+    }
+
+    vector<Reader*> readers;
+    vector<pthread_t> readerThreads(numReaders);
+    Atomic<size_t> finishedReaders(0);
+    for (size_t r = 0; r < numReaders; ++r) {
+        shared_ptr<Distributor> d(new Distributor(dests[0], queues, progress,
+                                                  static_cast<bool>(killCrlf),
+                                                  batchSize));
+        readers.push_back(new Reader(srcs[r], d, progress,
+                                     byVBucket ? &vbuckets : NULL,
+                                     &nextVBucket, batchSize,
+                                     &finishedReaders));
+        if (pthread_create(&readerThreads[r], NULL, launchReader,
+                           readers[r]) != 0) {
+            cerr << "Failed to start a reader thread" << endl;
+            abort();
+        }
+    }
+
+    size_t lastItems(0);
+    hrtime_t lastTime(startTime);
+    while (finishedReaders.get() < numReaders) {
+        sleep(1);
+        if (progress.getTransferred() >= lastItems + reportEvery) {
+            report(progress, startTime, lastItems, lastTime);
+        }
+    }
+    for (size_t r = 0; r < numReaders; ++r) {
+        pthread_join(readerThreads[r], NULL);
+    }
+    for (size_t w = 0; w < numWriters; ++w) {
+        queues[w]->close();
+        pthread_join(writerThreads[w], NULL);
+    }
+
+    cout << "Elapsed time=" << (gethrtime() - startTime)/1000000000
+         << " seconds." << endl;
+    cout << "Moved " << progress.getTransferred() << " items." << endl;
+    if (interrupted) {
+        cout << "Interrupted; run again with the same checkpoint to resume."
+             << endl;
+    }
+
+    for (size_t i = 0; i < readers.size(); ++i) {
+        delete readers[i];
+    }
+    for (size_t i = 0; i < writers.size(); ++i) {
+        delete writers[i];
+        delete queues[i];
+    }
 
-    return 0;
+    return interrupted ? EXIT_FAILURE : 0;
 }
@@ -123,6 +123,10 @@ public:
 
     void optimizeWrites(std::vector<queued_item> &items);
 
+    bool isKeyOrderedWrites() {
+        return true;
+    }
+
     void processTxnSizeChange(size_t txn_size);
 
     void setVBBatchCount(size_t batch_count);
@@ -63,7 +63,9 @@ MutationLog::MutationLog(const std::string &path,
     entries(0),
     entryBuffer(static_cast<uint8_t*>(calloc(MutationLogEntry::len(256), 1))),
     blockBuffer(static_cast<uint8_t*>(calloc(bs, 1))),
-    syncConfig(DEFAULT_SYNC_CONF) {
+    syncConfig(DEFAULT_SYNC_CONF),
+    inTransaction(false),
+    holdTransactions(false) {
 
     assert(entryBuffer);
     assert(blockBuffer);
@@ -80,14 +82,17 @@ MutationLog::~MutationLog() {
 }
 
 void MutationLog::disable() {
+    LockHolder lh(mutex);
     if (file >= 0) {
         close();
-        file = DISABLED_FD;
     }
+    file = DISABLED_FD;
 }
 
 void MutationLog::newItem(uint16_t vbucket, const std::string &key, uint64_t rowid) {
+    LockHolder lh(mutex);
     if (isEnabled()) {
+        waitForTurn_UNLOCKED();
         MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
                                                            rowid, ML_NEW, vbucket, key);
         writeEntry(mle);
@@ -95,7 +100,9 @@ void MutationLog::newItem(uint16_t vbucket, const std::string &key, uint64_t row
 }
 
 void MutationLog::delItem(uint16_t vbucket, const std::string &key) {
+    LockHolder lh(mutex);
     if (isEnabled()) {
+        waitForTurn_UNLOCKED();
         MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
                                                            0, ML_DEL, vbucket, key);
         writeEntry(mle);
@@ -103,7 +110,9 @@ void MutationLog::delItem(uint16_t vbucket, const std::string &key) {
 }
 
 void MutationLog::deleteAll(uint16_t vbucket) {
+    LockHolder lh(mutex);
     if (isEnabled()) {
+        waitForTurn_UNLOCKED();
         MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
                                                            0, ML_DEL_ALL, vbucket, "");
         writeEntry(mle);
@@ -111,6 +120,11 @@ void MutationLog::deleteAll(uint16_t vbucket) {
 }
 
 void MutationLog::sync() {
+    LockHolder lh(mutex);
+    sync_UNLOCKED();
+}
+
+void MutationLog::sync_UNLOCKED() {
     assert(isOpen());
     BlockTimer timer(&syncTimeHisto);
     int fsyncResult = doFsync(file);
@@ -118,29 +132,33 @@ void MutationLog::sync() {
 }
 
 void MutationLog::commit1() {
+    LockHolder lh(mutex);
     if (isEnabled()) {
+        waitForTurn_UNLOCKED();
         MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
                                                            0, ML_COMMIT1, 0, "");
         writeEntry(mle);
         if ((getSyncConfig() & FLUSH_COMMIT_1) != 0) {
-            flush();
+            flush_UNLOCKED();
         }
         if ((getSyncConfig() & SYNC_COMMIT_1) != 0) {
-            sync();
+            sync_UNLOCKED();
         }
     }
 }
 
 void MutationLog::commit2() {
+    LockHolder lh(mutex);
     if (isEnabled()) {
+        waitForTurn_UNLOCKED();
         MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
                                                            0, ML_COMMIT2, 0, "");
         writeEntry(mle);
         if ((getSyncConfig() & FLUSH_COMMIT_2) != 0) {
-            flush();
+            flush_UNLOCKED();
         }
         if ((getSyncConfig() & SYNC_COMMIT_2) != 0) {
-            sync();
+            sync_UNLOCKED();
         }
     }
 }
@@ -266,12 +284,117 @@ void MutationLog::close() {
 }
 
 bool MutationLog::replaceWith(MutationLog &mlog) {
+    LockHolder lh(mutex);
+    return replaceWith_UNLOCKED(mlog);
+}
+
+bool MutationLog::replaceWith(MutationLog &mlog, size_t offset,
+                              const size_t *counts, double timeout) {
+    assert(mlog.isEnabled());
+    assert(isEnabled());
+
+    LockHolder lh(mutex);
+    bool committed(waitForCommit_UNLOCKED(timeout));
+    if (!committed) {
+        holdTransactions = false;
+        mutex.notify();
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "No commit in \"%s\" within %.0f seconds, "
+                         "not replacing it.\n", getLogFile().c_str(), timeout);
+        return false;
+    }
+    flush_UNLOCKED();
+    size_t tail = logSize.get() - offset;
+    copyBlocksTo(mlog, offset);
+    for (int i(0); i < MUTATION_LOG_TYPES; ++i) {
+        mlog.itemsLogged[i] += itemsLogged[i] - counts[i];
+    }
+    getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                     "Copied the last %llu bytes of \"%s\" into \"%s\".\n",
+                     (unsigned long long)tail, getLogFile().c_str(),
+                     mlog.getLogFile().c_str());
+    bool rv = replaceWith_UNLOCKED(mlog);
+    holdTransactions = false;
+    mutex.notify();
+    return rv;
+}
+
+bool MutationLog::mark(size_t *counts, size_t &offset, double timeout) {
+    assert(isEnabled());
+    LockHolder lh(mutex);
+    bool committed(waitForCommit_UNLOCKED(timeout));
+    if (committed) {
+        flush_UNLOCKED();
+        for (int i(0); i < MUTATION_LOG_TYPES; ++i) {
+            counts[i] = itemsLogged[i];
+        }
+        offset = logSize.get();
+    }
+    holdTransactions = false;
+    mutex.notify();
+    return committed;
+}
+
+void MutationLog::waitForTurn_UNLOCKED() {
+    while (!inTransaction && holdTransactions) {
+        mutex.wait();
+    }
+}
+
+bool MutationLog::waitForCommit_UNLOCKED(double timeout) {
+    // Writers don't start another transaction until the caller lets
+    // them, so this can't be starved by a busy flusher.
+    holdTransactions = true;
+    struct timeval deadline;
+    gettimeofday(&deadline, NULL);
+    advance_tv(deadline, timeout);
+    while (inTransaction) {
+        if (!mutex.wait(deadline)) {
+            break;
+        }
+    }
+    return !inTransaction;
+}
+
+size_t MutationLog::copyBlocksTo(MutationLog &dest, size_t offset) {
+    assert(dest.isOpen());
+    assert(isOpen());
+    assert(dest.getBlockSize() == blockSize);
+    assert(offset % blockSize == 0);
+
+    // Only whole blocks below logSize are ever read, and logSize is
+    // not advanced until a block has been fully written.
+    size_t end(logSize.get());
+    if (offset >= end) {
+        return offset;
+    }
+
+    dest.flush();
+    size_t buflen(blockSize * 64);
+    uint8_t *buf = static_cast<uint8_t*>(malloc(buflen));
+    assert(buf);
+    while (offset < end) {
+        size_t len(std::min(buflen, end - offset));
+        ssize_t bytesread = pread(file, buf, len, offset);
+        if (bytesread != static_cast<ssize_t>(len)) {
+            free(buf);
+            throw ShortReadException();
+        }
+        writeFully(dest.file, buf, len);
+        dest.logSize += len;
+        offset += len;
+    }
+    free(buf);
+    return offset;
+}
+
+bool MutationLog::replaceWith_UNLOCKED(MutationLog &mlog) {
     assert(mlog.isEnabled());
     assert(isEnabled());
 
     mlog.flush();
     mlog.close();
-    flush();
+    flush_UNLOCKED();
     close();
 
     for (int i(0); i < MUTATION_LOG_TYPES; ++i) {
@@ -296,6 +419,11 @@ bool MutationLog::replaceWith(MutationLog &mlog) {
 }
 
 void MutationLog::flush() {
+    LockHolder lh(mutex);
+    flush_UNLOCKED();
+}
+
+void MutationLog::flush_UNLOCKED() {
     if (isEnabled() && blockPos > HEADER_RESERVED) {
         assert(isOpen());
         BlockTimer timer(&flushTimeHisto);
@@ -324,9 +452,13 @@ void MutationLog::flush() {
 void MutationLog::writeEntry(MutationLogEntry *mle) {
     assert(isEnabled());
     assert(isOpen());
+    inTransaction = mle->type() != ML_COMMIT2;
+    if (!inTransaction) {
+        mutex.notify();
+    }
     size_t len(mle->len());
     if (blockPos + len > blockSize) {
-        flush();
+        flush_UNLOCKED();
     }
     assert(len < blockSize);
 
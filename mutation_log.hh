@@ -19,6 +19,7 @@
 #include "common.hh"
 #include "atomic.hh"
 #include "histo.hh"
+#include "syncobject.hh"
 
 #define ML_BUFLEN (128 * 1024 * 1024)
 
@@ -27,6 +28,8 @@ const uint8_t MUTATION_LOG_MAGIC(0x45);
 const size_t HEADER_RESERVED(4);
 const uint32_t LOG_VERSION(1);
 const size_t LOG_ENTRY_BUF_SIZE(512);
+//! The most seconds the compactor waits for a transaction to commit.
+const double MAX_COMMIT_WAIT(30.0);
 const int DISABLED_FD(-3);
 
 const uint8_t SYNC_COMMIT_1(1);
@@ -275,6 +278,49 @@ public:
      */
     bool replaceWith(MutationLog &mlog);
 
+    /**
+     * Replace the current log with a given log after appending to it
+     * everything this log has written since the given mark.
+     *
+     * Only this final tail copy and the rename are done with writers
+     * excluded, so the given log may be built while this one is still
+     * being appended to.  The switch waits for the transaction being
+     * logged to be committed, so every row id written to the given log
+     * since the mark was committed by then.
+     *
+     * @param mlog the log that will replace this one
+     * @param offset the offset returned by mark() or copyBlocksTo()
+     * @param counts the item counts filled in by mark()
+     * @param timeout the most seconds to wait for a commit
+     * @return false if the log couldn't be replaced
+     */
+    bool replaceWith(MutationLog &mlog, size_t offset, const size_t *counts,
+                     double timeout = MAX_COMMIT_WAIT);
+
+    /**
+     * Wait for the transaction being logged to be committed, then
+     * flush any buffered entries and get the current end of the log.
+     *
+     * Every entry before the mark is committed, and the flusher has
+     * set the row ids of the items it logged there.
+     *
+     * @param counts filled in with the number of items logged by type
+     *               up to the returned offset
+     * @param offset set to the end of the log
+     * @param timeout the most seconds to wait for a commit
+     * @return false if no commit came within the timeout
+     */
+    bool mark(size_t *counts, size_t &offset, double timeout = MAX_COMMIT_WAIT);
+
+    /**
+     * Append the blocks this log has written from the given offset
+     * onwards to the given log.  This may run while other threads are
+     * writing to this log.
+     *
+     * @return the offset up to which blocks were copied
+     */
+    size_t copyBlocksTo(MutationLog &dest, size_t offset);
+
     bool setSyncConfig(const std::string &s);
     bool setFlushConfig(const std::string &s);
 
@@ -382,6 +428,12 @@ private:
 
     void writeEntry(MutationLogEntry *mle);
 
+    void flush_UNLOCKED();
+    void sync_UNLOCKED();
+    bool waitForCommit_UNLOCKED(double timeout);
+    void waitForTurn_UNLOCKED();
+    bool replaceWith_UNLOCKED(MutationLog &mlog);
+
     void writeInitialBlock();
     void readInitialBlock();
 
@@ -398,6 +450,12 @@ private:
     uint8_t           *entryBuffer;
     uint8_t           *blockBuffer;
     uint8_t            syncConfig;
+    //! Whether entries were logged since the last commit2.
+    bool               inTransaction;
+    //! Whether new transactions wait for the compactor.
+    bool               holdTransactions;
+    //! Serializes writers against the compactor's final switch-over.
+    SyncObject         mutex;
 
     DISALLOW_COPY_AND_ASSIGN(MutationLog);
 };
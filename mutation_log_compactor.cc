@@ -76,16 +76,45 @@ bool MutationLogCompactor::callback(Dispatcher &d, TaskId t) {
         }
 
         BlockTimer timer(&stats.mlogCompactorHisto, "klogCompactorTime", stats.timingLog);
-        epStore->pauseFlusher();
         try {
             MutationLog new_log(compact_file, mutationLog.getBlockSize());
             new_log.open();
             assert(new_log.isEnabled());
             new_log.setSyncConfig(mutationLog.getSyncConfig());
 
+            // The flusher keeps appending to the live log while the hash
+            // tables are dumped.  Everything it writes after this mark is
+            // copied over verbatim afterwards.  The mark is taken between
+            // two transactions, so the ids of the items logged before it
+            // are all set and committed.
+            size_t counts[MUTATION_LOG_TYPES];
+            size_t offset(0);
+            if (!mutationLog.mark(counts, offset)) {
+                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                                 "Mutation log compactor: The flusher didn't "
+                                 "commit in time, trying again later.\n");
+                remove(compact_file.c_str());
+                d.snooze(t, MUTATION_LOG_COMPACTOR_FREQ);
+                return true;
+            }
+
             LogCompactionVisitor compact_visitor(new_log, stats);
-            epStore->visit(compact_visitor); 
-            mutationLog.replaceWith(new_log);
+            epStore->visit(compact_visitor);
+
+            // Catch up with the live log so that only a short tail is
+            // left to copy while writers are blocked.
+            for (int i = 0; i < MAX_TAIL_CATCHUP_ROUNDS; ++i) {
+                size_t prev = offset;
+                offset = mutationLog.copyBlocksTo(new_log, offset);
+                if (offset - prev <= MAX_LOCKED_TAIL_SIZE) {
+                    break;
+                }
+            }
+            // The switch waits for the next commit as well, so any id
+            // the dump saw from a transaction in progress is committed.
+            if (!mutationLog.replaceWith(new_log, offset, counts)) {
+                remove(compact_file.c_str());
+            }
         } catch (MutationLog::ReadException e) {
             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                              "Error in creating a new mutation log for compaction:  %s\n",
@@ -99,7 +128,6 @@ bool MutationLogCompactor::callback(Dispatcher &d, TaskId t) {
             mutationLog.disable();
             rv = false;
         }
-        epStore->resumeFlusher();
         ++stats.mlogCompactorRuns;
     }
 
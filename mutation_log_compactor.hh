@@ -11,6 +11,8 @@ const size_t MAX_LOG_SIZE((size_t)(unsigned int)-1);
 const size_t MAX_ENTRY_RATIO(10);
 const size_t LOG_COMPACTOR_QUEUE_CAP(500000);
 const int MUTATION_LOG_COMPACTOR_FREQ(3600);
+const size_t MAX_LOCKED_TAIL_SIZE(256 * 1024);
+const int MAX_TAIL_CATCHUP_ROUNDS(10);
 
 /**
  * Mutation log compactor config that is used to control the scheduling of
@@ -76,6 +78,10 @@ class EventuallyPersistentStore;
 /**
  * Dispatcher task that compacts a mutation log file if the compaction condition
  * is satisfied.
+ *
+ * The compacted log is built from the hash tables while the flusher keeps
+ * appending to the live log; the entries logged in the meantime are then
+ * copied to the end of the compacted log before it replaces the live one.
  */
 class MutationLogCompactor : public DispatcherCallback {
 public:
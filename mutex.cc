@@ -66,6 +66,23 @@ void Mutex::acquire() {
     EP_MUTEX_ACQUIRED(this);
 }
 
+bool Mutex::tryAcquire() {
+    int e;
+    if ((e = pthread_mutex_trylock(&mutex)) != 0) {
+        if (e == EBUSY) {
+            return false;
+        }
+        std::cerr << "MUTEX ERROR: Failed to try a lock: ";
+        std::cerr << std::strerror(e) << std::endl;
+        std::cerr.flush();
+        abort();
+    }
+    setHolder(true);
+
+    EP_MUTEX_ACQUIRED(this);
+    return true;
+}
+
 void Mutex::release() {
     assert(held && pthread_equal(holder, pthread_self()));
     setHolder(false);
@@ -39,6 +39,13 @@ protected:
     void acquire();
     void release();
 
+    /**
+     * Acquire the lock only if nobody (including the caller) holds it.
+     *
+     * @return true if the lock was acquired
+     */
+    bool tryAcquire();
+
     void setHolder(bool isHeld) {
         held = isHeld;
         holder = pthread_self();
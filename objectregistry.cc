@@ -87,6 +87,26 @@ void ObjectRegistry::onDeleteQueuedItem(QueuedItem *qi)
    }
 }
 
+void ObjectRegistry::onCreateQueuedItemSnapshot(QueuedItemSnapshot *snap)
+{
+   EventuallyPersistentEngine *engine = th->get();
+   if (verifyEngine(engine)) {
+       EPStats &stats = engine->getEpStats();
+       stats.memOverhead.incr(snap->size());
+       assert(stats.memOverhead.get() < GIGANTOR);
+   }
+}
+
+void ObjectRegistry::onDeleteQueuedItemSnapshot(QueuedItemSnapshot *snap)
+{
+   EventuallyPersistentEngine *engine = th->get();
+   if (verifyEngine(engine)) {
+       EPStats &stats = engine->getEpStats();
+       stats.memOverhead.decr(snap->size());
+       assert(stats.memOverhead.get() < GIGANTOR);
+   }
+}
+
 void ObjectRegistry::onCreateItem(Item *pItem)
 {
    EventuallyPersistentEngine *engine = th->get();
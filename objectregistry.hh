@@ -20,6 +20,7 @@
 class EventuallyPersistentEngine;
 class Blob;
 class QueuedItem;
+class QueuedItemSnapshot;
 
 class ObjectRegistry {
 public:
@@ -29,6 +30,9 @@ public:
     static void onCreateQueuedItem(QueuedItem *qi);
     static void onDeleteQueuedItem(QueuedItem *qi);
 
+    static void onCreateQueuedItemSnapshot(QueuedItemSnapshot *snap);
+    static void onDeleteQueuedItemSnapshot(QueuedItemSnapshot *snap);
+
     static void onCreateItem(Item *pItem);
     static void onDeleteItem(Item *pItem);
 
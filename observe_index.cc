@@ -0,0 +1,97 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <memcached/protocol_binary.h>
+
+#include "observe_index.hh"
+#include "command_ids.h"
+#include "locks.hh"
+
+ObserveIndex::ObserveIndex(size_t n)
+    : numPartitions(n), partitions(new ObservePartition[n]) {
+}
+
+ObserveIndex::~ObserveIndex() {
+    delete []partitions;
+}
+
+void ObserveIndex::add(observed_key_t *obs) {
+    ObservePartition &p = getPartition(obs->key);
+    LockHolder lh(p.mutex);
+    p.watchers[obs->key].push_back(obs);
+}
+
+void ObserveIndex::remove(observed_key_t *obs) {
+    ObservePartition &p = getPartition(obs->key);
+    LockHolder lh(p.mutex);
+    unordered_map<std::string, std::list<observed_key_t*> >::iterator it;
+    it = p.watchers.find(obs->key);
+    if (it == p.watchers.end()) {
+        return;
+    }
+    it->second.remove(obs);
+    if (it->second.empty()) {
+        p.watchers.erase(it);
+    }
+}
+
+bool ObserveIndex::isObserved(const std::string &key, uint16_t vbucket) {
+    ObservePartition &p = getPartition(key);
+    LockHolder lh(p.mutex);
+    unordered_map<std::string, std::list<observed_key_t*> >::iterator it;
+    it = p.watchers.find(key);
+    if (it == p.watchers.end()) {
+        return false;
+    }
+    std::list<observed_key_t*>::iterator oit;
+    for (oit = it->second.begin(); oit != it->second.end(); ++oit) {
+        if ((*oit)->vbucket == vbucket) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t ObserveIndex::keyEvent(const std::string &key, uint64_t cas,
+                              uint16_t vbucket, int event) {
+    ObservePartition &p = getPartition(key);
+    LockHolder lh(p.mutex);
+    unordered_map<std::string, std::list<observed_key_t*> >::iterator it;
+    it = p.watchers.find(key);
+    if (it == p.watchers.end()) {
+        return 0;
+    }
+
+    hrtime_t now = gethrtime();
+    size_t found = 0;
+    std::list<observed_key_t*>::iterator oit;
+    for (oit = it->second.begin(); oit != it->second.end(); ++oit) {
+        observed_key_t *obs = *oit;
+        if (obs->vbucket != vbucket) {
+            continue;
+        }
+        ++found;
+        if (obs->touched) {
+            obs->touched->set(now);
+        }
+        if (event == OBS_DELETED_EVENT) {
+            obs->deleted = true;
+        } else if (obs->cas != cas && event == OBS_MODIFIED_EVENT) {
+            obs->mutated = true;
+            obs->deleted = false;
+        } else if (obs->cas == cas) {
+            if (event == OBS_PERSISTED_EVENT) {
+                obs->persisted = true;
+            } else if (event == OBS_REPLICATED_EVENT) {
+                obs->replicas++;
+            }
+        }
+    }
+    return found;
+}
+
+observed_key_t ObserveIndex::getState(const observed_key_t *obs) {
+    ObservePartition &p = getPartition(obs->key);
+    LockHolder lh(p.mutex);
+    return *obs;
+}
@@ -0,0 +1,98 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef OBSERVE_INDEX_HH
+#define OBSERVE_INDEX_HH 1
+
+#include <list>
+#include <string>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "mutex.hh"
+
+typedef struct observed_key_t {
+    observed_key_t(std::string aKey, uint64_t(aCas))
+        : key(aKey), cas(aCas), replicas(0), mutated(false), persisted(false),
+        deleted(false), vbucket(0), touched(NULL) {
+    }
+
+    std::string key;
+    uint64_t cas;
+    uint8_t replicas;
+    bool mutated;
+    bool persisted;
+    bool deleted;
+    uint16_t vbucket;
+    //! Set to the time of every event on the key, if not NULL.
+    Atomic<hrtime_t> *touched;
+} observed_key_t;
+
+/**
+ * One lock and the watchers of the keys hashing to it.
+ */
+struct ObservePartition {
+    Mutex mutex;
+    unordered_map<std::string, std::list<observed_key_t*> > watchers;
+};
+
+/**
+ * Finds the observers of a key without looking at anybody else.
+ *
+ * Observed keys are kept in a hash map split into partitions with a
+ * lock each, so an event costs one lookup plus the work for the
+ * observers of that key, and events on keys in different partitions
+ * don't wait for each other.  The state of an observed key is guarded
+ * by the lock of its partition.
+ */
+class ObserveIndex {
+public:
+
+    ObserveIndex(size_t numPartitions = 64);
+
+    ~ObserveIndex();
+
+    /**
+     * Start delivering events on the key to the given observer.
+     */
+    void add(observed_key_t *obs);
+
+    /**
+     * Stop delivering events to the given observer.  Once this
+     * returns, no event touches it any more.
+     */
+    void remove(observed_key_t *obs);
+
+    /**
+     * Whether anybody observes the given key.
+     */
+    bool isObserved(const std::string &key, uint16_t vbucket);
+
+    /**
+     * Deliver an event on a key to its observers.
+     *
+     * @return the number of observers of the key
+     */
+    size_t keyEvent(const std::string &key, uint64_t cas, uint16_t vbucket,
+                    int event);
+
+    /**
+     * A consistent copy of the state of an observed key.
+     */
+    observed_key_t getState(const observed_key_t *obs);
+
+private:
+
+    ObservePartition &getPartition(const std::string &key) {
+        size_t h = 5381;
+        for (size_t i = 0; i < key.length(); ++i) {
+            h = ((h << 5) + h) ^ key[i];
+        }
+        return partitions[h % numPartitions];
+    }
+
+    size_t            numPartitions;
+    ObservePartition *partitions;
+
+    DISALLOW_COPY_AND_ASSIGN(ObserveIndex);
+};
+
+#endif /* OBSERVE_INDEX_HH */
@@ -20,6 +20,13 @@
 #include "command_ids.h"
 #include "vbucket.hh"
 
+ObserveRegistry::~ObserveRegistry() {
+    std::map<std::string, ObserveSet*>::iterator itr;
+    for (itr = registry.begin(); itr != registry.end(); ++itr) {
+        delete itr->second;
+    }
+}
+
 protocol_binary_response_status ObserveRegistry::observeKey(const std::string &key,
                                                             const uint64_t cas,
                                                             const uint16_t vbucket,
@@ -62,10 +69,20 @@ void ObserveRegistry::unobserveKey(const std::string &key,
 
 void ObserveRegistry::removeExpired() {
     LockHolder lh(registry_mutex);
-    std::map<std::string, ObserveSet*>::iterator itr;
-    for (itr = registry.begin(); itr != registry.end(); itr++) {
-        if (itr->second->isExpired()) {
+    hrtime_t now = gethrtime();
+    while (!deadlines.empty() && deadlines.top().deadline <= now) {
+        ObserveDeadline d(deadlines.top());
+        deadlines.pop();
+        std::map<std::string, ObserveSet*>::iterator itr = registry.find(d.name);
+        if (itr == registry.end() || itr->second->getId() != d.id) {
+            // The set was removed or replaced since.
+            continue;
+        }
+        hrtime_t deadline = itr->second->getDeadline();
+        if (deadline <= now) {
             removeObserveSet(itr);
+        } else {
+            deadlines.push(ObserveDeadline(deadline, d.id, d.name));
         }
     }
 }
@@ -83,63 +100,32 @@ state_map* ObserveRegistry::getObserveSetState(const std::string &obs_set_name)
 }
 
 void ObserveRegistry::itemsPersisted(std::list<queued_item> &itemlist) {
-    LockHolder lh(registry_mutex);
     std::list<queued_item>::iterator itr;
     for (itr = itemlist.begin(); itr != itemlist.end(); itr++) {
-        std::map<std::string,ObserveSet*>::iterator obs_itr;
-        for (obs_itr = registry.begin(); obs_itr != registry.end(); obs_itr++) {
-            if (!obs_itr->second->isExpired()) {
-                StoredValue *sv = (*epstore)->getStoredValue((*itr)->getKey(),
-                                                             (*itr)->getVBucketId(),
-                                                             false);
-                obs_itr->second->keyEvent((*itr)->getKey().c_str(),
-                                          sv ? sv->getCas() : 0,
-                                          (*itr)->getVBucketId(),
-                                          OBS_PERSISTED_EVENT);
-            } else {
-                removeObserveSet(obs_itr);
-            }
+        const std::string &key((*itr)->getKey());
+        uint16_t vbucket((*itr)->getVBucketId());
+        if (!index.isObserved(key, vbucket)) {
+            continue;
         }
+        StoredValue *sv = (*epstore)->getStoredValue(key, vbucket, false);
+        index.keyEvent(key, sv ? sv->getCas() : 0, vbucket,
+                       OBS_PERSISTED_EVENT);
     }
 }
 
 void ObserveRegistry::itemModified(const Item &itm) {
-    LockHolder lh(registry_mutex);
-    std::map<std::string,ObserveSet*>::iterator itr;
-    for (itr = registry.begin(); itr != registry.end(); itr++) {
-        if (!itr->second->isExpired()) {
-            itr->second->keyEvent(itm.getKey().c_str(), itm.getCas(),
-                                  itm.getVBucketId(), OBS_MODIFIED_EVENT);
-        } else {
-            removeObserveSet(itr);
-        }
-    }
+    index.keyEvent(itm.getKey(), itm.getCas(), itm.getVBucketId(),
+                   OBS_MODIFIED_EVENT);
 }
 
 void ObserveRegistry::itemDeleted(const std::string &key, const uint64_t cas,
                                   const uint16_t vbucket) {
-    LockHolder lh(registry_mutex);
-    std::map<std::string,ObserveSet*>::iterator itr;
-    for (itr = registry.begin(); itr != registry.end(); itr++) {
-        if (!itr->second->isExpired()) {
-            itr->second->keyEvent(key, cas, vbucket, OBS_DELETED_EVENT);
-        } else {
-            removeObserveSet(itr);
-        }
-    }
+    index.keyEvent(key, cas, vbucket, OBS_DELETED_EVENT);
 }
 
 void ObserveRegistry::itemReplicated(const Item &itm) {
-    LockHolder lh(registry_mutex);
-    std::map<std::string,ObserveSet*>::iterator itr;
-    for (itr = registry.begin(); itr != registry.end(); itr++) {
-        if (!itr->second->isExpired()) {
-            itr->second->keyEvent(itm.getKey().c_str(), itm.getCas(),
-                                  itm.getVBucketId(), OBS_REPLICATED_EVENT);
-        } else {
-            removeObserveSet(itr);
-        }
-    }
+    index.keyEvent(itm.getKey(), itm.getCas(), itm.getVBucketId(),
+                   OBS_REPLICATED_EVENT);
 }
 
 void ObserveRegistry::removeObserveSet(std::map<std::string,ObserveSet*>::iterator itr) {
@@ -152,13 +138,17 @@ void ObserveRegistry::removeObserveSet(std::map<std::string,ObserveSet*>::iterat
 ObserveSet* ObserveRegistry::addObserveSet(const std::string &obs_set_name,
                                            const uint16_t expiration) {
     std::pair<std::map<std::string,ObserveSet*>::iterator,bool> res;
+    ObserveSet *obs_set = new ObserveSet(epstore, stats, &index, nextId++,
+                                         expiration);
     res = registry.insert(std::pair<std::string,ObserveSet*>(obs_set_name,
-                              new ObserveSet(epstore, stats, expiration)));
+                                                             obs_set));
     if (!res.second) {
+        delete obs_set;
         stats->obsErrors++;
         return NULL;
     }
-    stats->totalObserveSets++;
+    deadlines.push(ObserveDeadline(obs_set->getDeadline(), obs_set->getId(),
+                                   obs_set_name));
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL, "Created new observe set: %s",
                      obs_set_name.c_str());
     return res.first->second;
@@ -173,15 +163,16 @@ protocol_binary_response_status ObserveSet::add(const std::string &key, uint64_t
         if (obs_set == observe_set.end()) {
             std::pair<std::map<int,VBObserveSet*>::iterator,bool> res;
             res = observe_set.insert(std::pair<int,VBObserveSet*>(vbucket,
-                                     new VBObserveSet(epstore, stats)));
+                                     new VBObserveSet(epstore, stats, index,
+                                                      &lastTouched)));
             if (!res.second) {
-                lastTouched = gethrtime();
+                lastTouched.set(gethrtime());
                 stats->obsErrors++;
                 return PROTOCOL_BINARY_RESPONSE_ETMPFAIL;
             }
             obs_set = res.first;
         }
-        lastTouched = gethrtime();
+        lastTouched.set(gethrtime());
         if (size >= MAX_OBS_SET_SIZE) {
             stats->obsErrors++;
             return PROTOCOL_BINARY_RESPONSE_EBUSY;
@@ -203,25 +194,12 @@ void ObserveSet::remove(const std::string &key, const uint64_t cas,
         if (vb_observe_set->remove(key, cas)) {
             size--;
         }
-        lastTouched = gethrtime();
-    }
-}
-
-void ObserveSet::keyEvent(const std::string &key, const uint64_t cas,
-                          const uint16_t vbucket, int event) {
-    std::map<int,VBObserveSet*>::iterator itr = observe_set.find(vbucket);
-    if (itr != observe_set.end()) {
-        itr->second->keyEvent(key, cas, event);
-        lastTouched = gethrtime();
+        lastTouched.set(gethrtime());
     }
 }
 
 bool ObserveSet::isExpired() {
-    hrtime_t now = gethrtime();
-    if ((now - lastTouched) > expiration) {
-        return true;
-    }
-    return false;
+    return getDeadline() <= gethrtime();
 }
 
 
@@ -242,24 +220,29 @@ ObserveSet::~ObserveSet() {
     for (itr = observe_set.begin(); itr != observe_set.end(); itr++) {
         size -= itr->second->size();
         delete itr->second;
-        stats->totalObserveSets--;
     }
+    stats->totalObserveSets--;
 }
 
 VBObserveSet::~VBObserveSet() {
+    key_map::iterator itr;
+    for (itr = keylist.begin(); itr != keylist.end(); ++itr) {
+        index->remove(itr->second);
+        delete itr->second;
+    }
     stats->obsRegSize -= keylist.size();
 }
 
 // Returns true if an item was added to the list
 bool VBObserveSet::add(const std::string &key, const uint64_t cas,
                        const uint16_t vbucket) {
-    observed_key_t obs_key(key, cas);
-    std::list<observed_key_t>::iterator itr;
-    for (itr = keylist.begin(); itr != keylist.end(); itr++) {
-        if (itr->key.compare(key) == 0 && itr->cas == cas) {
-            return true;
-        }
+    std::pair<std::string, uint64_t> id(key, cas);
+    if (keylist.find(id) != keylist.end()) {
+        return true;
     }
+    observed_key_t obs_key(key, cas);
+    obs_key.vbucket = vbucket;
+    obs_key.touched = lastTouched;
     StoredValue *sv = (*epstore)->getStoredValue(key, vbucket, false);
     if (sv == NULL) {
         obs_key.deleted = true;
@@ -271,74 +254,57 @@ bool VBObserveSet::add(const std::string &key, const uint64_t cas,
         obs_key.replicas = -1;
     }
     stats->obsRegSize++;
-    keylist.push_back(obs_key);
+    observed_key_t *obs = new observed_key_t(obs_key);
+    keylist[id] = obs;
+    index->add(obs);
     return true;
 }
 
 // Returns true if an item was removed from the list, returns false if
 // the item didn't exist
 bool VBObserveSet::remove(const std::string &key, const uint64_t cas) {
-    std::list<observed_key_t>::iterator itr;
-    for (itr = keylist.begin(); itr != keylist.end(); itr++) {
-        observed_key_t obs_key = *itr;
-        if (obs_key.key.compare(key) == 0 && obs_key.cas == cas) {
-            stats->obsRegSize--;
-            keylist.erase(itr);
-            return true;
-        }
+    key_map::iterator itr = keylist.find(std::make_pair(key, cas));
+    if (itr == keylist.end()) {
+        return false;
     }
-    return false;
+    index->remove(itr->second);
+    delete itr->second;
+    keylist.erase(itr);
+    stats->obsRegSize--;
+    return true;
 }
 
 void VBObserveSet::getState(state_map *sm) {
-    std::list<observed_key_t>::iterator itr;
+    key_map::iterator itr;
     for (itr = keylist.begin(); itr != keylist.end(); itr++) {
+        // Events update the state under the lock of the index.
+        observed_key_t obs(index->getState(itr->second));
         std::stringstream state_key;
         std::stringstream state_value;
-        state_key << itr->key << "," << itr->cas;
-        state_value << (int)itr->replicas << ",";
-        if (itr->deleted) {
+        state_key << obs.key << "," << obs.cas;
+        state_value << (int)obs.replicas << ",";
+        if (obs.deleted) {
             state_value << "deleted";
         }
-        if (itr->mutated) {
-            if (itr->deleted) {
+        if (obs.mutated) {
+            if (obs.deleted) {
                 state_value << ",";
             }
             state_value << "mutated";
         }
-        if (itr->persisted) {
-            if (itr->deleted || itr->mutated) {
+        if (obs.persisted) {
+            if (obs.deleted || obs.mutated) {
                 state_value << ",";
             }
             state_value << "persisted";
         }
-        if (!itr->persisted && !itr->mutated && !itr->deleted) {
+        if (!obs.persisted && !obs.mutated && !obs.deleted) {
             state_value << "none";
         }
         (*sm)[state_key.str()] = state_value.str();
     }
 }
 
-void VBObserveSet::keyEvent(const std::string &key, const uint64_t cas,
-                            int event) {
-    std::list<observed_key_t>::iterator itr;
-    for (itr = keylist.begin(); itr != keylist.end(); itr++) {
-        if (itr->key.compare(key) == 0 && event == OBS_DELETED_EVENT) {
-            itr->deleted = true;
-        } else if (itr->key.compare(key) == 0 && itr->cas != cas &&
-                   event == OBS_MODIFIED_EVENT) {
-            itr->mutated = true;
-            itr->deleted = false;
-        } else if (itr->key.compare(key) == 0 && itr->cas == cas) {
-            if (event == OBS_PERSISTED_EVENT) {
-                itr->persisted = true;
-            } else if (event == OBS_REPLICATED_EVENT) {
-                itr->replicas++;
-            }
-        }
-    }
-}
-
 bool ObserveRegistryCleaner::callback(Dispatcher &d, TaskId t) {
     ++stats.obsCleanerRuns;
     observeRegistry.removeExpired();
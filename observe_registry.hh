@@ -22,32 +22,38 @@
 
 #include <list>
 #include <map>
+#include <queue>
+#include <vector>
 
 #include "common.hh"
 #include "mutex.hh"
 #include "locks.hh"
 #include "dispatcher.hh"
 #include "queueditem.hh"
+#include "observe_index.hh"
 
 class ObserveRegistry;
 
 #include "ep.hh"
 
-typedef struct observed_key_t {
-    observed_key_t(std::string aKey, uint64_t(aCas))
-        : key(aKey), cas(aCas), replicas(0), mutated(false), persisted(false),
-        deleted(false) {
-    }
+typedef std::map<std::string, std::string> state_map;
 
-    std::string key;
-    uint64_t cas;
-    uint8_t replicas;
-    bool mutated;
-    bool persisted;
-    bool deleted;
-} observed_key_t;
+/**
+ * When an observe set expires if nobody touches it: the deadline, the
+ * id of the set and its name.
+ */
+struct ObserveDeadline {
+    ObserveDeadline(hrtime_t d, uint64_t i, const std::string &n)
+        : deadline(d), id(i), name(n) {}
 
-typedef std::map<std::string, std::string> state_map;
+    bool operator >(const ObserveDeadline &other) const {
+        return deadline > other.deadline;
+    }
+
+    hrtime_t    deadline;
+    uint64_t    id;
+    std::string name;
+};
 
 class ObserveSet;
 class VBObserveSet;
@@ -58,9 +64,11 @@ class ObserveRegistry {
 public:
 
     ObserveRegistry(EventuallyPersistentStore **e, EPStats *stats_ptr)
-        : epstore(e), stats(stats_ptr) {
+        : epstore(e), stats(stats_ptr), nextId(1) {
     }
 
+    ~ObserveRegistry();
+
     protocol_binary_response_status observeKey(const std::string &key,
                                                const uint64_t cas,
                                                const uint16_t vbucket,
@@ -92,14 +100,22 @@ private:
     Mutex registry_mutex;
     EventuallyPersistentStore **epstore;
     EPStats *stats;
+    //! Observed keys by key, so events don't need registry_mutex.
+    ObserveIndex index;
+    //! Observe sets by deadline, soonest first.
+    std::priority_queue<ObserveDeadline, std::vector<ObserveDeadline>,
+                        std::greater<ObserveDeadline> > deadlines;
+    uint64_t nextId;
 };
 
 class ObserveSet {
 public:
 
-    ObserveSet(EventuallyPersistentStore **e, EPStats *stats_ptr, uint32_t exp)
+    ObserveSet(EventuallyPersistentStore **e, EPStats *stats_ptr,
+               ObserveIndex *idx, uint64_t anId, uint32_t exp)
         : expiration(exp * ObserveSet::ONE_SECOND), epstore(e), stats(stats_ptr),
-        lastTouched(gethrtime()), size(0) {
+        index(idx), id(anId), lastTouched(gethrtime()), size(0) {
+        stats->totalObserveSets++;
     }
 
     ~ObserveSet();
@@ -108,10 +124,19 @@ public:
                                         const uint16_t vbucket);
     void remove(const std::string &key, const uint64_t cas,
                 const uint16_t vbucket);
-    void keyEvent(const std::string &key, const uint64_t,
-                  const uint16_t vbucket, int event);
     bool isExpired();
 
+    /**
+     * When the set expires unless it's touched before.
+     */
+    hrtime_t getDeadline() {
+        return lastTouched.get() + expiration;
+    }
+
+    uint64_t getId() {
+        return id;
+    }
+
     state_map* getState();
 
 private:
@@ -121,15 +146,19 @@ private:
     std::map<int, VBObserveSet* > observe_set;
     EventuallyPersistentStore **epstore;
     EPStats *stats;
-    hrtime_t lastTouched;
+    ObserveIndex *index;
+    uint64_t id;
+    //! Also set by events on the observed keys.
+    Atomic<hrtime_t> lastTouched;
     int size;
 };
 
 class VBObserveSet {
 public:
 
-    VBObserveSet(EventuallyPersistentStore **e, EPStats *stats_ptr)
-        : epstore(e), stats(stats_ptr) {
+    VBObserveSet(EventuallyPersistentStore **e, EPStats *stats_ptr,
+                 ObserveIndex *idx, Atomic<hrtime_t> *touched)
+        : epstore(e), stats(stats_ptr), index(idx), lastTouched(touched) {
     }
 
     ~VBObserveSet();
@@ -138,14 +167,16 @@ public:
     bool remove(const std::string &key, const uint64_t cas);
     int  size(void) { return keylist.size(); };
     void getState(state_map* sm);
-    void keyEvent(const std::string &key, const uint64_t cas,
-                  int event);
 
 private:
 
-    std::list<observed_key_t> keylist;
+    typedef std::map<std::pair<std::string, uint64_t>, observed_key_t*> key_map;
+
+    key_map keylist;
     EventuallyPersistentStore **epstore;
     EPStats *stats;
+    ObserveIndex *index;
+    Atomic<hrtime_t> *lastTouched;
 };
 
 class ObserveRegistryCleaner : public DispatcherCallback {
@@ -33,6 +33,7 @@ const Priority Priority::VBucketPersistLowPriority("vbucket_persist_low_priority
 const Priority Priority::StatSnapPriority("statsnap_priority", 9);
 const Priority Priority::InvalidItemDbPagerPriority("invalid_item_db_pager_priority", 9);
 const Priority Priority::MutationLogCompactorPriority("mutation_log_compactor_priority", 9);
+const Priority Priority::ValueCacheCompactorPriority("value_cache_compactor_priority", 9);
 
 // Priorities for NON-IO dispatcher
 const Priority Priority::CheckpointRemoverPriority("checkpoint_remover_priority", 6);
@@ -40,6 +41,7 @@ const Priority Priority::ItemPagerPriority("item_pager_priority", 7);
 const Priority Priority::BackfillTaskPriority("backfill_task_priority", 8);
 const Priority Priority::HTResizePriority("hashtable_resize_priority", 211);
 const Priority Priority::ObserveRegistryCleanerPriority("obs_reg_cleaneer_priority", 315);
+const Priority Priority::StatGroupSnapperPriority("stat_group_snapper_priority", 9);
 const Priority Priority::TapResumePriority("tap_resume_priority", 316);
 /**
  * The tap connection reaper run with short iterations to give memory back to the
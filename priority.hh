@@ -27,6 +27,7 @@ public:
     static const Priority StatSnapPriority;
     static const Priority InvalidItemDbPagerPriority;
     static const Priority MutationLogCompactorPriority;
+    static const Priority ValueCacheCompactorPriority;
 
     // Priorities for NON-IO dispatcher
     static const Priority CheckpointRemoverPriority;
@@ -36,6 +37,7 @@ public:
     static const Priority TapConnectionReaperPriority;
     static const Priority HTResizePriority;
     static const Priority ObserveRegistryCleanerPriority;
+    static const Priority StatGroupSnapperPriority;
 
     bool operator==(const Priority &other) const {
         return other.getPriorityValue() == this->priority;
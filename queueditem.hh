@@ -25,6 +25,33 @@ typedef enum {
     vbucket_del_invalid
 } vbucket_del_result;
 
+/**
+ * The state a mutation left its stored value in.  It is attached to
+ * the queued item so the flusher can persist the value without copying
+ * it out of the hash table, as long as the stored value is unchanged.
+ *
+ * The value it holds on to is in mem_used through its Blob; the
+ * snapshot itself is counted as overhead.
+ */
+class QueuedItemSnapshot {
+public:
+    QueuedItemSnapshot(const Item &itm) :
+        value(itm.getValue()), cas(itm.getCas()), exptime(itm.getExptime()),
+        flags(itm.getFlags()) { }
+
+    size_t size() const {
+        return sizeof(QueuedItemSnapshot);
+    }
+
+    value_t  value;
+    uint64_t cas;
+    time_t   exptime;
+    uint32_t flags;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(QueuedItemSnapshot);
+};
+
 /**
  * Representation of an item queued for persistence or tap.
  */
@@ -34,12 +61,13 @@ public:
                enum queue_operation o, const uint16_t vb_version = -1,
                const int64_t rid = -1, const uint32_t seqno = 1)
         : key(k), rowId(rid), seqNum(seqno), queued(ep_current_time()),
-          op(o), vbucket(vb), vbucketVersion(vb_version)
+          op(o), vbucket(vb), vbucketVersion(vb_version), snapshot(NULL)
     {
         ObjectRegistry::onCreateQueuedItem(this);
     }
 
     ~QueuedItem() {
+        clearSnapshot();
         ObjectRegistry::onDeleteQueuedItem(this);
     }
 
@@ -59,6 +87,33 @@ public:
         op = o;
     }
 
+    /**
+     * Remember the state the given item (just stored in the hash
+     * table) left the stored value in.  Only the flusher may look at
+     * or clear the snapshot afterwards, except that the checkpoint
+     * drops it when the item is replaced before the flusher got it.
+     */
+    void setSnapshot(const Item &itm) {
+        assert(snapshot == NULL);
+        snapshot = new QueuedItemSnapshot(itm);
+        ObjectRegistry::onCreateQueuedItemSnapshot(snapshot);
+    }
+
+    const QueuedItemSnapshot *getSnapshot() const {
+        return snapshot;
+    }
+
+    /**
+     * Drop the snapshot (and the reference it holds on the value).
+     */
+    void clearSnapshot() {
+        if (snapshot) {
+            ObjectRegistry::onDeleteQueuedItemSnapshot(snapshot);
+            delete snapshot;
+            snapshot = NULL;
+        }
+    }
+
     bool operator <(const QueuedItem &other) const {
         return getVBucketId() == other.getVBucketId() ?
             getKey() < other.getKey() : getVBucketId() < other.getVBucketId();
@@ -76,6 +131,7 @@ private:
     enum queue_operation op;
     uint16_t vbucket;
     uint16_t vbucketVersion;
+    QueuedItemSnapshot *snapshot;
 
     DISALLOW_COPY_AND_ASSIGN(QueuedItem);
 };
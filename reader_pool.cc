@@ -0,0 +1,129 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include "reader_pool.hh"
+#include "locks.hh"
+#include "objectregistry.hh"
+#include "stats.hh"
+
+extern "C" {
+    static void *readerPoolMain(void *arg);
+}
+
+static void *readerPoolMain(void *arg) {
+    PoolReader *reader = static_cast<PoolReader*>(arg);
+    try {
+        reader->pool->run(reader->store);
+    } catch (std::exception& e) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Reader pool: Caught an exception: %s\n", e.what());
+    } catch(...) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Reader pool: Caught a fatal exception\n");
+    }
+    return NULL;
+}
+
+ReaderPool::ReaderPool(EventuallyPersistentEngine &e, EPStats &st,
+                       const std::vector<KVStore*> &stores)
+    : engine(e), stats(st), readers(stores.size()), running(false) {
+    for (size_t i = 0; i < stores.size(); ++i) {
+        readers[i].pool = this;
+        readers[i].store = stores[i];
+    }
+}
+
+ReaderPool::~ReaderPool() {
+    stop();
+    std::vector<PoolReader>::iterator it;
+    for (it = readers.begin(); it != readers.end(); ++it) {
+        delete it->store;
+    }
+}
+
+void ReaderPool::start() {
+    LockHolder lh(mutex);
+    assert(!running);
+    running = true;
+    for (size_t i = 0; i < readers.size(); ++i) {
+        if (pthread_create(&readers[i].thread, NULL,
+                           readerPoolMain, &readers[i]) != 0) {
+            throw std::runtime_error("Reader pool: Initialization error!!!");
+        }
+    }
+}
+
+void ReaderPool::stop() {
+    LockHolder lh(mutex);
+    if (!running) {
+        return;
+    }
+    running = false;
+    mutex.notify();
+    lh.unlock();
+
+    std::vector<PoolReader>::iterator it;
+    for (it = readers.begin(); it != readers.end(); ++it) {
+        void *rcode;
+        (void)pthread_join(it->thread, &rcode);
+    }
+
+    lh.lock();
+    std::list<ReadRequest> dropped;
+    dropped.swap(queue);
+    lh.unlock();
+
+    // Whoever queued them is still waiting for an answer.
+    std::list<ReadRequest>::iterator rit;
+    for (rit = dropped.begin(); rit != dropped.end(); ++rit) {
+        GetValue gv(NULL, ENGINE_TMPFAIL);
+        rit->cb->callback(gv);
+        --stats.bgReadsInFlight;
+    }
+}
+
+void ReaderPool::getAsync(const std::string &key, uint64_t rowid,
+                          uint16_t vbucket, uint16_t vbver,
+                          shared_ptr<Callback<GetValue> > cb) {
+    ReadRequest req;
+    req.key = key;
+    req.rowid = rowid;
+    req.vbucket = vbucket;
+    req.vbver = vbver;
+    req.cb = cb;
+    req.queued = gethrtime();
+
+    LockHolder lh(mutex);
+    queue.push_back(req);
+    stats.bgMaxReadsInFlight.setIfBigger(++stats.bgReadsInFlight);
+    mutex.notify();
+}
+
+void ReaderPool::run(KVStore *store) {
+    ObjectRegistry::onSwitchThread(&engine);
+    for (;;) {
+        LockHolder lh(mutex);
+        while (running && queue.empty()) {
+            mutex.wait();
+        }
+        if (!running) {
+            break;
+        }
+        ReadRequest req(queue.front());
+        queue.pop_front();
+        lh.unlock();
+
+        hrtime_t start(gethrtime());
+        RememberingCallback<GetValue> gcb;
+        store->get(req.key, req.rowid, req.vbucket, req.vbver, gcb);
+        gcb.waitForValue();
+        hrtime_t stop(gethrtime());
+
+        if (stop > start && start > req.queued) {
+            stats.diskReadWaitHisto.add((start - req.queued) / 1000);
+            stats.diskReadHisto.add((stop - start) / 1000);
+        }
+        req.cb->callback(gcb.val);
+        --stats.bgReadsInFlight;
+    }
+}
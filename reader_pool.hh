@@ -0,0 +1,102 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef READER_POOL_HH
+#define READER_POOL_HH 1
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "callbacks.hh"
+#include "histo.hh"
+#include "kvstore.hh"
+#include "syncobject.hh"
+
+class EventuallyPersistentEngine;
+class ReaderPool;
+
+/**
+ * The argument passed to each of the reader threads.
+ */
+struct PoolReader {
+    ReaderPool *pool;
+    KVStore    *store;
+    pthread_t   thread;
+};
+
+/**
+ * A read waiting for a reader thread.
+ */
+struct ReadRequest {
+    std::string                      key;
+    uint64_t                         rowid;
+    uint16_t                         vbucket;
+    uint16_t                         vbver;
+    shared_ptr<Callback<GetValue> >  cb;
+    hrtime_t                         queued;
+};
+
+/**
+ * Reads items from a kv store on a pool of threads so the caller
+ * doesn't have to wait for the disk.
+ *
+ * Each thread reads through its own kv store instance, so as many
+ * reads as there are threads are served by the storage layer at once.
+ * The callback of a read fires on the reader thread that performed it.
+ */
+class ReaderPool {
+public:
+
+    /**
+     * Create a pool with one thread per store.  The pool owns the
+     * stores and deletes them when it's destroyed.
+     */
+    ReaderPool(EventuallyPersistentEngine &e, EPStats &st,
+               const std::vector<KVStore*> &stores);
+
+    ~ReaderPool();
+
+    /**
+     * Start the reader threads.
+     */
+    void start();
+
+    /**
+     * Stop the reader threads.  Reads that didn't start yet are
+     * dropped, and their callbacks fire with ENGINE_TMPFAIL.
+     */
+    void stop();
+
+    /**
+     * Queue a read of an item; the callback fires once it was read.
+     */
+    void getAsync(const std::string &key, uint64_t rowid,
+                  uint16_t vbucket, uint16_t vbver,
+                  shared_ptr<Callback<GetValue> > cb);
+
+    /**
+     * The number of reader threads.
+     */
+    size_t getNumReaders() const {
+        return readers.size();
+    }
+
+    /**
+     * Serve reads until the pool is stopped.
+     */
+    void run(KVStore *store);
+
+private:
+
+    EventuallyPersistentEngine &engine;
+    EPStats                    &stats;
+    std::vector<PoolReader>     readers;
+    SyncObject                  mutex;
+    std::list<ReadRequest>      queue;
+    bool                        running;
+
+    DISALLOW_COPY_AND_ASSIGN(ReaderPool);
+};
+
+#endif /* READER_POOL_HH */
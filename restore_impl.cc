@@ -24,17 +24,23 @@
 #include "embedded/sqlite3.h"
 #endif
 
+// Every reader thread runs the query with its own sqlite connection and
+// only sees the vbuckets where (vbucket_id % readers) equals its own
+// partition number. Keeping a vbucket within a single reader preserves
+// the newest-first ordering the restore depends on for each key.
 static const char *checks_enabled_query =
     "select cpoint_op.vbucket_id,op,key,flg,exp,cas,val,cpoint_op.cpoint_id "
     "from cpoint_state "
     "  join cpoint_op on (cpoint_op.vbucket_id = cpoint_state.vbucket_id and"
     "                     cpoint_op.cpoint_id = cpoint_state.cpoint_id) "
     "where cpoint_state.state = \"closed\" "
+    "  and (cpoint_op.vbucket_id % ?1) = ?2 "
     "order by cpoint_op.cpoint_id desc";
 
 static const char *checks_disabled_query =
     "select cpoint_op.vbucket_id,op,key,flg,exp,cas,val,cpoint_id "
-    "from cpoint_op ";
+    "from cpoint_op "
+    "where (cpoint_op.vbucket_id % ?1) = ?2";
 
 static const int vbucket_id_idx = 0;
 static const int op_idx = 1;
@@ -45,8 +51,17 @@ static const int cas_idx = 5;
 static const int val_idx = 6;
 static const int cpoint_idx = 7;
 
+// The number of restored items a reader collects before handing them
+// over to the flusher.
+static const size_t RESTORE_BATCH_SIZE = 256;
+
+// Upper bound for the time a reader sleeps while waiting for the
+// flusher and the item pager to catch up.
+static const useconds_t MAX_THROTTLE_SLEEP = 100000;
+
 extern "C" {
     static void *restoreThreadMain(void *arg);
+    static void *restoreReaderMain(void *arg);
 }
 
 /**
@@ -75,12 +90,25 @@ const State State::Starting("starting");
 const State State::Running("running");
 const State State::Zombie("zombie");
 
+class DecrementalRestorer;
+
+/**
+ * The argument passed to each of the reader threads.
+ */
+struct RestoreReader {
+    DecrementalRestorer *restorer;
+    size_t partition;
+    pthread_t thread;
+};
+
 /**
  * Hehe.. Since we're applying all of the incremental backups in the
  * let's let the name reflect that ;-)
  *
  * The DecrementalRestorer is responsible for processing a single
  * incremental restore file and add all of it's content to epengine.
+ * The file is read by a number of reader threads, each owning a
+ * disjoint set of vbuckets.
  *
  */
 class DecrementalRestorer {
@@ -90,27 +118,26 @@ public:
      * its member variable.
      * @param theEngine where to restore the data
      * @param dbname the name of the incremental database to restore
+     * @param restore_file_checks only restore closed checkpoints
+     * @param nreaders the number of threads reading the file
+     * @param maxpending the number of items we may have waiting for the
+     *                   flusher before the readers back off
+     * @param term set when the restore should stop as soon as possible
      */
     DecrementalRestorer(EventuallyPersistentEngine &theEngine,
-                        const std::string &dbname, bool restore_file_checks) :
-        db(NULL), statement(NULL), engine(theEngine),
-        store(*engine.getEpStore()), file(dbname),
-        expired(0), wrongVBucket(0), restored(0), skipped(0), busy(0), restore_cpoint(0)
+                        const std::string &dbname, bool restore_file_checks,
+                        size_t nreaders, size_t maxpending,
+                        Atomic<bool> &term) :
+        engine(theEngine), store(*engine.getEpStore()),
+        stats(engine.getEpStats()), file(dbname),
+        readers(nreaders == 0 ? 1 : nreaders), maxPending(maxpending),
+        terminate(term), expired(0), wrongVBucket(0), restored(0),
+        skipped(0), busy(0), throttled(0), restore_cpoint(0),
+        startTime(0), endTime(0)
     {
         query = restore_file_checks == true ? checks_enabled_query : checks_disabled_query;
     }
 
-    /**
-     * Release all allocated resources. We might have the database in an
-     * open state if an exception is thrown during restore.
-     */
-    ~DecrementalRestorer() {
-        if (db != NULL) {
-            (void)sqlite3_finalize(statement);
-            (void)sqlite3_close(db);
-        }
-    }
-
     const std::string &getDbFile() const
     {
         return file;
@@ -140,49 +167,161 @@ public:
         return expired;
     }
 
+    uint32_t getNumThrottled() const {
+        return throttled;
+    }
+
+    size_t getNumReaders() const {
+        return readers;
+    }
+
+    /**
+     * Get the number of rows processed from the file so far.
+     */
+    uint32_t getNumRows() const {
+        return restored + skipped + expired + wrongVBucket;
+    }
+
+    /**
+     * Get the time spent processing this file (in usec).
+     */
+    hrtime_t getElapsed() const {
+        hrtime_t start = startTime;
+        if (start == 0) {
+            return 0;
+        }
+        hrtime_t end = endTime;
+        return ((end == 0 ? gethrtime() : end) - start) / 1000;
+    }
+
     /**
      * Process this database file
      * @throw a string describing why an error occured
      */
     void process() throw (std::string) {
-        if (sqlite3_open(file.c_str(), &db) !=  SQLITE_OK) {
-            db = NULL;
-            throw std::string("Failed to open database");
+        startTime = gethrtime();
+        std::vector<RestoreReader> threads(readers);
+        size_t started = 1;
+        for (; started < readers; ++started) {
+            threads[started].restorer = this;
+            threads[started].partition = started;
+            if (pthread_create(&threads[started].thread, NULL,
+                               restoreReaderMain, &threads[started]) != 0) {
+                setError("Failed to create restore reader thread");
+                break;
+            }
         }
 
-        if (sqlite3_prepare_v2(db, query,
-                               strlen(query),
-                               &statement, NULL) != SQLITE_OK) {
-            (void)sqlite3_finalize(statement);
-            (void)sqlite3_close(db);
-            db = NULL;
-            throw std::string("Failed to prepare statement");
+        // The calling thread takes care of the first partition
+        if (!failed.get()) {
+            processPartition(0);
         }
 
-        int rc;
-        while ((rc = sqlite3_step(statement)) != SQLITE_DONE) {
-            if (rc == SQLITE_ROW) {
-                processEntry();
-            } else if (rc == SQLITE_BUSY) {
-                ++busy;
-            } else {
-                std::stringstream ss;
-                ss << "sqlite error: " << sqlite3_errmsg(db);
-                throw std::string(ss.str());
+        for (size_t ii = 1; ii < started; ++ii) {
+            void *rcode;
+            (void)pthread_join(threads[ii].thread, &rcode);
+        }
+        endTime = gethrtime();
+
+        LockHolder lh(mutex);
+        if (!errorMsg.empty()) {
+            throw std::string(errorMsg);
+        }
+    }
+
+    /**
+     * Restore all of the vbuckets belonging to the given partition
+     * of the file. Errors are recorded and stop the other readers.
+     */
+    void processPartition(size_t partition) {
+        ObjectRegistry::onSwitchThread(&engine);
+        sqlite3 *db(NULL);
+        sqlite3_stmt *statement(NULL);
+        std::vector<queued_item> batch;
+        batch.reserve(RESTORE_BATCH_SIZE);
+
+        try {
+            if (sqlite3_open(file.c_str(), &db) !=  SQLITE_OK) {
+                throw std::string("Failed to open database");
+            }
+
+            if (sqlite3_prepare_v2(db, query,
+                                   strlen(query),
+                                   &statement, NULL) != SQLITE_OK ||
+                sqlite3_bind_int64(statement, 1, readers) != SQLITE_OK ||
+                sqlite3_bind_int64(statement, 2, partition) != SQLITE_OK) {
+                throw std::string("Failed to prepare statement");
             }
+
+            int rc;
+            while (!shouldStop() &&
+                   (rc = sqlite3_step(statement)) != SQLITE_DONE) {
+                if (rc == SQLITE_ROW) {
+                    processEntry(statement, batch);
+                    if (batch.size() >= RESTORE_BATCH_SIZE) {
+                        store.queueRestoredItems(batch);
+                        throttle();
+                    }
+                } else if (rc == SQLITE_BUSY) {
+                    ++busy;
+                } else {
+                    std::stringstream ss;
+                    ss << "sqlite error: " << sqlite3_errmsg(db);
+                    throw std::string(ss.str());
+                }
+            }
+        } catch (std::string message) {
+            setError(message);
         }
 
+        store.queueRestoredItems(batch);
         (void)sqlite3_finalize(statement);
         (void)sqlite3_close(db);
-        db = NULL;
     }
 
 private:
 
+    bool shouldStop() {
+        return terminate.get() || failed.get();
+    }
+
+    void setError(const std::string &message) {
+        LockHolder lh(mutex);
+        if (errorMsg.empty()) {
+            errorMsg.assign(message);
+        }
+        failed.set(true);
+    }
+
+    /**
+     * The restored items can't be evicted before they're persisted, so
+     * back off while the flusher is behind or we're above the high
+     * watermark and give the flusher and the item pager a chance to
+     * catch up.
+     */
+    bool shouldThrottle() {
+        size_t pending = store.getNumPendingRestoreItems() + stats.flusher_todo.get();
+        if (pending >= maxPending) {
+            return true;
+        }
+        size_t memory = stats.currentSize.get() + stats.memOverhead.get();
+        return memory >= stats.mem_high_wat.get();
+    }
+
+    void throttle() {
+        useconds_t sleepTime = 1000;
+        while (!shouldStop() && shouldThrottle()) {
+            ++throttled;
+            usleep(sleepTime);
+            sleepTime = std::min(sleepTime << 1, MAX_THROTTLE_SLEEP);
+        }
+    }
+
     /**
      * callback to process the current item
      */
-    void processEntry() throw(std::string) {
+    void processEntry(sqlite3_stmt *statement,
+                      std::vector<queued_item> &batch) throw(std::string) {
         uint32_t exptime = sqlite3_column_int(statement, exp_idx);
         if (exptime != 0 && exptime <  static_cast<int64_t>(ep_real_time())) {
             ++expired;
@@ -203,17 +342,15 @@ private:
 
         uint16_t vbid =  (uint16_t)sqlite3_column_int(statement,
                                                       vbucket_id_idx);
-        if (!restore_cpoint) {
-            restore_cpoint = (uint32_t)sqlite3_column_int(statement,
-                                                            cpoint_idx);
-        }
+        restore_cpoint.setIfBigger((uint32_t)sqlite3_column_int(statement,
+                                                                cpoint_idx));
 
         uint32_t flags = sqlite3_column_int(statement, flag_idx);
         time_t expiration = sqlite3_column_int(statement, exp_idx);
         uint64_t cas = sqlite3_column_int64(statement, cas_idx);
 
         Item itm(key, flags, expiration, value, cas, -1, vbid);
-        int r = store.restoreItem(itm, op);
+        int r = store.restoreItem(itm, op, &batch);
         if (r == 0) {
             ++restored;
         } else if (r == 1) {
@@ -223,17 +360,25 @@ private:
         }
     }
 
-    sqlite3 *db;
-    sqlite3_stmt *statement;
     EventuallyPersistentEngine &engine;
     EventuallyPersistentStore &store;
+    EPStats &stats;
     const std::string file;
-    uint32_t expired;
-    uint32_t wrongVBucket;
-    uint32_t restored;
-    uint32_t skipped;
-    uint32_t busy;
-    uint32_t restore_cpoint;
+    const size_t readers;
+    const size_t maxPending;
+    Atomic<bool> &terminate;
+    Atomic<bool> failed;
+    Mutex mutex;
+    std::string errorMsg;
+    Atomic<uint32_t> expired;
+    Atomic<uint32_t> wrongVBucket;
+    Atomic<uint32_t> restored;
+    Atomic<uint32_t> skipped;
+    Atomic<uint32_t> busy;
+    Atomic<uint32_t> throttled;
+    Atomic<uint32_t> restore_cpoint;
+    Atomic<hrtime_t> startTime;
+    Atomic<hrtime_t> endTime;
     const char *query;
 };
 
@@ -247,6 +392,7 @@ public:
         restored(0),
         skipped(0),
         busy(0),
+        throttled(0),
         restore_cpoint(0),
         restore_file_checks(true),
         state(&State::Uninitialized)
@@ -272,7 +418,12 @@ public:
         }
 
         assert(instance == NULL);
-        instance = new DecrementalRestorer(engine, config, restore_file_checks);
+        terminate.set(false);
+        Configuration &conf = engine.getConfiguration();
+        instance = new DecrementalRestorer(engine, config, restore_file_checks,
+                                           conf.getRestoreReaders(),
+                                           conf.getRestoreQueueCap(),
+                                           terminate);
         setState_UNLOCKED(State::Initialized);
     }
 
@@ -336,6 +487,7 @@ public:
             addStat(cookie, "number_restored", restored, add_stat);
             addStat(cookie, "number_expired", expired, add_stat);
             addStat(cookie, "number_wrong_vbucket", wrongVBucket, add_stat);
+            addStat(cookie, "number_throttled", throttled, add_stat);
         } else {
             addStat(cookie, "restore_checkpoint", restore_cpoint ? restore_cpoint :
                                         instance->getRestoreCheckpoint(), add_stat);
@@ -350,6 +502,22 @@ public:
                     instance->getNumExpired() + expired, add_stat);
             addStat(cookie, "number_wrong_vbucket",
                     instance->getNumWrongVBucket() + wrongVBucket, add_stat);
+            addStat(cookie, "number_throttled",
+                    instance->getNumThrottled() + throttled, add_stat);
+            addStat(cookie, "readers", instance->getNumReaders(), add_stat);
+            addStat(cookie, "pending_items",
+                    engine.getEpStore()->getNumPendingRestoreItems(), add_stat);
+
+            // Progress of the current file
+            hrtime_t elapsed = instance->getElapsed();
+            uint32_t rows = instance->getNumRows();
+            addStat(cookie, "file_rows", rows, add_stat);
+            addStat(cookie, "file_elapsed", elapsed, add_stat);
+            if (elapsed > 0) {
+                addStat(cookie, "file_rows_per_sec",
+                        static_cast<uint64_t>(rows) * 1000000 / elapsed,
+                        add_stat);
+            }
             addStat(cookie, "terminate", terminate, add_stat);
         }
     }
@@ -386,6 +554,9 @@ private:
         skipped += instance->getNumSkipped();
         busy += instance->getNumBusy();
         restored += instance->getNumRestored();
+        expired += instance->getNumExpired();
+        wrongVBucket += instance->getNumWrongVBucket();
+        throttled += instance->getNumThrottled();
         if (!restore_cpoint) {
             restore_cpoint = instance->getRestoreCheckpoint();
         }
@@ -427,6 +598,7 @@ private:
     uint32_t restored;
     uint32_t skipped;
     uint32_t busy;
+    uint32_t throttled;
     uint32_t restore_cpoint;
     bool restore_file_checks;
 
@@ -455,3 +627,10 @@ static void *restoreThreadMain(void *arg)
     return instance->run();
 }
 
+static void *restoreReaderMain(void *arg)
+{
+    RestoreReader *reader = reinterpret_cast<RestoreReader*>(arg);
+    reader->restorer->processPartition(reader->partition);
+    return NULL;
+}
+
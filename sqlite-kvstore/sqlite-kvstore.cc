@@ -303,6 +303,38 @@ void StrategicSqlite3::dump(uint16_t vb, shared_ptr<Callback<GetValue> > cb) {
     strategy->closeVBStatements(loaders);
 }
 
+bool StrategicSqlite3::dumpFrom(uint16_t vb, DumpPosition &pos, size_t limit,
+                                shared_ptr<Callback<GetValue> > cb) {
+    assert(strategy->hasEfficientVBLoad());
+    std::vector<PreparedStatement*> loaders(strategy->getVBStatements(vb, select_range));
+
+    // Each call runs its own short query, so dumps of the same
+    // vbucket for different connections can be interleaved.
+    size_t n(0);
+    while (pos.part < loaders.size() && n < limit) {
+        PreparedStatement *st = loaders[pos.part];
+        size_t want(limit - n);
+        st->bind64(1, static_cast<uint64_t>(pos.rowid));
+        st->bind64(2, want);
+        size_t fetched(0);
+        while (st->fetch()) {
+            pos.rowid = st->column_int64(7);
+            processDumpRow(stats, st, cb);
+            ++fetched;
+        }
+        st->reset();
+        n += fetched;
+        if (fetched < want) {
+            ++pos.part;
+            pos.rowid = -1;
+        }
+    }
+
+    strategy->closeVBStatements(loaders);
+    pos.done = pos.part >= loaders.size();
+    return pos.done;
+}
+
 
 static char lc(const char i) {
     return std::tolower(i);
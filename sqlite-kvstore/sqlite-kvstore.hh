@@ -88,7 +88,7 @@ public:
      */
     bool begin() {
         if(!intransaction) {
-            if (execute("begin immediate") != -1) {
+            if (execute(SqliteStrategy::getBeginStatement()) != -1) {
                 intransaction = true;
             }
         }
@@ -164,6 +164,12 @@ public:
 
     void dump(uint16_t vb, shared_ptr<Callback<GetValue> > cb);
 
+    /**
+     * Overrides dumpFrom
+     */
+    bool dumpFrom(uint16_t vb, DumpPosition &pos, size_t limit,
+                  shared_ptr<Callback<GetValue> > cb);
+
     size_t getNumShards() {
         return strategy->getNumOfDbShards();
     }
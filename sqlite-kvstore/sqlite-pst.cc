@@ -149,6 +149,8 @@ void Statements::initStatements(const StatementFactory *sfact) {
     assert(sel_stmt);
     all_stmt = sfact->mkSelectAll(db, tableName);
     assert(all_stmt);
+    range_stmt = sfact->mkSelectRange(db, tableName);
+    assert(range_stmt);
     del_stmt = sfact->mkDelete(db, tableName);
     assert(del_stmt);
     del_vb_stmt = sfact->mkDeleteVBucket(db, tableName);
@@ -194,6 +196,16 @@ PreparedStatement *StatementFactory::mkSelectAll(sqlite3 *db,
     return new PreparedStatement(db, buf);
 }
 
+PreparedStatement *StatementFactory::mkSelectRange(sqlite3 *db,
+                                                   const std::string &table) const {
+    char buf[1024];
+    // Same columns as mkSelectAll, for the rows after a given rowid.
+    snprintf(buf, sizeof(buf),
+             "select k, v, flags, exptime, cas, vbucket, vb_version, rowid "
+             "from %s where rowid > ? order by rowid limit ?", table.c_str());
+    return new PreparedStatement(db, buf);
+}
+
 PreparedStatement *StatementFactory::mkDelete(sqlite3 *db,
                                               const std::string &table) const {
     char buf[1024];
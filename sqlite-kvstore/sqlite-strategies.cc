@@ -14,6 +14,7 @@
 static const int CURRENT_SCHEMA_VERSION(2);
 
 bool SqliteStrategy::shouldCheckSchemaVersion = true;
+bool SqliteStrategy::immediateTransactions = true;
 
 extern "C" {
 
@@ -565,6 +566,9 @@ std::vector<PreparedStatement*> ShardedMultiTableSqliteStrategy::getVBStatements
         case select_all:
             rv.push_back(st.at(vb)->all());
             break;
+        case select_range:
+            rv.push_back(st.at(vb)->range());
+            break;
         case delete_vbucket:
             rv.push_back(st.at(vb)->del_vb());
             break;
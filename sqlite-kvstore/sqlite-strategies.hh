@@ -15,6 +15,7 @@ class EventuallyPersistentEngine;
 
 typedef enum {
     select_all,
+    select_range,
     delete_vbucket
 } vb_statement_type;
 
@@ -104,6 +105,19 @@ public:
         shouldCheckSchemaVersion = false;
     }
 
+    /**
+     * Lock the shards a transaction writes to when it first writes to
+     * them rather than all of them when it begins, so connections
+     * writing to different shards don't wait for each other.
+     */
+    static void deferTransactionLocks() {
+        immediateTransactions = false;
+    }
+
+    static const char *getBeginStatement() {
+        return immediateTransactions ? "begin immediate" : "begin";
+    }
+
     SQLiteStats         sqliteStats;
 
 protected:
@@ -137,6 +151,7 @@ protected:
     void destroyMetaStatements();
 
     static bool shouldCheckSchemaVersion;
+    static bool immediateTransactions;
 
     sqlite3            *db;
     const char * const  filename;
@@ -217,6 +232,9 @@ public:
             case select_all:
                 rv.push_back((*it)->all());
                 break;
+            case select_range:
+                rv.push_back((*it)->range());
+                break;
             case delete_vbucket:
                 rv.push_back((*it)->del_vb());
                 break;
@@ -350,6 +368,9 @@ public:
         case select_all:
             rv.push_back(statements.at(vb)->all());
             break;
+        case select_range:
+            rv.push_back(statements.at(vb)->range());
+            break;
         case delete_vbucket:
             rv.push_back(statements.at(vb)->del_vb());
             break;
@@ -14,6 +14,10 @@
 #define DEFAULT_MAX_DATA_SIZE (std::numeric_limits<size_t>::max())
 #endif
 
+#ifndef DEFAULT_EXPIRY_INDEX_MAX_ENTRIES
+#define DEFAULT_EXPIRY_INDEX_MAX_ENTRIES (1024 * 1024)
+#endif
+
 static const hrtime_t ONE_SECOND(1000000);
 
 /**
@@ -23,6 +27,7 @@ class EPStats {
 public:
 
     EPStats() : maxDataSize(DEFAULT_MAX_DATA_SIZE),
+                expiryIndexMaxEntries(DEFAULT_EXPIRY_INDEX_MAX_ENTRIES),
                 dirtyAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
                 dataAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
                 diskCommitHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
@@ -114,10 +119,16 @@ public:
     Atomic<size_t> pagerRuns;
     //! Number of times the expiry pager runs for purging expired items
     Atomic<size_t> expiryPagerRuns;
+    //! Number of items the expiry pager purged
+    Atomic<size_t> expiryPagerExpired;
+    //! Items purged per second by the expiry pager between its last two runs
+    Atomic<size_t> expiryPagerRate;
     //! Number of times the checkpoint remover runs for removing closed unreferenced checkpoints.
     Atomic<size_t> checkpointRemoverRuns;
     //! Number of items removed from closed unreferenced checkpoints.
     Atomic<size_t> itemsRemovedFromCheckpoints;
+    //! Number of checkpoint key lookups answered by the key filter alone.
+    Atomic<size_t> chkKeyFilterSkips;
     //! Number of times a value is ejected
     Atomic<size_t> numValueEjects;
     //! Number of times a replica value is ejected
@@ -142,6 +153,10 @@ public:
     Atomic<size_t> totalValueSize;
     //! Amount of memory used to track items and what-not.
     Atomic<size_t> memOverhead;
+    //! Number of keys in the expiry indexes of all hash tables.
+    Atomic<size_t> expiryIndexEntries;
+    //! The most keys the expiry indexes may hold between them.
+    Atomic<size_t> expiryIndexMaxEntries;
 
     //! Pager low water mark.
     Atomic<size_t> mem_low_wat;
@@ -205,6 +220,33 @@ public:
     //! Histogram of background wait loads.
     Histogram<hrtime_t> bgLoadHisto;
 
+    //! Number of reads queued or running in the reader pool
+    Atomic<size_t> bgReadsInFlight;
+    //! The most reads the reader pool had at once
+    Atomic<size_t> bgMaxReadsInFlight;
+    //! Histogram of the time reads waited for a reader thread.
+    Histogram<hrtime_t> diskReadWaitHisto;
+    //! Histogram of the time the storage layer took to read an item.
+    Histogram<hrtime_t> diskReadHisto;
+
+    //! Number of background fetches served by the value cache
+    Atomic<size_t> valueCacheHits;
+    //! Number of background fetches the value cache couldn't serve
+    Atomic<size_t> valueCacheMisses;
+    //! Number of ejected values written to the value cache
+    Atomic<size_t> valueCacheWrites;
+    //! Number of ejected values that didn't fit in the value cache
+    Atomic<size_t> valueCacheWriteFailures;
+    //! Number of times the value cache was compacted
+    Atomic<size_t> valueCacheCompactorRuns;
+    //! Histogram of the time the value cache took to read a value.
+    Histogram<hrtime_t> valueCacheReadHisto;
+
+    //! Number of reads sampled by the hot key tracker
+    Atomic<size_t> hotKeySamples;
+    //! Number of sampled reads served without the bucket lock
+    Atomic<size_t> hotKeyLockFreeSamples;
+
     //! Histogram of time an item spends non-resident.
     Histogram<rel_time_t> pagedOutTimeHisto;
 
@@ -296,6 +338,12 @@ public:
     //! Histogram of get commands.
     Histogram<hrtime_t> getCmdHisto;
 
+    //! Histogram of batched get commands.
+    Histogram<hrtime_t> getMultiCmdHisto;
+
+    //! Histogram of batched set commands.
+    Histogram<hrtime_t> setMultiCmdHisto;
+
     //! Histogram of arithmetic commands.
     Histogram<hrtime_t> arithCmdHisto;
 
@@ -336,6 +384,24 @@ public:
     //! Histogram of disk commits
     Histogram<hrtime_t> diskCommitHisto;
 
+    //! Histogram of collecting the dirty items at the start of a flush
+    Histogram<hrtime_t> flushCollectHisto;
+
+    //! Histogram of deduplicating and sorting the items of a flush
+    Histogram<hrtime_t> flushDedupHisto;
+
+    //! Histogram of distributing the items of a flush to the db shards
+    Histogram<hrtime_t> flushShardHisto;
+
+    //! Histogram of writing a transaction worth of items
+    Histogram<hrtime_t> flushWriteHisto;
+
+    //! Histogram of the hash bucket lock hold time per flushed item (ns)
+    Histogram<hrtime_t> flushLockHoldHisto;
+
+    //! Histogram of expiry pager runs
+    Histogram<hrtime_t> expiryPagerHisto;
+
     //! Histogram of purging a chunk of items with the old vbucket version from disk
     Histogram<hrtime_t> diskInvaidItemDelHisto;
 
@@ -367,6 +433,7 @@ public:
         pagerRuns.set(0);
         checkpointRemoverRuns.set(0);
         itemsRemovedFromCheckpoints.set(0);
+        chkKeyFilterSkips.set(0);
         numValueEjects.set(0);
         numFailedEjects.set(0);
         numNotMyVBuckets.set(0);
@@ -381,6 +448,7 @@ public:
         bgMaxWait.set(0);
         bgMinLoad.set(999999999);
         bgMaxLoad.set(0);
+        bgMaxReadsInFlight.set(bgReadsInFlight.get());
         tapBgNumOperations.set(0);
         tapBgWait.set(0);
         tapBgLoad.set(0);
@@ -403,10 +471,20 @@ public:
         obsErrors.set(0);
         obsCleanerRuns.set(0);
         mlogCompactorRuns.set(0);
+        valueCacheHits.set(0);
+        valueCacheMisses.set(0);
+        valueCacheWrites.set(0);
+        valueCacheWriteFailures.set(0);
+        valueCacheCompactorRuns.set(0);
+        hotKeySamples.set(0);
+        hotKeyLockFreeSamples.set(0);
 
         pendingOpsHisto.reset();
         bgWaitHisto.reset();
         bgLoadHisto.reset();
+        diskReadWaitHisto.reset();
+        diskReadHisto.reset();
+        valueCacheReadHisto.reset();
         pagedOutTimeHisto.reset();
         tapBgWaitHisto.reset();
         tapBgLoadHisto.reset();
@@ -414,6 +492,8 @@ public:
         setVbucketCmdHisto.reset();
         delVbucketCmdHisto.reset();
         getCmdHisto.reset();
+        getMultiCmdHisto.reset();
+        setMultiCmdHisto.reset();
         arithCmdHisto.reset();
         tapVbucketResetHisto.reset();
         tapMutationHisto.reset();
@@ -426,6 +506,12 @@ public:
         diskVBDelHisto.reset();
         diskInvalidVBTableDelHisto.reset();
         diskCommitHisto.reset();
+        flushCollectHisto.reset();
+        flushDedupHisto.reset();
+        flushShardHisto.reset();
+        flushWriteHisto.reset();
+        flushLockHoldHisto.reset();
+        expiryPagerHisto.reset();
         diskInvaidItemDelHisto.reset();
 
         dataAgeHisto.reset();
@@ -9,6 +9,7 @@
 #include "common.hh"
 #include "statsnap.hh"
 #include "ep_engine.h"
+#include "statwriter.hh"
 
 extern "C" {
     static void add_stat(const char *key, const uint16_t klen,
@@ -38,3 +39,38 @@ bool StatSnap::callback(Dispatcher &d, TaskId t) {
     d.snooze(t, STATSNAP_FREQ);
     return true;
 }
+
+extern "C" {
+    static void append_stat(const char *key, const uint16_t klen,
+                            const char *val, const uint32_t vlen,
+                            const void *cookie) {
+        assert(cookie);
+        void *cokie = const_cast<void *>(cookie);
+        StatGroupSnapshot::stat_list *l =
+            static_cast<StatGroupSnapshot::stat_list*>(cokie);
+        l->push_back(std::make_pair(std::string(key, klen),
+                                    std::string(val, vlen)));
+    }
+}
+
+ADD_STAT StatGroupSnapshot::getCollector() {
+    return append_stat;
+}
+
+void StatGroupSnapshot::addStats(const stat_list &l, ADD_STAT add_stat,
+                                 const void *cookie) {
+    add_casted_stat("snapshot_version", version, add_stat, cookie);
+    add_casted_stat("snapshot_age", ep_current_time() - taken, add_stat, cookie);
+    stat_list::const_iterator it;
+    for (it = l.begin(); it != l.end(); ++it) {
+        add_stat(it->first.data(), static_cast<uint16_t>(it->first.length()),
+                 it->second.data(), static_cast<uint32_t>(it->second.length()),
+                 cookie);
+    }
+}
+
+bool StatGroupSnapper::callback(Dispatcher &d, TaskId t) {
+    engine->updateStatGroupSnapshot();
+    d.snooze(t, engine->getConfiguration().getStatSnapshotStime());
+    return true;
+}
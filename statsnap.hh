@@ -6,6 +6,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 #include "dispatcher.hh"
 #include "stats.hh"
@@ -51,4 +52,55 @@ private:
     std::map<std::string, std::string>  map;
 };
 
+/**
+ * A copy of the stat groups that have to walk every hash table or take
+ * the checkpoint locks to be computed ("hash" and "checkpoint").
+ *
+ * Stat requests for these groups are served from the most recent copy
+ * so that polling them doesn't compete with the front end for locks.
+ */
+class StatGroupSnapshot : public RCValue {
+public:
+    typedef std::vector<std::pair<std::string, std::string> > stat_list;
+
+    StatGroupSnapshot(uint64_t v) : version(v), taken(ep_current_time()) { }
+
+    /**
+     * Send the given list of stats along with the age and version of
+     * this snapshot.
+     */
+    void addStats(const stat_list &l, ADD_STAT add_stat, const void *cookie);
+
+    /**
+     * Get the ADD_STAT callback that appends to the stat list passed as
+     * the cookie.
+     */
+    static ADD_STAT getCollector();
+
+    stat_list hash;
+    stat_list checkpoint;
+
+    const uint64_t   version;
+    //! When collecting the stats started, so the age of the snapshot
+    //! is never less than that of any of its stats.
+    const rel_time_t taken;
+};
+
+/**
+ * Periodically refresh the stat group snapshot of the engine.
+ */
+class StatGroupSnapper : public DispatcherCallback {
+public:
+    StatGroupSnapper(EventuallyPersistentEngine *e) : engine(e) { }
+
+    bool callback(Dispatcher &d, TaskId t);
+
+    std::string description() {
+        return std::string("Updating stat group snapshot");
+    }
+
+private:
+    EventuallyPersistentEngine *engine;
+};
+
 #endif /* STATSNAP_HH */
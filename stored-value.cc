@@ -11,6 +11,9 @@
 
 size_t HashTable::defaultNumBuckets = DEFAULT_HT_SIZE;
 size_t HashTable::defaultNumLocks = 193;
+const size_t HashTable::MIN_SIZE = 3;
+const size_t HashTable::MIN_LOCKS = 1;
+const size_t HashTable::MAX_EXPIRY_CHANGES = 256;
 enum stored_value_type HashTable::defaultStoredValueType = featured;
 double StoredValue::mutation_mem_threshold = 0.9;
 
@@ -21,6 +24,12 @@ static ssize_t prime_size_table[] = {
     1610612741, -1
 };
 
+//! Threads waiting for the locks of a table for more than this share
+//! of the time between two checks get it more locks.
+static const double LOCK_CONTENTION_SHARE(0.01);
+//! The most locks a table gets, in multiples of the default number.
+static const size_t MAX_LOCKS_FACTOR(8);
+
 bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
     if (eligibleForEviction()) {
         size_t oldsize = size();
@@ -28,6 +37,9 @@ bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
         blobval uval;
         uval.len = valLength();
         RCPtr<Blob> sp(Blob::New(uval.chlen, sizeof(uval)));
+        if (ht.getNumHotItems() > 0) {
+            ht.unpublishHot(getKey());
+        }
         extra.feature.resident = false;
         timestampEviction();
         value = sp;
@@ -132,10 +144,14 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
         // If not deactivating, assert we're already active.
         assert(isActive());
     }
-    MultiLockHolder mlh(mutexes, n_locks);
+    LockHolder rlh(reshapeMutex);
+    MultiLockHolder mlh(locks->mutexes, locks->count);
     if (deactivate) {
         setActiveState(false);
     }
+    for (size_t i = 0; i < locks->count; ++i) {
+        dropExpiryChanges(locks->expiryChanges[i]);
+    }
     for (int i = 0; i < (int)size; i++) {
         while (values[i]) {
             StoredValue *v = values[i];
@@ -149,67 +165,212 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
     numNonResidentItems.set(0);
     memSize.set(0);
     cacheSize.set(0);
+    stats.memOverhead.decr(expiryIndex.clear());
+    if (snapshot) {
+        // Whatever was being copied out is gone.
+        stats.memOverhead.decr(snapshot->invalidate());
+        snapshot.reset();
+    }
+    HotItems *h = hotItems.get();
+    if (h) {
+        h->clear();
+    }
 
     return rv;
 }
 
+void HashTable::unlocked_publishHot(StoredValue *v) {
+    if (!v->isResident() || v->isDeleted() || v->isLocked(ep_current_time())) {
+        return;
+    }
+    HotItems *h = hotItems.get();
+    if (!h) {
+        HotItems *created = new HotItems;
+        if (hotItems.cas(NULL, created)) {
+            stats.memOverhead.incr(sizeof(HotItems));
+            h = created;
+        } else {
+            delete created;
+            h = hotItems.get();
+        }
+    }
+    h->publish(new HotItem(v->getKey(), v->getFlags(), v->getExptime(),
+                           v->getCas(), v->getId(), v->getSeqno(),
+                           v->getValue()));
+}
+
 void HashTable::resize(size_t newSize) {
+    reshape(newSize, locks->count, false);
+}
+
+bool HashTable::reshape(size_t newSize, size_t newLocks, bool tryOnly) {
     assert(isActive());
+    assert(newLocks > 0);
 
     // Due to the way hashing works, we can't fit anything larger than
     // an int.
     if (newSize > static_cast<size_t>(std::numeric_limits<int>::max())) {
-        return;
+        return false;
+    }
+
+    LockHolder rlh(reshapeMutex, tryOnly);
+    if (!rlh.isLocked()) {
+        return false;
     }
 
+    HashTableLocks *oldLocks(locks);
     // Don't resize to the same size, either.
-    if (newSize == size) {
-        return;
+    if (newSize == size && newLocks == oldLocks->count) {
+        return false;
     }
 
-    MultiLockHolder mlh(mutexes, n_locks);
+    MultiLockHolder mlh(oldLocks->mutexes, oldLocks->count, tryOnly);
+    if (!mlh.isLocked()) {
+        return false;
+    }
     if (visitors.get() > 0) {
         // Do not allow a resize while any visitors are actually
         // processing.  The next attempt will have to pick it up.  New
         // visitors cannot start doing meaningful work (we own all
         // locks at this point).
-        return;
+        return false;
+    }
+    if (snapshot) {
+        // A snapshot scan walks the buckets by number.
+        return false;
     }
 
-    // Get a place for the new items.
-    StoredValue **newValues = static_cast<StoredValue**>(calloc(newSize,
-                                                                sizeof(StoredValue*)));
-    // If we can't allocate memory, don't move stuff around.
-    if (!newValues) {
-        return;
+    StoredValue **newValues(values);
+    if (newSize != size) {
+        // Get a place for the new items.
+        newValues = static_cast<StoredValue**>(calloc(newSize,
+                                                      sizeof(StoredValue*)));
+        // If we can't allocate memory, don't move stuff around.
+        if (!newValues) {
+            return false;
+        }
     }
 
     stats.memOverhead.decr(memorySize());
-    ++numResizes;
 
-    // Set the new size so all the hashy stuff works.
-    size_t oldSize = size;
-    size = newSize;
-    ep_sync_synchronize();
+    if (newSize != size) {
+        ++numResizes;
 
-    // Move existing records into the new space.
-    for (size_t i = 0; i < oldSize; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
-            values[i] = v->next;
+        // Set the new size so all the hashy stuff works.
+        size_t oldSize = size;
+        size = newSize;
+        ep_sync_synchronize();
+
+        // Move existing records into the new space.
+        for (size_t i = 0; i < oldSize; i++) {
+            while (values[i]) {
+                StoredValue *v = values[i];
+                values[i] = v->next;
 
-            int newBucket = getBucketForHash(hash(v->getKeyBytes(), v->getKeyLen()));
-            v->next = newValues[newBucket];
-            newValues[newBucket] = v;
+                int newBucket = getBucketForHash(hash(v->getKeyBytes(),
+                                                      v->getKeyLen()));
+                v->next = newValues[newBucket];
+                newValues[newBucket] = v;
+            }
         }
+
+        // values still points to the old (now empty) table.
+        free(values);
+        values = newValues;
     }
 
-    // values still points to the old (now empty) table.
-    free(values);
-    values = newValues;
+    if (newLocks != oldLocks->count) {
+        // Queued expiry changes stay with the locks they were made
+        // under.
+        for (size_t i = 0; i < oldLocks->count; ++i) {
+            applyExpiryChanges(oldLocks->expiryChanges[i]);
+        }
+        // Free what earlier reshapes retired before retiring the locks
+        // still held here.
+        getLocksEpochManager().reclaim();
+        // Threads waiting for the old locks see they were replaced
+        // once the holder releases them.
+        ep_sync_synchronize();
+        locks = new HashTableLocks(newLocks);
+        // Accounted apart from the table from now on, as any table's
+        // reshape may free them.
+        oldLocks->retire(stats, numRetiredLocks);
+        getLocksEpochManager().retire(oldLocks);
+    }
 
     stats.memOverhead.incr(memorySize());
     assert(stats.memOverhead.get() < GIGANTOR);
+    return true;
+}
+
+EpochManager &HashTable::getLocksEpochManager() {
+    static EpochManager epochs;
+    return epochs;
+}
+
+void HashTable::waitForRetiredLocks() {
+    // Threads waiting for the locks of other tables may hold back the
+    // epoch these were retired in for a little while.
+    while (numRetiredLocks > 0) {
+        if (getLocksEpochManager().reclaim() == 0) {
+            usleep(100);
+        }
+    }
+}
+
+void HashTable::applyExpiryChanges() {
+    if (!isActive()) {
+        return;
+    }
+    size_t n(locks->count);
+    for (size_t i = 0; i < n; ++i) {
+        LockHolder lh(getLock(static_cast<int>(i)));
+        // The locks can't be replaced while one of them is held.
+        applyExpiryChanges(locks->expiryChanges[i % locks->count]);
+    }
+}
+
+void HashTable::applyExpiryChanges(std::vector<ExpiryChange> &changes) {
+    if (changes.empty()) {
+        return;
+    }
+    ssize_t indexed = expiryIndex.apply(changes);
+    if (indexed > 0) {
+        stats.memOverhead.incr(indexed);
+    } else {
+        stats.memOverhead.decr(-indexed);
+    }
+    dropExpiryChanges(changes);
+}
+
+void HashTable::dropExpiryChanges(std::vector<ExpiryChange> &changes) {
+    size_t queued(0);
+    std::vector<ExpiryChange>::iterator it;
+    for (it = changes.begin(); it != changes.end(); ++it) {
+        queued += ExpiryChange::size(it->key);
+    }
+    stats.memOverhead.decr(queued);
+    assert(stats.memOverhead.get() < GIGANTOR);
+    // Don't keep the space around on locks that rarely see changes.
+    std::vector<ExpiryChange>().swap(changes);
+}
+
+void HashTable::growCompacted() {
+    size_t newSize(std::max(size, defaultNumBuckets));
+    size_t newLocks(std::max(locks->count, defaultNumLocks));
+    // The caller may hold a lock of this table already.
+    reshape(newSize, std::min(newLocks, newSize), true);
+}
+
+HashTableLocks *HashTable::getVisitedLocks() {
+    while (true) {
+        EpochGuard eg(getLocksEpochManager());
+        HashTableLocks *l(locks);
+        LockHolder lh(l->mutexes[0]);
+        if (l == locks) {
+            return l;
+        }
+    }
 }
 
 static size_t distance(size_t a, size_t b) {
@@ -225,11 +386,58 @@ static bool isCurrently(size_t size, ssize_t a, ssize_t b) {
     return (current == a || current == b);
 }
 
+/**
+ * Get the smallest size in the prime table that holds n items.
+ */
+static size_t fittingSize(size_t n) {
+    int i(0);
+    while (prime_size_table[i + 1] > 0 &&
+           prime_size_table[i] < static_cast<ssize_t>(n)) {
+        ++i;
+    }
+    return prime_size_table[i];
+}
+
+/**
+ * Get the next number of locks up from n in the prime table.
+ */
+static size_t moreLocks(size_t n) {
+    int i(0);
+    while (prime_size_table[i + 1] > 0 &&
+           prime_size_table[i] <= static_cast<ssize_t>(n)) {
+        ++i;
+    }
+    return prime_size_table[i];
+}
+
+/**
+ * Get the next number of locks down from n in the prime table.
+ */
+static size_t fewerLocks(size_t n) {
+    size_t rv(HashTable::MIN_LOCKS);
+    for (int i = 0; prime_size_table[i] > 0; ++i) {
+        if (prime_size_table[i] >= static_cast<ssize_t>(n)) {
+            break;
+        }
+        rv = prime_size_table[i];
+    }
+    return rv;
+}
+
 void HashTable::resize() {
     size_t ni = getNumItems();
     int i(0);
     size_t new_size(0);
 
+    size_t deletes(numDeletes.get());
+    bool shrinking(deletes - numDeletesAtResize > ni);
+    numDeletesAtResize = deletes;
+
+    if (size < defaultNumBuckets && ni <= size && !shrinking) {
+        // Compacted, and not used enough to grow back yet.
+        return;
+    }
+
     // Figure out where in the prime table we are.
     ssize_t target(static_cast<ssize_t>(ni));
     for (i = 0; prime_size_table[i] > 0 && prime_size_table[i] < target; ++i) {
@@ -239,6 +447,10 @@ void HashTable::resize() {
     if (prime_size_table[i] == -1) {
         // We're at the end, take the biggest
         new_size = prime_size_table[i-1];
+    } else if (shrinking && prime_size_table[i] < static_cast<ssize_t>(size)) {
+        // Most of the items were deleted; don't keep the buckets
+        // around for them.
+        new_size = prime_size_table[i];
     } else if (prime_size_table[i] < static_cast<ssize_t>(defaultNumBuckets)) {
         // Was going to be smaller than the configured ht_size.
         new_size = defaultNumBuckets;
@@ -254,15 +466,154 @@ void HashTable::resize() {
     resize(new_size);
 }
 
+void HashTable::compact() {
+    numDeletesAtResize = numDeletes.get();
+    reshape(std::max(fittingSize(getNumItems()), MIN_SIZE), MIN_LOCKS, false);
+}
+
+void HashTable::adjustLocks() {
+    hrtime_t now(gethrtime());
+    hrtime_t waited(lockWaitTime.get());
+    size_t waits(numLockWaits.get());
+    hrtime_t interval(now - lastLockCheck);
+    bool contended(static_cast<double>(waited - lockWaitTimeAtCheck) >
+                   static_cast<double>(interval) * LOCK_CONTENTION_SHARE);
+    bool uncontended(waits == numLockWaitsAtCheck);
+    lastLockCheck = now;
+    lockWaitTimeAtCheck = waited;
+    numLockWaitsAtCheck = waits;
+
+    size_t n(locks->count);
+    size_t to(n);
+    if (contended) {
+        to = n < defaultNumLocks ? defaultNumLocks
+            : std::min(moreLocks(n), defaultNumLocks * MAX_LOCKS_FACTOR);
+    } else if (uncontended) {
+        to = fewerLocks(n);
+    }
+    // More locks than buckets don't help anybody.
+    to = std::max(std::min(to, size), MIN_LOCKS);
+    if (to != n) {
+        reshape(size, to, false);
+    }
+}
+
+static SnapshotValue snapshotOf(const std::string &key, StoredValue *v) {
+    SnapshotValue sv(key);
+    if (v && !v->isDeleted()) {
+        sv.present = true;
+        sv.resident = v->isResident();
+        if (sv.resident) {
+            sv.value = v->getValue();
+        }
+        sv.flags = v->getFlags();
+        sv.exptime = v->getExptime();
+        sv.cas = v->getCas();
+        sv.id = v->getId();
+        sv.seqno = v->getSeqno();
+    }
+    return sv;
+}
+
+RCPtr<HashTableSnapshot> HashTable::beginSnapshot(uint64_t checkpointId) {
+    assert(isActive());
+    RCPtr<HashTableSnapshot> snap(new HashTableSnapshot(checkpointId));
+    // Holding every lock makes sure no write is halfway between
+    // checking for a snapshot and changing a value.
+    LockHolder rlh(reshapeMutex);
+    MultiLockHolder mlh(locks->mutexes, locks->count);
+    if (snapshot) {
+        return RCPtr<HashTableSnapshot>();
+    }
+    snapshot = snap;
+    return snap;
+}
+
+void HashTable::preserveForSnapshot(const std::string &key, int bucket_num,
+                                    StoredValue *v) {
+    RCPtr<HashTableSnapshot> snap(snapshot);
+    if (!snap || snap->isScanned(bucket_num)) {
+        return;
+    }
+    stats.memOverhead.incr(snap->preserve(bucket_num, snapshotOf(key, v)));
+    assert(stats.memOverhead.get() < GIGANTOR);
+}
+
+static bool isPreserved(const std::vector<SnapshotValue> &preserved,
+                        const std::string &key) {
+    std::vector<SnapshotValue>::const_iterator it;
+    for (it = preserved.begin(); it != preserved.end(); ++it) {
+        if (it->key == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HashTable::scanSnapshot(const RCPtr<HashTableSnapshot> &snap,
+                             size_t numBuckets,
+                             std::vector<SnapshotValue> &out) {
+    std::vector<SnapshotValue> preserved;
+    for (size_t n = 0; n < numBuckets; ++n) {
+        int bucket_num = snap->getNextBucket();
+        if (!isActive() || bucket_num >= static_cast<int>(size)) {
+            return false;
+        }
+        // The table keeps its locks while a snapshot is taken, but
+        // this one may have just ended.
+        EpochGuard eg(getLocksEpochManager());
+        LockHolder lh(locks->mutexes[mutexForBucket(bucket_num)]);
+        if (snapshot.get() != snap.get()) {
+            // Ended or cleared under us.
+            return false;
+        }
+
+        preserved.clear();
+        stats.memOverhead.decr(snap->takeBucket(bucket_num, preserved));
+        assert(stats.memOverhead.get() < GIGANTOR);
+        for (StoredValue *v = values[bucket_num]; v; v = v->next) {
+            if (v->isDeleted()) {
+                continue;
+            }
+            std::string key(v->getKey());
+            if (!isPreserved(preserved, key)) {
+                out.push_back(snapshotOf(key, v));
+            }
+        }
+        std::vector<SnapshotValue>::iterator it;
+        for (it = preserved.begin(); it != preserved.end(); ++it) {
+            if (it->present) {
+                out.push_back(*it);
+            }
+        }
+    }
+    return snap->getNextBucket() < static_cast<int>(size);
+}
+
+void HashTable::endSnapshot(const RCPtr<HashTableSnapshot> &snap) {
+    if (!isActive()) {
+        return;
+    }
+    LockHolder rlh(reshapeMutex);
+    MultiLockHolder mlh(locks->mutexes, locks->count);
+    if (snapshot.get() == snap.get()) {
+        stats.memOverhead.decr(snap->invalidate());
+        assert(stats.memOverhead.get() < GIGANTOR);
+        snapshot.reset();
+    }
+}
+
 void HashTable::visit(HashTableVisitor &visitor) {
     if (numItems.get() == 0 || !isActive()) {
         return;
     }
     VisitorTracker vt(&visitors);
+    HashTableLocks *lks(getVisitedLocks());
+    int n_locks(static_cast<int>(lks->count));
     bool aborted = !visitor.shouldContinue();
     size_t visited = 0;
-    for (int l = 0; isActive() && !aborted && l < static_cast<int>(n_locks); l++) {
-        LockHolder lh(mutexes[l]);
+    for (int l = 0; isActive() && !aborted && l < n_locks; l++) {
+        LockHolder lh(lks->mutexes[l]);
         for (int i = l; i < static_cast<int>(size); i+= n_locks) {
             assert(l == mutexForBucket(i));
             StoredValue *v = values[i];
@@ -286,21 +637,24 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
     }
     size_t visited = 0;
     VisitorTracker vt(&visitors);
+    HashTableLocks *lks(getVisitedLocks());
+    int n_locks(static_cast<int>(lks->count));
 
-    for (int l = 0; l < static_cast<int>(n_locks); l++) {
-        LockHolder lh(mutexes[l]);
+    for (int l = 0; l < n_locks; l++) {
+        LockHolder lh(lks->mutexes[l]);
         for (int i = l; i < static_cast<int>(size); i+= n_locks) {
             size_t depth = 0;
             StoredValue *p = values[i];
             assert(p == NULL || i == getBucketForHash(hash(p->getKeyBytes(),
                                                            p->getKeyLen())));
-            size_t mem(0);
+            size_t mem(0), metaMem(0);
             while (p) {
                 depth++;
                 mem += p->size();
+                metaMem += p->size() - (p->isDeleted() ? 0 : p->getValue()->length());
                 p = p->next;
             }
-            visitor.visit(i, depth, mem);
+            visitor.visit(i, depth, mem, metaMem);
             ++visited;
         }
     }
@@ -389,6 +743,11 @@ void StoredValue::reduceCacheSize(HashTable &ht,
     assert(ht.memSize.get() < GIGANTOR);
 }
 
+void StoredValue::indexExpiry(HashTable &ht, const std::string &key,
+                              time_t oldExptime, time_t exptime) {
+    ht.indexExpiry(key, oldExptime, exptime);
+}
+
 void StoredValue::increaseCurrentSize(EPStats &st, size_t by) {
     st.currentSize.incr(by);
     assert(st.currentSize.get() < GIGANTOR);
@@ -5,8 +5,13 @@
 #include <climits>
 #include <cstring>
 #include <algorithm>
+#include <list>
 
 #include "common.hh"
+#include "epoch.hh"
+#include "expiry_index.hh"
+#include "hot_keys.hh"
+#include "ht_snapshot.hh"
 #include "item.hh"
 #include "locks.hh"
 #include "stats.hh"
@@ -78,7 +83,12 @@ public:
      */
     void touch() {
         if (isResident() && !isDirty()) {
-            dirtiness = ep_current_time() >> 2;
+            // Only write when the time changed, so reads of a popular
+            // key don't keep invalidating each other's cache line.
+            uint32_t now = ep_current_time() >> 2;
+            if (dirtiness != now) {
+                dirtiness = now;
+            }
         }
     }
 
@@ -248,6 +258,7 @@ public:
      * @param preserveSeqno Preserve the sequence number from the item.
      */
     void setValue(Item &itm, EPStats &stats, HashTable &ht, bool preserveSeqno) {
+        time_t oldExptime = getExptime();
         size_t currSize = size();
         reduceCacheSize(ht, currSize);
         reduceCurrentSize(stats, isDeleted() ? currSize : currSize - value->length());
@@ -269,6 +280,9 @@ public:
         increaseCacheSize(ht, newSize);
         increaseCurrentSize(stats, newSize - value->length());
         replicas = 0;
+        if (!_isSmall) {
+            indexExpiry(ht, itm.getKey(), oldExptime, itm.getExptime());
+        }
     }
 
     size_t valLength() {
@@ -506,7 +520,10 @@ public:
 
         value.reset();
         markDirty();
-        setCas(getCas() + 1);
+        setCas(CasGenerator::next(getCas()));
+        if (getExptime() != 0) {
+            indexExpiry(ht, getKey(), getExptime(), 0);
+        }
 
         size_t newsize = size();
         if (oldsize < newsize) {
@@ -580,6 +597,11 @@ public:
      */
     static void setMutationMemoryThreshold(double memThreshold);
 
+    /**
+     * Whether there's room in the bucket quota to store the given item.
+     */
+    static bool hasAvailableSpace(EPStats&, const Item &item);
+
     /**
      * Get the maximum amount of memory this instance can store.
      */
@@ -608,6 +630,7 @@ private:
             extra.feature.lock_expiry = 0;
             extra.feature.keylen = itm.getKey().length();
             extra.feature.seqno = itm.getSeqno();
+            indexExpiry(ht, itm.getKey(), 0, itm.getExptime());
         }
 
         if (setDirty) {
@@ -651,8 +674,9 @@ private:
     static void reduceCacheSize(HashTable &ht,
                                 size_t by, bool residentOnly = false);
     static void increaseCurrentSize(EPStats&, size_t by);
+    static void indexExpiry(HashTable &ht, const std::string &key,
+                            time_t oldExptime, time_t exptime);
     static void reduceCurrentSize(EPStats&, size_t by);
-    static bool hasAvailableSpace(EPStats&, const Item &item);
     static double mutation_mem_threshold;
 
     DISALLOW_COPY_AND_ASSIGN(StoredValue);
@@ -719,8 +743,9 @@ public:
      * @param bucket the index of the hashtable bucket
      * @param depth the number of entries in this hashtable bucket
      * @param mem counted memory used by this hash table
+     * @param metaMem the part of mem not used by item values
      */
-    virtual void visit(int bucket, int depth, size_t mem) = 0;
+    virtual void visit(int bucket, int depth, size_t mem, size_t metaMem) = 0;
 };
 
 /**
@@ -731,9 +756,10 @@ public:
 
     HashTableDepthStatVisitor() : depthHisto(GrowingWidthGenerator<unsigned int>(1, 1, 1.3),
                                              10),
-                                  size(0), memUsed(0), min(-1), max(0) {}
+                                  size(0), memUsed(0), metaUsed(0),
+                                  min(-1), max(0) {}
 
-    void visit(int bucket, int depth, size_t mem) {
+    void visit(int bucket, int depth, size_t mem, size_t metaMem) {
         (void)bucket;
         // -1 is a special case for min.  If there's a value other than
         // -1, we prefer that.
@@ -742,11 +768,13 @@ public:
         depthHisto.add(depth);
         size += depth;
         memUsed += mem;
+        metaUsed += metaMem;
     }
 
     Histogram<unsigned int> depthHisto;
     size_t                  size;
     size_t                  memUsed;
+    size_t                  metaUsed;
     int                     min;
     int                     max;
 };
@@ -872,12 +900,83 @@ private:
 
 };
 
+/**
+ * The locks guarding the buckets of a hash table.
+ *
+ * A table that changes how many locks it has swaps in a new set while
+ * holding every lock of the old one.  The old set is retired through
+ * HashTable::getLocksEpochManager(), as threads may be about to wait
+ * on it; they find out it was replaced once they get the lock.
+ *
+ * Each lock also guards the expiry changes made while holding it,
+ * which are applied to the table's expiry index in batches.
+ */
+class HashTableLocks : public Retired {
+public:
+
+    HashTableLocks(size_t n)
+        : count(n), mutexes(new Mutex[n]),
+          expiryChanges(new std::vector<ExpiryChange>[n]),
+          stats(NULL), numRetired(NULL) {
+        assert(count > 0);
+    }
+
+    ~HashTableLocks() {
+        if (stats) {
+            stats->memOverhead.decr(memorySize());
+            assert(stats->memOverhead.get() < GIGANTOR);
+            numRetired->decr(1);
+        }
+        delete []mutexes;
+        delete []expiryChanges;
+    }
+
+    size_t memorySize() const {
+        return sizeof(HashTableLocks)
+            + count * (sizeof(Mutex) + sizeof(std::vector<ExpiryChange>));
+    }
+
+    /**
+     * Account for these locks until they're destroyed, after the table
+     * stopped using them.
+     *
+     * @param st the stats the memory is accounted in
+     * @param n the table's count of retired lock sets
+     */
+    void retire(EPStats &st, Atomic<size_t> &n) {
+        stats = &st;
+        numRetired = &n;
+        ++n;
+        stats->memOverhead.incr(memorySize());
+    }
+
+    const size_t  count;
+    Mutex * const mutexes;
+    std::vector<ExpiryChange> * const expiryChanges;
+
+private:
+    EPStats        *stats;
+    Atomic<size_t> *numRetired;
+
+    DISALLOW_COPY_AND_ASSIGN(HashTableLocks);
+};
+
 /**
  * A container of StoredValue instances.
+ *
+ * Every table sizes itself: tables nobody uses shrink to almost
+ * nothing and grow back to the default size as soon as they fill up,
+ * and the resizer adds locks to tables whose threads wait for them
+ * and takes them away from tables nobody waits on.
  */
 class HashTable {
 public:
 
+    //! The fewest buckets a table shrinks to.
+    static const size_t MIN_SIZE;
+    //! The fewest locks a table gets by with.
+    static const size_t MIN_LOCKS;
+
     /**
      * Create a HashTable.
      *
@@ -887,16 +986,21 @@ public:
      * @param t the type of StoredValues this hash table will contain
      */
     HashTable(EPStats &st, size_t s = 0, size_t l = 0,
-              enum stored_value_type t = featured) : stats(st), valFact(st, t) {
+              enum stored_value_type t = featured)
+        : stats(st), valFact(st, t),
+          expiryIndex(ep_real_time(), st.expiryIndexEntries,
+                      st.expiryIndexMaxEntries) {
         size = HashTable::getNumBuckets(s);
-        n_locks = HashTable::getNumLocks(l);
+        locks = new HashTableLocks(HashTable::getNumLocks(l));
         valFact = StoredValueFactory(st, getDefaultStorageValueType());
         assert(size > 0);
-        assert(n_locks > 0);
         assert(visitors == 0);
         values = static_cast<StoredValue**>(calloc(size, sizeof(StoredValue*)));
-        mutexes = new Mutex[n_locks];
         activeState = true;
+        lastLockCheck = gethrtime();
+        lockWaitTimeAtCheck = 0;
+        numLockWaitsAtCheck = 0;
+        numDeletesAtResize = 0;
     }
 
     ~HashTable() {
@@ -905,7 +1009,13 @@ public:
         while (visitors > 0) {
             usleep(100);
         }
-        delete []mutexes;
+        waitForRetiredLocks();
+        HotItems *h = hotItems.get();
+        if (h) {
+            stats.memOverhead.decr(sizeof(HotItems));
+            delete h;
+        }
+        delete locks;
         free(values);
         values = NULL;
     }
@@ -913,7 +1023,8 @@ public:
     size_t memorySize() {
         return sizeof(HashTable)
             + (size * sizeof(StoredValue*))
-            + (n_locks * sizeof(Mutex));
+            + locks->memorySize()
+            + expiryIndex.memorySize() - sizeof(ExpiryIndex);
     }
 
     /**
@@ -924,7 +1035,19 @@ public:
     /**
      * Get the number of locks in this hash table.
      */
-    size_t getNumLocks(void) { return n_locks; }
+    size_t getNumLocks(void) { return locks->count; }
+
+    /**
+     * Get the number of times a thread had to wait for a lock of
+     * this hash table.
+     */
+    size_t getNumLockWaits(void) { return numLockWaits; }
+
+    /**
+     * Get the total time (in nanoseconds) threads spent waiting for
+     * the locks of this hash table.
+     */
+    hrtime_t getLockWaitTime(void) { return lockWaitTime; }
 
     /**
      * Get the number of items within this hash table.
@@ -946,6 +1069,67 @@ public:
      */
     size_t getItemMemory(void) { return memSize; }
 
+    /**
+     * Get the number of entries in the expiry index of this hash table.
+     */
+    size_t getExpiryIndexSize(void) {
+        applyExpiryChanges();
+        return expiryIndex.size();
+    }
+
+    /**
+     * Get the number of keys with an expiry time that didn't fit in the
+     * expiry index of this hash table.
+     */
+    size_t getExpiryIndexDropped(void) { return expiryIndex.getNumDropped(); }
+
+    /**
+     * Remember that the given key expires at the given time, so the
+     * expiry pager can find it without visiting the whole table.  The
+     * caller must hold the lock of the key's bucket.
+     *
+     * The change is queued on that lock and applied to the expiry
+     * index later, so writers don't contend on the index.
+     *
+     * @param key the key
+     * @param oldExptime the expiry time the key had (0 if none)
+     * @param exptime the expiry time it has now (0 if none)
+     */
+    void indexExpiry(const std::string &key, time_t oldExptime, time_t exptime) {
+        if (oldExptime == exptime) {
+            return;
+        }
+        std::vector<ExpiryChange> &changes =
+            locks->expiryChanges[mutexForBucket(getBucketForHash(hash(key)))];
+        changes.push_back(ExpiryChange(key, oldExptime, exptime));
+        stats.memOverhead.incr(ExpiryChange::size(key));
+        assert(stats.memOverhead.get() < GIGANTOR);
+        if (changes.size() >= MAX_EXPIRY_CHANGES) {
+            applyExpiryChanges(changes);
+        }
+    }
+
+    /**
+     * Get the keys whose expiry time is before the given time.
+     *
+     * The keys are only candidates: any of them may have been updated
+     * or deleted since its expiry time was indexed.
+     *
+     * @param now the time to expire against
+     * @param keys where to append the candidate keys
+     * @param limit roughly the most keys to return
+     * @return true if all of the due keys were returned
+     */
+    bool popExpired(time_t now, std::vector<std::string> &keys,
+                    size_t limit) {
+        applyExpiryChanges();
+        size_t memory(0);
+        bool rv = expiryIndex.popExpired(now, keys, limit, memory);
+        stats.memOverhead.decr(memory);
+        assert(stats.memOverhead.get() < GIGANTOR);
+        return rv;
+    }
+
     /**
      * Clear the hash table.
      *
@@ -962,9 +1146,29 @@ public:
 
     /**
      * Automatically resize to fit the current data.
+     *
+     * A table smaller than the default size stays that way until it
+     * holds more items than it has buckets, and a table that lost
+     * more items to deletions since the last resize than it still
+     * holds shrinks to fit them, even below the default size.
      */
     void resize();
 
+    /**
+     * Shrink to the smallest table that fits the current data, with
+     * the fewest locks.  For tables nobody is using, e.g. of dead or
+     * empty vbuckets.  The table grows back to the default size when
+     * it's used again.
+     */
+    void compact();
+
+    /**
+     * Adjust the number of locks to how much threads waited for them
+     * since the last call: a table whose locks were contended gets
+     * more of them, one whose locks nobody waited for gets fewer.
+     */
+    void adjustLocks();
+
     /**
      * Resize to the specified size.
      */
@@ -983,6 +1187,98 @@ public:
         return unlocked_find(key, bucket_num);
     }
 
+    /**
+     * Get a hot item without taking any lock.
+     *
+     * @param key the key to look for
+     * @param vbucket the vbucket of the table
+     * @return a copy of the item, or NULL if it isn't published (the
+     *         caller then takes the bucket lock as usual)
+     */
+    Item *getHotItem(const std::string &key, uint16_t vbucket) {
+        HotItems *h = hotItems.get();
+        return h ? h->get(key, vbucket) : NULL;
+    }
+
+    /**
+     * Publish a resident item for getHotItem() (the caller
+     * <b>MUST</b> hold the lock for the bucket of the item).
+     */
+    void unlocked_publishHot(StoredValue *v);
+
+    /**
+     * Stop handing out a key through getHotItem().
+     */
+    void unpublishHot(const std::string &key) {
+        HotItems *h = hotItems.get();
+        if (h) {
+            h->unpublish(key);
+        }
+    }
+
+    /**
+     * The number of items getHotItem() hands out.
+     */
+    size_t getNumHotItems() {
+        HotItems *h = hotItems.get();
+        return h ? h->getNumItems() : 0;
+    }
+
+    /**
+     * Start taking a point in time snapshot of this hash table.
+     *
+     * From here on, the first write to a key in a bucket the scan
+     * hasn't reached saves the key's previous state in the snapshot.
+     * The table isn't resized until the snapshot is ended.
+     *
+     * @param checkpointId the id of the open checkpoint right now
+     * @return the snapshot, or NULL if one is already being taken
+     */
+    RCPtr<HashTableSnapshot> beginSnapshot(uint64_t checkpointId);
+
+    /**
+     * Copy the next buckets of a snapshot.  Only one bucket is locked
+     * at a time, and only while it's being copied.
+     *
+     * @param snap the snapshot from beginSnapshot
+     * @param numBuckets the most buckets to copy
+     * @param out where to append the items of the copied buckets
+     * @return true if there are more buckets to copy
+     */
+    bool scanSnapshot(const RCPtr<HashTableSnapshot> &snap, size_t numBuckets,
+                      std::vector<SnapshotValue> &out);
+
+    /**
+     * Stop taking the given snapshot and release what it retained.
+     */
+    void endSnapshot(const RCPtr<HashTableSnapshot> &snap);
+
+    /**
+     * Get the snapshot currently being taken, if any.
+     */
+    RCPtr<HashTableSnapshot> getSnapshot() {
+        return snapshot;
+    }
+
+    /**
+     * Save the current state of a key in the snapshot being taken
+     * before changing it, and stop handing the key out as a hot item.
+     * Anything that modifies a stored value outside of this class
+     * must call this first (the caller <b>MUST</b> hold the lock for
+     * bucket_num).
+     *
+     * @param key the key about to change
+     * @param bucket_num the locked bucket the key hashes to
+     * @param v the current stored value of the key (NULL if none)
+     */
+    void unlocked_preserve(const std::string &key, int bucket_num,
+                           StoredValue *v) {
+        if (snapshot) {
+            preserveForSnapshot(key, bucket_num, v);
+        }
+        unpublishHot(key);
+    }
+
     /**
      * Add an item from online restore.
      *
@@ -997,6 +1293,7 @@ public:
             return false;
         }
 
+        unlocked_preserve(itm.getKey(), bucket_num, NULL);
         StoredValue *v = valFact(itm, values[bucket_num], *this);
         assert(v);
         values[bucket_num] = v;
@@ -1032,6 +1329,28 @@ public:
      */
     mutation_type_t set(const Item &val, uint64_t cas, int64_t &row_id,
                         bool allowExisting, bool hasMetaData = true) {
+        int bucket_num(0);
+        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
+        return unlocked_set(val, cas, row_id, allowExisting, hasMetaData,
+                            bucket_num);
+    }
+
+    /**
+     * Set an Item into this hashtable without trying to lock the
+     * bucket first (the caller <b>MUST</b> hold the lock for
+     * bucket_num).
+     *
+     * @param val the Item to store
+     * @param cas This is the cas value for the item <b>in</b> the cache
+     * @param row_id the row id that is assigned to the item to store
+     * @param allowExisting should we allow existing items or not
+     * @param hasMetaData should we keep the seqno the same or increment it
+     * @param bucket_num the locked bucket the key hashes to
+     * @return a result indicating the status of the store
+     */
+    mutation_type_t unlocked_set(const Item &val, uint64_t cas,
+                                 int64_t &row_id, bool allowExisting,
+                                 bool hasMetaData, int bucket_num) {
         assert(isActive());
         Item &itm = const_cast<Item&>(val);
         if (!StoredValue::hasAvailableSpace(stats, itm)) {
@@ -1039,8 +1358,6 @@ public:
         }
 
         mutation_type_t rv = NOT_FOUND;
-        int bucket_num(0);
-        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
         StoredValue *v = unlocked_find(val.getKey(), bucket_num, true);
 
         /*
@@ -1078,8 +1395,9 @@ public:
                 return INVALID_CAS;
             }
 
+            unlocked_preserve(val.getKey(), bucket_num, v);
             if (!hasMetaData) {
-                itm.setCas();
+                itm.setCasAfter(v->getCas());
             }
             rv = v->isClean() ? WAS_CLEAN : WAS_DIRTY;
             if (!v->isResident()) {
@@ -1090,6 +1408,7 @@ public:
         } else if (cas != 0) {
             rv = NOT_FOUND;
         } else {
+            unlocked_preserve(val.getKey(), bucket_num, NULL);
             if (!hasMetaData) {
                 itm.setCas();
             }
@@ -1126,6 +1445,7 @@ public:
         StoredValue *v = unlocked_find(itm.getKey(), bucket_num, true);
 
         if (v == NULL) {
+            unlocked_preserve(itm.getKey(), bucket_num, NULL);
             v = valFact(itm, values[bucket_num], *this);
             if (partial) {
                 v->extra.feature.resident = false;
@@ -1147,6 +1467,7 @@ public:
                 --numNonResidentItems;
             }
 
+            unlocked_preserve(itm.getKey(), bucket_num, v);
             v->setValue(const_cast<Item&>(itm), stats, *this, true);
         }
 
@@ -1177,10 +1498,11 @@ public:
             rv = ADD_EXISTS;
         } else {
             Item &itm = const_cast<Item&>(val);
-            itm.setCas();
+            itm.setCasAfter(v ? v->getCas() : 0);
             if (!StoredValue::hasAvailableSpace(stats, itm)) {
                 return ADD_NOMEM;
             }
+            unlocked_preserve(val.getKey(), bucket_num, v);
             if (v) {
                 rv = (v->isDeleted() || v->isExpired(ep_real_time())) ? ADD_UNDEL : ADD_SUCCESS;
                 v->setValue(itm, stats, *this, false);
@@ -1240,6 +1562,7 @@ public:
                 if (!v->isResident()) {
                     --numNonResidentItems;
                 }
+                unlocked_preserve(v);
                 v->del(stats, *this);
                 return rv;
             }
@@ -1260,6 +1583,7 @@ public:
             v->unlock();
 
             rv = v->isClean() ? WAS_CLEAN : WAS_DIRTY;
+            unlocked_preserve(v);
             v->setSeqno(seqno);
             v->del(stats, *this);
         }
@@ -1330,11 +1654,19 @@ public:
      * @return a locked LockHolder
      */
     inline LockHolder getLockedBucket(int h, int *bucket) {
+        if (size < defaultNumBuckets && numItems > size) {
+            growCompacted();
+        }
         while (true) {
             assert(isActive());
+            // Keeps the locks from being freed until they're held.
+            EpochGuard eg(getLocksEpochManager());
+            HashTableLocks *l(locks);
             *bucket = getBucketForHash(h);
-            LockHolder rv(mutexes[mutexForBucket(*bucket)]);
-            if (*bucket == getBucketForHash(h)) {
+            hrtime_t waited;
+            LockHolder rv(l->mutexes[*bucket % l->count], waited);
+            countLockWait(waited);
+            if (l == locks && *bucket == getBucketForHash(h)) {
                 return rv;
             }
         }
@@ -1365,6 +1697,56 @@ public:
         return getLockedBucket(hash(s.data(), s.size()), bucket);
     }
 
+    /**
+     * Get the number of the lock guarding the bucket for the given
+     * hash.  The table may be resized whenever that lock isn't held,
+     * so the answer has to be confirmed with getBucketUnderLock once
+     * the lock is acquired.
+     *
+     * @param h the input hash
+     * @return the lock number
+     */
+    int getLockNumForHash(int h) {
+        return mutexForBucket(getBucketForHash(h));
+    }
+
+    /**
+     * Get a lock holder holding the given lock.  This lets callers
+     * working on many keys take each lock once for all of the keys
+     * it guards.  The table keeps its locks while one is held.
+     *
+     * @param lock_num a lock number from getLockNumForHash
+     * @return a locked LockHolder
+     */
+    LockHolder getLock(int lock_num) {
+        assert(lock_num >= 0);
+        while (true) {
+            assert(isActive());
+            EpochGuard eg(getLocksEpochManager());
+            HashTableLocks *l(locks);
+            hrtime_t waited;
+            LockHolder rv(l->mutexes[lock_num % l->count], waited);
+            countLockWait(waited);
+            if (l == locks) {
+                return rv;
+            }
+        }
+    }
+
+    /**
+     * Get the bucket for the given hash while holding the given lock.
+     *
+     * @param h the input hash
+     * @param lock_num the lock currently held by the caller
+     * @return the bucket number, or -1 if the table was resized (or
+     *         got a different number of locks) and the bucket is no
+     *         longer guarded by lock_num
+     */
+    int getBucketUnderLock(int h, int lock_num) {
+        int bucket = getBucketForHash(h);
+        return mutexForBucket(bucket) == lock_num ? bucket : -1;
+    }
+
     /**
      * Delete a key from the cache without trying to lock the cache first
      * (Please note that you <b>MUST</b> acquire the mutex before calling
@@ -1388,6 +1770,8 @@ public:
             if (!v->isDeleted() && v->isLocked(ep_current_time())) {
                 return false;
             }
+            unlocked_preserve(key, bucket_num, v);
+            indexExpiry(key, v->getExptime(), 0);
             values[bucket_num] = v->next;
             size_t currSize = v->size();
             v->reduceCacheSize(*this, currSize);
@@ -1395,6 +1779,7 @@ public:
                                  v->isDeleted() ? currSize : currSize - v->getValue()->length());
             delete v;
             --numItems;
+            ++numDeletes;
             return true;
         }
 
@@ -1404,6 +1789,8 @@ public:
                 if (!tmp->isDeleted() && tmp->isLocked(ep_current_time())) {
                     return false;
                 }
+                unlocked_preserve(key, bucket_num, tmp);
+                indexExpiry(key, tmp->getExptime(), 0);
                 v->next = v->next->next;
                 size_t currSize = tmp->size();
                 tmp->reduceCacheSize(*this, currSize);
@@ -1411,6 +1798,7 @@ public:
                                tmp->isDeleted() ? currSize : currSize - tmp->getValue()->length());
                 delete tmp;
                 --numItems;
+                ++numDeletes;
                 return true;
             } else {
                 v = v->next;
@@ -1491,6 +1879,13 @@ public:
      */
     static const char* getDefaultStorageValueTypeStr();
 
+    /**
+     * Get the epochs the lock sets replaced by any table are retired
+     * in.  Threads load a table's locks and wait for one of them
+     * while reading in it.
+     */
+    static EpochManager &getLocksEpochManager();
+
     Atomic<size_t>       numNonResidentItems;
     Atomic<size_t>       numEjects;
     //! Memory consumed by items in this hashtable.
@@ -1503,15 +1898,33 @@ private:
     inline void setActiveState(bool newv) { activeState = newv; }
 
     size_t               size;
-    size_t               n_locks;
     StoredValue        **values;
-    Mutex               *mutexes;
+    HashTableLocks      *locks;
+    //! Lock sets replaced and not yet freed.
+    Atomic<size_t>       numRetiredLocks;
+    //! Serializes the operations that take every lock.
+    Mutex                reshapeMutex;
+    Atomic<size_t>       numLockWaits;
+    Atomic<hrtime_t>     lockWaitTime;
+    Atomic<size_t>       numDeletes;
+    // The rest is only touched by the resizer.
+    hrtime_t             lastLockCheck;
+    hrtime_t             lockWaitTimeAtCheck;
+    size_t               numLockWaitsAtCheck;
+    size_t               numDeletesAtResize;
     EPStats&             stats;
     StoredValueFactory   valFact;
     Atomic<size_t>       visitors;
     Atomic<size_t>       numItems;
     Atomic<size_t>       numResizes;
     bool                 activeState;
+    ExpiryIndex          expiryIndex;
+    RCPtr<HashTableSnapshot> snapshot;
+    //! Created when the first hot item is published.
+    AtomicPtr<HotItems>  hotItems;
+
+    //! Expiry changes queued on a lock before its holder applies them.
+    static const size_t MAX_EXPIRY_CHANGES;
 
     static size_t                 defaultNumBuckets;
     static size_t                 defaultNumLocks;
@@ -1521,11 +1934,76 @@ private:
         return abs(h % static_cast<int>(size));
     }
 
+    void countLockWait(hrtime_t waited) {
+        if (waited != 0) {
+            ++numLockWaits;
+            lockWaitTime += waited;
+        }
+    }
+
+    /**
+     * Change the number of buckets and locks.
+     *
+     * @param newSize the number of buckets to have
+     * @param newLocks the number of locks to have
+     * @param tryOnly if true, give up rather than wait for a lock
+     * @return true if the table was changed
+     */
+    bool reshape(size_t newSize, size_t newLocks, bool tryOnly);
+
+    /**
+     * Grow a table that was compacted back to the default size, if
+     * nobody holds any of its locks.
+     */
+    void growCompacted();
+
+    /**
+     * Get the locks of the table while it's being visited, which
+     * keeps them from being replaced.
+     */
+    HashTableLocks *getVisitedLocks();
+
+    /**
+     * Wait for every lock set this table replaced to be freed.
+     */
+    void waitForRetiredLocks();
+
+    /**
+     * Apply the expiry changes queued on every lock to the index.
+     */
+    void applyExpiryChanges();
+
+    /**
+     * Apply the expiry changes queued on one lock, which the caller
+     * holds, to the index.
+     */
+    void applyExpiryChanges(std::vector<ExpiryChange> &changes);
+
+    /**
+     * Drop the expiry changes queued on one lock, which the caller
+     * holds.
+     */
+    void dropExpiryChanges(std::vector<ExpiryChange> &changes);
+
+    void preserveForSnapshot(const std::string &key, int bucket_num,
+                             StoredValue *v);
+
+    void unlocked_preserve(StoredValue *v) {
+        if (snapshot || hotItems) {
+            std::string key(v->getKey());
+            if (snapshot) {
+                preserveForSnapshot(key, getBucketForHash(hash(key)), v);
+            }
+            unpublishHot(key);
+        }
+    }
+
     inline int mutexForBucket(int bucket_num) {
         assert(isActive());
         assert(bucket_num >= 0);
-        int lock_num = bucket_num % static_cast<int>(n_locks);
-        assert(lock_num < static_cast<int>(n_locks));
+        int n_locks = static_cast<int>(locks->count);
+        int lock_num = bucket_num % n_locks;
+        assert(lock_num < n_locks);
         assert(lock_num >= 0);
         return lock_num;
     }
@@ -0,0 +1,161 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <set>
+#include <vector>
+#include <algorithm>
+
+#include "atomic.hh"
+#include "cas_generator.hh"
+#include "locks.hh"
+#include "threadtests.hh"
+
+static const size_t numThreads = 8;
+static const size_t casEach = 100000;
+
+/**
+ * Generates CAS values, checking each is larger than the previous one.
+ */
+class CasLoop : public Generator<std::vector<uint64_t> > {
+public:
+    std::vector<uint64_t> operator()() {
+        std::vector<uint64_t> cas;
+        cas.reserve(casEach);
+        for (size_t i = 0; i < casEach; ++i) {
+            uint64_t c = CasGenerator::next();
+            assert(cas.empty() || c > cas.back());
+            cas.push_back(c);
+        }
+        return cas;
+    }
+};
+
+static void testUniqueAcrossThreads() {
+    CasLoop loop;
+    std::vector<std::vector<uint64_t> > results =
+        getCompletedThreads<std::vector<uint64_t> >(numThreads, &loop);
+
+    std::set<uint64_t> all;
+    std::vector<std::vector<uint64_t> >::iterator it;
+    for (it = results.begin(); it != results.end(); ++it) {
+        assert(it->size() == casEach);
+        all.insert(it->begin(), it->end());
+    }
+    assert(all.size() == numThreads * casEach);
+}
+
+static void testObservedCas() {
+    uint64_t now = CasGenerator::next();
+    // A CAS a second ahead of this node, e.g. set by setWithMeta.
+    uint64_t remote = now + (1000000ULL << CasGenerator::THREAD_BITS);
+    uint64_t c = CasGenerator::next(remote);
+    assert(c > remote);
+    // The clock stays ahead even when nothing is observed.
+    assert(CasGenerator::next() > c);
+    // An older CAS doesn't hold the clock back.
+    assert(CasGenerator::next(now) > c);
+}
+
+static void testBogusObservedCas() {
+    uint64_t before = CasGenerator::next();
+    // Garbage from the wire doesn't take the clock with it.
+    uint64_t c = CasGenerator::next(~0ULL);
+    assert(c > before);
+    assert(CasGenerator::getTime(c) - CasGenerator::getTime(before) < 1000000);
+    c = CasGenerator::next(1ULL << 63);
+    assert(CasGenerator::getTime(c) - CasGenerator::getTime(before) < 1000000);
+
+    // Nor does a CAS from an hour ahead.
+    uint64_t hour = 3600ULL * 1000000;
+    c = CasGenerator::next(before + (hour << CasGenerator::THREAD_BITS));
+    assert(CasGenerator::getTime(c) - CasGenerator::getTime(before) < 1000000);
+
+    // And the thread goes on handing out increasing values.
+    uint64_t prev = c;
+    for (int i = 0; i < 1000; ++i) {
+        c = CasGenerator::next();
+        assert(c > prev);
+        prev = c;
+    }
+}
+
+/**
+ * A key mutated by many threads.
+ */
+struct SharedKey {
+    SharedKey() : cas(0) {}
+    Mutex    mutex;
+    uint64_t cas;
+};
+
+class KeyLoop : public Generator<bool> {
+public:
+    KeyLoop(SharedKey *k) : key(k) {}
+
+    bool operator()() {
+        for (size_t i = 0; i < casEach; ++i) {
+            LockHolder lh(key->mutex);
+            uint64_t c = CasGenerator::next(key->cas);
+            if (c <= key->cas) {
+                return false;
+            }
+            key->cas = c;
+        }
+        return true;
+    }
+
+private:
+    SharedKey *key;
+};
+
+static void testKeyCasGrows() {
+    SharedKey key;
+    // Another node ran its clock ahead of ours.
+    key.cas = CasGenerator::next() + (5000000ULL << CasGenerator::THREAD_BITS);
+    KeyLoop loop(&key);
+    std::vector<bool> results = getCompletedThreads<bool>(numThreads, &loop);
+    assert(std::count(results.begin(), results.end(), true)
+           == static_cast<int>(numThreads));
+}
+
+/**
+ * Pushes the clock of its thread far ahead.
+ */
+class AheadLoop : public Generator<uint64_t> {
+public:
+    uint64_t operator()() {
+        uint64_t c = CasGenerator::next();
+        return CasGenerator::next(c + (60000000ULL << CasGenerator::THREAD_BITS));
+    }
+};
+
+class FirstCas : public Generator<uint64_t> {
+public:
+    uint64_t operator()() {
+        return CasGenerator::next();
+    }
+};
+
+static void testThreadIdReuse() {
+    AheadLoop ahead;
+    uint64_t last = getCompletedThreads<uint64_t>(1, &ahead)[0];
+    FirstCas first;
+    uint64_t c = getCompletedThreads<uint64_t>(1, &first)[0];
+    // The new thread got the clock the old one gave back.
+    assert(CasGenerator::getThreadId(c) == CasGenerator::getThreadId(last));
+    assert(c > last);
+}
+
+int main(int argc, char **argv) {
+    (void)argc; (void)argv;
+    alarm(60);
+
+    testUniqueAcrossThreads();
+    testObservedCas();
+    testBogusObservedCas();
+    testKeyCasGrows();
+    testThreadIdReuse();
+}
@@ -4,6 +4,8 @@
 #include <signal.h>
 #include <unistd.h>
 
+#include <iostream>
+#include <sstream>
 #include <vector>
 #include <set>
 #include <algorithm>
@@ -21,6 +23,19 @@
 EPStats global_stats;
 CheckpointConfig checkpoint_config;
 
+/**
+ * Checkpoint config that allows as many checkpoints as possible with a
+ * small number of items each.
+ */
+class SmallCheckpointConfig : public CheckpointConfig {
+public:
+    SmallCheckpointConfig(size_t numCheckpoints) {
+        setCheckpointMaxItems(MIN_CHECKPOINT_ITEMS);
+        setMaxCheckpoints(std::max(numCheckpoints,
+                                   static_cast<size_t>(DEFAULT_MAX_CHECKPOINTS)));
+    }
+};
+
 struct thread_args {
     SyncObject *mutex;
     SyncObject *gate;
@@ -143,6 +158,116 @@ static void *launch_set_thread(void *arg) {
 }
 }
 
+static std::string keyOf(const char *prefix, int i) {
+    std::stringstream ss;
+    ss << prefix << i;
+    return ss.str();
+}
+
+static void fillCheckpoints(CheckpointManager &manager, const RCPtr<VBucket> &vbucket,
+                            size_t numItems) {
+    for (size_t i = 0; i < numItems; ++i) {
+        queued_item qi(new QueuedItem(keyOf("key-", i), 0, queue_op_set));
+        manager.queueDirty(qi, vbucket);
+    }
+}
+
+static void testKeyFilter(const RCPtr<VBucket> &vbucket) {
+    SmallCheckpointConfig config(MAX_CHECKPOINTS_UPPER_BOUND);
+    CheckpointManager manager(global_stats, 0, config, 1);
+    int numItems = MAX_CHECKPOINTS_UPPER_BOUND * MIN_CHECKPOINT_ITEMS - 1;
+    fillCheckpoints(manager, vbucket, numItems);
+    assert(manager.getNumCheckpoints() == MAX_CHECKPOINTS_UPPER_BOUND);
+
+    for (int i = 0; i < numItems; ++i) {
+        assert(manager.isKeyResidentInCheckpoints(keyOf("key-", i)));
+    }
+    size_t skipped = global_stats.chkKeyFilterSkips.get();
+    for (int i = 0; i < numItems; ++i) {
+        assert(!manager.isKeyResidentInCheckpoints(keyOf("missing-", i)));
+    }
+    assert(global_stats.chkKeyFilterSkips.get() - skipped > numItems * 9 / 10);
+
+    // Once the persisted checkpoints are gone their keys are uncounted.
+    std::vector<queued_item> items;
+    manager.getAllItemsForPersistence(items);
+    bool newCheckpointCreated;
+    manager.removeClosedUnrefCheckpoints(vbucket, newCheckpointCreated);
+    assert(manager.getNumCheckpoints() == 1);
+
+    skipped = global_stats.chkKeyFilterSkips.get();
+    int removed = 0;
+    for (int i = 0; i < numItems; ++i) {
+        if (!manager.isKeyResidentInCheckpoints(keyOf("key-", i))) {
+            ++removed;
+        }
+    }
+    assert(removed > numItems - MIN_CHECKPOINT_ITEMS);
+    assert(global_stats.chkKeyFilterSkips.get() - skipped > removed * 9 / 10);
+
+    manager.clear(vbucket_state_active);
+    assert(!manager.isKeyResidentInCheckpoints(keyOf("key-", numItems - 1)));
+}
+
+static queued_item queueSnapshotted(CheckpointManager &manager,
+                                    const RCPtr<VBucket> &vbucket,
+                                    const std::string &key) {
+    Item itm(key, 0, 0, "value", 5);
+    queued_item qi(new QueuedItem(key, 0, queue_op_set));
+    qi->setSnapshot(itm);
+    manager.queueDirty(qi, vbucket);
+    return qi;
+}
+
+static void testSnapshotDedup(const RCPtr<VBucket> &vbucket) {
+    CheckpointManager manager(global_stats, 0, checkpoint_config, 1);
+
+    // A replaced item the flusher hasn't seen lets go of its value.
+    queued_item first = queueSnapshotted(manager, vbucket, "key");
+    queued_item second = queueSnapshotted(manager, vbucket, "key");
+    assert(first->getSnapshot() == NULL);
+    assert(second->getSnapshot() != NULL);
+
+    // One the flusher has is left alone.
+    std::vector<queued_item> items;
+    manager.getAllItemsForPersistence(items);
+    queued_item third = queueSnapshotted(manager, vbucket, "key");
+    assert(second->getSnapshot() != NULL);
+    assert(third->getSnapshot() != NULL);
+    manager.clear(vbucket_state_active);
+}
+
+/**
+ * Time lookups of keys that are and aren't in a number of checkpoints.
+ */
+static void benchKeyLookups(const RCPtr<VBucket> &vbucket, size_t numCheckpoints) {
+    SmallCheckpointConfig config(numCheckpoints);
+    CheckpointManager manager(global_stats, 0, config, 1);
+    int numItems = numCheckpoints * MIN_CHECKPOINT_ITEMS;
+    fillCheckpoints(manager, vbucket, numItems - 1);
+    assert(manager.getNumCheckpoints() == numCheckpoints);
+
+    std::vector<std::string> missing, existing;
+    for (int i = 0; i < numItems - 1; ++i) {
+        missing.push_back(keyOf("missing-", i));
+        existing.push_back(keyOf("key-", i));
+    }
+
+    const int lookups = 1000000;
+    hrtime_t start = gethrtime();
+    for (int i = 0; i < lookups; ++i) {
+        manager.isKeyResidentInCheckpoints(missing[i % missing.size()]);
+    }
+    hrtime_t absent = gethrtime();
+    for (int i = 0; i < lookups; ++i) {
+        manager.isKeyResidentInCheckpoints(existing[i % existing.size()]);
+    }
+    hrtime_t present = gethrtime();
+    std::cout << "  " << numCheckpoints << " checkpoints: absent "
+              << (absent - start) / lookups << "ns, present "
+              << (present - absent) / lookups << "ns per lookup" << std::endl;
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
@@ -151,6 +276,13 @@ int main(int argc, char **argv) {
     HashTable::setDefaultNumLocks(1);
     RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats, checkpoint_config));
 
+    testKeyFilter(vbucket);
+    testSnapshotDedup(vbucket);
+    std::cout << "Checkpoint key lookups:" << std::endl;
+    benchKeyLookups(vbucket, 1);
+    benchKeyLookups(vbucket, 3);
+    benchKeyLookups(vbucket, MAX_CHECKPOINTS_UPPER_BOUND);
+
     CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 0,
                                                                   checkpoint_config, 1);
     SyncObject *mutex = new SyncObject();
@@ -57,6 +57,119 @@ bool TestCallback::callback(Dispatcher &d, TaskId t) {
     return thing->doSomething(d, t);
 }
 
+static Atomic<bool> hogging;
+
+/**
+ * Keeps the dispatcher busy with a best priority task for as long as
+ * hogging is set.
+ */
+class HogCallback : public DispatcherCallback {
+public:
+    bool callback(Dispatcher &, TaskId) {
+        hrtime_t start = gethrtime();
+        while (gethrtime() - start < 20 * 1000 * 1000) {
+            // Busy.
+        }
+        return hogging.get();
+    }
+
+    std::string description() { return std::string("Hog"); }
+};
+
+/**
+ * Counts its runs.
+ */
+class CountCallback : public DispatcherCallback {
+public:
+    CountCallback(Atomic<int> &c, hrtime_t d = 1000 * 1000)
+        : count(c), duration(d) {}
+
+    bool callback(Dispatcher &, TaskId) {
+        ++count;
+        return false;
+    }
+
+    std::string description() { return std::string("Count"); }
+
+    hrtime_t maxExpectedDuration() { return duration; }
+
+private:
+    Atomic<int> &count;
+    hrtime_t duration;
+};
+
+/**
+ * Runs until the dispatcher asks it to yield.
+ */
+class YieldCallback : public DispatcherCallback {
+public:
+    YieldCallback(Atomic<int> &c) : yielded(c) {}
+
+    bool callback(Dispatcher &d, TaskId) {
+        hrtime_t start = gethrtime();
+        while (gethrtime() - start < 2000 * 1000 * 1000) {
+            if (d.shouldYield()) {
+                ++yielded;
+                break;
+            }
+        }
+        return false;
+    }
+
+    std::string description() { return std::string("Yield"); }
+
+private:
+    Atomic<int> &yielded;
+};
+
+static bool waitFor(Atomic<int> &count, int expected) {
+    for (int i = 0; i < 2000 && count.get() < expected; ++i) {
+        usleep(1000);
+    }
+    return count.get() >= expected;
+}
+
+static void testFairShare() {
+    Dispatcher d(*engine, "Fair");
+    d.setFairShare(true);
+    assert(d.isFairShare());
+    d.start();
+
+    // A low priority task still gets its turn behind a busy high
+    // priority one.
+    Atomic<int> low;
+    hogging.set(true);
+    d.schedule(shared_ptr<DispatcherCallback>(new HogCallback()),
+               NULL, Priority::BgFetcherPriority);
+    d.schedule(shared_ptr<DispatcherCallback>(new CountCallback(low)),
+               NULL, Priority::StatSnapPriority);
+    assert(waitFor(low, 1));
+
+    // A task past its expected duration runs ahead of its turn.
+    Atomic<int> overdue;
+    d.schedule(shared_ptr<DispatcherCallback>(new CountCallback(overdue, 1000)),
+               NULL, Priority::InvalidItemDbPagerPriority);
+    assert(waitFor(overdue, 1));
+    assert(d.getNumOverdue() >= 1);
+    hogging.set(false);
+
+    // A long task is asked to yield once its slice is used up and
+    // something else is waiting.
+    Atomic<int> yielded;
+    Atomic<int> after;
+    d.schedule(shared_ptr<DispatcherCallback>(new YieldCallback(yielded)),
+               NULL, Priority::FlusherPriority);
+    d.schedule(shared_ptr<DispatcherCallback>(new CountCallback(after)),
+               NULL, Priority::VBucketDeletionPriority, 0.01);
+    assert(waitFor(after, 1));
+    assert(yielded.get() == 1);
+    assert(d.getNumYields() >= 1);
+
+    std::vector<std::pair<std::string, const Histogram<hrtime_t>*> > histos(d.getWaitHistos());
+    assert(histos.size() == 5);
+    d.stop();
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     int expected_num_callbacks=3;
@@ -88,5 +201,7 @@ int main(int argc, char **argv) {
     IdleTask it;
     assert(hrtime2text(it.maxExpectedDuration()) == std::string("3600 ms"));
 
+    testFairShare();
+
     return 0;
 }
@@ -0,0 +1,273 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+
+#include "expiry_index.hh"
+#include "stored-value.hh"
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL);
+    }
+}
+
+EPStats global_stats;
+
+//! The entries of the indexes not under global_stats, which share no cap.
+static Atomic<size_t> numEntries;
+static Atomic<size_t> noLimit(std::numeric_limits<size_t>::max());
+
+static std::string keyOf(int i) {
+    std::stringstream ss;
+    ss << "key" << i;
+    return ss.str();
+}
+
+static std::vector<std::string> pop(ExpiryIndex &idx, time_t now,
+                                    size_t limit = 1000) {
+    std::vector<std::string> out;
+    size_t memory(0);
+    assert(idx.popExpired(now, out, limit, memory));
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+static void testPopInOrder() {
+    ExpiryIndex idx(1000, numEntries, noLimit, 8);
+    idx.add("never", 0);
+    idx.add("past", 990);
+    idx.add("now", 1000);
+    idx.add("soon", 1003);
+    idx.add("later", 1010);
+    idx.add("much_later", 1100);
+    assert(idx.size() == 5);
+
+    // Anything added behind the wheel is due right away.
+    std::vector<std::string> out = pop(idx, 1000);
+    assert(out.size() == 1);
+    assert(out[0] == "past");
+
+    out = pop(idx, 1001);
+    assert(out.size() == 1);
+    assert(out[0] == "now");
+
+    out = pop(idx, 1004);
+    assert(out.size() == 1);
+    assert(out[0] == "soon");
+
+    out = pop(idx, 1010);
+    assert(out.empty());
+
+    out = pop(idx, 1011);
+    assert(out.size() == 1);
+    assert(out[0] == "later");
+
+    idx.add("late", 1005);
+    out = pop(idx, 1011);
+    assert(out.size() == 1);
+    assert(out[0] == "late");
+
+    out = pop(idx, 2000);
+    assert(out.size() == 1);
+    assert(out[0] == "much_later");
+    assert(idx.size() == 0);
+}
+
+static void testLimit() {
+    ExpiryIndex idx(0, numEntries, noLimit, 16);
+    for (int i = 0; i < 100; ++i) {
+        idx.add(keyOf(i), 1 + i);
+    }
+
+    std::vector<std::string> out;
+    size_t memory(0);
+    assert(!idx.popExpired(1000, out, 10, memory));
+    assert(out.size() == 10);
+    assert(memory == 10 * ExpiryIndex::entrySize(keyOf(0)));
+    assert(idx.popExpired(1000, out, 1000, memory));
+    assert(out.size() == 100);
+    assert(idx.size() == 0);
+}
+
+static void testClear() {
+    ExpiryIndex idx(0, numEntries, noLimit, 4);
+    idx.add("a", 1);
+    idx.add("bb", 100);
+    assert(idx.size() == 2);
+    assert(idx.clear() == ExpiryIndex::entrySize("a")
+           + ExpiryIndex::entrySize("bb"));
+    assert(idx.size() == 0);
+    assert(pop(idx, 1000).empty());
+}
+
+static void testUpdate() {
+    ExpiryIndex idx(1000, numEntries, noLimit, 8);
+    // A key moving around keeps a single entry.
+    time_t exptime(0);
+    for (time_t t = 1001; t < 1100; ++t) {
+        idx.update("moving", exptime, t);
+        exptime = t;
+        assert(idx.size() == 1);
+    }
+    assert(!idx.add("moving", exptime));
+    assert(pop(idx, 1050).empty());
+
+    // Entries due now, in the wheel and in the overflow all go away.
+    assert(idx.add("due", 990));
+    assert(idx.add("wheel", 1003));
+    assert(idx.size() == 3);
+    assert(idx.remove("moving", exptime));
+    assert(idx.remove("due", 990));
+    assert(idx.remove("wheel", 1003));
+    assert(!idx.remove("wheel", 1003));
+    assert(idx.size() == 0);
+    assert(pop(idx, 2000).empty());
+
+    // Losing the expiry time drops the entry.
+    assert(idx.add("k", 1500));
+    assert(idx.update("k", 1500, 0) == -1);
+    assert(idx.size() == 0);
+}
+
+static void testFull() {
+    Atomic<size_t> entries;
+    Atomic<size_t> maxEntries(2);
+    {
+        // The indexes share the budget.
+        ExpiryIndex idx(0, entries, maxEntries, 4);
+        ExpiryIndex other(0, entries, maxEntries, 4);
+        assert(idx.add("a", 1));
+        assert(other.add("b", 100));
+        assert(entries == 2);
+        assert(!idx.add("c", 2));
+        assert(idx.getNumDropped() == 1);
+        assert(idx.size() == 1);
+        // Moving an indexed key still works when full.
+        assert(idx.update("a", 1, 3) == 0);
+        assert(pop(idx, 4).size() == 1);
+        assert(idx.add("c", 2));
+        assert(!other.add("d", 2));
+        idx.clear();
+        assert(idx.getNumDropped() == 0);
+        assert(other.add("d", 2));
+    }
+    assert(entries == 0);
+}
+
+static void store(HashTable &h, const std::string &k, time_t exptime) {
+    Item i(k, 0, exptime, k.c_str(), k.length());
+    int64_t row_id = -1;
+    h.set(i, row_id);
+}
+
+static void testHashTable() {
+    HashTable h(global_stats, 5, 1);
+    time_t now = ep_real_time();
+    // The table may grow, which is accounted for too.
+    size_t overhead = global_stats.memOverhead.get() - h.memorySize();
+
+    store(h, "expired", now - 10);
+    store(h, "live", now + 3600);
+    store(h, "forever", 0);
+    // The entry goes away with the expiry time.
+    store(h, "updated", now - 10);
+    store(h, "updated", 0);
+    assert(h.getExpiryIndexSize() == 2);
+    // Rewriting a key with new times keeps one entry.
+    for (int i = 0; i < 100; ++i) {
+        store(h, "rewritten", now + 100 + i * 1000);
+    }
+    assert(h.getExpiryIndexSize() == 3);
+    // So does deleting it.
+    int64_t row_id(-1);
+    h.softDelete("rewritten", 0, row_id);
+    assert(h.getExpiryIndexSize() == 2);
+    store(h, "removed", now + 10);
+    assert(h.getExpiryIndexSize() == 3);
+    {
+        int bucket_num(0);
+        LockHolder lh = h.getLockedBucket("removed", &bucket_num);
+        assert(h.unlocked_del("removed", bucket_num));
+    }
+    assert(h.getExpiryIndexSize() == 2);
+    // The locks replaced by growing the table are accounted for until
+    // they're freed.
+    HashTable::getLocksEpochManager().reclaim();
+    assert(global_stats.memOverhead.get() - h.memorySize() - overhead
+           == ExpiryIndex::entrySize("expired") + ExpiryIndex::entrySize("live"));
+
+    std::vector<std::string> keys;
+    assert(h.popExpired(now, keys, 1000));
+    assert(keys.size() == 1);
+    assert(keys[0] == "expired");
+    assert(h.getExpiryIndexSize() == 1);
+
+    h.clear();
+    assert(h.getExpiryIndexSize() == 0);
+    assert(global_stats.memOverhead.get() - h.memorySize() == overhead);
+    assert(global_stats.expiryIndexEntries == 0);
+}
+
+class ExpiredCounter : public HashTableVisitor {
+public:
+    ExpiredCounter(time_t t) : now(t), expired(0) { }
+
+    void visit(StoredValue *v) {
+        if (v->isExpired(now) && !v->isDeleted()) {
+            ++expired;
+        }
+    }
+
+    time_t now;
+    size_t expired;
+};
+
+/**
+ * The expiry index finds the same items a visit of the whole table
+ * does, also when the changes were queued on many locks.
+ */
+static void testMatchesVisitor(size_t items, double fraction) {
+    HashTable h(global_stats, 769, 47);
+    time_t now = ep_real_time();
+    size_t ttld = static_cast<size_t>(items * fraction);
+    for (size_t i = 0; i < items; ++i) {
+        store(h, keyOf(i), i < ttld ? now - 1 : 0);
+    }
+
+    ExpiredCounter counter(now);
+    h.visit(counter);
+    std::vector<std::string> keys;
+    while (!h.popExpired(now, keys, 100)) {
+    }
+
+    assert(counter.expired == ttld);
+    assert(keys.size() == ttld);
+    h.clear();
+}
+
+int main() {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    global_stats.maxDataSize = 256 * 1024 * 1024;
+    testPopInOrder();
+    testLimit();
+    testClear();
+    testUpdate();
+    testFull();
+    testHashTable();
+    testMatchesVisitor(20000, 0.01);
+    testMatchesVisitor(20000, 0.5);
+    return 0;
+}
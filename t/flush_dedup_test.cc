@@ -0,0 +1,89 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include "flush_dedup.hh"
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+}
+
+static queued_item makeItem(const std::string &key, int64_t rowid) {
+    return queued_item(new QueuedItem(key, 0, queue_op_set, -1, rowid));
+}
+
+static std::string keyOf(int i) {
+    std::stringstream ss;
+    ss << "key" << i;
+    return ss.str();
+}
+
+static void testDedup() {
+    FlushDedupArena arena;
+    arena.reset(4);
+    assert(arena.insert(makeItem("a", 1)));
+    assert(arena.insert(makeItem("b", 2)));
+    assert(!arena.insert(makeItem("a", 3)));
+    assert(arena.insert(makeItem("c", 4)));
+    assert(!arena.insert(makeItem("b", 5)));
+    assert(arena.size() == 3);
+
+    std::vector<queued_item> out;
+    arena.drain(out);
+    assert(arena.size() == 0);
+    assert(out.size() == 3);
+    // The first item inserted for a key wins, in insertion order.
+    assert(out[0]->getKey() == "a" && out[0]->getRowId() == 1);
+    assert(out[1]->getKey() == "b" && out[1]->getRowId() == 2);
+    assert(out[2]->getKey() == "c" && out[2]->getRowId() == 4);
+}
+
+static void testReuse() {
+    FlushDedupArena arena;
+    arena.reset(1000);
+    size_t capacity = arena.capacity();
+    for (int i = 0; i < 1000; ++i) {
+        assert(arena.insert(makeItem(keyOf(i), i)));
+    }
+    std::vector<queued_item> out;
+    arena.drain(out);
+    assert(out.size() == 1000);
+
+    // A smaller batch reuses the slots, and nothing is left behind.
+    arena.reset(10);
+    assert(arena.capacity() == capacity);
+    for (int i = 0; i < 10; ++i) {
+        assert(arena.insert(makeItem(keyOf(i), i)));
+    }
+    assert(arena.size() == 10);
+    out.clear();
+    arena.drain(out);
+    assert(out.size() == 10);
+
+    // Growing reallocates the slots.
+    arena.reset(5000);
+    assert(arena.capacity() > capacity);
+    for (int i = 0; i < 5000; ++i) {
+        assert(arena.insert(makeItem(keyOf(i), i)));
+        assert(!arena.insert(makeItem(keyOf(i), i)));
+    }
+    assert(arena.size() == 5000);
+    out.clear();
+    arena.drain(out);
+}
+
+int main() {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    testDedup();
+    testReuse();
+    return 0;
+}
@@ -6,6 +6,7 @@
 #include <limits>
 #include <cassert>
 #include <algorithm>
+#include <map>
 
 #include <ep.hh>
 #include <item.hh>
@@ -273,6 +274,46 @@ static void testResize() {
     verifyFound(h, keys);
 }
 
+static void testLockedBatchSet() {
+    HashTable h(global_stats, 5, 3);
+
+    std::vector<std::string> keys = generateKeys(1000);
+    std::vector<std::string>::iterator it;
+    for (int lock_num = 0; lock_num < 3; ++lock_num) {
+        LockHolder lh = h.getLock(lock_num);
+        for (it = keys.begin(); it != keys.end(); ++it) {
+            int hv = h.hash(*it);
+            if (h.getLockNumForHash(hv) != lock_num) {
+                continue;
+            }
+            int bucket_num = h.getBucketUnderLock(hv, lock_num);
+            assert(bucket_num >= 0);
+            Item i(*it, 0, 0, it->c_str(), it->length());
+            int64_t row_id = -1;
+            assert(h.unlocked_set(i, 0, row_id, true, false, bucket_num)
+                   == NOT_FOUND);
+        }
+    }
+    verifyFound(h, keys);
+
+    // A lock number taken before a resize may no longer guard the key
+    std::vector<int> before;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        before.push_back(h.getLockNumForHash(h.hash(*it)));
+    }
+    h.resize(6143);
+    int moved = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        int hv = h.hash(keys[i]);
+        assert(h.getBucketUnderLock(hv, h.getLockNumForHash(hv)) >= 0);
+        if (h.getBucketUnderLock(hv, before[i]) < 0) {
+            ++moved;
+        }
+    }
+    assert(moved > 0);
+    verifyFound(h, keys);
+}
+
 class AccessGenerator : public Generator<bool> {
 public:
 
@@ -331,6 +372,158 @@ static void testAutoResize() {
     verifyFound(h, keys);
 }
 
+static void testShrinkAfterDeletes() {
+    HashTable h(global_stats, 5, 3);
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+    h.resize();
+    assert(h.getSize() == 6143);
+
+    for (size_t i = 100; i < keys.size(); ++i) {
+        assert(h.del(keys[i]));
+    }
+    keys.resize(100);
+    h.resize();
+    assert(h.getSize() == 193);
+    verifyFound(h, keys);
+
+    // Nothing was deleted since, so it stays put.
+    h.resize();
+    assert(h.getSize() == 193);
+}
+
+static void testCompact() {
+    HashTable::setDefaultNumBuckets(47);
+    HashTable h(global_stats, HashTable::MIN_SIZE, HashTable::MIN_LOCKS);
+    assert(h.getSize() == HashTable::MIN_SIZE);
+
+    std::vector<std::string> keys = generateKeys(3);
+    storeMany(h, keys);
+    assert(h.getSize() == HashTable::MIN_SIZE);
+
+    // Filling it up grows it to the default size right away.
+    std::vector<std::string> more = generateKeys(100, 3);
+    storeMany(h, more);
+    assert(h.getSize() == 47);
+    assert(h.getNumLocks() > HashTable::MIN_LOCKS);
+    verifyFound(h, keys);
+    verifyFound(h, more);
+
+    for (size_t i = 0; i < more.size(); ++i) {
+        assert(h.del(more[i]));
+    }
+
+    size_t overhead = global_stats.memOverhead.get();
+    h.compact();
+    assert(h.getSize() == HashTable::MIN_SIZE);
+    assert(h.getNumLocks() == HashTable::MIN_LOCKS);
+    assert(global_stats.memOverhead.get() < overhead);
+    verifyFound(h, keys);
+
+    HashTable::setDefaultNumBuckets(3);
+}
+
+static void testAdjustLocks() {
+    HashTable h(global_stats, 47, 7);
+    std::vector<std::string> keys = generateKeys(100);
+    storeMany(h, keys);
+
+    // Nobody waited for a lock, so it gives them up one step at a time.
+    h.adjustLocks();
+    assert(h.getNumLocks() == 3);
+    h.adjustLocks();
+    assert(h.getNumLocks() == 1);
+    h.adjustLocks();
+    assert(h.getNumLocks() == 1);
+    assert(h.getNumLockWaits() == 0);
+    verifyFound(h, keys);
+}
+
+static void testRetiredLocks() {
+    EpochManager &epochs(HashTable::getLocksEpochManager());
+    epochs.reclaim();
+    size_t overhead(global_stats.memOverhead.get());
+    {
+        HashTable h(global_stats, 47, 7);
+        global_stats.memOverhead.incr(h.memorySize());
+        size_t inTable(h.memorySize());
+
+        // A thread that loaded the locks but didn't get to wait on
+        // them yet keeps the replaced set alive.
+        EpochGuard *eg = new EpochGuard(epochs);
+        h.adjustLocks();
+        assert(h.getNumLocks() == 3);
+        epochs.reclaim();
+        assert(epochs.getNumRetired() == 1);
+        assert(global_stats.memOverhead.get() > overhead + h.memorySize());
+
+        delete eg;
+        epochs.reclaim();
+        assert(epochs.getNumRetired() == 0);
+        assert(global_stats.memOverhead.get() == overhead + h.memorySize());
+        assert(h.memorySize() < inTable);
+        global_stats.memOverhead.decr(h.memorySize());
+    }
+    assert(global_stats.memOverhead.get() == overhead);
+}
+
+/**
+ * Sets and deletes keys, while the first thread also compacts the
+ * table and adjusts its locks.
+ */
+class ReshapeGenerator : public Generator<bool> {
+public:
+
+    ReshapeGenerator(const std::vector<std::string> &k,
+                     HashTable &h) : keys(k), ht(h), threads(0) {}
+
+    bool operator()() {
+        bool reshaping(threads++ == 0);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (reshaping && i % 97 == 0) {
+                if (i % 2 == 0) {
+                    ht.compact();
+                } else {
+                    ht.adjustLocks();
+                }
+            }
+            Item itm(keys[i], 0, 0, keys[i].c_str(), keys[i].length());
+            int64_t row_id = -1;
+            ht.set(itm, row_id);
+            if (i % 3 == 0) {
+                ht.del(keys[i]);
+            }
+        }
+        return true;
+    }
+
+private:
+    std::vector<std::string>  keys;
+    HashTable                &ht;
+    Atomic<int>               threads;
+};
+
+static void testConcurrentAccessReshape() {
+    HashTable::setDefaultNumBuckets(769);
+    HashTable h(global_stats, HashTable::MIN_SIZE, HashTable::MIN_LOCKS);
+
+    std::vector<std::string> keys = generateKeys(10000);
+    ReshapeGenerator gen(keys, h);
+    getCompletedThreads(16, &gen);
+
+    std::vector<std::string> left;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (i % 3 != 0) {
+            left.push_back(keys[i]);
+        }
+    }
+    verifyFound(h, left);
+    assert(count(h) == static_cast<int>(left.size()));
+
+    HashTable::setDefaultNumBuckets(3);
+}
+
 static void testAdd() {
     HashTable h(global_stats, 5, 1);
     const int nkeys = 5000;
@@ -387,6 +580,93 @@ static void testPoisonKey() {
     assert(count(h) == 1);
 }
 
+static void update(HashTable &h, const std::string &k, const std::string &val) {
+    Item i(k, 0, 0, val.c_str(), val.length());
+    int64_t row_id = -1;
+    h.set(i, row_id);
+}
+
+static void testSnapshot() {
+    HashTable h(global_stats, 47, 3);
+    std::vector<std::string> keys = generateKeys(500);
+    storeMany(h, keys);
+    size_t overhead = global_stats.memOverhead.get();
+
+    RCPtr<HashTableSnapshot> snap = h.beginSnapshot(7);
+    assert(snap);
+    assert(snap->getCheckpointId() == 7);
+    assert(!h.beginSnapshot(8));
+
+    std::vector<SnapshotValue> image;
+    assert(h.scanSnapshot(snap, 10, image));
+
+    // Change everything, both in the buckets already copied and the
+    // ones that aren't.
+    for (size_t i = 0; i < keys.size(); ++i) {
+        int64_t row_id = -1;
+        if (i % 2 == 0) {
+            update(h, keys[i], "changed");
+            update(h, keys[i], "changed again");
+        } else {
+            assert(h.softDelete(keys[i], 0, row_id) == WAS_DIRTY);
+        }
+    }
+    std::vector<std::string> added = generateKeys(600, 500);
+    storeMany(h, added);
+    assert(snap->getNumVersions() > 0);
+    assert(snap->getNumVersions() < keys.size() + added.size());
+    assert(global_stats.memOverhead.get() > overhead);
+
+    // The bucket numbers must stay put until the snapshot is done.
+    h.resize(6143);
+    assert(h.getSize() == 47);
+
+    while (h.scanSnapshot(snap, 10, image)) {
+    }
+    assert(snap->getNumVersions() == 0);
+    assert(global_stats.memOverhead.get() == overhead);
+
+    std::map<std::string, std::string> seen;
+    std::vector<SnapshotValue>::iterator it;
+    for (it = image.begin(); it != image.end(); ++it) {
+        assert(it->present);
+        assert(it->resident);
+        assert(seen.find(it->key) == seen.end());
+        seen[it->key] = it->value->to_s();
+    }
+    assert(seen.size() == keys.size());
+    std::vector<std::string>::iterator kit;
+    for (kit = keys.begin(); kit != keys.end(); ++kit) {
+        assert(seen[*kit] == *kit);
+    }
+
+    h.endSnapshot(snap);
+    assert(!h.getSnapshot());
+    h.resize(6143);
+    assert(h.getSize() == 6143);
+    assert(count(h, false) == 250 + 100);
+}
+
+static void testSnapshotClear() {
+    HashTable h(global_stats, 47, 3);
+    std::vector<std::string> keys = generateKeys(100);
+    storeMany(h, keys);
+    size_t overhead = global_stats.memOverhead.get();
+
+    RCPtr<HashTableSnapshot> snap = h.beginSnapshot(1);
+    update(h, keys[0], "changed");
+    assert(snap->getNumVersions() == 1);
+
+    h.clear();
+    assert(!snap->isValid());
+    assert(!h.getSnapshot());
+    assert(global_stats.memOverhead.get() == overhead);
+    std::vector<SnapshotValue> image;
+    assert(!h.scanSnapshot(snap, 47, image));
+    assert(image.empty());
+    h.endSnapshot(snap);
+}
+
 int main() {
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
     global_stats.maxDataSize = 64*1024*1024;
@@ -403,7 +683,15 @@ int main() {
     testDepthCounting();
     testPoisonKey();
     testResize();
+    testLockedBatchSet();
     testConcurrentAccessResize();
     testAutoResize();
+    testShrinkAfterDeletes();
+    testCompact();
+    testAdjustLocks();
+    testRetiredLocks();
+    testConcurrentAccessReshape();
+    testSnapshot();
+    testSnapshotClear();
     exit(0);
 }
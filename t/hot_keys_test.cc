@@ -0,0 +1,236 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+#include "hot_keys.hh"
+#include "stored-value.hh"
+
+#include "threadtests.hh"
+
+time_t time_offset;
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL) + time_offset;
+    }
+}
+
+EPStats global_stats;
+
+static std::string makeKey(size_t i) {
+    std::stringstream ss;
+    ss << "key" << i;
+    return ss.str();
+}
+
+static void store(HashTable &h, const std::string &k, const std::string &v,
+                  time_t exptime = 0) {
+    Item i(k, 0, exptime, v.c_str(), v.length());
+    int64_t row_id = -1;
+    h.set(i, row_id);
+}
+
+static void publish(HashTable &h, const std::string &k) {
+    int bucket_num(0);
+    LockHolder lh = h.getLockedBucket(k, &bucket_num);
+    StoredValue *v = h.unlocked_find(k, bucket_num);
+    assert(v);
+    h.unlocked_publishHot(v);
+}
+
+static std::string getHot(HashTable &h, const std::string &k) {
+    Item *itm = h.getHotItem(k, 0);
+    if (itm == NULL) {
+        return "";
+    }
+    std::string rv(itm->getValue()->to_s());
+    delete itm;
+    return rv;
+}
+
+static void testSampling() {
+    HotKeyTracker none(0, 1);
+    HotKeyTracker some(4, 1);
+    size_t sampled(0);
+    for (int i = 0; i < 100; ++i) {
+        assert(!none.shouldSample());
+        if (some.shouldSample()) {
+            ++sampled;
+        }
+    }
+    assert(sampled == 25);
+}
+
+static void testTracker() {
+    HotKeyTracker tracker(1, 64);
+    bool hot(false);
+    for (size_t i = 0; i < 2000; ++i) {
+        if (i % 2 == 0) {
+            hot = tracker.sample(3, "hot");
+        } else {
+            assert(!tracker.sample(3, makeKey(random() % 10000)));
+        }
+    }
+    assert(hot);
+    // The same key in another vbucket is another key.
+    assert(!tracker.sample(4, "hot"));
+    assert(tracker.getNumHotKeys() == 1);
+
+    std::vector<HotKey> keys;
+    tracker.getKeys(keys);
+    assert(keys.size() <= HotKeyTracker::MAX_CANDIDATES);
+    assert(keys[0].vbucket == 3 && keys[0].key == "hot");
+    assert(keys[0].samples >= 64);
+
+    // It cools down once nobody reads it any more.
+    for (size_t i = 0; i < 10 * HotKeyTracker::WINDOW; ++i) {
+        tracker.sample(3, makeKey(random() % 10000));
+    }
+    assert(tracker.getNumHotKeys() == 0);
+}
+
+static void testPublish() {
+    HashTable h(global_stats, 5, 1);
+    store(h, "k", "v1");
+    assert(getHot(h, "k") == "");
+
+    publish(h, "k");
+    assert(h.getNumHotItems() == 1);
+    Item *itm = h.getHotItem("k", 0);
+    assert(itm && itm->getValue()->to_s() == "v1");
+    std::string k("k");
+    assert(itm->getCas() == h.find(k)->getCas());
+    delete itm;
+
+    // Any change stops the old version from being handed out.
+    store(h, "k", "v2");
+    assert(getHot(h, "k") == "");
+    publish(h, "k");
+    assert(getHot(h, "k") == "v2");
+
+    int64_t row_id(-1);
+    assert(h.softDelete("k", 0, row_id) == WAS_DIRTY);
+    assert(getHot(h, "k") == "");
+    assert(h.getNumHotItems() == 0);
+
+    // Locked items aren't handed out.
+    store(h, "locked", "v");
+    {
+        int bucket_num(0);
+        LockHolder lh = h.getLockedBucket("locked", &bucket_num);
+        StoredValue *v = h.unlocked_find("locked", bucket_num);
+        v->lock(ep_current_time() + 10);
+        h.unlocked_publishHot(v);
+    }
+    assert(getHot(h, "locked") == "");
+
+    // Nor are ejected ones.
+    store(h, "ejected", "v");
+    publish(h, "ejected");
+    assert(getHot(h, "ejected") == "v");
+    {
+        int bucket_num(0);
+        LockHolder lh = h.getLockedBucket("ejected", &bucket_num);
+        StoredValue *v = h.unlocked_find("ejected", bucket_num);
+        v->markClean(NULL);
+        assert(v->ejectValue(global_stats, h));
+    }
+    assert(getHot(h, "ejected") == "");
+
+    // Nor expired ones.
+    store(h, "expiring", "v", ep_real_time() + 5);
+    publish(h, "expiring");
+    assert(getHot(h, "expiring") == "v");
+    time_offset += 10;
+    assert(getHot(h, "expiring") == "");
+    time_offset = 0;
+
+    // Only a few items are published at once.
+    for (size_t i = 0; i < 2 * HotItems::NUM_SLOTS; ++i) {
+        store(h, makeKey(i), makeKey(i));
+        publish(h, makeKey(i));
+        assert(getHot(h, makeKey(i)) == makeKey(i));
+    }
+    assert(h.getNumHotItems() == HotItems::NUM_SLOTS);
+
+    h.clear();
+    assert(h.getNumHotItems() == 0);
+    assert(getHot(h, makeKey(2 * HotItems::NUM_SLOTS - 1)) == "");
+}
+
+static const size_t numVersions = 20000;
+
+/**
+ * One thread keeps changing a key while the others read it, through
+ * the hot item when there's one and under the lock otherwise.  Nobody
+ * may see an older version after seeing a newer one.
+ */
+class VersionGenerator : public Generator<bool> {
+public:
+    VersionGenerator(HashTable &ht) : h(ht), next(0), done(false) {}
+
+    bool operator()() {
+        if (next++ == 0) {
+            for (size_t i = 1; i <= numVersions; ++i) {
+                std::stringstream ss;
+                ss << i;
+                store(h, "key", ss.str());
+            }
+            done = true;
+            return true;
+        }
+
+        size_t seen(0);
+        while (!done) {
+            std::string value(getHot(h, "key"));
+            if (value.empty()) {
+                int bucket_num(0);
+                LockHolder lh = h.getLockedBucket("key", &bucket_num);
+                StoredValue *v = h.unlocked_find("key", bucket_num);
+                value = v->getValue()->to_s();
+                h.unlocked_publishHot(v);
+            }
+            size_t version(strtoul(value.c_str(), NULL, 10));
+            assert(version >= seen);
+            seen = version;
+        }
+        return true;
+    }
+
+private:
+    HashTable     &h;
+    Atomic<int>    next;
+    Atomic<bool>   done;
+};
+
+static void testConcurrentVersions() {
+    HashTable h(global_stats, 5, 1);
+    store(h, "key", "0");
+    VersionGenerator gen(h);
+    getCompletedThreads(4, &gen);
+    h.clear();
+}
+
+int main(int argc, char **argv) {
+    (void)argc; (void)argv;
+    alarm(120);
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    HashTable::setDefaultNumBuckets(5);
+    HashTable::setDefaultNumLocks(1);
+
+    testSampling();
+    testTracker();
+    testPublish();
+    testConcurrentVersions();
+}
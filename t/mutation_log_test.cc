@@ -228,6 +228,87 @@ static void testDelAll() {
     remove(TMP_LOG_FILE);
 }
 
+static void testReplaceWithTail() {
+    remove(TMP_LOG_FILE);
+    remove(TMP_LOG_FILE ".compact");
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+
+        ml.newItem(3, "key1", 1);
+        ml.newItem(3, "key1", 2);
+        ml.newItem(2, "key2", 3);
+        ml.commit1();
+        ml.commit2();
+
+        size_t counts[MUTATION_LOG_TYPES];
+        size_t offset(0);
+        assert(ml.mark(counts, offset));
+        assert(counts[ML_NEW] == 3);
+        assert(offset == ml.logSize);
+
+        // Written to the live log while the compacted one is built.
+        ml.newItem(3, "key3", 4);
+        ml.delItem(2, "key2");
+        ml.commit1();
+        ml.commit2();
+
+        MutationLog compacted(TMP_LOG_FILE ".compact");
+        compacted.open();
+        compacted.newItem(3, "key1", 2);
+        compacted.newItem(2, "key2", 3);
+        compacted.commit1();
+        compacted.commit2();
+
+        offset = ml.copyBlocksTo(compacted, offset);
+        assert(offset == ml.logSize);
+
+        // And some more before the switch.
+        ml.newItem(2, "key4", 5);
+        ml.commit1();
+        ml.commit2();
+
+        assert(ml.replaceWith(compacted, offset, counts));
+        assert(!compacted.exists());
+        assert(ml.isOpen());
+
+        // 2 compacted + 2 tail, 1 tail delete.
+        assert(ml.itemsLogged[ML_NEW] == 4);
+        assert(ml.itemsLogged[ML_DEL] == 1);
+        assert(ml.itemsLogged[ML_COMMIT2] == 3);
+
+        // Writing continues in the replaced log.
+        ml.newItem(3, "key5", 6);
+        ml.commit1();
+        ml.commit2();
+    }
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        h.setVbVer(2, 1);
+        h.setVbVer(3, 1);
+
+        assert(h.load());
+        assert(h.getItemsSeen()[ML_NEW] == 5);
+        assert(h.getItemsSeen()[ML_DEL] == 1);
+
+        std::map<std::string, uint64_t> maps[4];
+        h.apply(&maps, loaderFun);
+
+        assert(maps[2].size() == 1);
+        assert(maps[2]["key4"] == 5);
+        assert(maps[3].size() == 3);
+        assert(maps[3]["key1"] == 2);
+        assert(maps[3]["key3"] == 4);
+        assert(maps[3]["key5"] == 6);
+    }
+
+    remove(TMP_LOG_FILE);
+}
+
 static bool leftover_compare(mutation_log_uncommitted_t a,
                              mutation_log_uncommitted_t b) {
     if (a.vbucket != b.vbucket) {
@@ -245,6 +326,54 @@ static bool leftover_compare(mutation_log_uncommitted_t a,
     return false;
 }
 
+extern "C" {
+    static void *commitLater(void *arg) {
+        MutationLog *ml = static_cast<MutationLog*>(arg);
+        usleep(100000);
+        ml->newItem(3, "key2", 2);
+        ml->commit1();
+        ml->commit2();
+        return NULL;
+    }
+}
+
+static void testMarkWaitsForCommit() {
+    remove(TMP_LOG_FILE);
+    remove(TMP_LOG_FILE ".compact");
+
+    MutationLog ml(TMP_LOG_FILE);
+    ml.open();
+    ml.newItem(3, "key1", 1);
+
+    // Nothing committed the transaction in progress.
+    size_t counts[MUTATION_LOG_TYPES];
+    size_t offset(0);
+    assert(!ml.mark(counts, offset, 0.1));
+
+    // The mark comes after the commit, never halfway through.
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, commitLater, &ml) == 0);
+    assert(ml.mark(counts, offset, 10));
+    assert(counts[ML_COMMIT2] == 1);
+    assert(counts[ML_NEW] == 2);
+    assert(offset == ml.logSize);
+    assert(pthread_join(tid, NULL) == 0);
+
+    // Nor is the log replaced halfway through one.
+    MutationLog compacted(TMP_LOG_FILE ".compact");
+    compacted.open();
+    ml.newItem(3, "key3", 3);
+    assert(!ml.replaceWith(compacted, offset, counts, 0.1));
+    assert(ml.isOpen());
+    ml.commit1();
+    ml.commit2();
+    assert(ml.replaceWith(compacted, offset, counts, 0.1));
+    assert(ml.itemsLogged[ML_NEW] == 1);
+    assert(ml.itemsLogged[ML_COMMIT2] == 1);
+
+    remove(TMP_LOG_FILE);
+}
+
 static void testLoggingDirty() {
     remove(TMP_LOG_FILE);
 
@@ -478,6 +607,8 @@ int main(int, char **) {
     testSyncSet();
     testLogging();
     testDelAll();
+    testReplaceWithTail();
+    testMarkWaitsForCommit();
     testLoggingDirty();
     testLoggingBadCRC();
     testLoggingShortRead();
@@ -0,0 +1,142 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+#include <unistd.h>
+
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <memcached/protocol_binary.h>
+
+#include "command_ids.h"
+#include "observe_index.hh"
+
+static std::string makeKey(size_t i) {
+    std::stringstream ss;
+    ss << "key" << i;
+    return ss.str();
+}
+
+static void testEvents() {
+    ObserveIndex index(7);
+    Atomic<hrtime_t> touched(0);
+    observed_key_t a("a", 10);
+    a.vbucket = 1;
+    a.touched = &touched;
+    observed_key_t other("a", 10);
+    other.vbucket = 2;
+    index.add(&a);
+    index.add(&other);
+
+    assert(index.isObserved("a", 1));
+    assert(!index.isObserved("a", 3));
+    assert(!index.isObserved("b", 1));
+
+    assert(index.keyEvent("a", 11, 1, OBS_PERSISTED_EVENT) == 1);
+    assert(!index.getState(&a).persisted);
+    assert(touched.get() != 0);
+
+    assert(index.keyEvent("a", 10, 1, OBS_PERSISTED_EVENT) == 1);
+    assert(index.keyEvent("a", 10, 1, OBS_REPLICATED_EVENT) == 1);
+    observed_key_t st(index.getState(&a));
+    assert(st.persisted);
+    assert(st.replicas == 1);
+    assert(!st.mutated);
+
+    assert(index.keyEvent("a", 12, 1, OBS_MODIFIED_EVENT) == 1);
+    assert(index.getState(&a).mutated);
+    assert(index.keyEvent("a", 12, 1, OBS_DELETED_EVENT) == 1);
+    assert(index.getState(&a).deleted);
+
+    // Nothing happened to the key in the other vbucket.
+    st = index.getState(&other);
+    assert(!st.persisted && !st.mutated && !st.deleted && st.replicas == 0);
+
+    index.remove(&a);
+    assert(!index.isObserved("a", 1));
+    assert(index.keyEvent("a", 10, 1, OBS_PERSISTED_EVENT) == 0);
+    assert(index.isObserved("a", 2));
+    index.remove(&other);
+    assert(!index.isObserved("a", 2));
+}
+
+static const size_t numSets = 10000;
+static const size_t keysPerSet = 10;
+static const size_t batchSize = 100000;
+static const size_t scanSample = 100;
+
+/**
+ * Persists a flush batch against 10k observe sets, through the index
+ * and by scanning every set for every item as the registry did.
+ */
+static void benchPersistBatch() {
+    ObserveIndex index;
+    std::vector<std::vector<observed_key_t*> > sets(numSets);
+    for (size_t s = 0; s < numSets; ++s) {
+        for (size_t k = 0; k < keysPerSet; ++k) {
+            // Every even key of the batch is observed by two sets.
+            size_t n = ((s * keysPerSet + k) * 2) % batchSize;
+            observed_key_t *obs = new observed_key_t(makeKey(n), n);
+            obs->vbucket = n % 1024;
+            sets[s].push_back(obs);
+            index.add(obs);
+        }
+    }
+
+    std::vector<std::string> batch;
+    for (size_t i = 0; i < batchSize; ++i) {
+        batch.push_back(makeKey(i));
+    }
+
+    hrtime_t start = gethrtime();
+    size_t found = 0;
+    for (size_t i = 0; i < batchSize; ++i) {
+        if (index.isObserved(batch[i], i % 1024)) {
+            found += index.keyEvent(batch[i], i, i % 1024,
+                                    OBS_PERSISTED_EVENT);
+        }
+    }
+    hrtime_t indexed = gethrtime() - start;
+    assert(found == numSets * keysPerSet);
+
+    start = gethrtime();
+    size_t scanned = 0;
+    for (size_t i = 0; i < scanSample; ++i) {
+        for (size_t s = 0; s < numSets; ++s) {
+            std::vector<observed_key_t*>::iterator it;
+            for (it = sets[s].begin(); it != sets[s].end(); ++it) {
+                if ((*it)->key.compare(batch[i]) == 0 && (*it)->cas == i) {
+                    (*it)->persisted = true;
+                    ++scanned;
+                }
+            }
+        }
+    }
+    hrtime_t scan = gethrtime() - start;
+    assert(scanned > 0);
+
+    std::cout << "Persisting " << batchSize << " items against " << numSets
+              << " observe sets:" << std::endl
+              << "  indexed: " << indexed / 1000000 << " ms" << std::endl
+              << "  scanning every set: "
+              << (scan / scanSample) * batchSize / 1000000
+              << " ms (estimated from " << scanSample << " items)"
+              << std::endl;
+
+    for (size_t s = 0; s < numSets; ++s) {
+        std::vector<observed_key_t*>::iterator it;
+        for (it = sets[s].begin(); it != sets[s].end(); ++it) {
+            index.remove(*it);
+            delete *it;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    (void)argc; (void)argv;
+    alarm(60);
+
+    testEvents();
+    benchPersistBatch();
+}
@@ -0,0 +1,217 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+#include <unistd.h>
+
+#include <cassert>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include "value_cache.hh"
+
+#include "threadtests.hh"
+
+#define TMP_CACHE_FILE "/tmp/value_cache_test.data"
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL);
+    }
+}
+
+EPStats global_stats;
+
+static std::string makeKey(size_t i) {
+    std::stringstream ss;
+    ss << "key" << i;
+    return ss.str();
+}
+
+static value_t makeValue(size_t i) {
+    // Compressible, and different for every key.
+    std::stringstream ss;
+    ss << i;
+    std::string s(ss.str());
+    while (s.size() < 512) {
+        s.append(ss.str());
+    }
+    return value_t(Blob::New(s.data(), s.size()));
+}
+
+static bool sameValue(const value_t &a, const value_t &b) {
+    return a && b && a->length() == b->length()
+        && std::memcmp(a->getData(), b->getData(), a->length()) == 0;
+}
+
+/**
+ * Wants the values of every other key.
+ */
+class EvenValidator : public ValueCacheValidator {
+public:
+    bool isWanted(uint16_t, const std::string &key, uint64_t) {
+        std::stringstream ss(key.substr(3));
+        size_t i;
+        ss >> i;
+        return i % 2 == 0;
+    }
+};
+
+class WantAllValidator : public ValueCacheValidator {
+public:
+    bool isWanted(uint16_t, const std::string &, uint64_t) {
+        return true;
+    }
+};
+
+static void testPutGet() {
+    ValueCache cache(TMP_CACHE_FILE, 1024 * 1024, global_stats);
+    assert(cache.open());
+
+    value_t v(makeValue(1));
+    assert(cache.put(0, "a", 10, v));
+    assert(cache.getNumItems() == 1);
+    assert(cache.getRawSize() == v->length());
+    assert(sameValue(cache.get(0, "a", 10), v));
+
+    // Other vbuckets and keys have nothing.
+    assert(!cache.get(1, "a", 10));
+    assert(!cache.get(0, "b", 10));
+
+    // A value written for an older version is never returned.
+    assert(!cache.get(0, "a", 11));
+    assert(cache.getNumItems() == 0);
+    assert(cache.getLiveSize() == 0);
+
+    // A newer version replaces the old one.
+    assert(cache.put(0, "a", 12, makeValue(2)));
+    assert(cache.put(0, "a", 13, v));
+    assert(cache.getNumItems() == 1);
+    assert(sameValue(cache.get(0, "a", 13), v));
+    cache.remove(0, "a");
+    assert(!cache.get(0, "a", 13));
+
+    // An empty value round trips too.
+    value_t empty(Blob::New(NULL, 0));
+    assert(cache.put(0, "e", 1, empty));
+    value_t got(cache.get(0, "e", 1));
+    assert(got && got->length() == 0);
+}
+
+static void testCompact() {
+    ValueCache cache(TMP_CACHE_FILE, 4 * 1024 * 1024, global_stats);
+    assert(cache.open());
+
+    const size_t n = 1000;
+    for (size_t i = 0; i < n; ++i) {
+        assert(cache.put(i % 4, makeKey(i), i, makeValue(i)));
+    }
+    assert(cache.getNumItems() == n);
+    assert(!cache.needsCompaction(0.5));
+    size_t before = cache.getFileSize();
+
+    // Replacing every value leaves half of the file unused.
+    for (size_t i = 0; i < n; ++i) {
+        assert(cache.put(i % 4, makeKey(i), i + n, makeValue(i)));
+    }
+    assert(cache.needsCompaction(0.4));
+
+    WantAllValidator all;
+    assert(cache.compact(all) == before);
+    assert(cache.getFileSize() == before);
+    assert(cache.getNumItems() == n);
+
+    EvenValidator even;
+    cache.compact(even);
+    assert(cache.getNumItems() == n / 2);
+    assert(cache.getFileSize() < before);
+    assert(cache.getFileSize() == cache.getLiveSize());
+    for (size_t i = 0; i < n; ++i) {
+        value_t v(cache.get(i % 4, makeKey(i), i + n));
+        if (i % 2 == 0) {
+            assert(sameValue(v, makeValue(i)));
+        } else {
+            assert(!v);
+        }
+    }
+
+    // Writes go on after a compaction.
+    assert(cache.put(0, "after", 1, makeValue(7)));
+    assert(sameValue(cache.get(0, "after", 1), makeValue(7)));
+}
+
+static void testFull() {
+    ValueCache cache(TMP_CACHE_FILE, 4096, global_stats);
+    assert(cache.open());
+
+    size_t failures = global_stats.valueCacheWriteFailures;
+    std::string big(8192, 'x');
+    for (size_t i = 0; i < big.size(); ++i) {
+        big[i] = static_cast<char>(random());
+    }
+    assert(!cache.put(0, "big", 1, value_t(Blob::New(big.data(), big.size()))));
+    assert(global_stats.valueCacheWriteFailures == failures + 1);
+    assert(cache.getNumItems() == 0);
+    assert(cache.put(0, "small", 1, makeValue(1)));
+}
+
+/**
+ * Half the threads read and write while the others compact.
+ */
+class CompactGenerator : public Generator<bool> {
+public:
+    CompactGenerator(ValueCache &c) : cache(c), next(0) {}
+
+    bool operator()() {
+        int id = next++;
+        if (id % 2 == 0) {
+            EvenValidator even;
+            for (int i = 0; i < 20; ++i) {
+                cache.compact(even);
+            }
+            return true;
+        }
+        for (size_t i = 0; i < 2000; ++i) {
+            size_t k = (i * 2) % 1000;
+            assert(cache.put(id, makeKey(k), i, makeValue(k)));
+            assert(sameValue(cache.get(id, makeKey(k), i), makeValue(k)));
+        }
+        return true;
+    }
+
+private:
+    ValueCache    &cache;
+    Atomic<int>    next;
+};
+
+static void testConcurrentCompact() {
+    ValueCache cache(TMP_CACHE_FILE, 64 * 1024 * 1024, global_stats);
+    assert(cache.open());
+
+    CompactGenerator gen(cache);
+    getCompletedThreads(8, &gen);
+
+    // Only the last version of every even key of the 4 writers is left.
+    EvenValidator even;
+    cache.compact(even);
+    assert(cache.getNumItems() == 4 * 500);
+    assert(!cache.needsCompaction(0.01));
+}
+
+int main(int argc, char **argv) {
+    (void)argc; (void)argv;
+    alarm(120);
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+
+    testPutGet();
+    testCompact();
+    testFull();
+    testConcurrentCompact();
+    assert(global_stats.memOverhead == 0);
+    assert(access(TMP_CACHE_FILE, F_OK) != 0);
+}
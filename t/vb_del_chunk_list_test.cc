@@ -3,6 +3,7 @@
 #include "ep.hh"
 #undef NDEBUG
 #include <assert.h>
+#include <set>
 
 
 static void testAddChunkRange() {
@@ -113,12 +114,85 @@ static void testMergeChunkRanges() {
     assert(it->first == 80 && it->second == 150);
 }
 
+static void testCreateRangeList() {
+    VBucketDeletionVisitor vbdv(3);
+    int64_t ids[] = { 9, 2, 14, 5, 7, 2, 11, 1 };
+    for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i) {
+        vbdv.addRowId(ids[i]);
+    }
+
+    // Sorted and without the duplicate: 1 2 5 | 7 9 11 | 14
+    VBDeletionChunkRangeList chunk_range_list;
+    vbdv.createRangeList(chunk_range_list);
+    assert(chunk_range_list.size() == 3);
+    chunk_range_iterator_t it = chunk_range_list.begin();
+    assert(it->first == 1 && it->second == 5);
+    ++it;
+    assert(it->first == 7 && it->second == 11);
+    ++it;
+    assert(it->first == 14 && it->second == 14);
+    assert(vbdv.memorySize() == 0);
+
+    VBucketDeletionVisitor empty(3);
+    VBDeletionChunkRangeList empty_list;
+    empty.createRangeList(empty_list);
+    assert(empty_list.size() == 0);
+}
+
+/**
+ * The chunk ranges built from the row id array match the ones built
+ * from the std::set the visitor used to keep.
+ */
+static void testMatchesSortedSet(size_t num_items, size_t chunk_size) {
+    std::vector<int64_t> ids(num_items);
+    for (size_t i = 0; i < num_items; ++i) {
+        ids[i] = static_cast<int64_t>(i * 2 + 1);
+    }
+    // Hash table order has nothing to do with the row id order.
+    srand(42);
+    std::random_shuffle(ids.begin(), ids.end());
+
+    VBucketDeletionVisitor vbdv(chunk_size, num_items);
+    std::vector<int64_t>::iterator it;
+    for (it = ids.begin(); it != ids.end(); ++it) {
+        vbdv.addRowId(*it);
+    }
+    VBDeletionChunkRangeList array_ranges;
+    vbdv.createRangeList(array_ranges);
+
+    std::set<int64_t> tree(ids.begin(), ids.end());
+    VBDeletionChunkRangeList tree_ranges;
+    size_t counter = 0;
+    int64_t start_row_id = -1;
+    std::set<int64_t>::iterator tit;
+    for (tit = tree.begin(); tit != tree.end(); ++tit) {
+        if (++counter == 1) {
+            start_row_id = *tit;
+        }
+        if (counter == chunk_size || tit == --tree.end()) {
+            tree_ranges.add(start_row_id, *tit);
+            counter = 0;
+        }
+    }
+
+    assert(array_ranges.size() == (num_items + chunk_size - 1) / chunk_size);
+    assert(array_ranges.size() == tree_ranges.size());
+    chunk_range_iterator_t ait = array_ranges.begin();
+    chunk_range_iterator_t tit2 = tree_ranges.begin();
+    for (; ait != array_ranges.end(); ++ait, ++tit2) {
+        assert(ait->first == tit2->first && ait->second == tit2->second);
+    }
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
 
     testAddChunkRange();
     testSplitChunkRange();
     testMergeChunkRanges();
+    testCreateRangeList();
+    testMatchesSortedSet(10000, 100);
+    testMatchesSortedSet(12345, 100);
 
     return 0;
 }
@@ -5,6 +5,7 @@
 #include <unistd.h>
 
 #include <cassert>
+#include <sstream>
 #include <vector>
 #include <algorithm>
 
@@ -100,6 +101,78 @@ static void testConcurrentUpdate(void) {
     assert(vbm.getBuckets().size() == ((numThreads * vbucketsEach) / 2));
 }
 
+class CountedRetired : public Retired {
+public:
+    CountedRetired(Atomic<int> &c) : count(c) {}
+    ~CountedRetired() { ++count; }
+private:
+    Atomic<int> &count;
+};
+
+static void testEpochReclaim() {
+    Atomic<int> destroyed;
+    EpochManager epochs;
+
+    epochs.retire(new CountedRetired(destroyed));
+    assert(epochs.reclaim() == 1);
+    assert(destroyed == 1);
+
+    {
+        EpochGuard outer(epochs);
+        epochs.retire(new CountedRetired(destroyed));
+        {
+            EpochGuard inner(epochs);
+        }
+        // Still inside the outer guard.
+        assert(epochs.reclaim() == 0);
+        assert(destroyed == 1);
+    }
+    assert(epochs.reclaim() == 1);
+    assert(destroyed == 2);
+
+    // A reader that entered after something was retired doesn't hold
+    // it back.
+    epochs.retire(new CountedRetired(destroyed));
+    {
+        EpochGuard early(epochs);
+        assert(epochs.reclaim() == 0);
+        epochs.retire(new CountedRetired(destroyed));
+    }
+    {
+        EpochGuard late(epochs);
+        assert(epochs.reclaim() == 1);
+        assert(destroyed == 3);
+        assert(epochs.getNumRetired() == 1);
+    }
+    assert(epochs.reclaim() == 1);
+    assert(destroyed == 4);
+}
+
+static void testPeekBucket() {
+    Configuration config;
+    VBucketMap vbm(config);
+    RCPtr<VBucket> v(new VBucket(7, vbucket_state_active, global_stats,
+                                 checkpoint_config));
+    vbm.addBucket(v);
+    v.reset();
+
+    EpochGuard *eg = new EpochGuard(vbm.getEpochManager());
+    VBucket *peeked = vbm.peekBucket(7);
+    assert(peeked && peeked->getId() == 7);
+    assert(vbm.peekBucket(8) == NULL);
+
+    // The removed vbucket stays around for the reader.
+    vbm.removeBucket(7);
+    assert(!vbm.getBucket(7));
+    assert(vbm.reclaim() == 0);
+    assert(vbm.getNumRetired() == 1);
+    assert(peeked->getId() == 7);
+
+    delete eg;
+    assert(vbm.reclaim() == 1);
+    assert(vbm.getNumRetired() == 0);
+}
+
 static void testVBucketFilter() {
     VBucketFilter empty;
 
@@ -189,6 +262,8 @@ int main(int argc, char **argv) {
 
     testVBucketLookup();
     testConcurrentUpdate();
+    testEpochReclaim();
+    testPeekBucket();
     testVBucketFilter();
     testVBucketFilterFormatter();
 }
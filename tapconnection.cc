@@ -19,6 +19,14 @@
 #include "ep_engine.h"
 #include "dispatcher.hh"
 
+/**
+ * The number of bytes a backfilled item is counted as while it waits
+ * to be sent.
+ */
+static size_t backfilledSize(const Item *itm) {
+    return itm->getNKey() + itm->getNBytes();
+}
+
 static void notifyReplicatedItems(std::list<TapLogElement>::iterator from,
                                   std::list<TapLogElement>::iterator to,
                                   EventuallyPersistentEngine &engine);
@@ -104,6 +112,10 @@ public:
             config.setBgMaxPending(value);
         } else if (key.compare("tap_backlog_limit") == 0) {
             config.setBackfillBacklogLimit(value);
+        } else if (key.compare("tap_backfill_readahead") == 0) {
+            config.setBackfillReadAhead(value);
+        } else if (key.compare("tap_consumer_batch") == 0) {
+            config.setConsumerBatchSize(value);
         }
     }
 
@@ -117,6 +129,12 @@ public:
         }
     }
 
+    virtual void booleanValueChanged(const std::string &key, bool value) {
+        if (key.compare("tap_backfill_snapshot") == 0) {
+            config.setBackfillSnapshot(value);
+        }
+    }
+
 private:
     TapConfig &config;
 };
@@ -134,6 +152,9 @@ TapConfig::TapConfig(EventuallyPersistentEngine &e)
     requeueSleepTime = config.getTapRequeueSleepTime();
     backfillBacklogLimit = config.getTapBacklogLimit();
     backfillResidentThreshold = config.getTapBackfillResident();
+    backfillReadAhead = config.getTapBackfillReadahead();
+    backfillSnapshot = config.isTapBackfillSnapshot();
+    consumerBatchSize = config.getTapConsumerBatch();
 }
 
 void TapConfig::addConfigChangeListener(EventuallyPersistentEngine &engine) {
@@ -156,6 +177,12 @@ void TapConfig::addConfigChangeListener(EventuallyPersistentEngine &engine) {
                               new TapConfigChangeListener(engine.getTapConfig()));
     configuration.addValueChangedListener("tap_backfill_resident",
                               new TapConfigChangeListener(engine.getTapConfig()));
+    configuration.addValueChangedListener("tap_backfill_readahead",
+                              new TapConfigChangeListener(engine.getTapConfig()));
+    configuration.addValueChangedListener("tap_backfill_snapshot",
+                              new TapConfigChangeListener(engine.getTapConfig()));
+    configuration.addValueChangedListener("tap_consumer_batch",
+                              new TapConfigChangeListener(engine.getTapConfig()));
 }
 
 TapProducer::TapProducer(EventuallyPersistentEngine &theEngine,
@@ -180,6 +207,11 @@ TapProducer::TapProducer(EventuallyPersistentEngine &theEngine,
     diskBackfillCounter(0),
     totalBackfillBacklogs(0),
     vbucketFilter(),
+    bgResultBytes(0),
+    bgResultBytesHighWat(0),
+    diskBackfillBytes(0),
+    diskBackfillTime(0),
+    diskBackfillStart(0),
     queueMemSize(0),
     queueFill(0),
     queueDrain(0),
@@ -548,6 +580,7 @@ void TapProducer::clearQueues_UNLOCKED() {
         backfilledItems.pop();
     }
     bgResultSize = 0;
+    bgResultBytes = 0;
 
     // Clear the checkpoint message queue as well
     while (!checkpointMsgs.empty()) {
@@ -1131,6 +1164,12 @@ void TapProducer::completeBGFetchJob(Item *itm, bool implicitEnqueue) {
     if (itm) {
         backfilledItems.push(itm);
         ++bgResultSize;
+        size_t bytes = backfilledSize(itm);
+        bgResultBytes.incr(bytes);
+        bgResultBytesHighWat = std::max(bgResultBytesHighWat, bgResultBytes.get());
+        if (implicitEnqueue) {
+            diskBackfillBytes += bytes;
+        }
         stats.memOverhead.incr(sizeof(Item *));
         assert(stats.memOverhead.get() < GIGANTOR);
     }
@@ -1142,6 +1181,7 @@ Item* TapProducer::nextBgFetchedItem_UNLOCKED() {
     assert(rv);
     backfilledItems.pop();
     --bgResultSize;
+    bgResultBytes.decr(backfilledSize(rv));
 
     stats.memOverhead.decr(sizeof(Item *));
     assert(stats.memOverhead.get() < GIGANTOR);
@@ -1170,6 +1210,18 @@ void TapProducer::addStats(ADD_STAT add_stat, const void *c) {
     addStat("bg_wait_for_results", waitForBgFetches_UNLOCKED(), add_stat, c);
     addStat("bg_queued", bgQueued, add_stat, c);
     addStat("bg_result_size", bgResultSize, add_stat, c);
+    addStat("bg_result_bytes", bgResultBytes, add_stat, c);
+    addStat("bg_result_bytes_peak", bgResultBytesHighWat, add_stat, c);
+    hrtime_t diskTime = diskBackfillTime;
+    if (diskBackfillCounter > 0) {
+        diskTime += gethrtime() - diskBackfillStart;
+    }
+    if (diskTime > 0) {
+        addStat("backfill_disk_bytes", diskBackfillBytes, add_stat, c);
+        addStat("backfill_disk_mb_per_sec",
+                (diskBackfillBytes / (1024.0 * 1024)) / (diskTime / 1000000000.0),
+                add_stat, c);
+    }
     addStat("bg_results", bgResults, add_stat, c);
     addStat("bg_jobs_issued", bgJobIssued, add_stat, c);
     addStat("bg_jobs_completed", bgJobCompleted, add_stat, c);
@@ -1223,12 +1275,21 @@ void TapProducer::processedEvent(tap_event_t event, ENGINE_ERROR_CODE)
 TapConsumer::TapConsumer(EventuallyPersistentEngine &theEngine,
                          const void *c,
                          const std::string &n) :
-    TapConnection(theEngine, c, n)
+    TapConnection(theEngine, c, n), batchVBucket(0), batchBackfill(false),
+    producerAcks(false)
 {
     setSupportAck(true);
     setLogHeader("TAP (Consumer) " + getName() + " -");
 }
 
+TapConsumer::~TapConsumer() {
+    // The producer replays what we never acked.
+    std::vector<std::pair<Item*, bool> >::iterator it;
+    for (it = batch.begin(); it != batch.end(); ++it) {
+        delete it->first;
+    }
+}
+
 void TapConsumer::addStats(ADD_STAT add_stat, const void *c) {
     TapConnection::addStats(add_stat, c);
     addStat("num_delete", numDelete, add_stat, c);
@@ -1237,6 +1298,7 @@ void TapConsumer::addStats(ADD_STAT add_stat, const void *c) {
     addStat("num_flush_failed", numFlushFailed, add_stat, c);
     addStat("num_mutation", numMutation, add_stat, c);
     addStat("num_mutation_failed", numMutationFailed, add_stat, c);
+    addStat("num_mutation_batches", numMutationBatches, add_stat, c);
     addStat("num_opaque", numOpaque, add_stat, c);
     addStat("num_opaque_failed", numOpaqueFailed, add_stat, c);
     addStat("num_vbucket_set", numVbucketSet, add_stat, c);
@@ -1281,6 +1343,74 @@ bool TapConsumer::isBackfillPhase(uint16_t vbucket) {
     return false;
 }
 
+bool TapConsumer::canBatchMutation(const Item &itm, bool ack) {
+    if (ack || !producerAcks || engine.getTapConfig().getConsumerBatchSize() == 0) {
+        return false;
+    }
+    if (!StoredValue::hasAvailableSpace(engine.getEpStats(), itm)) {
+        // Let the mutation fail on its own so the producer retries it.
+        return false;
+    }
+    if (batch.empty() || batchVBucket != itm.getVBucketId()) {
+        // A set to an active vbucket may have to wait for a hot reload.
+        const VBucketMap &vbuckets = engine.getEpStore()->getVBuckets();
+        RCPtr<VBucket> vb = vbuckets.getBucket(itm.getVBucketId());
+        if (!vb || vb->getState() == vbucket_state_active ||
+            vb->getState() == vbucket_state_dead) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TapConsumer::addToBatch(Item *itm, bool meta, bool backfill) {
+    assert(isBatchFor(itm->getVBucketId(), backfill));
+    if (batch.empty()) {
+        batchVBucket = itm->getVBucketId();
+        batchBackfill = backfill;
+    }
+    batch.push_back(std::make_pair(itm, meta));
+    return batch.size() >= engine.getTapConfig().getConsumerBatchSize();
+}
+
+ENGINE_ERROR_CODE TapConsumer::applyBatch() {
+    if (batch.empty()) {
+        return ENGINE_SUCCESS;
+    }
+
+    std::vector<MultiSetItem> items;
+    items.reserve(batch.size());
+    std::vector<std::pair<Item*, bool> >::iterator it;
+    for (it = batch.begin(); it != batch.end(); ++it) {
+        items.push_back(MultiSetItem(it->first, it->second));
+    }
+    batch.clear();
+    ++numMutationBatches;
+
+    engine.getEpStore()->setTapMutations(batchVBucket, items, batchBackfill);
+
+    ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
+    std::vector<MultiSetItem>::iterator mi;
+    for (mi = items.begin(); mi != items.end(); ++mi) {
+        if (mi->status == ENGINE_SUCCESS) {
+            engine.addMutationEvent(mi->item);
+        } else if (ret == ENGINE_SUCCESS) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "%s Failed to apply a batch of %d mutations to "
+                             "vbucket %d (error %d). Force disconnect\n",
+                             logHeader(), static_cast<int>(items.size()),
+                             batchVBucket, mi->status);
+            ret = ENGINE_DISCONNECT;
+        }
+        delete mi->item;
+    }
+
+    if (!supportsCheckpointSync()) {
+        checkVBOpenCheckpoint(batchVBucket);
+    }
+    return ret;
+}
+
 void TapConsumer::processedEvent(tap_event_t event, ENGINE_ERROR_CODE ret)
 {
     switch (event) {
@@ -1470,6 +1600,7 @@ bool TapProducer::cleanSome()
     while (!backfilledItems.empty() && ii < 1000) {
         Item *i(backfilledItems.front());
         assert(i);
+        bgResultBytes.decr(backfilledSize(i));
         delete i;
         backfilledItems.pop();
         --bgResultSize;
@@ -2068,6 +2199,7 @@ void TapProducer::flush() {
         backfilledItems.pop();
     }
     bgResultSize = 0;
+    bgResultBytes = 0;
 
     // Clear the checkpoint message queue as well
     while (!checkpointMsgs.empty()) {
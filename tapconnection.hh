@@ -204,6 +204,18 @@ public:
         return backfillResidentThreshold;
     }
 
+    size_t getBackfillReadAhead() const {
+        return backfillReadAhead;
+    }
+
+    bool isBackfillSnapshot() const {
+        return backfillSnapshot;
+    }
+
+    size_t getConsumerBatchSize() const {
+        return consumerBatchSize;
+    }
+
 protected:
     friend class TapConfigChangeListener;
     friend class EventuallyPersistentEngine;
@@ -247,6 +259,18 @@ protected:
         backfillResidentThreshold = value;
     }
 
+    void setBackfillReadAhead(size_t value) {
+        backfillReadAhead = value;
+    }
+
+    void setBackfillSnapshot(bool value) {
+        backfillSnapshot = value;
+    }
+
+    void setConsumerBatchSize(size_t value) {
+        consumerBatchSize = value;
+    }
+
     static void addConfigChangeListener(EventuallyPersistentEngine &engine);
 
 private:
@@ -269,6 +293,11 @@ private:
     // Parameters to control the backfill
     size_t backfillBacklogLimit;
     double backfillResidentThreshold;
+    size_t backfillReadAhead;
+    bool backfillSnapshot;
+
+    // Max number of mutations a consumer applies at once
+    size_t consumerBatchSize;
 
     EventuallyPersistentEngine &engine;
 };
@@ -494,11 +523,20 @@ private:
     Atomic<size_t> numCheckpointEnd;
     Atomic<size_t> numCheckpointEndFailed;
     Atomic<size_t> numUnknown;
+    Atomic<size_t> numMutationBatches;
+
+    //! Mutations held back to be applied together, and if each has metadata
+    std::vector<std::pair<Item*, bool> > batch;
+    uint16_t batchVBucket;
+    bool batchBackfill;
+    //! Set once the producer asked for an ack, so it replays what we don't ack
+    bool producerAcks;
 
 public:
     TapConsumer(EventuallyPersistentEngine &theEngine,
                 const void *c,
                 const std::string &n);
+    virtual ~TapConsumer();
     virtual void processedEvent(tap_event_t event, ENGINE_ERROR_CODE ret);
     virtual void addStats(ADD_STAT add_stat, const void *c);
     virtual const char *getType() const { return "consumer"; };
@@ -508,6 +546,52 @@ public:
     virtual bool processOnlineUpdateCommand(uint32_t event, uint16_t vbucket);
     void setBackfillPhase(bool isBackfill, uint16_t vbucket);
     bool isBackfillPhase(uint16_t vbucket);
+
+    /**
+     * Remember that the producer asked for an ack.  Until then every
+     * mutation is applied as it arrives.
+     */
+    void ackRequested() {
+        producerAcks = true;
+    }
+
+    /**
+     * Whether a mutation may be held back and applied together with
+     * the ones received after it.
+     *
+     * That is only safe if the producer replays everything we didn't
+     * ack when we drop the connection, so a mutation failing once it's
+     * applied costs a reconnect instead of losing it.  A mutation the
+     * producer wants acked is never held back, as the ack covers it.
+     *
+     * @param itm the mutation
+     * @param ack true if the producer asked for an ack of it
+     */
+    bool canBatchMutation(const Item &itm, bool ack);
+
+    /**
+     * Whether the held back mutations may be applied together with
+     * one to the given vbucket in the given phase.
+     */
+    bool isBatchFor(uint16_t vbucket, bool backfill) const {
+        return batch.empty() ||
+            (batchVBucket == vbucket && batchBackfill == backfill);
+    }
+
+    /**
+     * Hold back a mutation.  The consumer owns the item from now on.
+     *
+     * @return true if the batch is full and should be applied
+     */
+    bool addToBatch(Item *itm, bool meta, bool backfill);
+
+    /**
+     * Apply the mutations held back, if any.
+     *
+     * @return ENGINE_SUCCESS if all of them were applied, or
+     *         ENGINE_DISCONNECT so the producer replays them
+     */
+    ENGINE_ERROR_CODE applyBatch();
 };
 
 
@@ -540,17 +624,28 @@ public:
 
     void scheduleDiskBackfill() {
         LockHolder lh(queueLock);
-        ++diskBackfillCounter;
+        if (diskBackfillCounter++ == 0) {
+            diskBackfillStart = gethrtime();
+        }
     }
 
     void completeDiskBackfill() {
         LockHolder lh(queueLock);
         if (diskBackfillCounter > 0) {
-            --diskBackfillCounter;
+            if (--diskBackfillCounter == 0) {
+                diskBackfillTime += gethrtime() - diskBackfillStart;
+            }
         }
         completeBackfillCommon_UNLOCKED();
     }
 
+    /**
+     * Get the number of bytes of backfilled items waiting to be sent.
+     */
+    size_t getBackfilledBytes() {
+        return bgResultBytes;
+    }
+
     /**
      * Invoked each time a background item fetch completes.
      */
@@ -1067,6 +1162,13 @@ private:
 
     Atomic<size_t> bgQueued;
     Atomic<size_t> bgResultSize;
+    //! Bytes of the items in backfilledItems, and the most there ever was
+    Atomic<size_t> bgResultBytes;
+    size_t bgResultBytesHighWat;
+    //! Bytes read by disk backfills and the time they were running
+    size_t diskBackfillBytes;
+    hrtime_t diskBackfillTime;
+    hrtime_t diskBackfillStart;
     Atomic<size_t> bgResults;
     Atomic<size_t> bgJobIssued;
     Atomic<size_t> bgJobCompleted;
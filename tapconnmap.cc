@@ -140,6 +140,20 @@ ssize_t TapConnMap::backfillQueueDepth(const std::string &name) {
     return rv;
 }
 
+ssize_t TapConnMap::backfilledBytes(const std::string &name) {
+    ssize_t rv(-1);
+    LockHolder lh(notifySync);
+
+    TapConnection *tc = findByName_UNLOCKED(name);
+    if (tc) {
+        TapProducer *tp = dynamic_cast<TapProducer*>(tc);
+        assert(tp);
+        rv = tp->getBackfilledBytes();
+    }
+
+    return rv;
+}
+
 TapConnection* TapConnMap::findByName(const std::string &name) {
     LockHolder lh(notifySync);
     return findByName_UNLOCKED(name);
@@ -178,6 +178,14 @@ public:
      */
     ssize_t backfillQueueDepth(const std::string &name);
 
+    /**
+     * Get the number of bytes of backfilled items the named tap
+     * connection has waiting to be sent.
+     *
+     * @return the number of bytes, or -1 if we can't find the connection
+     */
+    ssize_t backfilledBytes(const std::string &name);
+
     /**
      * Add an event to all tap connections telling them to flush their
      * items.
@@ -28,6 +28,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 
 #ifdef HAS_ARPA_INET_H
@@ -142,6 +144,37 @@ extern "C" {
     }
 }
 
+extern "C" {
+    static bool add_response(const void *key, uint16_t keylen,
+                             const void *ext, uint8_t extlen,
+                             const void *body, uint32_t bodylen,
+                             uint8_t datatype, uint16_t status,
+                             uint64_t cas, const void *cookie) {
+        (void)key; (void)keylen; (void)ext; (void)extlen;
+        (void)body; (void)bodylen; (void)datatype; (void)cas; (void)cookie;
+        last_status = static_cast<protocol_binary_response_status>(status);
+        return true;
+    }
+}
+
+static bool set_vbucket_state(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                              uint16_t vb, vbucket_state_t state) {
+    protocol_binary_request_set_vbucket req;
+    protocol_binary_request_header *pkt;
+    pkt = reinterpret_cast<protocol_binary_request_header*>(&req);
+    memset(&req, 0, sizeof(req));
+
+    req.message.header.request.magic = PROTOCOL_BINARY_REQ;
+    req.message.header.request.opcode = PROTOCOL_BINARY_CMD_SET_VBUCKET;
+    req.message.header.request.vbucket = htons(vb);
+    req.message.body.state = static_cast<vbucket_state_t>(htonl(state));
+
+    if (h1->unknown_command(h, NULL, pkt, add_response) != ENGINE_SUCCESS) {
+        return false;
+    }
+    return last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
 static int get_int_stat(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
                         const char *statname, const char *statkey = NULL) {
     vals.clear();
@@ -212,6 +245,447 @@ static test_result test_persistence(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
 }
 }
 
+extern "C" {
+static test_result test_restore(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    char fnm[1024];
+    if (!getcwd(fnm, sizeof(fnm) - 32)) {
+        return FAIL;
+    }
+    strcat(fnm, "/mbbackup-0001.mbb");
+    if (access(fnm, F_OK) != 0) {
+        std::cerr << "Skipping restore test: missing " << fnm
+                  << " (run t/generate-mbbackup)" << std::endl;
+        return SUCCESS;
+    }
+
+    for (uint16_t ii = 1; ii < 16; ++ii) {
+        check(set_vbucket_state(h, h1, ii, vbucket_state_active),
+              "Failed to activate vbucket");
+    }
+
+    size_t len = strlen(fnm);
+    protocol_binary_request_header *req;
+    req = static_cast<protocol_binary_request_header*>(calloc(1, sizeof(*req) + len));
+    assert(req);
+    req->request.opcode = CMD_RESTORE_FILE;
+    req->request.keylen = htons(static_cast<uint16_t>(len));
+    req->request.bodylen = htonl(static_cast<uint32_t>(len));
+    memcpy(req + 1, fnm, len);
+
+    check(h1->unknown_command(h, NULL, req, add_response) == ENGINE_SUCCESS,
+          "The server should know the command");
+    check(last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS,
+          "The server should start the restore");
+    free(req);
+
+    useconds_t sleepTime = 128;
+    std::string state;
+    do {
+        decayingSleep(&sleepTime);
+        vals.clear();
+        check(h1->get_stats(h, NULL, "restore", 7, add_stats) == ENGINE_SUCCESS,
+              "Failed to get stats.");
+        state = vals["ep_restore:state"];
+    } while (state != "zombie");
+
+    check(vals.find("ep_restore:last_error") == vals.end(),
+          "The restore failed");
+    std::cout << vals["ep_restore:readers"] << " readers - "
+              << vals["ep_restore:file_rows"] << " rows in "
+              << vals["ep_restore:file_elapsed"] << "us ("
+              << vals["ep_restore:file_rows_per_sec"] << " rows/s), "
+              << vals["ep_restore:number_throttled"] << " throttled"
+              << std::endl;
+
+    wait_for_flusher_to_settle(h, h1);
+    return SUCCESS;
+}
+}
+
+extern "C" {
+    static void ignore_stats(const char *key, const uint16_t klen,
+                             const char *val, const uint32_t vlen,
+                             const void *cookie) {
+        (void)key; (void)klen; (void)val; (void)vlen; (void)cookie;
+    }
+}
+
+static double cpu_usecs(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000.0
+        + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static double scrape_cost(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                          const char **groups, size_t iterations) {
+    double start = cpu_usecs();
+    for (size_t i = 0; i < iterations; ++i) {
+        for (const char **g = groups; *g != NULL; ++g) {
+            const char *key = **g ? *g : NULL;
+            check(h1->get_stats(h, NULL, key, key ? strlen(key) : 0,
+                                ignore_stats) == ENGINE_SUCCESS,
+                  "Failed to get stats.");
+        }
+    }
+    return (cpu_usecs() - start) / iterations;
+}
+
+extern "C" {
+static test_result test_stats_scrape(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    size_t iterations = env_int("TEST_SCRAPES", 1000);
+
+    // The text groups holding the counters and histograms exported by
+    // the binary stats
+    const char *text[] = { "", "timings", "memory", NULL };
+    const char *binary[] = { "binary", NULL };
+
+    double textCost = scrape_cost(h, h1, text, iterations);
+    double binaryCost = scrape_cost(h, h1, binary, iterations);
+
+    std::cout << "CPU per scrape: text " << textCost << "us, binary "
+              << binaryCost << "us" << std::endl;
+    return SUCCESS;
+}
+}
+
+static double wall_usecs(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static size_t multi_failures(0);
+static uint8_t multi_opcode(0);
+
+extern "C" {
+    // Count the entries of a get/set multi response that didn't succeed.
+    static bool multi_response(const void *key, uint16_t keylen,
+                               const void *ext, uint8_t extlen,
+                               const void *body, uint32_t bodylen,
+                               uint8_t datatype, uint16_t status,
+                               uint64_t cas, const void *cookie) {
+        (void)key; (void)keylen; (void)ext; (void)extlen;
+        (void)datatype; (void)cas; (void)cookie;
+        last_status = static_cast<protocol_binary_response_status>(status);
+        const char *p = static_cast<const char*>(body);
+        const char *end = p + bodylen;
+        while (p < end) {
+            uint16_t st;
+            memcpy(&st, p, sizeof(st));
+            if (ntohs(st) != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+                ++multi_failures;
+            }
+            if (multi_opcode == CMD_SET_MULTI) {
+                // status and cas
+                p += sizeof(uint16_t) + sizeof(uint64_t);
+            } else {
+                // status, flags, cas, length and the value
+                uint32_t vlen;
+                memcpy(&vlen, p + 14, sizeof(vlen));
+                p += 18 + ntohl(vlen);
+            }
+        }
+        return true;
+    }
+}
+
+static void append_multi(std::string &pkt, const void *data, size_t len) {
+    pkt.append(static_cast<const char*>(data), len);
+}
+
+static void multi_op(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1, uint8_t opcode,
+                     const std::vector<std::string> &keys, size_t start,
+                     size_t n, const std::string &value) {
+    protocol_binary_request_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    std::string pkt(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    for (size_t i = start; i < start + n; ++i) {
+        uint16_t vb = 0;
+        uint16_t nkey = htons(static_cast<uint16_t>(keys[i].length()));
+        append_multi(pkt, &vb, sizeof(vb));
+        append_multi(pkt, &nkey, sizeof(nkey));
+        if (opcode == CMD_SET_MULTI) {
+            uint32_t flags = 0, exptime = 0;
+            uint64_t cas = 0;
+            uint32_t nbytes = htonl(static_cast<uint32_t>(value.length()));
+            append_multi(pkt, &flags, sizeof(flags));
+            append_multi(pkt, &exptime, sizeof(exptime));
+            append_multi(pkt, &cas, sizeof(cas));
+            append_multi(pkt, &nbytes, sizeof(nbytes));
+            pkt.append(keys[i]);
+            pkt.append(value);
+        } else {
+            pkt.append(keys[i]);
+        }
+    }
+
+    protocol_binary_request_header *req;
+    req = reinterpret_cast<protocol_binary_request_header*>(&pkt[0]);
+    req->request.magic = PROTOCOL_BINARY_REQ;
+    req->request.opcode = opcode;
+    req->request.bodylen = htonl(static_cast<uint32_t>(pkt.size() - sizeof(hdr)));
+
+    multi_opcode = opcode;
+    check(h1->unknown_command(h, NULL, req, multi_response) == ENGINE_SUCCESS,
+          "Batched operation failed");
+    check(last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS,
+          "Batched operation was rejected");
+}
+
+extern "C" {
+static test_result test_multi_ops(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    size_t total = env_int("TEST_TOTAL_KEYS", 100000);
+    size_t batch = env_int("TEST_BATCH_SIZE", 100);
+    std::string value(env_int("TEST_VAL_SIZE", 20), 'x');
+    total -= total % batch;
+
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < total; ++i) {
+        std::stringstream ss;
+        ss << "key" << i;
+        keys.push_back(ss.str());
+    }
+
+    double start = wall_usecs();
+    for (size_t i = 0; i < total; ++i) {
+        item *it = NULL;
+        check(storeCasVb11(h, h1, NULL, OPERATION_SET, keys[i].c_str(),
+                           value.data(), value.length(), 0, &it, 0, 0)
+              == ENGINE_SUCCESS, "store failure");
+        h1->release(h, NULL, it);
+    }
+    double singleSet = wall_usecs() - start;
+
+    start = wall_usecs();
+    for (size_t i = 0; i < total; i += batch) {
+        multi_op(h, h1, CMD_SET_MULTI, keys, i, batch, value);
+    }
+    double multiSet = wall_usecs() - start;
+
+    start = wall_usecs();
+    for (size_t i = 0; i < total; ++i) {
+        item *it = NULL;
+        check(h1->get(h, NULL, &it, keys[i].data(), keys[i].length(), 0)
+              == ENGINE_SUCCESS, "get failure");
+        h1->release(h, NULL, it);
+    }
+    double singleGet = wall_usecs() - start;
+
+    start = wall_usecs();
+    for (size_t i = 0; i < total; i += batch) {
+        multi_op(h, h1, CMD_GET_MULTI, keys, i, batch, value);
+    }
+    double multiGet = wall_usecs() - start;
+
+    check(multi_failures == 0, "Some of the batched operations failed");
+
+    std::cout << total << " keys in batches of " << batch
+              << " - set " << singleSet / total << "us single, "
+              << multiSet / total << "us batched; get "
+              << singleGet / total << "us single, "
+              << multiGet / total << "us batched (per key)" << std::endl;
+
+    wait_for_flusher_to_settle(h, h1);
+    return SUCCESS;
+}
+}
+
+//! The keys the reading threads look up.
+static std::vector<std::string> loop_keys;
+
+typedef void (*loop_fn)(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                        size_t id, size_t ops);
+
+struct loop_args {
+    ENGINE_HANDLE    *h;
+    ENGINE_HANDLE_V1 *h1;
+    loop_fn           fn;
+    size_t            id;
+    size_t            ops;
+};
+
+extern "C" {
+    static void *run_loop(void *arg) {
+        loop_args *a = static_cast<loop_args*>(arg);
+        a->fn(a->h, a->h1, a->id, a->ops);
+        return NULL;
+    }
+}
+
+/**
+ * Run the given loop in this many threads at once.
+ *
+ * @return the operations per second of all the threads together
+ */
+static double run_threads(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                          loop_fn fn, size_t threads, size_t ops) {
+    std::vector<pthread_t> ids(threads);
+    std::vector<loop_args> args(threads);
+    double start = wall_usecs();
+    for (size_t i = 0; i < threads; ++i) {
+        loop_args a = { h, h1, fn, i, ops };
+        args[i] = a;
+        check(pthread_create(&ids[i], NULL, run_loop, &args[i]) == 0,
+              "Failed to start a thread");
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        check(pthread_join(ids[i], NULL) == 0, "Failed to join a thread");
+    }
+    return threads * ops * 1000000.0 / (wall_usecs() - start);
+}
+
+static void get_loop(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                     size_t id, size_t ops) {
+    for (size_t i = 0; i < ops; ++i) {
+        const std::string &key = loop_keys[(id + i) % loop_keys.size()];
+        item *it = NULL;
+        check(h1->get(h, NULL, &it, key.data(), key.length(), 0)
+              == ENGINE_SUCCESS, "get failure");
+        h1->release(h, NULL, it);
+    }
+}
+
+static void set_loop(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                     size_t id, size_t ops) {
+    for (size_t i = 0; i < ops; ++i) {
+        std::stringstream ss;
+        ss << "t" << id << "k" << (i % 1000);
+        std::string key(ss.str());
+        item *it = NULL;
+        check(storeCasVb11(h, h1, NULL, OPERATION_SET, key.c_str(),
+                           "x", 1, 0, &it, 0, 0) == ENGINE_SUCCESS,
+              "store failure");
+        h1->release(h, NULL, it);
+    }
+}
+
+static void store_loop_keys(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    std::vector<std::string>::iterator it;
+    for (it = loop_keys.begin(); it != loop_keys.end(); ++it) {
+        item *i = NULL;
+        check(storeCasVb11(h, h1, NULL, OPERATION_SET, it->c_str(),
+                           it->data(), it->length(), 0, &i, 0, 0)
+              == ENGINE_SUCCESS, "store failure");
+        h1->release(h, NULL, i);
+    }
+}
+
+extern "C" {
+static test_result test_get_scaling(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    size_t ops = env_int("TEST_OPS_PER_THREAD", 200000);
+    size_t maxThreads = env_int("TEST_THREADS", 8);
+
+    loop_keys.clear();
+    for (size_t i = 0; i < 1000; ++i) {
+        std::stringstream ss;
+        ss << "key" << i;
+        loop_keys.push_back(ss.str());
+    }
+    store_loop_keys(h, h1);
+
+    std::cout << "GETs per second on one vbucket:";
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        std::cout << " " << threads << " threads "
+                  << static_cast<uint64_t>(run_threads(h, h1, get_loop,
+                                                       threads, ops));
+    }
+    std::cout << std::endl;
+    wait_for_flusher_to_settle(h, h1);
+    return SUCCESS;
+}
+}
+
+extern "C" {
+static test_result test_hot_key_reads(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    size_t ops = env_int("TEST_OPS_PER_THREAD", 100000);
+    size_t maxThreads = env_int("TEST_THREADS", 32);
+
+    loop_keys.clear();
+    loop_keys.push_back("hotkey");
+    store_loop_keys(h, h1);
+    // Enough reads for the key to be found hot, if it's looked for.
+    get_loop(h, h1, 0, 1000);
+
+    std::cout << "Reads of a single key per second ("
+              << get_int_stat(h, h1, "ep_hot_keys") << " hot):";
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        std::cout << " " << threads << " threads "
+                  << static_cast<uint64_t>(run_threads(h, h1, get_loop,
+                                                       threads, ops));
+    }
+    std::cout << std::endl;
+    wait_for_flusher_to_settle(h, h1);
+    return SUCCESS;
+}
+}
+
+extern "C" {
+static test_result test_set_scaling(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    size_t ops = env_int("TEST_OPS_PER_THREAD", 100000);
+    size_t maxThreads = env_int("TEST_THREADS", 8);
+
+    // Every set takes a CAS from the generator.
+    std::cout << "SETs per second:";
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        std::cout << " " << threads << " threads "
+                  << static_cast<uint64_t>(run_threads(h, h1, set_loop,
+                                                       threads, ops));
+        wait_for_flusher_to_settle(h, h1);
+    }
+    std::cout << std::endl;
+    return SUCCESS;
+}
+}
+
+static bool del_vbucket(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1, uint16_t vb) {
+    protocol_binary_request_header req;
+    memset(&req, 0, sizeof(req));
+    req.request.magic = PROTOCOL_BINARY_REQ;
+    req.request.opcode = PROTOCOL_BINARY_CMD_DEL_VBUCKET;
+    req.request.vbucket = htons(vb);
+
+    if (h1->unknown_command(h, NULL, &req, add_response) != ENGINE_SUCCESS) {
+        return false;
+    }
+    return last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
+extern "C" {
+static test_result test_vbucket_deletion(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    size_t total = env_int("TEST_TOTAL_KEYS", 1000000);
+
+    check(set_vbucket_state(h, h1, 1, vbucket_state_active),
+          "Failed to activate vbucket 1");
+    for (size_t i = 0; i < total; ++i) {
+        std::stringstream ss;
+        ss << "key" << i;
+        std::string key(ss.str());
+        item *it = NULL;
+        check(storeCasVb11(h, h1, NULL, OPERATION_SET, key.c_str(),
+                           "x", 1, 0, &it, 0, 1) == ENGINE_SUCCESS,
+              "store failure");
+        h1->release(h, NULL, it);
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    check(set_vbucket_state(h, h1, 1, vbucket_state_dead),
+          "Failed to kill vbucket 1");
+    int deleted = get_int_stat(h, h1, "ep_vbucket_del");
+    double start = wall_usecs();
+    check(del_vbucket(h, h1, 1), "Failed to delete vbucket 1");
+    useconds_t sleepTime = 128;
+    while (get_int_stat(h, h1, "ep_vbucket_del") == deleted) {
+        decayingSleep(&sleepTime);
+    }
+
+    std::cout << "Deleting a vbucket of " << total << " items took "
+              << static_cast<uint64_t>((wall_usecs() - start) / 1000)
+              << "ms" << std::endl;
+    return SUCCESS;
+}
+}
+
 extern "C" MEMCACHED_PUBLIC_API
 bool setup_suite(struct test_harness *th) {
     testHarness = *th;
@@ -224,6 +698,24 @@ engine_test_t* get_tests(void) {
     static engine_test_t tests[]  = {
         {"test persistence", test_persistence, NULL, teardown, NULL,
          NULL, NULL},
+        {"test stats scrape", test_stats_scrape, NULL, teardown, NULL,
+         NULL, NULL},
+        {"test multi get/set", test_multi_ops, NULL, teardown, NULL,
+         NULL, NULL},
+        {"test restore (1 reader)", test_restore, NULL, teardown,
+         "restore_mode=true;restore_readers=1", NULL, NULL},
+        {"test restore (4 readers)", test_restore, NULL, teardown,
+         "restore_mode=true;restore_readers=4", NULL, NULL},
+        {"test get scaling", test_get_scaling, NULL, teardown,
+         "ht_size=3079;ht_locks=193", NULL, NULL},
+        {"test hot key reads (locked)", test_hot_key_reads, NULL, teardown,
+         "hot_key_sample_rate=0", NULL, NULL},
+        {"test hot key reads (lock free)", test_hot_key_reads, NULL, teardown,
+         "hot_key_sample_rate=1;hot_key_threshold=10", NULL, NULL},
+        {"test set scaling", test_set_scaling, NULL, teardown, NULL,
+         NULL, NULL},
+        {"test vbucket deletion", test_vbucket_deletion, NULL, teardown,
+         NULL, NULL, NULL},
         {NULL, NULL, NULL, NULL, NULL, NULL, NULL}
     };
     return tests;
@@ -26,6 +26,7 @@
 #include <iostream>
 #include <fstream>
 #include <map>
+#include <set>
 
 #include <ctype.h>
 
@@ -34,13 +35,17 @@
 using namespace std;
 
 stringstream prototypes;
+stringstream fields;
 stringstream initialization;
 stringstream implementation;
+stringstream counterVisitor;
+stringstream histogramVisitor;
 
 typedef string (*getValidatorCode)(const std::string &, cJSON*);
 
 std::map<string, getValidatorCode> validators;
 map<string, string> getters;
+map<string, string> cachedTypes;
 map<string, string> datatypes;
 
 
@@ -131,15 +136,31 @@ static void initialize() {
                << "// # DO NOT EDIT! THIS IS A GENERATED FILE " << endl
                << "// ###########################################" << endl;
 
+    fields << "private:" << endl
+           << "    // The values of the numeric and boolean parameters, kept"
+           << endl
+           << "    // up to date by setParameter() so they read without the mutex"
+           << endl;
+
     implementation << "// ###########################################" << endl
                    << "// # DO NOT EDIT! THIS IS A GENERATED FILE " << endl
                    << "// ###########################################" << endl;
+
+    counterVisitor << "template <typename V>" << endl
+                   << "static void visitCounters(const EPStats &stats, "
+                   << "const Configuration &config, V &visitor) {" << endl;
+    histogramVisitor << "template <typename V>" << endl
+                     << "static void visitHistograms(const EPStats &stats, "
+                     << "V &visitor) {" << endl;
     validators["range"] = getRangeValidatorCode;
     validators["enum"] = getEnumValidatorCode;
     getters["std::string"] = "getString";
     getters["bool"] = "getBool";
     getters["size_t"] = "getInteger";
     getters["float"] = "getFloat";
+    cachedTypes["bool"] = "v_bool";
+    cachedTypes["size_t"] = "v_size";
+    cachedTypes["float"] = "v_float";
     datatypes["bool"] = "bool";
     datatypes["size_t"] = "size_t";
     datatypes["float"] = "float";
@@ -230,6 +251,16 @@ static string getCppName(const string &str) {
     return ss.str();
 }
 
+/**
+ * The name of the member holding the value of a parameter, if it has
+ * one (e.g. "chk_max_items" is held in "chkMaxItems").
+ */
+static string getFieldName(const string &cppname) {
+    string ret(cppname);
+    ret[0] = (char)tolower(ret[0]);
+    return ret;
+}
+
 static void generate(cJSON *o) {
     assert(o != NULL);
 
@@ -249,16 +280,33 @@ static void generate(cJSON *o) {
     string validator = getValidator(config_name,
                                     cJSON_GetObjectItem(o, "validator"));
 
+    map<string, string>::iterator cached = cachedTypes.find(type);
+    string field = getFieldName(cppname);
+
     // Generate prototypes
-    prototypes << "    " << type
-               << " " << getGetterPrefix(type)
-               << cppname << "() const;" << endl;
+    if (cached != cachedTypes.end()) {
+        // Inline, as reading the value is a plain load
+        prototypes << "    " << type
+                   << " " << getGetterPrefix(type)
+                   << cppname << "() const {" << endl
+                   << "        return " << field << ".get();" << endl
+                   << "    }" << endl;
+        fields << "    Atomic<" << type << "> " << field << ";" << endl;
+    } else {
+        prototypes << "    " << type
+                   << " " << getGetterPrefix(type)
+                   << cppname << "() const;" << endl;
+    }
     if  (!isReadOnly(o)) {
         prototypes << "    void set" << cppname << "(const " << type
                    << " &nval);" << endl;
     }
 
     // Generate initialization code
+    if (cached != cachedTypes.end()) {
+        initialization << "    attributes[\"" << config_name << "\"].cached."
+                       << cached->second << " = &" << field << ";" << endl;
+    }
     initialization << "    setParameter(\"" << config_name << "\", ";
     if (type.compare("std::string") == 0) {
         initialization << "(const char*)\"" << defaultVal << "\");" << endl;
@@ -271,11 +319,13 @@ static void generate(cJSON *o) {
     }
 
 
-    // Generate the getter
-    implementation << type << " Configuration::" << getGetterPrefix(type)
-                   << cppname << "() const {" << endl
-                   << "    return " << getters[type] << "(\""
-                   << config_name << "\");" << endl << "}" << endl;
+    if (cached == cachedTypes.end()) {
+        // Generate the getter
+        implementation << type << " Configuration::" << getGetterPrefix(type)
+                       << cppname << "() const {" << endl
+                       << "    return " << getters[type] << "(\""
+                       << config_name << "\");" << endl << "}" << endl;
+    }
 
     if  (!isReadOnly(o)) {
         // generate the setter
@@ -287,9 +337,104 @@ static void generate(cJSON *o) {
     }
 }
 
+/**
+ * Export the numeric configuration parameters in the binary stats.
+ */
+static void generateConfigCounter(cJSON *o, const set<string> &exported) {
+    string config_name = o->string;
+    if (exported.find("ep_" + config_name) != exported.end()) {
+        // EPStats already tracks the current value
+        return;
+    }
+
+    string cppname = getCppName(config_name);
+    string type = getDatatype(config_name, o);
+
+    if (type.compare("size_t") == 0) {
+        counterVisitor << "    visitor(\"ep_" << config_name
+                       << "\", static_cast<uint64_t>(config.get"
+                       << cppname << "()));" << endl;
+    } else if (type.compare("bool") == 0) {
+        counterVisitor << "    visitor(\"ep_" << config_name
+                       << "\", static_cast<uint64_t>(config.is"
+                       << cppname << "() ? 1 : 0));" << endl;
+    }
+}
+
+/**
+ * Read "stats.json" and generate the visitors used to lay out the
+ * binary stats (see binary_stats.hh). Each entry maps a stat name to
+ * the EPStats member holding it.
+ */
+static bool generateBinaryStats(cJSON *params) {
+    struct stat st;
+    if (stat("stats.json", &st) == -1) {
+        cerr << "Failed to look up stats.json: "
+             << strerror(errno) << endl;
+        return false;
+    }
+
+    char *data = new char[st.st_size + 1];
+    data[st.st_size] = 0;
+    ifstream input("stats.json");
+    input.read(data, st.st_size);
+    input.close();
+
+    cJSON *c = cJSON_Parse(data);
+    if (c == NULL) {
+        cerr << "Failed to parse stats.json.. probably syntax error" << endl;
+        delete []data;
+        return false;
+    }
+
+    cJSON *counters = cJSON_GetObjectItem(c, "counters");
+    cJSON *histograms = cJSON_GetObjectItem(c, "histograms");
+    if (counters == NULL || histograms == NULL) {
+        cerr << "FATAL: stats.json needs a \"counters\" and a "
+             << "\"histograms\" section" << endl;
+        cJSON_Delete(c);
+        delete []data;
+        return false;
+    }
+
+    set<string> exported;
+    for (cJSON *i(counters->child); i; i = i->next) {
+        exported.insert(i->string);
+        counterVisitor << "    visitor(\"" << i->string
+                       << "\", static_cast<uint64_t>(stats."
+                       << getString(i) << ".get()));" << endl;
+    }
+
+    int num = cJSON_GetArraySize(params);
+    for (int ii = 0; ii < num; ++ii) {
+        generateConfigCounter(cJSON_GetArrayItem(params, ii), exported);
+    }
+
+    for (cJSON *i(histograms->child); i; i = i->next) {
+        histogramVisitor << "    visitor(\"" << i->string
+                         << "\", stats." << getString(i) << ");" << endl;
+    }
+
+    counterVisitor << "}" << endl;
+    histogramVisitor << "}" << endl;
+
+    ofstream statsfile("generated_binary_stats.cc");
+    statsfile << "// ###########################################" << endl
+              << "// # DO NOT EDIT! THIS IS A GENERATED FILE " << endl
+              << "// ###########################################" << endl
+              << counterVisitor.str() << endl
+              << histogramVisitor.str();
+    statsfile.close();
+
+    cJSON_Delete(c);
+    delete []data;
+    return true;
+}
+
 /**
  * Read "configuration.json" and generate getters and setters
- * for the parameters in there
+ * for the parameters in there, and the binary stats layout from
+ * "stats.json"
  */
 int main(int argc, char **argv) {
     (void)argc;
@@ -327,8 +472,11 @@ int main(int argc, char **argv) {
         generate(cJSON_GetArrayItem(params, ii));
     }
 
+    fields << "public:" << endl;
+
     ofstream headerfile("generated_configuration.hh");
-    headerfile << prototypes.str();
+    headerfile << prototypes.str() << endl
+               << fields.str();
     headerfile.close();
 
     ofstream implfile("generated_configuration.cc");
@@ -338,6 +486,12 @@ int main(int argc, char **argv) {
              << "}" << endl;
     implfile.close();
 
+    if (!generateBinaryStats(params)) {
+        cJSON_Delete(c);
+        delete []data;
+        return 1;
+    }
+
     cJSON_Delete(c);
     delete []data;
 
@@ -0,0 +1,394 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#define USE_ZLIB 1
+#endif
+
+#include "locks.hh"
+#include "value_cache.hh"
+
+static inline int doClose(int fd) {
+    int ret;
+    while ((ret = close(fd)) == -1 && (errno == EINTR)) {
+        /* Retry */
+    }
+    return ret;
+}
+
+static bool writeFullyAt(int fd, const char *buf, size_t nbytes, off_t offset) {
+    while (nbytes > 0) {
+        ssize_t written = pwrite(fd, buf, nbytes, offset);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        nbytes -= written;
+        buf += written;
+        offset += written;
+    }
+    return true;
+}
+
+/**
+ * Create a file of the given size and map it for reading.
+ *
+ * @return the mapping, or NULL if the file can't be used
+ */
+static char *createMapped(const std::string &path, size_t size, int &fd) {
+    fd = ::open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0600);
+    if (fd < 0) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Unable to create value cache file \"%s\": %s\n",
+                         path.c_str(), strerror(errno));
+        return NULL;
+    }
+    // The file is sparse, so only what's written takes up space.
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Unable to size value cache file \"%s\": %s\n",
+                         path.c_str(), strerror(errno));
+        doClose(fd);
+        fd = -1;
+        return NULL;
+    }
+    void *m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Unable to map value cache file \"%s\": %s\n",
+                         path.c_str(), strerror(errno));
+        doClose(fd);
+        fd = -1;
+        return NULL;
+    }
+    return static_cast<char*>(m);
+}
+
+/**
+ * Get the bytes to store for a value: compressed if that's smaller.
+ */
+static void encode(const value_t &value, std::vector<char> &out) {
+#ifdef USE_ZLIB
+    uLongf len = compressBound(static_cast<uLong>(value->length()));
+    out.resize(len);
+    if (compress2(reinterpret_cast<Bytef*>(&out[0]), &len,
+                  reinterpret_cast<const Bytef*>(value->getData()),
+                  static_cast<uLong>(value->length()), Z_BEST_SPEED) == Z_OK
+        && len < value->length()) {
+        out.resize(len);
+        return;
+    }
+#endif
+    out.assign(value->getData(), value->getData() + value->length());
+}
+
+/**
+ * Turn stored bytes back into the value.
+ */
+static value_t decode(const std::vector<char> &in, size_t rawLength) {
+#ifdef USE_ZLIB
+    std::vector<char> out(rawLength);
+    uLongf len = static_cast<uLongf>(rawLength);
+    if (uncompress(reinterpret_cast<Bytef*>(&out[0]), &len,
+                   reinterpret_cast<const Bytef*>(&in[0]),
+                   static_cast<uLong>(in.size())) == Z_OK
+        && len == rawLength) {
+        return value_t(Blob::New(&out[0], rawLength));
+    }
+#endif
+    (void)in;
+    (void)rawLength;
+    getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                     "Can't uncompress a value in the value cache\n");
+    return value_t();
+}
+
+ValueCache::ValueCache(const std::string &p, size_t m, EPStats &st) :
+    path(p), maxSize(m), stats(st), fd(-1), data(NULL) {
+    assert(maxSize > 0);
+}
+
+ValueCache::~ValueCache() {
+    if (data) {
+        munmap(data, maxSize);
+    }
+    if (fd >= 0) {
+        doClose(fd);
+        unlink(path.c_str());
+    }
+    LockHolder lh(mutex);
+    unordered_map<std::string, ValueCacheEntry>::iterator it;
+    while ((it = index.begin()) != index.end()) {
+        forget_UNLOCKED(it);
+    }
+}
+
+bool ValueCache::open() {
+    LockHolder lh(mutex);
+    assert(!data);
+    data = createMapped(path, maxSize, fd);
+    return data != NULL;
+}
+
+std::string ValueCache::makeKey(uint16_t vbucket, const std::string &key) {
+    std::string rv;
+    rv.reserve(key.size() + sizeof(vbucket));
+    rv.append(reinterpret_cast<const char*>(&vbucket), sizeof(vbucket));
+    rv.append(key);
+    return rv;
+}
+
+void ValueCache::forget_UNLOCKED(unordered_map<std::string, ValueCacheEntry>::iterator it) {
+    liveSize.decr(it->second.length);
+    rawSize.decr(it->second.rawLength);
+    --numItems;
+    stats.memOverhead.decr(entryOverhead(it->first));
+    index.erase(it);
+}
+
+bool ValueCache::put(uint16_t vbucket, const std::string &key, uint64_t cas,
+                     const value_t &value) {
+    assert(data);
+    std::string k(makeKey(vbucket, key));
+    {
+        LockHolder lh(mutex);
+        unordered_map<std::string, ValueCacheEntry>::iterator it = index.find(k);
+        if (it != index.end() && it->second.cas == cas) {
+            // Ejected again since it was fetched from here.
+            return true;
+        }
+    }
+
+    // Compress without holding the lock.
+    std::vector<char> bytes;
+    encode(value, bytes);
+
+    LockHolder lh(mutex);
+    size_t offset(fileSize);
+    if (offset + bytes.size() > maxSize) {
+        ++stats.valueCacheWriteFailures;
+        return false;
+    }
+    if (!bytes.empty() &&
+        !writeFullyAt(fd, &bytes[0], bytes.size(), static_cast<off_t>(offset))) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Failed to write to the value cache: %s\n",
+                         strerror(errno));
+        ++stats.valueCacheWriteFailures;
+        return false;
+    }
+    fileSize.incr(bytes.size());
+
+    unordered_map<std::string, ValueCacheEntry>::iterator it = index.find(k);
+    if (it != index.end()) {
+        forget_UNLOCKED(it);
+    }
+    ValueCacheEntry &e(index[k]);
+    e.cas = cas;
+    e.offset = offset;
+    e.length = static_cast<uint32_t>(bytes.size());
+    e.rawLength = static_cast<uint32_t>(value->length());
+    liveSize.incr(e.length);
+    rawSize.incr(e.rawLength);
+    ++numItems;
+    stats.memOverhead.incr(entryOverhead(k));
+    ++stats.valueCacheWrites;
+    return true;
+}
+
+value_t ValueCache::get(uint16_t vbucket, const std::string &key, uint64_t cas) {
+    assert(data);
+    hrtime_t start(gethrtime());
+    std::string k(makeKey(vbucket, key));
+    std::vector<char> bytes;
+    size_t rawLength(0);
+    {
+        LockHolder lh(mutex);
+        unordered_map<std::string, ValueCacheEntry>::iterator it = index.find(k);
+        if (it == index.end() || it->second.cas != cas) {
+            if (it != index.end()) {
+                // The item changed since its value was written.
+                forget_UNLOCKED(it);
+            }
+            lh.unlock();
+            ++stats.valueCacheMisses;
+            return value_t();
+        }
+        const ValueCacheEntry &e(it->second);
+        const char *p(data + e.offset);
+        if (e.length == e.rawLength) {
+            value_t rv(Blob::New(p, e.length));
+            lh.unlock();
+            ++stats.valueCacheHits;
+            stats.valueCacheReadHisto.add((gethrtime() - start) / 1000);
+            return rv;
+        }
+        // Copy it out so it's uncompressed without holding the lock.
+        bytes.assign(p, p + e.length);
+        rawLength = e.rawLength;
+    }
+
+    value_t rv(decode(bytes, rawLength));
+    if (rv) {
+        ++stats.valueCacheHits;
+        stats.valueCacheReadHisto.add((gethrtime() - start) / 1000);
+    } else {
+        remove(vbucket, key);
+        ++stats.valueCacheMisses;
+    }
+    return rv;
+}
+
+void ValueCache::remove(uint16_t vbucket, const std::string &key) {
+    LockHolder lh(mutex);
+    unordered_map<std::string, ValueCacheEntry>::iterator it =
+        index.find(makeKey(vbucket, key));
+    if (it != index.end()) {
+        forget_UNLOCKED(it);
+    }
+}
+
+bool ValueCache::needsCompaction(double maxGarbage) const {
+    size_t used(fileSize), live(liveSize);
+    return used > live &&
+        static_cast<double>(used - live) > static_cast<double>(used) * maxGarbage;
+}
+
+/**
+ * A value copied by the compactor.
+ */
+struct CopiedValue {
+    CopiedValue(const std::string &k, const ValueCacheEntry &e) :
+        key(k), entry(e), newOffset(0) {}
+
+    std::string     key;
+    ValueCacheEntry entry;
+    uint64_t        newOffset;
+};
+
+size_t ValueCache::compact(ValueCacheValidator &validator) {
+    assert(data);
+    LockHolder clh(compactionMutex);
+
+    // Values are never rewritten in place, so everything before the
+    // end of the file stays put while it's copied.
+    std::vector<CopiedValue> values;
+    size_t end;
+    {
+        LockHolder lh(mutex);
+        end = fileSize;
+        values.reserve(index.size());
+        unordered_map<std::string, ValueCacheEntry>::iterator it;
+        for (it = index.begin(); it != index.end(); ++it) {
+            values.push_back(CopiedValue(it->first, it->second));
+        }
+    }
+
+    std::string compactPath(path + ".compact");
+    int newFd;
+    char *newData = createMapped(compactPath, maxSize, newFd);
+    if (!newData) {
+        return 0;
+    }
+
+    // The validator looks at the hash tables, so none of our locks
+    // may be held while it runs.
+    size_t newSize(0);
+    std::vector<CopiedValue> copied;
+    copied.reserve(values.size());
+    std::vector<CopiedValue>::iterator vit;
+    for (vit = values.begin(); vit != values.end(); ++vit) {
+        uint16_t vbucket;
+        std::memcpy(&vbucket, vit->key.data(), sizeof(vbucket));
+        if (!validator.isWanted(vbucket, vit->key.substr(sizeof(vbucket)),
+                                vit->entry.cas)) {
+            continue;
+        }
+        if (!writeFullyAt(newFd, data + vit->entry.offset, vit->entry.length,
+                          static_cast<off_t>(newSize))) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Failed to compact the value cache: %s\n",
+                             strerror(errno));
+            munmap(newData, maxSize);
+            doClose(newFd);
+            unlink(compactPath.c_str());
+            return 0;
+        }
+        vit->newOffset = newSize;
+        newSize += vit->entry.length;
+        copied.push_back(*vit);
+    }
+
+    LockHolder lh(mutex);
+    unordered_map<std::string, ValueCacheEntry> newIndex;
+    unordered_map<std::string, ValueCacheEntry>::iterator it;
+    // Keep what was copied unless it was replaced or removed since.
+    for (vit = copied.begin(); vit != copied.end(); ++vit) {
+        it = index.find(vit->key);
+        if (it != index.end() && it->second.offset == vit->entry.offset) {
+            ValueCacheEntry e(it->second);
+            e.offset = vit->newOffset;
+            newIndex[vit->key] = e;
+        }
+    }
+    // And copy what was written while the rest was copied.
+    bool failed(false);
+    for (it = index.begin(); !failed && it != index.end(); ++it) {
+        if (it->second.offset >= end) {
+            ValueCacheEntry e(it->second);
+            failed = !writeFullyAt(newFd, data + e.offset, e.length,
+                                   static_cast<off_t>(newSize));
+            e.offset = newSize;
+            newSize += e.length;
+            newIndex[it->first] = e;
+        }
+    }
+    if (failed || rename(compactPath.c_str(), path.c_str()) != 0) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Failed to compact the value cache: %s\n",
+                         strerror(errno));
+        munmap(newData, maxSize);
+        doClose(newFd);
+        unlink(compactPath.c_str());
+        return 0;
+    }
+
+    munmap(data, maxSize);
+    doClose(fd);
+    data = newData;
+    fd = newFd;
+
+    size_t oldSize(fileSize);
+    size_t overhead(0), live(0), raw(0);
+    for (it = index.begin(); it != index.end(); ++it) {
+        overhead += entryOverhead(it->first);
+    }
+    stats.memOverhead.decr(overhead);
+    overhead = 0;
+    for (it = newIndex.begin(); it != newIndex.end(); ++it) {
+        overhead += entryOverhead(it->first);
+        live += it->second.length;
+        raw += it->second.rawLength;
+    }
+    stats.memOverhead.incr(overhead);
+    index.swap(newIndex);
+    numItems.set(index.size());
+    fileSize.set(newSize);
+    liveSize.set(live);
+    rawSize.set(raw);
+    ++stats.valueCacheCompactorRuns;
+
+    return oldSize - newSize;
+}
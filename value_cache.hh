@@ -0,0 +1,153 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef VALUE_CACHE_HH
+#define VALUE_CACHE_HH 1
+
+#include <string>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "item.hh"
+#include "mutex.hh"
+#include "stats.hh"
+
+/**
+ * Where a value lives in the value cache file.
+ */
+struct ValueCacheEntry {
+    //! The CAS of the item the value belongs to.
+    uint64_t cas;
+    //! Offset of the value in the file.
+    uint64_t offset;
+    //! Bytes the value takes in the file.
+    uint32_t length;
+    //! Bytes the value takes once uncompressed.
+    uint32_t rawLength;
+};
+
+/**
+ * Decides which values the value cache keeps when it's compacted.
+ */
+class ValueCacheValidator {
+public:
+    virtual ~ValueCacheValidator() {}
+
+    /**
+     * Whether the given version of an item may still be fetched.
+     */
+    virtual bool isWanted(uint16_t vbucket, const std::string &key,
+                          uint64_t cas) = 0;
+};
+
+/**
+ * A local tier between memory and the kv store for evicted values.
+ *
+ * Values of clean items are compressed and appended to a file on
+ * local disk when they're ejected, and a background fetch looks them
+ * up here (through an index kept in memory) before going to the kv
+ * store.  The file is memory mapped for reads.  A value is only
+ * returned for the CAS it was written with, so a stale one is never
+ * restored; space held by stale and replaced values is given back by
+ * compact().
+ *
+ * Nothing survives a restart: the file is truncated when opened.
+ */
+class ValueCache {
+public:
+
+    /**
+     * Create a value cache.
+     *
+     * @param path the file holding the values
+     * @param maxSize the most bytes the file may hold
+     */
+    ValueCache(const std::string &path, size_t maxSize, EPStats &st);
+
+    ~ValueCache();
+
+    /**
+     * Create the file and map it.
+     *
+     * @return false if the value cache can't be used
+     */
+    bool open();
+
+    /**
+     * Store the value of an ejected item.
+     *
+     * @return false if the value wasn't stored (e.g. the file is full)
+     */
+    bool put(uint16_t vbucket, const std::string &key, uint64_t cas,
+             const value_t &value);
+
+    /**
+     * Get the value of an item.
+     *
+     * @param cas the CAS of the item the value is wanted for
+     * @return the value, or a NULL one if there's none for the CAS
+     */
+    value_t get(uint16_t vbucket, const std::string &key, uint64_t cas);
+
+    /**
+     * Forget the value of an item.
+     */
+    void remove(uint16_t vbucket, const std::string &key);
+
+    /**
+     * Rewrite the file with only the values still wanted.  Reads and
+     * writes go on while the values are copied; only the ones
+     * written in the meantime are copied while holding the lock.
+     *
+     * @return the number of bytes given back
+     */
+    size_t compact(ValueCacheValidator &validator);
+
+    /**
+     * Whether more than the given share of the file holds values
+     * nobody can get anymore.
+     */
+    bool needsCompaction(double maxGarbage) const;
+
+    size_t getNumItems() const { return numItems; }
+
+    //! Bytes appended to the file so far.
+    size_t getFileSize() const { return fileSize; }
+
+    //! Bytes of the file holding values that can be fetched.
+    size_t getLiveSize() const { return liveSize; }
+
+    //! Bytes the values that can be fetched take uncompressed.
+    size_t getRawSize() const { return rawSize; }
+
+    size_t getMaxSize() const { return maxSize; }
+
+    const std::string &getPath() const { return path; }
+
+private:
+
+    static std::string makeKey(uint16_t vbucket, const std::string &key);
+
+    void forget_UNLOCKED(unordered_map<std::string, ValueCacheEntry>::iterator it);
+
+    size_t entryOverhead(const std::string &k) const {
+        return k.size() + sizeof(ValueCacheEntry) + 2 * sizeof(void*);
+    }
+
+    const std::string path;
+    const size_t      maxSize;
+    EPStats          &stats;
+    int               fd;
+    char             *data;
+    //! Guards the index, the append position and the mapping.
+    Mutex             mutex;
+    //! Only one compaction at a time.
+    Mutex             compactionMutex;
+    unordered_map<std::string, ValueCacheEntry> index;
+    Atomic<size_t>    numItems;
+    Atomic<size_t>    fileSize;
+    Atomic<size_t>    liveSize;
+    Atomic<size_t>    rawSize;
+
+    DISALLOW_COPY_AND_ASSIGN(ValueCache);
+};
+
+#endif /* VALUE_CACHE_HH */
@@ -0,0 +1,49 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "config.h"
+#include "value_cache_compactor.hh"
+#include "ep.hh"
+
+/**
+ * Keeps the values of the items of active vbuckets that are still
+ * ejected, with the version that was written to the value cache.
+ */
+class EjectedValueValidator : public ValueCacheValidator {
+public:
+    EjectedValueValidator(EventuallyPersistentStore *s) : store(s) {}
+
+    bool isWanted(uint16_t vbucket, const std::string &key, uint64_t cas) {
+        RCPtr<VBucket> vb = store->getVBucket(vbucket);
+        if (!vb || vb->getState() != vbucket_state_active) {
+            // Background fetches for it won't look in the cache.
+            return false;
+        }
+        int bucket_num(0);
+        LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
+        StoredValue *v = vb->ht.unlocked_find(key, bucket_num);
+        return v && !v->isResident() && v->getCas() == cas;
+    }
+
+private:
+    EventuallyPersistentStore *store;
+};
+
+bool ValueCacheCompactor::callback(Dispatcher &d, TaskId t) {
+    size_t size(cache.getFileSize());
+    // Compacting a full cache nothing was added to since won't help.
+    bool full(size > sizeAfterCompaction &&
+              static_cast<double>(size) >
+              static_cast<double>(cache.getMaxSize()) * VALUE_CACHE_FULL);
+    if (full || cache.needsCompaction(VALUE_CACHE_MAX_GARBAGE)) {
+        EjectedValueValidator validator(store);
+        size_t freed(cache.compact(validator));
+        sizeAfterCompaction = cache.getFileSize();
+        getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                         "Value cache compactor: freed %llu bytes, %llu left.\n",
+                         static_cast<unsigned long long>(freed),
+                         static_cast<unsigned long long>(sizeAfterCompaction));
+    }
+
+    d.snooze(t, static_cast<double>(sleepTime));
+    return true;
+}
@@ -0,0 +1,39 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef VALUE_CACHE_COMPACTOR_HH
+#define VALUE_CACHE_COMPACTOR_HH 1
+
+#include "common.hh"
+#include "dispatcher.hh"
+#include "value_cache.hh"
+
+//! Compact once more than this share of the value cache is garbage...
+const double VALUE_CACHE_MAX_GARBAGE(0.5);
+//! ...or once the value cache is this full.
+const double VALUE_CACHE_FULL(0.8);
+
+class EventuallyPersistentStore;
+
+/**
+ * Dispatcher task that rewrites the value cache without the values
+ * of items that were changed, deleted or fetched back into memory.
+ */
+class ValueCacheCompactor : public DispatcherCallback {
+public:
+    ValueCacheCompactor(EventuallyPersistentStore *s, ValueCache &c,
+                        size_t stime) :
+        store(s), cache(c), sleepTime(stime), sizeAfterCompaction(0) {}
+
+    bool callback(Dispatcher &d, TaskId t);
+
+    std::string description() {
+        return std::string("Compacting the value cache");
+    }
+
+private:
+    EventuallyPersistentStore *store;
+    ValueCache                &cache;
+    size_t                     sleepTime;
+    size_t                     sizeAfterCompaction;
+};
+
+#endif /* VALUE_CACHE_COMPACTOR_HH */
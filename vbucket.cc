@@ -187,6 +187,8 @@ void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c) {
         addStat("ht_item_memory", ht.getItemMemory(), add_stat, c);
         addStat("ht_cache_size", ht.cacheSize, add_stat, c);
         addStat("num_ejects", ht.getNumEjects(), add_stat, c);
+        addStat("expiry_index_size", ht.getExpiryIndexSize(), add_stat, c);
+        addStat("expiry_index_dropped", ht.getExpiryIndexDropped(), add_stat, c);
         addStat("ops_create", opsCreate, add_stat, c);
         addStat("ops_update", opsUpdate, add_stat, c);
         addStat("ops_delete", opsDelete, add_stat, c);
@@ -105,7 +105,9 @@ public:
 
     VBucket(int i, vbucket_state_t newState, EPStats &st, CheckpointConfig &checkpointConfig,
             vbucket_state_t initState = vbucket_state_dead, uint64_t checkpointId = 1) :
-        ht(st), checkpointManager(st, i, checkpointConfig, checkpointId), id(i), state(newState),
+        // The table grows to the default size once items show up.
+        ht(st, HashTable::MIN_SIZE, HashTable::MIN_LOCKS),
+        checkpointManager(st, i, checkpointConfig, checkpointId), id(i), state(newState),
         initialState(initState), stats(st) {
 
         backfill.isBackfillPhase = false;
@@ -179,6 +181,14 @@ public:
         stats.memOverhead.incr(sizeof(queued_item));
         return true;
     }
+    void queueBackfillItems(const std::vector<queued_item> &items) {
+        LockHolder lh(backfill.mutex);
+        std::vector<queued_item>::const_iterator it;
+        for (it = items.begin(); it != items.end(); ++it) {
+            backfill.items.push(*it);
+        }
+        stats.memOverhead.incr(items.size() * sizeof(queued_item));
+    }
     void getBackfillItems(std::vector<queued_item> &items) {
         LockHolder lh(backfill.mutex);
         size_t num_items = backfill.items.size();
@@ -35,9 +35,20 @@ RCPtr<VBucket> VBucketMap::getBucket(uint16_t id) const {
     }
 }
 
+void VBucketMap::retire(uint16_t id) {
+    RCPtr<VBucket> old(buckets[id]);
+    if (old) {
+        epochs.retire(new RetiredRCPtr<VBucket>(old));
+    }
+}
+
 void VBucketMap::addBucket(const RCPtr<VBucket> &b) {
     if (static_cast<size_t>(b->getId()) < size) {
+        LockHolder lh(mutex);
+        retire(b->getId());
         buckets[b->getId()].reset(b);
+        lh.unlock();
+        epochs.reclaim();
         getLogger()->log(EXTENSION_LOG_INFO, NULL,
                          "Mapped new vbucket %d in state %s",
                          b->getId(), VBucket::toString(b->getState()));
@@ -50,7 +61,11 @@ void VBucketMap::removeBucket(uint16_t id) {
     if (static_cast<size_t>(id) < size) {
         // Theoretically, this could be off slightly.  In
         // practice, this happens only on dead vbuckets.
+        LockHolder lh(mutex);
+        retire(id);
         buckets[id].reset();
+        lh.unlock();
+        epochs.reclaim();
     }
 }
 
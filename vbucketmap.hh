@@ -3,6 +3,7 @@
 #define VBUCKETMAP_HH 1
 
 #include "configuration.hh"
+#include "epoch.hh"
 #include "vbucket.hh"
 
 /**
@@ -17,6 +18,43 @@ public:
     void removeBucket(uint16_t id);
     void addBuckets(const std::vector<VBucket*> &newBuckets);
     RCPtr<VBucket> getBucket(uint16_t id) const;
+
+    /**
+     * Get a vbucket without touching its reference count.
+     *
+     * The caller must hold an EpochGuard on getEpochManager() for as
+     * long as it uses the vbucket; a vbucket removed or replaced in
+     * the meantime is only released once every such guard is gone.
+     */
+    VBucket *peekBucket(uint16_t id) const {
+        if (static_cast<size_t>(id) < size) {
+            return buckets[id].get();
+        }
+        return NULL;
+    }
+
+    /**
+     * The epochs guarding the readers of peekBucket().
+     */
+    EpochManager &getEpochManager() {
+        return epochs;
+    }
+
+    /**
+     * Release the removed vbuckets no reader can see any more.
+     *
+     * @return the number of vbuckets released
+     */
+    size_t reclaim() {
+        return epochs.reclaim();
+    }
+
+    /**
+     * The number of removed vbuckets waiting for their readers.
+     */
+    size_t getNumRetired() {
+        return epochs.getNumRetired();
+    }
     size_t getSize() const;
     std::vector<int> getBuckets(void) const;
     bool isBucketDeletion(uint16_t id) const;
@@ -87,6 +125,8 @@ public:
     bool setLowPriorityVbSnapshotFlag(bool lowPrioritySnapshot);
 private:
 
+    void retire(uint16_t id);
+
     RCPtr<VBucket> *buckets;
     Atomic<bool> *bucketDeletion;
     Atomic<uint16_t> *bucketVersions;
@@ -94,6 +134,9 @@ private:
     Atomic<bool> highPriorityVbSnapshot;
     Atomic<bool> lowPriorityVbSnapshot;
     size_t size;
+    // Serializes replacing a vbucket with retiring the old one.
+    Mutex mutex;
+    EpochManager epochs;
 
     DISALLOW_COPY_AND_ASSIGN(VBucketMap);
 };
@@ -0,0 +1,649 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2012 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * YCSB style workloads.  Each test loads a number of records, then
+ * runs a mix of gets and sets on them from several client threads and
+ * reports the throughput and the latency percentiles of each kind of
+ * operation.  Every workload runs against each backend.
+ *
+ * The results are printed, and appended as one JSON object per run to
+ * the file named by WORKLOAD_RESULTS (workload_results.json by
+ * default) so they can be compared across builds.
+ *
+ * The size of a run may be changed through the environment:
+ *
+ *   WORKLOAD_RECORDS  the number of records loaded
+ *   WORKLOAD_OPS      the number of operations each client runs
+ *   WORKLOAD_THREADS  the number of client threads (of the workloads
+ *                     that don't set their own)
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <assert.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memcached/engine.h>
+#include <memcached/engine_testapp.h>
+
+#include "atomic.hh"
+#include "ep_testsuite.h"
+
+bool abort_msg(const char *expr, const char *msg, int line);
+
+#define check(expr, msg) \
+    static_cast<void>((expr) ? 0 : abort_msg(#expr, msg, __LINE__))
+
+std::map<std::string, std::string> vals;
+
+struct test_harness testHarness;
+
+bool abort_msg(const char *expr, const char *msg, int line) {
+    fprintf(stderr, "%s:%d Test failed: `%s' (%s)\n",
+            __FILE__, line, msg, expr);
+    abort();
+    // UNREACHABLE
+    return false;
+}
+
+/**
+ * A mix of operations run against the records.
+ */
+struct Workload {
+    const char *name;
+    //! The fraction of the operations that are gets, the rest are sets
+    double readProportion;
+    //! Pick keys from a zipfian distribution, or else uniformly
+    bool zipfian;
+    size_t valueSize;
+    size_t records;
+    //! Stream the mutations to a TAP client while the workload runs
+    bool tap;
+    //! Engine configuration of the workload, if any
+    const char *cfg;
+    //! Whether the workload reads back evicted values, which the
+    //! blackhole backend doesn't keep
+    bool needsStorage;
+    //! The number of client threads (0 for WORKLOAD_THREADS)
+    size_t threads;
+};
+
+static const Workload workloads[] = {
+    { "update heavy", 0.5, true, 1024, 100000, false, NULL, false, 0 },
+    { "read mostly", 0.95, true, 1024, 100000, false, NULL, false, 0 },
+    { "read only", 1.0, true, 1024, 100000, false, NULL, false, 0 },
+    { "read mostly uniform", 0.95, false, 1024, 100000, false, NULL, false, 0 },
+    { "write heavy", 0.1, true, 1024, 100000, false, NULL, false, 0 },
+    { "update heavy small values", 0.5, true, 32, 100000, false, NULL, false, 0 },
+    { "update heavy large values", 0.5, true, 16384, 10000, false, NULL, false, 0 },
+    // Around 130MB of records with their metadata
+    { "read mostly half resident", 0.95, true, 1024, 100000, false,
+      "max_size=67108864", true, 0 },
+    { "update heavy with tap", 0.5, true, 1024, 100000, true,
+      "tap_noop_interval=1", false, 0 },
+    // How reads of one key scale, with and without the lock free
+    // path for hot keys
+    { "single key reads 1 thread", 1.0, false, 1024, 1, false, NULL, false, 1 },
+    { "single key reads 2 threads", 1.0, false, 1024, 1, false, NULL, false, 2 },
+    { "single key reads 4 threads", 1.0, false, 1024, 1, false, NULL, false, 4 },
+    { "single key reads 8 threads", 1.0, false, 1024, 1, false, NULL, false, 8 },
+    { "single key reads 16 threads", 1.0, false, 1024, 1, false, NULL, false, 16 },
+    { "single key reads 32 threads", 1.0, false, 1024, 1, false, NULL, false, 32 },
+    { "single key reads 1 thread locked", 1.0, false, 1024, 1, false,
+      "hot_key_sample_rate=0", false, 1 },
+    { "single key reads 2 threads locked", 1.0, false, 1024, 1, false,
+      "hot_key_sample_rate=0", false, 2 },
+    { "single key reads 4 threads locked", 1.0, false, 1024, 1, false,
+      "hot_key_sample_rate=0", false, 4 },
+    { "single key reads 8 threads locked", 1.0, false, 1024, 1, false,
+      "hot_key_sample_rate=0", false, 8 },
+    { "single key reads 16 threads locked", 1.0, false, 1024, 1, false,
+      "hot_key_sample_rate=0", false, 16 },
+    { "single key reads 32 threads locked", 1.0, false, 1024, 1, false,
+      "hot_key_sample_rate=0", false, 32 }
+};
+
+struct Backend {
+    const char *name;
+    bool persists;
+};
+
+static const Backend backends[] = {
+    { "sqlite", true },
+    { "leveldb", true },
+    { "blackhole", false }
+};
+
+static const size_t numWorkloads = sizeof(workloads) / sizeof(workloads[0]);
+static const size_t numBackends = sizeof(backends) / sizeof(backends[0]);
+
+static engine_test_t *testcases;
+static const Workload *currentWorkload;
+static const Backend *currentBackend;
+
+static void rmdir_contents(const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        std::string f(path);
+        f.append("/").append(de->d_name);
+        unlink(f.c_str());
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+extern "C" {
+    static void rmdb(void) {
+        unlink("/tmp/test.db");
+        unlink("/tmp/test.db-0.sqlite");
+        unlink("/tmp/test.db-1.sqlite");
+        unlink("/tmp/test.db-2.sqlite");
+        unlink("/tmp/test.db-3.sqlite");
+        rmdir_contents("/tmp/testdb");
+    }
+
+    static bool teardown(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+        (void)h; (void)h1;
+        atexit(rmdb);
+        vals.clear();
+        return true;
+    }
+
+    static void add_stats(const char *key, const uint16_t klen,
+                          const char *val, const uint32_t vlen,
+                          const void *cookie) {
+        (void)cookie;
+        std::string k(key, klen);
+        std::string v(val, vlen);
+        vals[k] = v;
+    }
+}
+
+static inline void decayingSleep(useconds_t *sleepTime) {
+    static const useconds_t maxSleepTime = 500000;
+    usleep(*sleepTime);
+    *sleepTime = std::min(*sleepTime << 1, maxSleepTime);
+}
+
+static int get_int_stat(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                        const char *statname, const char *statkey = NULL) {
+    vals.clear();
+    check(h1->get_stats(h, NULL, statkey, statkey == NULL ? 0 : strlen(statkey),
+                        add_stats) == ENGINE_SUCCESS,
+          "Failed to get stats.");
+    std::string s = vals[statname];
+    return atoi(s.c_str());
+}
+
+static void wait_for_flusher_to_settle(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    useconds_t sleepTime = 128;
+    while (get_int_stat(h, h1, "ep_flusher_todo")
+           + get_int_stat(h, h1, "ep_queue_size") > 0) {
+        decayingSleep(&sleepTime);
+    }
+}
+
+static size_t env_int(const char *k, size_t rv) {
+    char *x = getenv(k);
+    if (x) {
+        rv = static_cast<size_t>(atoi(x));
+    }
+    return rv;
+}
+
+static std::string makeKey(size_t n) {
+    char key[32];
+    snprintf(key, sizeof(key), "user%lu", static_cast<unsigned long>(n));
+    return std::string(key);
+}
+
+static ENGINE_ERROR_CODE storeValue(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                                    const void *cookie, const std::string &key,
+                                    const std::string &value) {
+    item *it = NULL;
+    ENGINE_ERROR_CODE rv = h1->allocate(h, cookie, &it, key.data(),
+                                        key.length(), value.length(), 0, 0);
+    if (rv != ENGINE_SUCCESS) {
+        return rv;
+    }
+
+    item_info info;
+    info.nvalue = 1;
+    check(h1->get_item_info(h, cookie, it, &info), "get item info failed");
+    memcpy(info.value[0].iov_base, value.data(), value.length());
+
+    uint64_t cas = 0;
+    rv = h1->store(h, cookie, it, &cas, OPERATION_SET, 0);
+    h1->release(h, cookie, it);
+    return rv;
+}
+
+/**
+ * Picks the record each operation works on.
+ *
+ * The zipfian distribution is the one of YCSB (with a constant of
+ * 0.99), and like YCSB the popular records are scattered over the
+ * key space by hashing so they don't all land next to each other.
+ */
+class KeyChooser {
+public:
+    KeyChooser(size_t n, bool z) : items(n), zipfian(z), theta(0.99),
+                                   zetan(0), alpha(0), eta(0) {
+        if (zipfian) {
+            zetan = zeta(items);
+            alpha = 1.0 / (1.0 - theta);
+            eta = (1 - pow(2.0 / items, 1 - theta)) / (1 - zeta(2) / zetan);
+        }
+    }
+
+    size_t next(unsigned short *xsubi) const {
+        if (!zipfian) {
+            return static_cast<size_t>(nrand48(xsubi)) % items;
+        }
+
+        double u = erand48(xsubi);
+        double uz = u * zetan;
+        uint64_t rank;
+        if (uz < 1.0) {
+            rank = 0;
+        } else if (uz < 1.0 + pow(0.5, theta)) {
+            rank = 1;
+        } else {
+            rank = static_cast<uint64_t>(items * pow(eta * u - eta + 1, alpha));
+        }
+
+        // FNV-1a of the rank
+        uint64_t h = 14695981039346656037ULL;
+        for (int i = 0; i < 8; ++i) {
+            h ^= (rank >> (i * 8)) & 0xff;
+            h *= 1099511628211ULL;
+        }
+        return h % items;
+    }
+
+private:
+    double zeta(size_t n) const {
+        double sum = 0;
+        for (size_t i = 1; i <= n; ++i) {
+            sum += 1 / pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+
+    size_t items;
+    bool zipfian;
+    double theta;
+    double zetan;
+    double alpha;
+    double eta;
+};
+
+enum op_type { OP_GET, OP_SET, NUM_OP_TYPES };
+
+static const char *opNames[] = { "get", "set" };
+
+/**
+ * A client thread and what it measured.
+ */
+struct Client {
+    ENGINE_HANDLE *h;
+    ENGINE_HANDLE_V1 *h1;
+    const void *cookie;
+    const KeyChooser *chooser;
+    const std::string *value;
+    double readProportion;
+    size_t ops;
+    unsigned short xsubi[3];
+
+    //! The latency of each operation, by type
+    std::vector<hrtime_t> latencies[NUM_OP_TYPES];
+    size_t misses;
+    size_t failures;
+};
+
+extern "C" {
+    static void *client_main(void *arg) {
+        Client *c = static_cast<Client*>(arg);
+        c->latencies[OP_GET].reserve(c->ops);
+        c->latencies[OP_SET].reserve(c->ops);
+
+        for (size_t i = 0; i < c->ops; ++i) {
+            std::string key(makeKey(c->chooser->next(c->xsubi)));
+            if (erand48(c->xsubi) < c->readProportion) {
+                item *it = NULL;
+                hrtime_t start = gethrtime();
+                ENGINE_ERROR_CODE rv = c->h1->get(c->h, c->cookie, &it,
+                                                  key.data(), key.length(), 0);
+                c->latencies[OP_GET].push_back(gethrtime() - start);
+                if (rv == ENGINE_SUCCESS) {
+                    c->h1->release(c->h, c->cookie, it);
+                } else if (rv == ENGINE_KEY_ENOENT) {
+                    ++c->misses;
+                } else {
+                    ++c->failures;
+                }
+            } else {
+                hrtime_t start = gethrtime();
+                ENGINE_ERROR_CODE rv = storeValue(c->h, c->h1, c->cookie,
+                                                  key, *c->value);
+                c->latencies[OP_SET].push_back(gethrtime() - start);
+                if (rv != ENGINE_SUCCESS) {
+                    ++c->failures;
+                }
+            }
+        }
+        return NULL;
+    }
+}
+
+/**
+ * A TAP client streaming the mutations made by the workload, the way
+ * a replica would.
+ */
+struct Replicator {
+    ENGINE_HANDLE *h;
+    ENGINE_HANDLE_V1 *h1;
+    const void *cookie;
+    Atomic<bool> done;
+    size_t mutations;
+};
+
+extern "C" {
+    static void *replicator_main(void *arg) {
+        Replicator *r = static_cast<Replicator*>(arg);
+        testHarness.lock_cookie(r->cookie);
+        TAP_ITERATOR iter = r->h1->get_tap_iterator(r->h, r->cookie, NULL, 0,
+                                                    0, NULL, 0);
+        check(iter != NULL, "Failed to create a tap iterator");
+
+        item *it;
+        void *engine_specific;
+        uint16_t nengine_specific;
+        uint8_t ttl;
+        uint16_t flags;
+        uint32_t seqno;
+        uint16_t vbucket;
+        tap_event_t event;
+        bool stop = false;
+
+        while (!stop) {
+            event = iter(r->h, r->cookie, &it, &engine_specific,
+                         &nengine_specific, &ttl, &flags, &seqno, &vbucket);
+            switch (event) {
+            case TAP_PAUSE:
+                if (r->done) {
+                    stop = true;
+                } else {
+                    testHarness.waitfor_cookie(r->cookie);
+                }
+                break;
+            case TAP_MUTATION:
+            case TAP_DELETION:
+                ++r->mutations;
+                r->h1->release(r->h, r->cookie, it);
+                break;
+            case TAP_CHECKPOINT_START:
+            case TAP_CHECKPOINT_END:
+                r->h1->release(r->h, r->cookie, it);
+                break;
+            case TAP_DISCONNECT:
+                stop = true;
+                break;
+            default:
+                break;
+            }
+        }
+        testHarness.unlock_cookie(r->cookie);
+        return NULL;
+    }
+}
+
+static hrtime_t percentile(const std::vector<hrtime_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t idx = static_cast<size_t>(sorted.size() * p);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+/**
+ * Store every record, waiting for the engine whenever it runs out of
+ * memory (the pager makes room once the records are persisted).
+ */
+static void load(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1, size_t records,
+                 const std::string &value) {
+    const void *cookie = testHarness.create_cookie();
+    for (size_t i = 0; i < records; ++i) {
+        std::string key(makeKey(i));
+        useconds_t sleepTime = 128;
+        ENGINE_ERROR_CODE rv;
+        while ((rv = storeValue(h, h1, cookie, key, value)) != ENGINE_SUCCESS) {
+            check(rv == ENGINE_ENOMEM || rv == ENGINE_TMPFAIL,
+                  "Failed to load a record");
+            decayingSleep(&sleepTime);
+        }
+    }
+    testHarness.destroy_cookie(cookie);
+    wait_for_flusher_to_settle(h, h1);
+}
+
+extern "C" {
+static test_result test_workload(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const Workload &w = *currentWorkload;
+    size_t records = env_int("WORKLOAD_RECORDS", w.records);
+    size_t ops = env_int("WORKLOAD_OPS", 100000);
+    size_t numClients = w.threads ? w.threads : env_int("WORKLOAD_THREADS", 4);
+    std::string value(w.valueSize, 'x');
+
+    load(h, h1, records, value);
+
+    KeyChooser chooser(records, w.zipfian);
+    std::vector<Client> clients(numClients);
+    for (size_t i = 0; i < numClients; ++i) {
+        Client &c = clients[i];
+        c.h = h;
+        c.h1 = h1;
+        c.cookie = testHarness.create_cookie();
+        c.chooser = &chooser;
+        c.value = &value;
+        c.readProportion = w.readProportion;
+        c.ops = ops;
+        c.xsubi[0] = static_cast<unsigned short>(i);
+        c.xsubi[1] = static_cast<unsigned short>(i >> 16);
+        c.xsubi[2] = 0x330e;
+        c.misses = 0;
+        c.failures = 0;
+    }
+
+    Replicator replicator;
+    replicator.h = h;
+    replicator.h1 = h1;
+    replicator.cookie = testHarness.create_cookie();
+    replicator.done = false;
+    replicator.mutations = 0;
+    pthread_t tapThread;
+    if (w.tap) {
+        check(pthread_create(&tapThread, NULL, replicator_main, &replicator) == 0,
+              "Failed to start the tap client");
+    }
+
+    std::vector<pthread_t> threads(numClients);
+    hrtime_t start = gethrtime();
+    for (size_t i = 0; i < numClients; ++i) {
+        check(pthread_create(&threads[i], NULL, client_main, &clients[i]) == 0,
+              "Failed to start a client");
+    }
+    for (size_t i = 0; i < numClients; ++i) {
+        check(pthread_join(threads[i], NULL) == 0, "Failed to join a client");
+    }
+    hrtime_t elapsed = gethrtime() - start;
+
+    if (w.tap) {
+        replicator.done = true;
+        // Wake the tap client up if it's waiting for mutations.
+        const void *cookie = testHarness.create_cookie();
+        storeValue(h, h1, cookie, "replicator_done", "done");
+        testHarness.destroy_cookie(cookie);
+        check(pthread_join(tapThread, NULL) == 0, "Failed to join the tap client");
+    }
+    testHarness.destroy_cookie(replicator.cookie);
+
+    std::vector<hrtime_t> latencies[NUM_OP_TYPES];
+    size_t misses = 0;
+    size_t failures = 0;
+    for (size_t i = 0; i < numClients; ++i) {
+        for (int t = 0; t < NUM_OP_TYPES; ++t) {
+            latencies[t].insert(latencies[t].end(),
+                                clients[i].latencies[t].begin(),
+                                clients[i].latencies[t].end());
+        }
+        misses += clients[i].misses;
+        failures += clients[i].failures;
+        testHarness.destroy_cookie(clients[i].cookie);
+    }
+
+    size_t total = numClients * ops;
+    double opsPerSec = total * 1000000000.0 / elapsed;
+    int resident = get_int_stat(h, h1, "vb_active_perc_mem_resident");
+
+    std::stringstream json;
+    json << "{\"workload\":\"" << w.name << "\","
+         << "\"backend\":\"" << currentBackend->name << "\","
+         << "\"records\":" << records << ","
+         << "\"value_size\":" << w.valueSize << ","
+         << "\"threads\":" << numClients << ","
+         << "\"operations\":" << total << ","
+         << "\"elapsed_ns\":" << elapsed << ","
+         << "\"ops_per_sec\":" << static_cast<uint64_t>(opsPerSec) << ","
+         << "\"resident_percent\":" << resident << ","
+         << "\"misses\":" << misses << ","
+         << "\"failures\":" << failures << ","
+         << "\"tap_mutations\":" << replicator.mutations << ","
+         << "\"ops\":{";
+
+    std::cout << std::endl << "  " << static_cast<uint64_t>(opsPerSec)
+              << " ops/s, " << resident << "% resident";
+    if (w.tap) {
+        std::cout << ", " << replicator.mutations << " mutations replicated";
+    }
+    std::cout << std::endl;
+
+    for (int t = 0; t < NUM_OP_TYPES; ++t) {
+        std::vector<hrtime_t> &l = latencies[t];
+        std::sort(l.begin(), l.end());
+        if (t != 0) {
+            json << ",";
+        }
+        json << "\"" << opNames[t] << "\":{"
+             << "\"count\":" << l.size() << ","
+             << "\"p50_ns\":" << percentile(l, 0.5) << ","
+             << "\"p95_ns\":" << percentile(l, 0.95) << ","
+             << "\"p99_ns\":" << percentile(l, 0.99) << ","
+             << "\"p999_ns\":" << percentile(l, 0.999) << ","
+             << "\"max_ns\":" << (l.empty() ? 0 : l.back()) << "}";
+        if (!l.empty()) {
+            std::cout << "  " << opNames[t] << ": " << l.size() << " ops, "
+                      << "p50 " << percentile(l, 0.5) / 1000 << "us, "
+                      << "p95 " << percentile(l, 0.95) / 1000 << "us, "
+                      << "p99 " << percentile(l, 0.99) / 1000 << "us, "
+                      << "p99.9 " << percentile(l, 0.999) / 1000 << "us, "
+                      << "max " << l.back() / 1000 << "us" << std::endl;
+        }
+    }
+    json << "}}";
+
+    const char *path = getenv("WORKLOAD_RESULTS");
+    std::ofstream results(path ? path : "workload_results.json",
+                          std::ios::app);
+    results << json.str() << std::endl;
+    results.close();
+
+    check(failures == 0, "Some operations failed");
+    return SUCCESS;
+}
+}
+
+extern "C" {
+    static test_result prepare(engine_test_t *test) {
+        size_t idx = test - testcases;
+        currentWorkload = &workloads[idx / numBackends];
+        currentBackend = &backends[idx % numBackends];
+        if (currentWorkload->needsStorage && !currentBackend->persists) {
+            return SKIPPED;
+        }
+        rmdb();
+        return SUCCESS;
+    }
+
+    static void cleanup(engine_test_t *test, enum test_result result) {
+        (void)test; (void)result;
+        rmdb();
+    }
+}
+
+extern "C" MEMCACHED_PUBLIC_API
+bool setup_suite(struct test_harness *th) {
+    testHarness = *th;
+    return true;
+}
+
+extern "C" MEMCACHED_PUBLIC_API
+engine_test_t* get_tests(void) {
+    testcases = static_cast<engine_test_t*>(calloc(numWorkloads * numBackends + 1,
+                                                   sizeof(engine_test_t)));
+    check(testcases != NULL, "Failed to allocate the tests");
+
+    for (size_t i = 0; i < numWorkloads; ++i) {
+        for (size_t j = 0; j < numBackends; ++j) {
+            std::stringstream name;
+            name << workloads[i].name << " (" << backends[j].name << ")";
+            std::stringstream cfg;
+            cfg << "backend=" << backends[j].name;
+            if (workloads[i].cfg != NULL) {
+                cfg << ";" << workloads[i].cfg;
+            }
+
+            engine_test_t &t = testcases[i * numBackends + j];
+            t.name = strdup(name.str().c_str());
+            t.tfun = test_workload;
+            t.test_teardown = teardown;
+            t.cfg = strdup(cfg.str().c_str());
+            t.prepare = prepare;
+            t.cleanup = cleanup;
+        }
+    }
+    return testcases;
+}